@@ -0,0 +1,930 @@
+/*--------------------------------------------------------------------*/
+/* aof.c                                                              */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "aof.h"
+#include "hashtable.h"
+/*--------------------------------------------------------------------*/
+#define AOF_CHUNK (1024 * 1024)         // replay verifies the log in chunks
+#define AOF_REWRITE_BUF (1024 * 1024)   // rewrite output buffer
+#define AOF_REWRITE_TAIL (64 * 1024)    // side buffer left to the writer
+/*--------------------------------------------------------------------*/
+enum AOF_REWRITE
+{
+    AOF_REWRITE_IDLE,
+    AOF_REWRITE_RUNNING, // rewriter thread dumping the table
+    AOF_REWRITE_DONE,    // dump written, writer thread switches the log
+    AOF_REWRITE_FAILED   // writer thread drops the new log
+};
+/*--------------------------------------------------------------------*/
+struct aof
+{
+    int fd;
+    int fsync_ms;
+    char *path;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t more;  // writer waits for records
+    pthread_cond_t done;  // committers wait for durability
+    pthread_cond_t space; // appenders wait for the writer to catch up
+    char *buf;            // batch being filled by appenders
+    size_t len, cap;
+    char *wbuf;           // batch being written by the writer
+    size_t wcap;
+    uint64_t appended;    // bytes appended so far
+    uint64_t durable;     // bytes written (and synced, if the policy says)
+    int closing;
+    int error;
+    /* compaction */
+    aof_dump_fn dump;
+    void *dump_arg;
+    off_t size;           // log size, writer only
+    off_t base_size;      // log size right after the last rewrite
+    int rewrite;          // enum AOF_REWRITE
+    pthread_t rewriter;
+    char *rw_path;        // new log being built
+    int rw_fd;
+    char *side;           // records appended while rewriting
+    size_t side_len, side_cap;
+    int side_error;
+};
+/* output of the rewriter thread */
+struct rewrite
+{
+    struct aof *aof;
+    char *buf;
+    size_t len;
+};
+/*--------------------------------------------------------------------*/
+/* end of the last record appended by this thread */
+static __thread uint64_t t_lsn = 0;
+/*--------------------------------------------------------------------*/
+/* crc of a record whose header is at rec and payload follows it */
+static uint32_t rec_crc(const struct aof_rec *hdr, const char *key,
+                        const char *value)
+{
+    uint32_t crc;
+
+    crc = crc32_update(0, &hdr->magic, sizeof(*hdr) - sizeof(hdr->crc));
+    crc = crc32_update(crc, key, hdr->key_len);
+    return crc32_update(crc, value, hdr->value_len);
+}
+/*--------------------------------------------------------------------*/
+/* fills the header of a record */
+static void rec_init(struct aof_rec *hdr, int op, const char *key,
+                     size_t key_len, const char *value, size_t value_len)
+{
+    hdr->magic = AOF_MAGIC;
+    hdr->op = op;
+    hdr->key_len = key_len;
+    hdr->pad = 0;
+    hdr->value_len = value_len;
+    hdr->crc = rec_crc(hdr, key, value);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * appends a record to a growable buffer.
+ * Returns -1 when any internal errors occur.
+ */
+static int rec_push(char **buf, size_t *len, size_t *cap,
+                    const struct aof_rec *hdr, const char *key,
+                    const char *value)
+{
+    size_t n = sizeof(*hdr) + hdr->key_len + hdr->value_len;
+    size_t new_cap;
+    char *p;
+
+    if (*len + n > *cap)
+    {
+        new_cap = *cap ? *cap : 4096;
+        while (new_cap < *len + n)
+        {
+            new_cap *= 2;
+        }
+        p = realloc(*buf, new_cap);
+        if (p == NULL)
+        {
+            return -1;
+        }
+        *buf = p;
+        *cap = new_cap;
+    }
+
+    p = *buf + *len;
+    memcpy(p, hdr, sizeof(*hdr));
+    memcpy(p + sizeof(*hdr), key, hdr->key_len);
+    if (hdr->value_len)
+    {
+        memcpy(p + sizeof(*hdr) + hdr->key_len, value, hdr->value_len);
+    }
+    *len += n;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*--------------------------------------------------------------------*/
+static int write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* makes a rename in the directory of path durable */
+static int sync_dir(const char *path)
+{
+    char *dir, *slash;
+    int fd, ret;
+
+    dir = strdup(path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+    slash = strrchr(dir, '/');
+    if (slash == NULL)
+    {
+        strcpy(dir, ".");
+    }
+    else
+    {
+        slash[slash == dir] = '\0'; // keep "/" for the root
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(dir);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * adds a record to the compact log.
+ * Returns -1 when any internal errors occur.
+ */
+static int rewrite_rec(struct rewrite *rw, int op, const char *key,
+                       size_t key_len, const char *value, size_t value_len)
+{
+    struct aof_rec hdr;
+    size_t n = sizeof(hdr) + key_len + value_len;
+
+    // 닫히고 있거나 side buffer가 넘쳐 버려질 log는 더 만들지 않는다
+    if (__atomic_load_n(&rw->aof->closing, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&rw->aof->side_error, __ATOMIC_RELAXED))
+    {
+        errno = ECANCELED;
+        return -1;
+    }
+
+    if (rw->len + n > AOF_REWRITE_BUF && rw->len > 0)
+    {
+        if (write_all(rw->aof->rw_fd, rw->buf, rw->len) < 0)
+        {
+            return -1;
+        }
+        rw->len = 0;
+    }
+
+    // buffer보다 큰 값은 바로 쓴다
+    rec_init(&hdr, op, key, key_len, value, value_len);
+    if (n > AOF_REWRITE_BUF)
+    {
+        if (write_all(rw->aof->rw_fd, (char *)&hdr, sizeof(hdr)) < 0 ||
+            write_all(rw->aof->rw_fd, key, key_len) < 0 ||
+            write_all(rw->aof->rw_fd, value, value_len) < 0)
+        {
+            return -1;
+        }
+        return 0;
+    }
+    memcpy(rw->buf + rw->len, &hdr, sizeof(hdr));
+    memcpy(rw->buf + rw->len + sizeof(hdr), key, key_len);
+    memcpy(rw->buf + rw->len + sizeof(hdr) + key_len, value, value_len);
+    rw->len += n;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* called by the dump for every live entry */
+static int rewrite_emit(void *arg, const char *key, size_t key_len,
+                        const char *value, size_t value_len, uint64_t expire)
+{
+    struct rewrite *rw = (struct rewrite *)arg;
+
+    if (rewrite_rec(rw, HASH_OP_INSERT, key, key_len, value, value_len) < 0)
+    {
+        return -1;
+    }
+    // TTL은 insert 뒤의 EXPIRE record로 남긴다
+    if (expire == 0)
+    {
+        return 0;
+    }
+    return rewrite_rec(rw, HASH_OP_EXPIRE, key, key_len,
+                       (const char *)&expire, sizeof(expire));
+}
+/*--------------------------------------------------------------------*/
+/**
+ * builds the compact log: the live entries first, then the records
+ * appended meanwhile, so replaying it reaches the current table
+ */
+static void *aof_rewriter(void *arg)
+{
+    struct aof *aof = (struct aof *)arg;
+    struct rewrite rw = {aof, NULL, 0};
+    char *side;
+    size_t side_len;
+    int ret = -1;
+
+    rw.buf = malloc(AOF_REWRITE_BUF);
+    if (rw.buf && aof->dump(aof->dump_arg, rewrite_emit, &rw) == 0 &&
+        write_all(aof->rw_fd, rw.buf, rw.len) == 0)
+    {
+        ret = 0;
+    }
+    free(rw.buf);
+
+    // 쌓인 side buffer는 lock 밖에서 최대한 비워 writer가 할 일을 줄인다
+    pthread_mutex_lock(&aof->lock);
+    while (ret == 0 && aof->side_len > AOF_REWRITE_TAIL &&
+           !aof->closing && !aof->side_error)
+    {
+        side = aof->side;
+        side_len = aof->side_len;
+        aof->side = NULL;
+        aof->side_len = aof->side_cap = 0;
+        pthread_mutex_unlock(&aof->lock);
+
+        ret = write_all(aof->rw_fd, side, side_len);
+        free(side);
+
+        pthread_mutex_lock(&aof->lock);
+    }
+    pthread_mutex_unlock(&aof->lock);
+
+    if (ret == 0)
+    {
+        ret = fdatasync(aof->rw_fd);
+    }
+
+    pthread_mutex_lock(&aof->lock);
+    aof->rewrite = ret == 0 ? AOF_REWRITE_DONE : AOF_REWRITE_FAILED;
+    pthread_cond_signal(&aof->more);
+    pthread_mutex_unlock(&aof->lock);
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* starts a rewrite; called by the writer with the lock held */
+static void aof_rewrite_start(struct aof *aof)
+{
+    aof->rw_fd = open(aof->rw_path,
+                      O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                      0644);
+    if (aof->rw_fd < 0)
+    {
+        DEBUG_PRINT("Failed to open %s", aof->rw_path);
+        aof->base_size = aof->size; // 다음 성장까지 재시도하지 않음
+        return;
+    }
+
+    aof->side_len = 0;
+    aof->side_error = 0;
+    aof->rewrite = AOF_REWRITE_RUNNING;
+    if (pthread_create(&aof->rewriter, NULL, aof_rewriter, aof) != 0)
+    {
+        DEBUG_PRINT("Failed to start the log rewriter");
+        aof->rewrite = AOF_REWRITE_IDLE;
+        close(aof->rw_fd);
+        unlink(aof->rw_path);
+        aof->base_size = aof->size;
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * switches to the new log, or drops it if the rewrite failed;
+ * called by the writer between batches with the lock held, which it
+ * releases while writing and syncing the new log.
+ * Returns 1 when switched.
+ */
+static int aof_rewrite_finish(struct aof *aof)
+{
+    int ok = aof->rewrite == AOF_REWRITE_DONE && !aof->side_error;
+    char *side = aof->side;
+    size_t side_len = aof->side_len, skip = aof->len;
+    uint64_t end = aof->appended;
+    off_t size = 0;
+
+    // 대기 중인 batch는 모두 side buffer에도 있다. 이제부터의 쓰기는
+    // batch에만 쌓이고, writer가 이 함수를 마친 뒤에 쓴다
+    aof->side = NULL;
+    aof->side_len = aof->side_cap = 0;
+    aof->rewrite = AOF_REWRITE_IDLE;
+    pthread_mutex_unlock(&aof->lock);
+
+    pthread_join(aof->rewriter, NULL);
+
+    // 남은 side buffer까지 쓰면 새 log가 지금의 table 전체를 담는다.
+    // disk를 기다리는 동안 appender를 막지 않도록 lock 밖에서 한다
+    if (ok)
+    {
+        ok = write_all(aof->rw_fd, side, side_len) == 0 &&
+             fdatasync(aof->rw_fd) == 0 &&
+             (size = lseek(aof->rw_fd, 0, SEEK_END)) >= 0 &&
+             rename(aof->rw_path, aof->path) == 0;
+    }
+    if (ok)
+    {
+        sync_dir(aof->path);
+    }
+    else
+    {
+        DEBUG_PRINT("Failed to rewrite %s", aof->path);
+        close(aof->rw_fd);
+        unlink(aof->rw_path);
+    }
+    free(side);
+
+    pthread_mutex_lock(&aof->lock);
+    if (!ok)
+    {
+        aof->base_size = aof->size;
+        return 0;
+    }
+    close(aof->fd);
+    aof->fd = aof->rw_fd;
+    aof->size = aof->base_size = size;
+    // 그 batch는 side buffer로 이미 새 log에 들어갔다
+    if (skip > 0)
+    {
+        aof->len -= skip;
+        memmove(aof->buf, aof->buf + skip, aof->len);
+    }
+    if (aof->durable < end)
+    {
+        aof->durable = end;
+    }
+    pthread_cond_broadcast(&aof->done);
+    pthread_cond_broadcast(&aof->space);
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * writes every batch with one write() and syncs it
+ * as the fsync policy says
+ */
+static void *aof_writer(void *arg)
+{
+    struct aof *aof = (struct aof *)arg;
+    uint64_t last_sync = now_ms(), end;
+    struct timespec deadline;
+    size_t len, cap;
+    char *tmp;
+    int dirty = 0, failed, ret;
+
+    pthread_mutex_lock(&aof->lock);
+    while (1)
+    {
+        ret = 0;
+        while (1)
+        {
+            if ((aof->rewrite == AOF_REWRITE_DONE ||
+                 aof->rewrite == AOF_REWRITE_FAILED) &&
+                aof_rewrite_finish(aof))
+            {
+                dirty = 0; // 새 log는 이미 sync됨
+            }
+            if (aof->len > 0 || ret == ETIMEDOUT ||
+                (aof->closing && aof->rewrite == AOF_REWRITE_IDLE))
+            {
+                break;
+            }
+
+            if (dirty && aof->fsync_ms > 0)
+            {
+                // 주기가 되면 새 record가 없어도 sync
+                end = last_sync + aof->fsync_ms;
+                deadline.tv_sec = end / 1000;
+                deadline.tv_nsec = (end % 1000) * 1000000;
+                ret = pthread_cond_timedwait(&aof->more, &aof->lock,
+                                             &deadline);
+            }
+            else
+            {
+                pthread_cond_wait(&aof->more, &aof->lock);
+            }
+        }
+        if (aof->len == 0 && aof->closing)
+        {
+            break;
+        }
+
+        // 쌓인 record를 통째로 가져가고 appender는 빈 버퍼에 계속 쓴다
+        tmp = aof->wbuf;
+        aof->wbuf = aof->buf;
+        aof->buf = tmp;
+        cap = aof->wcap;
+        aof->wcap = aof->cap;
+        aof->cap = cap;
+        len = aof->len;
+        aof->len = 0;
+        end = aof->appended;
+        pthread_cond_broadcast(&aof->space);
+        pthread_mutex_unlock(&aof->lock);
+
+        failed = 0;
+        if (len > 0)
+        {
+            failed = write_all(aof->fd, aof->wbuf, len) < 0;
+            aof->size += len;
+            dirty = 1;
+        }
+        if (dirty && (aof->fsync_ms == AOF_FSYNC_ALWAYS ||
+                      (aof->fsync_ms > 0 &&
+                       now_ms() >= last_sync + aof->fsync_ms)))
+        {
+            // group commit: 배치 전체를 fdatasync 한 번으로
+            failed |= fdatasync(aof->fd) < 0;
+            last_sync = now_ms();
+            dirty = 0;
+        }
+
+        pthread_mutex_lock(&aof->lock);
+        if (failed)
+        {
+            DEBUG_PRINT("Failed to write the append-only log");
+            aof->error = 1;
+        }
+        if (aof->durable < end)
+        {
+            aof->durable = end;
+        }
+        pthread_cond_broadcast(&aof->done);
+
+        // 지난 rewrite 이후 log가 충분히 커졌으면 compaction 시작
+        if (aof->dump && aof->rewrite == AOF_REWRITE_IDLE &&
+            !aof->closing && aof->size >= AOF_REWRITE_MIN &&
+            aof->size >= aof->base_size * AOF_REWRITE_GROWTH)
+        {
+            aof_rewrite_start(aof);
+        }
+    }
+    pthread_mutex_unlock(&aof->lock);
+
+    if (dirty && aof->fsync_ms != AOF_FSYNC_NEVER && fdatasync(aof->fd) < 0)
+    {
+        aof->error = 1;
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+struct aof *aof_open(const char *path, int fsync_ms,
+                     aof_dump_fn dump, void *arg)
+{
+    TRACE_PRINT();
+    pthread_condattr_t attr;
+    struct aof *aof;
+
+    aof = calloc(1, sizeof(struct aof));
+    if (aof == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for append-only log");
+        return NULL;
+    }
+    aof->fsync_ms = fsync_ms;
+    aof->dump = dump;
+    aof->dump_arg = arg;
+    aof->rw_fd = -1;
+
+    aof->path = strdup(path);
+    aof->rw_path = malloc(strlen(path) + sizeof(".rewrite"));
+    if (aof->path == NULL || aof->rw_path == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for append-only log");
+        goto err;
+    }
+    sprintf(aof->rw_path, "%s.rewrite", path);
+
+    aof->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (aof->fd < 0)
+    {
+        DEBUG_PRINT("Failed to open %s", path);
+        goto err;
+    }
+    aof->size = aof->base_size = lseek(aof->fd, 0, SEEK_END);
+
+    pthread_mutex_init(&aof->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&aof->more, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&aof->done, NULL);
+    pthread_cond_init(&aof->space, NULL);
+
+    if (pthread_create(&aof->writer, NULL, aof_writer, aof) != 0)
+    {
+        DEBUG_PRINT("Failed to start the log writer");
+        close(aof->fd);
+        pthread_mutex_destroy(&aof->lock);
+        pthread_cond_destroy(&aof->more);
+        pthread_cond_destroy(&aof->done);
+        pthread_cond_destroy(&aof->space);
+        goto err;
+    }
+
+    return aof;
+
+err:
+    free(aof->path);
+    free(aof->rw_path);
+    free(aof);
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+int aof_append(struct aof *aof, int op, const char *key, size_t key_len,
+               const char *value, size_t value_len)
+{
+    TRACE_PRINT();
+    struct aof_rec hdr;
+    size_t len = sizeof(hdr) + key_len + value_len;
+    int ret;
+
+    if (!aof || !key || key_len == 0 || key_len > MAX_KEY_LEN ||
+        (value_len && !value) || value_len > UINT32_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // crc는 lock 밖에서 계산
+    rec_init(&hdr, op, key, key_len, value, value_len);
+
+    pthread_mutex_lock(&aof->lock);
+    while (aof->len > 0 && aof->len + len > AOF_MAX_PENDING &&
+           !aof->closing)
+    {
+        // writer가 밀려 있으면 메모리가 무한히 늘지 않게 기다림
+        pthread_cond_wait(&aof->space, &aof->lock);
+    }
+
+    ret = rec_push(&aof->buf, &aof->len, &aof->cap, &hdr, key, value);
+    if (ret == 0)
+    {
+        // rewrite 중의 쓰기는 새 log 끝에도 붙인다. dump가 bucket lock을
+        // 잡으니 기다릴 수는 없고, 너무 밀리면 이번 rewrite를 포기한다
+        if (aof->rewrite != AOF_REWRITE_IDLE && !aof->side_error &&
+            (aof->side_len + len > AOF_MAX_PENDING ||
+             rec_push(&aof->side, &aof->side_len, &aof->side_cap,
+                      &hdr, key, value) != 0))
+        {
+            __atomic_store_n(&aof->side_error, 1, __ATOMIC_RELAXED);
+            free(aof->side);
+            aof->side = NULL;
+            aof->side_len = aof->side_cap = 0;
+        }
+        aof->appended += len;
+        t_lsn = aof->appended;
+        pthread_cond_signal(&aof->more);
+    }
+    pthread_mutex_unlock(&aof->lock);
+
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int aof_commit(struct aof *aof)
+{
+    TRACE_PRINT();
+    int ret;
+
+    if (aof == NULL || aof->fsync_ms != AOF_FSYNC_ALWAYS)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&aof->lock);
+    while (aof->durable < t_lsn && !aof->error)
+    {
+        pthread_cond_wait(&aof->done, &aof->lock);
+    }
+    ret = aof->error ? -1 : 0;
+    pthread_mutex_unlock(&aof->lock);
+
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int aof_close(struct aof *aof)
+{
+    TRACE_PRINT();
+    int ret;
+
+    if (aof == NULL)
+    {
+        return 0;
+    }
+
+    // 진행 중인 rewrite는 버리고 writer가 남은 batch를 쓴 뒤 종료
+    pthread_mutex_lock(&aof->lock);
+    aof->closing = 1;
+    pthread_cond_signal(&aof->more);
+    pthread_cond_broadcast(&aof->space);
+    pthread_mutex_unlock(&aof->lock);
+    pthread_join(aof->writer, NULL);
+
+    ret = aof->error ? -1 : 0;
+    if (close(aof->fd) < 0)
+    {
+        ret = -1;
+    }
+    pthread_mutex_destroy(&aof->lock);
+    pthread_cond_destroy(&aof->more);
+    pthread_cond_destroy(&aof->done);
+    pthread_cond_destroy(&aof->space);
+    free(aof->buf);
+    free(aof->wbuf);
+    free(aof->path);
+    free(aof->rw_path);
+    free(aof);
+
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+/* state shared by the replay threads */
+struct replay
+{
+    const char *map;
+    size_t end;           // end of the well-framed records
+    size_t *chunks;       // first record offset of each chunk
+    size_t num_chunks;
+    size_t next_chunk;    // verification: next chunk to claim
+    size_t bad;           // offset of the first corrupted record
+    int num_threads;
+    aof_apply_fn apply;
+    void *arg;
+    int error;
+};
+struct replay_arg
+{
+    struct replay *r;
+    int idx;
+};
+/*--------------------------------------------------------------------*/
+/**
+ * returns the length of the well-framed record at off,
+ * or 0 when the log ends there
+ */
+static size_t rec_frame(const char *map, size_t size, size_t off,
+                        struct aof_rec *hdr)
+{
+    size_t len;
+
+    if (size - off < sizeof(*hdr))
+    {
+        return 0;
+    }
+    memcpy(hdr, map + off, sizeof(*hdr));
+    if (hdr->magic != AOF_MAGIC || hdr->key_len == 0 ||
+        hdr->key_len > MAX_KEY_LEN)
+    {
+        return 0;
+    }
+    len = sizeof(*hdr) + hdr->key_len + (size_t)hdr->value_len;
+    return len <= size - off ? len : 0;
+}
+/*--------------------------------------------------------------------*/
+/* phase 1: checks the crc of every record, a chunk at a time */
+static void *replay_verify(void *arg)
+{
+    struct replay *r = ((struct replay_arg *)arg)->r;
+    struct aof_rec hdr;
+    size_t c, off, end, len, bad;
+
+    while ((c = __atomic_fetch_add(&r->next_chunk, 1, __ATOMIC_RELAXED)) <
+           r->num_chunks)
+    {
+        off = r->chunks[c];
+        end = c + 1 < r->num_chunks ? r->chunks[c + 1] : r->end;
+        for (; off < end; off += len)
+        {
+            len = rec_frame(r->map, r->end, off, &hdr);
+            if (rec_crc(&hdr, r->map + off + sizeof(hdr),
+                        r->map + off + sizeof(hdr) + hdr.key_len) != hdr.crc)
+            {
+                // 가장 앞의 손상 위치만 남긴다
+                bad = __atomic_load_n(&r->bad, __ATOMIC_RELAXED);
+                while (off < bad &&
+                       !__atomic_compare_exchange_n(&r->bad, &bad, off, 1,
+                                                    __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED))
+                    ;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* phase 2: applies, in log order, the records of this thread's keys */
+static void *replay_apply(void *arg)
+{
+    struct replay *r = ((struct replay_arg *)arg)->r;
+    int idx = ((struct replay_arg *)arg)->idx;
+    static const uint64_t seed[2] = {0, 0};
+    struct aof_rec hdr;
+    const char *key;
+    size_t off, len;
+
+    for (off = 0; off < r->end; off += len)
+    {
+        len = rec_frame(r->map, r->end, off, &hdr);
+        key = r->map + off + sizeof(hdr);
+        // 같은 key는 항상 같은 스레드가 순서대로 적용
+        if (hash_fast(key, hdr.key_len, seed) % r->num_threads != (size_t)idx)
+        {
+            continue;
+        }
+        if (r->apply(r->arg, hdr.op, key, hdr.key_len,
+                     key + hdr.key_len, hdr.value_len) < 0)
+        {
+            __atomic_store_n(&r->error, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * runs fn on num_threads threads (the caller being one of them).
+ * Returns -1 when any internal errors occur.
+ */
+static int replay_run(struct replay *r, void *(*fn)(void *))
+{
+    pthread_t *threads;
+    struct replay_arg *args;
+    int i, n = r->num_threads, ret = 0;
+
+    threads = calloc(n, sizeof(pthread_t));
+    args = calloc(n, sizeof(struct replay_arg));
+    if (!threads || !args)
+    {
+        free(threads);
+        free(args);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        args[i].r = r;
+        args[i].idx = i;
+    }
+    for (i = 1; i < n; i++)
+    {
+        if (pthread_create(&threads[i], NULL, fn, &args[i]) != 0)
+        {
+            break;
+        }
+    }
+    if (i < n)
+    {
+        // 만들지 못한 몫까지 직접 처리할 수는 없으므로 실패로 본다
+        ret = -1;
+        __atomic_store_n(&r->error, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        fn(&args[0]);
+    }
+    while (--i > 0)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(args);
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+ssize_t aof_replay(const char *path, int num_threads,
+                   aof_apply_fn apply, void *arg)
+{
+    TRACE_PRINT();
+    struct replay r;
+    struct aof_rec hdr;
+    struct stat st;
+    size_t off, len, cap = 0, mark = 0;
+    ssize_t count = 0;
+    int fd;
+
+    memset(&r, 0, sizeof(r));
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    r.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (r.map == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    posix_madvise((void *)r.map, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    // framing은 순차적으로만 알 수 있으므로 한 번 훑으며 chunk 경계를 기록
+    for (off = 0; (len = rec_frame(r.map, st.st_size, off, &hdr)) > 0;
+         off += len, count++)
+    {
+        if (off < mark)
+        {
+            continue;
+        }
+        if (r.num_chunks == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            size_t *chunks = realloc(r.chunks, cap * sizeof(size_t));
+            if (chunks == NULL)
+            {
+                r.error = 1;
+                break;
+            }
+            r.chunks = chunks;
+        }
+        r.chunks[r.num_chunks++] = off;
+        mark = off + AOF_CHUNK;
+    }
+
+    r.end = off;
+    r.bad = off;
+    r.num_threads = num_threads > 0 ? num_threads : 1;
+    r.apply = apply;
+    r.arg = arg;
+
+    if (!r.error && replay_run(&r, replay_verify) == 0)
+    {
+        // 손상된 record부터 뒤는 버린다
+        if (r.bad < r.end)
+        {
+            r.end = r.bad;
+            for (count = 0, off = 0; off < r.end; off += len, count++)
+            {
+                len = rec_frame(r.map, r.end, off, &hdr);
+            }
+        }
+        replay_run(&r, replay_apply);
+    }
+
+    munmap((void *)r.map, st.st_size);
+    free(r.chunks);
+
+    if (!r.error && r.end < (size_t)st.st_size)
+    {
+        fprintf(stderr, "%s: discarding %zu bytes of torn or corrupted log\n",
+                path, (size_t)st.st_size - r.end);
+        if (ftruncate(fd, r.end) < 0)
+        {
+            r.error = 1;
+        }
+    }
+    close(fd);
+
+    return r.error ? -1 : count;
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,125 @@
+/*--------------------------------------------------------------------*/
+/* aof.h                                                              */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _AOF_H
+#define _AOF_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Append-only log of the hash table writes.
+ * Workers append records to a shared in-memory batch; a writer thread
+ * writes every batch with one write() and, depending on the fsync
+ * policy, makes it durable with one fdatasync() (group commit).
+ *
+ * Every record is an aof_rec header followed by key_len bytes of key
+ * and value_len bytes of value, in host byte order. crc covers the
+ * rest of the header, the key and the value, so a torn tail left by
+ * a crash is detected and cut off on replay.
+ *
+ * Once the log has grown AOF_REWRITE_GROWTH times since the last
+ * rewrite, a rewriter thread builds a compact log from the live
+ * entries while writes go on, then the writer renames it over the old
+ * one. Records appended meanwhile are kept aside and added after the
+ * dump, so the new log replays to the same table.
+ */
+#define AOF_MAGIC 0xa5
+struct aof_rec
+{
+    uint32_t crc;
+    uint8_t magic;
+    uint8_t op;      // enum HASH_OP
+    uint8_t key_len;
+    uint8_t pad;
+    uint32_t value_len;
+};
+/*--------------------------------------------------------------------*/
+/* fsync policies, or a positive interval in ms */
+#define AOF_FSYNC_ALWAYS 0 // reply only after the record is durable
+#define AOF_FSYNC_NEVER -1 // leave flushing to the kernel
+#define AOF_FSYNC_DEFAULT 1000
+/* appenders wait while this many bytes are not yet written, and a
+   rewrite is given up once this many bytes wait to be added to it */
+#define AOF_MAX_PENDING (64 * 1024 * 1024)
+/* compact the log once it is this large and has grown this much */
+#define AOF_REWRITE_MIN (16 * 1024 * 1024)
+#define AOF_REWRITE_GROWTH 2
+/*--------------------------------------------------------------------*/
+struct aof;
+/*--------------------------------------------------------------------*/
+/**
+ * Called by aof_replay() for every valid record, from several threads
+ * at once but always from the same thread for the same key.
+ * Returns -1 when any internal errors occur.
+ */
+typedef int (*aof_apply_fn)(void *arg, int op, const char *key,
+                            size_t key_len, const char *value,
+                            size_t value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Called by the rewriter thread for every live entry, with its
+ * deadline (0 for none), which is logged as a HASH_OP_EXPIRE record.
+ * Returns -1 when any internal errors occur, and the rewrite is dropped.
+ */
+typedef int (*aof_emit_fn)(void *emit_arg, const char *key,
+                           size_t key_len, const char *value,
+                           size_t value_len, uint64_t expire);
+/**
+ * Calls emit for every live entry, without blocking writers for long.
+ * An entry written during the dump may be emitted or not, even twice.
+ * Returns -1 when any internal errors occur.
+ */
+typedef int (*aof_dump_fn)(void *arg, aof_emit_fn emit, void *emit_arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Replays the log at path with num_threads threads, partitioning the
+ * records by key, and cuts off a torn or corrupted tail.
+ * A missing log is an empty one.
+ * Returns -1 when any internal errors occur.
+ * Returns the number of replayed records on success.
+ */
+ssize_t aof_replay(const char *path, int num_threads,
+                   aof_apply_fn apply, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Opens the log at path for appending and starts its writer thread.
+ * fsync_ms is AOF_FSYNC_ALWAYS, AOF_FSYNC_NEVER or an interval in ms.
+ * dump (if not NULL) is called with arg to compact the log; the new
+ * log is built in path.rewrite.
+ * Returns NULL when any internal errors occur.
+ */
+struct aof *aof_open(const char *path, int fsync_ms,
+                     aof_dump_fn dump, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Queues a record for the writer thread.
+ * Callers must serialize appends for the same key, so that the log
+ * keeps the order in which they hit the table.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int aof_append(struct aof *aof, int op, const char *key, size_t key_len,
+               const char *value, size_t value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * With AOF_FSYNC_ALWAYS, waits until every record appended by the
+ * calling thread is durable; returns at once with other policies.
+ * Returns -1 when the log could not be written.
+ * Returns 0 on success.
+ */
+int aof_commit(struct aof *aof);
+/*--------------------------------------------------------------------*/
+/**
+ * Writes and syncs the pending records, stops the writer thread
+ * (dropping a rewrite in progress) and closes the log.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int aof_close(struct aof *aof);
+/*--------------------------------------------------------------------*/
+#endif // _AOF_H
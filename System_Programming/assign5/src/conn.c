@@ -0,0 +1,535 @@
+/*--------------------------------------------------------------------*/
+/* conn.c                                                             */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "conn.h"
+#include "stats.h"
+/*--------------------------------------------------------------------*/
+struct conn *conn_alloc(int fd)
+{
+    TRACE_PRINT();
+    struct conn *c = malloc(sizeof(struct conn));
+
+    if (c == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for connection");
+        return NULL;
+    }
+
+    c->fd = fd;
+    c->state = CONN_READING;
+    c->proto = CONN_PROTO_UNKNOWN;
+    c->rlen = 0;
+    c->wlen = 0;
+    c->woff = 0;
+    c->discard = 0;
+    c->eof = 0;
+    c->fwd_req = c->rbuf;
+    c->fwd_len = 0;
+    c->fwd_shard = 0;
+    c->uctx = NULL;
+    c->next = NULL;
+    c->all_prev = NULL;
+    c->all_next = NULL;
+    c->num_refs = 0;
+    c->ref_bytes = 0;
+    c->value = NULL;
+    c->value_off = 0;
+    c->value_held = 0;
+    c->value_skip = 0;
+    c->vreq_len = 0;
+    stats_count(STATS_CONN_OPENED, 1);
+
+    return c;
+}
+/*--------------------------------------------------------------------*/
+/* unpins the values of the batch once it is sent or dropped */
+static void conn_release(struct conn *c)
+{
+    int i;
+
+    for (i = 0; i < c->num_refs; i++)
+    {
+        hash_release(c->refs[i].value);
+    }
+    c->num_refs = 0;
+    c->ref_bytes = 0;
+}
+/*--------------------------------------------------------------------*/
+void conn_free(struct conn *c)
+{
+    TRACE_PRINT();
+    if (c == NULL)
+    {
+        return;
+    }
+    conn_release(c);
+    skvs_value_done(c->value_held);
+    hash_release(c->value);
+    close(c->fd);
+    free(c);
+    stats_count(STATS_CONN_CLOSED, 1);
+}
+/*--------------------------------------------------------------------*/
+/* appends len bytes at base to iov, less the skip bytes already sent */
+static inline void conn_iov_add(struct iovec *iov, int *n, const char *base,
+                                size_t len, size_t *skip)
+{
+    if (*skip >= len)
+    {
+        *skip -= len;
+        return;
+    }
+    iov[*n].iov_base = (char *)base + *skip;
+    iov[*n].iov_len = len - *skip;
+    *skip = 0;
+    (*n)++;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * fills iov with the part of the batch not sent yet: wbuf cut at the
+ * offset of every value sent in place, with the value in between.
+ * Returns the number of entries, at most 2 * CONN_MAX_REFS + 1.
+ */
+static int conn_iov(struct conn *c, struct iovec *iov)
+{
+    size_t skip = c->woff, off = 0, end;
+    int i, n = 0;
+
+    for (i = 0; i <= c->num_refs; i++)
+    {
+        end = i < c->num_refs ? c->refs[i].off : c->wlen;
+        conn_iov_add(iov, &n, c->wbuf + off, end - off, &skip);
+        off = end;
+        if (i < c->num_refs)
+        {
+            conn_iov_add(iov, &n, c->refs[i].value->data,
+                         c->refs[i].value->size, &skip);
+        }
+    }
+    return n;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * sends the batched responses, timing the send as the STATS_SEND
+ * phase of every request answered in the batch, and takes the bytes
+ * sent off budget.
+ * Returns 1 when everything is sent, 0 on EAGAIN or when the budget
+ * runs out, -1 on error.
+ */
+static int conn_flush(struct conn *c, size_t *budget)
+{
+    TRACE_PRINT();
+    uint64_t start = stats_now();
+    size_t woff = c->woff;
+    struct iovec iov[2 * CONN_MAX_REFS + 1];
+    struct msghdr msg;
+    int ret = 1;
+
+    // 값은 table에서 바로, 나머지는 wbuf에서 한 번에 보낸다
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    while (c->woff < c->wlen + c->ref_bytes)
+    {
+        if (*budget == 0)
+        {
+            ret = 0;
+            break;
+        }
+        msg.msg_iovlen = conn_iov(c, iov);
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            ret = errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            break;
+        }
+        c->woff += n;
+        *budget -= (size_t)n < *budget ? (size_t)n : *budget;
+    }
+    stats_sent(stats_now() - start, c->woff - woff);
+
+    if (ret == 1)
+    {
+        c->wlen = 0;
+        c->woff = 0;
+        conn_release(c);
+    }
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * tells whether the request at req belongs to another shard,
+ * and if so, marks it to be forwarded there.
+ */
+static int conn_foreign(struct skvs_ctx *ctx, struct conn *c,
+                        const char *req, size_t len)
+{
+    TRACE_PRINT();
+    size_t req_len;
+    int shard;
+
+    if (ctx->num_shards <= 1)
+        return 0;
+    shard = skvs_shard(req, len, c->proto == CONN_PROTO_BINARY,
+                       ctx->num_shards, &req_len);
+    if (shard < 0 || shard == ctx->shard)
+        return 0;
+
+    c->fwd_shard = shard;
+    c->fwd_req = c->rbuf; // conn_process*()가 rbuf 앞으로 옮긴다
+    c->fwd_len = req_len;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/* appends a response of wlen bytes served into the end of wbuf */
+static inline void conn_add(struct conn *c, size_t wlen,
+                            struct skvs_ref *ref)
+{
+    if (ref && ref->value)
+    {
+        ref->off += c->wlen;
+        c->ref_bytes += ref->value->size;
+        c->num_refs++;
+    }
+    c->wlen += wlen;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * takes what rbuf holds of the value of the large frame being
+ * received, and serves the frame once the value is complete.
+ * Returns 1 when served, 0 when the value is not complete or belongs
+ * to another shard, -1 when any internal errors occur.
+ */
+static int conn_value(struct skvs_ctx *ctx, struct conn *c, char **frame,
+                      char *end)
+{
+    TRACE_PRINT();
+    size_t n = c->value->size - c->value_off, wlen;
+    int ret;
+
+    if (n > (size_t)(end - *frame))
+        n = end - *frame;
+    memcpy(c->value->data + c->value_off, *frame, n);
+    c->value_off += n;
+    *frame += n;
+    if (c->value_off < c->value->size)
+        return 0; // 나머지는 conn_handle()이 값으로 바로 받는다
+    skvs_value_done(c->value_held);
+    c->value_held = 0;
+
+    if (conn_foreign(ctx, c, c->vreq, c->vreq_len))
+    {
+        c->fwd_req = c->vreq; // 값은 c->value째로 넘긴다
+        return 0;
+    }
+    ret = skvs_serve_value(ctx, c->vreq, c->vreq_len, c->value,
+                           c->wbuf + c->wlen, &wlen);
+    c->value = NULL;
+    if (ret < 0)
+        return -1;
+    c->wlen += wlen;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * serves every complete binary frame in rbuf while wbuf has room
+ * for one more response, and keeps the partial frame in rbuf.
+ * A large frame leaves rbuf as soon as its request is in: its value
+ * goes to c->value, taking what rbuf holds of it first, unless
+ * skvs_value_admit() refuses it and the value is dropped instead.
+ * Stops at a frame for another shard, leaving it at the start of rbuf
+ * (or in vreq).
+ * Returns -1 when the framing is broken, 0 otherwise.
+ */
+static int conn_process_bin(struct skvs_ctx *ctx, struct conn *c)
+{
+    TRACE_PRINT();
+    char *frame = c->rbuf;
+    char *end = c->rbuf + c->rlen;
+    struct skvs_ref *ref;
+    size_t wlen, value_len;
+    ssize_t ret;
+
+    while (CONN_WBUF_SIZE - c->wlen >= BUF_SIZE &&
+           c->num_refs < CONN_MAX_REFS)
+    {
+        if (c->value_skip > 0)
+        {
+            // 받지 않기로 한 값은 들어오는 대로 버린다
+            wlen = end - frame;
+            if (wlen > c->value_skip)
+                wlen = c->value_skip;
+            frame += wlen;
+            c->value_skip -= wlen;
+            if (c->value_skip > 0)
+                break;
+            continue;
+        }
+        if (c->value)
+        {
+            ret = conn_value(ctx, c, &frame, end);
+            if (ret < 0)
+                return -1;
+            if (ret == 0)
+                break;
+            continue;
+        }
+        if (frame == end)
+            break;
+
+        // 큰 frame은 요청 부분만 떼어 두고 값은 따로 받는다
+        ret = skvs_value_req(frame, end - frame, &value_len);
+        if (ret < 0)
+            return -1;
+        if (ret > 0)
+        {
+            if (end - frame < ret)
+                break;
+            c->vreq_len = ret;
+            ret = skvs_value_admit(ctx, frame, value_len,
+                                   c->wbuf + c->wlen, &wlen);
+            if (ret < 0)
+                return -1;
+            if (ret == 0)
+            {
+                // 거절한 값은 할당하지 않고 흘려보낸다
+                conn_add(c, wlen, NULL);
+                c->value_skip = value_len;
+                frame += c->vreq_len;
+                continue;
+            }
+            c->value_held = value_len;
+            c->value = hash_value_alloc(value_len);
+            if (c->value == NULL)
+                return -1;
+            c->value_off = 0;
+            memcpy(c->vreq, frame, c->vreq_len);
+            frame += c->vreq_len;
+            continue;
+        }
+
+        if (conn_foreign(ctx, c, frame, end - frame))
+            break;
+        ref = &c->refs[c->num_refs];
+        ret = skvs_serve_bin(ctx, frame, end - frame,
+                             c->wbuf + c->wlen, &wlen, ref);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            break;
+        conn_add(c, wlen, ref);
+        frame += ret;
+    }
+
+    c->rlen = end - frame;
+    if (c->rlen > 0 && frame != c->rbuf)
+        memmove(c->rbuf, frame, c->rlen);
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * serves every complete request in rbuf while wbuf has room
+ * for one more response, and keeps the partial tail in rbuf.
+ * Stops at a request for another shard, leaving it at the start of rbuf.
+ * Returns -1 when any internal errors occur, 0 otherwise.
+ */
+static int conn_process(struct skvs_ctx *ctx, struct conn *c)
+{
+    TRACE_PRINT();
+    char *line = c->rbuf;
+    char *end = c->rbuf + c->rlen;
+    char *lf;
+    struct skvs_ref *ref;
+    size_t len, wlen;
+    int ret;
+
+    c->fwd_len = 0;
+
+    // 첫 바이트로 프로토콜 결정
+    if (c->proto == CONN_PROTO_UNKNOWN && c->rlen > 0)
+    {
+        c->proto = (unsigned char)c->rbuf[0] == SKVS_BIN_REQ_MAGIC
+                       ? CONN_PROTO_BINARY
+                       : CONN_PROTO_TEXT;
+    }
+    if (c->proto == CONN_PROTO_BINARY)
+    {
+        return conn_process_bin(ctx, c);
+    }
+
+    // 응답 하나(최대 BUF_SIZE)가 들어갈 공간이 있는 동안 처리
+    while (line < end && !c->eof &&
+           CONN_WBUF_SIZE - c->wlen >= BUF_SIZE &&
+           c->num_refs < CONN_MAX_REFS)
+    {
+        lf = memchr(line, '\n', end - line);
+        if (lf == NULL)
+        {
+            if (end - line < BUF_SIZE || c->discard)
+            {
+                if (c->discard)
+                    line = end; // 줄 끝까지 계속 버림
+                break;
+            }
+
+            // \n 없이 BUF_SIZE를 넘는 요청: INVALID CMD 후 줄 끝까지 버림
+            ret = skvs_serve(ctx, line, BUF_SIZE,
+                             c->wbuf + c->wlen, &wlen, NULL);
+            if (ret < 0)
+                return -1;
+            c->wlen += wlen;
+            c->discard = 1;
+            line = end;
+            break;
+        }
+
+        len = lf - line + 1;
+        if (c->discard)
+        {
+            c->discard = 0;
+            line = lf + 1;
+            continue;
+        }
+
+        if (len == 1 || (len == 2 && line[0] == '\r'))
+        {
+            // 빈 줄: 앞선 응답을 보낸 뒤 연결 종료
+            c->eof = 1;
+            line = end;
+            break;
+        }
+
+        // 다른 shard의 key면 여기서 멈추고 넘긴다
+        if (conn_foreign(ctx, c, line, end - line))
+            break;
+
+        // SKVS 요청 처리
+        wlen = 0;
+        ref = &c->refs[c->num_refs];
+        ret = skvs_serve(ctx, line, len, c->wbuf + c->wlen, &wlen, ref);
+        if (ret < 0)
+            return -1;
+        conn_add(c, wlen, ref);
+        line = lf + 1;
+    }
+
+    // 남은 partial 요청은 버퍼 앞으로 옮겨 다음 recv에서 이어 받음
+    c->rlen = end - line;
+    if (c->rlen > 0 && line != c->rbuf)
+        memmove(c->rbuf, line, c->rlen);
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+enum CONN_STATE conn_handle(struct skvs_ctx *ctx, struct conn *c)
+{
+    TRACE_PRINT();
+    size_t budget = CONN_IO_BUDGET, len;
+    char *buf;
+    ssize_t n;
+    int ret;
+
+    while (1)
+    {
+        // 모아둔 응답을 한 번의 send로 전송
+        if (c->woff < c->wlen + c->ref_bytes)
+        {
+            // 배치의 첫 send 전에 log가 fsync 정책만큼 내려가기를 기다림
+            if (c->woff == 0 && skvs_commit(ctx) < 0)
+                return c->state = CONN_CLOSING;
+            ret = conn_flush(c, &budget);
+            if (ret < 0)
+                return c->state = CONN_CLOSING;
+            if (ret == 0) // EPOLLOUT 대기, 또는 다른 연결에 양보
+                return c->state = budget ? CONN_WRITING : CONN_BUSY;
+        }
+        c->state = CONN_READING;
+
+        if (c->eof)
+            return c->state = CONN_CLOSING;
+
+        // 버퍼에 남은 완성된 요청 먼저 처리
+        if (conn_process(ctx, c) < 0)
+            return c->state = CONN_CLOSING;
+        // 앞선 응답을 모두 보낸 뒤에 다른 shard로 넘겨 순서를 지킨다
+        if (c->fwd_len > 0 && c->wlen == 0)
+            return c->state = CONN_FORWARD;
+        if (c->wlen > 0 || c->eof)
+            continue;
+
+        // 한 연결이 thread를 오래 붙잡지 않도록 양보
+        if (budget == 0)
+            return c->state = CONN_BUSY;
+
+        // edge-triggered에서는 EAGAIN까지 읽는다.
+        // 큰 값은 rbuf를 거치지 않고 제자리로 받는다
+        if (c->value)
+        {
+            assert(c->rlen == 0 && c->value_off < c->value->size);
+            buf = c->value->data + c->value_off;
+            len = c->value->size - c->value_off;
+        }
+        else
+        {
+            assert(c->rlen < CONN_RBUF_SIZE);
+            buf = c->rbuf + c->rlen;
+            len = CONN_RBUF_SIZE - c->rlen;
+        }
+        n = recv(c->fd, buf, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return CONN_READING;
+            return c->state = CONN_CLOSING;
+        }
+        if (n == 0)
+        {
+            // 연결 종료
+            return c->state = CONN_CLOSING;
+        }
+        if (c->value)
+            c->value_off += n;
+        else
+            c->rlen += n;
+        budget -= (size_t)n < budget ? (size_t)n : budget;
+        stats_count(STATS_BYTES_IN, n);
+    }
+}
+/*--------------------------------------------------------------------*/
+void conn_forwarded(struct conn *c, const char *res, size_t res_len,
+                    const struct skvs_ref *ref)
+{
+    TRACE_PRINT();
+    assert(c->state == CONN_FORWARD && c->wlen == 0 && c->num_refs == 0);
+    assert(res_len <= CONN_WBUF_SIZE);
+
+    memcpy(c->wbuf, res, res_len);
+    c->wlen = res_len;
+    c->woff = 0;
+    if (ref && ref->value)
+    {
+        c->refs[0] = *ref;
+        c->num_refs = 1;
+        c->ref_bytes = ref->value->size;
+    }
+
+    // 넘겼던 요청을 rbuf에서 제거 (큰 값의 요청은 vreq에 있었다)
+    if (c->fwd_req == c->rbuf)
+    {
+        c->rlen -= c->fwd_len;
+        if (c->rlen > 0)
+            memmove(c->rbuf, c->rbuf + c->fwd_len, c->rlen);
+    }
+    c->fwd_req = c->rbuf;
+    c->fwd_len = 0;
+    c->state = CONN_READING;
+}
+/*--------------------------------------------------------------------*/
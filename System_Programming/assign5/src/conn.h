@@ -0,0 +1,118 @@
+/*--------------------------------------------------------------------*/
+/* conn.h                                                             */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _CONN_H
+#define _CONN_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "skvslib.h"
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/* pipelined requests and batched responses are buffered per connection */
+#define CONN_RBUF_SIZE (2 * BUF_SIZE)
+#define CONN_WBUF_SIZE (2 * BUF_SIZE)
+#define CONN_MAX_REFS 16 // values sent in place per batch, see refs
+#define CONN_IO_BUDGET (256 * 1024) // bytes moved by one conn_handle()
+/*--------------------------------------------------------------------*/
+/* connection states */
+enum CONN_STATE
+{
+    CONN_READING, // waiting for (more of) a request
+    CONN_WRITING, // response is pending on a full socket buffer
+    CONN_CLOSING, // peer closed, sent an empty line or failed
+    CONN_FORWARD, // next request belongs to another shard (fwd_shard)
+    CONN_BUSY     // yielded with more to do, see conn_handle()
+};
+/* wire protocol, negotiated by the first byte of the connection */
+enum CONN_PROTO
+{
+    CONN_PROTO_UNKNOWN,
+    CONN_PROTO_TEXT,
+    CONN_PROTO_BINARY
+};
+/*--------------------------------------------------------------------*/
+/* per-connection state */
+struct conn
+{
+    int fd;
+    enum CONN_STATE state;
+    enum CONN_PROTO proto;
+    size_t rlen;       // bytes buffered in rbuf (partial tail included)
+    size_t wlen;       // bytes of batched responses in wbuf
+    size_t woff;       // bytes of responses already sent, refs included
+    int discard;       // skipping the rest of an oversized request
+    int eof;           // empty line received, close after flushing
+    const char *fwd_req; // request to forward, at rbuf[0] or vreq
+    size_t fwd_len;    // length of that request
+    int fwd_shard;     // shard owning its key
+    void *uctx;        // free for the caller, NULL at first
+    struct conn *next; // link for the ready queue
+    struct conn *all_prev, *all_next; // list of open connections
+    /* values of the batch sent from the table (skvs_serve()), in order;
+       refs[i].off is where refs[i].value goes in wbuf */
+    struct skvs_ref refs[CONN_MAX_REFS];
+    int num_refs;
+    size_t ref_bytes; // bytes of those values
+    /* large binary frame (skvs_value_req()) being received: its request
+       before the value is kept in vreq, and the value is received in
+       place, bypassing rbuf */
+    value_t *value;    // NULL when none
+    size_t value_off;  // bytes of it received so far
+    size_t value_held; // bytes admitted by skvs_value_admit(), until received
+    size_t value_skip; // bytes of a refused value still to drop
+    size_t vreq_len;
+    char vreq[SKVS_VALUE_REQ_MAX];
+    char rbuf[CONN_RBUF_SIZE];
+    char wbuf[CONN_WBUF_SIZE];
+};
+/*--------------------------------------------------------------------*/
+/**
+ * Allocates a connection for the given socket.
+ * Returns NULL when any internal errors occur.
+ */
+struct conn *conn_alloc(int fd);
+/*--------------------------------------------------------------------*/
+/**
+ * Closes the socket and frees the connection.
+ */
+void conn_free(struct conn *c);
+/*--------------------------------------------------------------------*/
+/**
+ * Drives the connection state machine as far as the socket allows.
+ * Every complete request in the receive buffer is served with
+ * skvs_serve() and the responses are flushed with a single sendmsg(),
+ * gathering the values read by reference straight from the table,
+ * while a partial request is carried over to the next read.
+ * The value of a large binary frame is received straight into its
+ * own allocation and linked to the table as is.
+ * On a non-blocking socket it reads and writes until EAGAIN;
+ * on a blocking one it returns on close or receive timeout.
+ * Either way it moves about CONN_IO_BUDGET bytes at most, so that a
+ * large value does not hold up the other connections of the thread.
+ * Returns the state the connection is left in:
+ * CONN_READING when it waits for readability,
+ * CONN_WRITING when it waits for writability,
+ * CONN_CLOSING when it should be closed,
+ * CONN_FORWARD when ctx is a shard (skvs_set_shard()) and the next
+ * request, the fwd_len bytes at fwd_req along with value when set,
+ * is for shard fwd_shard; every earlier response has been sent by then.
+ * CONN_BUSY when it used up its budget: call it again once the other
+ * ready connections had their turn, without waiting for an event.
+ */
+enum CONN_STATE conn_handle(struct skvs_ctx *ctx, struct conn *c);
+/*--------------------------------------------------------------------*/
+/**
+ * Completes the request a CONN_FORWARD connection was waiting on with
+ * the response res the owning shard made, followed by the value in
+ * ref (if not NULL) like skvs_serve(), which the connection then
+ * releases, and makes the connection CONN_READING again; call
+ * conn_handle() next to send the response and serve the requests
+ * behind it.
+ */
+void conn_forwarded(struct conn *c, const char *res, size_t res_len,
+                    const struct skvs_ref *ref);
+/*--------------------------------------------------------------------*/
+#endif // _CONN_H
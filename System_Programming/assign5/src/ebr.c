@@ -0,0 +1,217 @@
+/*--------------------------------------------------------------------*/
+/* ebr.c                                                              */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <pthread.h>
+#include "ebr.h"
+/*--------------------------------------------------------------------*/
+#define EBR_NUM_EPOCHS 3
+#define EBR_ADVANCE_INTERVAL 32 // retires between advance attempts
+/*--------------------------------------------------------------------*/
+struct ebr_node
+{
+    void *ptr;
+    void (*free_fn)(void *);
+    struct ebr_node *next;
+};
+/*--------------------------------------------------------------------*/
+/* per-thread record, never unlinked until ebr_destroy() */
+struct ebr_thread
+{
+    unsigned long epoch; // global epoch observed on entry
+    int active;          // inside a read-side critical section
+    int nest;            // nesting depth of ebr_enter()
+    unsigned int retired;
+    unsigned long limbo_epoch[EBR_NUM_EPOCHS];
+    struct ebr_node *limbo[EBR_NUM_EPOCHS];
+    struct ebr_thread *next;
+};
+/*--------------------------------------------------------------------*/
+static unsigned long g_epoch = 0;
+static struct ebr_thread *g_threads = NULL;
+static pthread_mutex_t g_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct ebr_thread *t_self = NULL;
+/*--------------------------------------------------------------------*/
+static struct ebr_thread *ebr_self(void)
+{
+    struct ebr_thread *t = t_self;
+
+    if (t)
+    {
+        return t;
+    }
+
+    t = calloc(1, sizeof(struct ebr_thread));
+    if (t == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for EBR thread record");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_threads_lock);
+    t->next = g_threads;
+    __atomic_store_n(&g_threads, t, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_threads_lock);
+
+    t_self = t;
+    return t;
+}
+/*--------------------------------------------------------------------*/
+static void ebr_free_list(struct ebr_node *n)
+{
+    struct ebr_node *tmp;
+
+    while (n)
+    {
+        tmp = n;
+        n = n->next;
+        tmp->free_fn(tmp->ptr);
+        free(tmp);
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * advances the global epoch if every active reader has
+ * observed the current one.
+ */
+static void ebr_try_advance(void)
+{
+    unsigned long epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+    struct ebr_thread *t;
+
+    for (t = __atomic_load_n(&g_threads, __ATOMIC_ACQUIRE); t; t = t->next)
+    {
+        if (__atomic_load_n(&t->active, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST) != epoch)
+        {
+            return;
+        }
+    }
+
+    __atomic_compare_exchange_n(&g_epoch, &epoch, epoch + 1, 0,
+                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * frees the limbo lists retired at least two epochs ago.
+ */
+static void ebr_collect(struct ebr_thread *t)
+{
+    unsigned long epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+    int i;
+
+    for (i = 0; i < EBR_NUM_EPOCHS; i++)
+    {
+        if (t->limbo[i] && t->limbo_epoch[i] + 2 <= epoch)
+        {
+            ebr_free_list(t->limbo[i]);
+            t->limbo[i] = NULL;
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+int ebr_enter(void)
+{
+    TRACE_PRINT();
+    struct ebr_thread *t = ebr_self();
+
+    if (t == NULL)
+    {
+        return -1;
+    }
+    if (t->nest++ > 0)
+    {
+        return 0;
+    }
+
+    __atomic_store_n(&t->active, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->epoch, __atomic_load_n(&g_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    /* publish the announcement before any shared pointer is loaded */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+void ebr_exit(void)
+{
+    TRACE_PRINT();
+    struct ebr_thread *t = t_self;
+
+    assert(t && t->nest > 0);
+    if (--t->nest == 0)
+    {
+        __atomic_store_n(&t->active, 0, __ATOMIC_RELEASE);
+    }
+}
+/*--------------------------------------------------------------------*/
+int ebr_retire(void *ptr, void (*free_fn)(void *))
+{
+    TRACE_PRINT();
+    struct ebr_thread *t = ebr_self();
+    struct ebr_node *n;
+    unsigned long epoch;
+    int i;
+
+    if (t == NULL)
+    {
+        return -1;
+    }
+
+    n = malloc(sizeof(struct ebr_node));
+    if (n == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for EBR node");
+        return -1;
+    }
+    n->ptr = ptr;
+    n->free_fn = free_fn;
+
+    /* the unlink must be visible before the epoch is sampled */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+
+    i = epoch % EBR_NUM_EPOCHS;
+    if (t->limbo[i] && t->limbo_epoch[i] != epoch)
+    {
+        /* the slot holds objects from at least three epochs ago */
+        ebr_free_list(t->limbo[i]);
+        t->limbo[i] = NULL;
+    }
+    t->limbo_epoch[i] = epoch;
+    n->next = t->limbo[i];
+    t->limbo[i] = n;
+
+    if (++t->retired >= EBR_ADVANCE_INTERVAL)
+    {
+        t->retired = 0;
+        ebr_try_advance();
+        ebr_collect(t);
+    }
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+void ebr_destroy(void)
+{
+    TRACE_PRINT();
+    struct ebr_thread *t, *tmp;
+    int i;
+
+    pthread_mutex_lock(&g_threads_lock);
+    t = g_threads;
+    g_threads = NULL;
+    while (t)
+    {
+        tmp = t;
+        t = t->next;
+        for (i = 0; i < EBR_NUM_EPOCHS; i++)
+        {
+            ebr_free_list(tmp->limbo[i]);
+        }
+        free(tmp);
+    }
+    t_self = NULL;
+    pthread_mutex_unlock(&g_threads_lock);
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,47 @@
+/*--------------------------------------------------------------------*/
+/* ebr.h                                                              */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _EBR_H
+#define _EBR_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Epoch-based reclamation.
+ * Lock-free readers run between ebr_enter() and ebr_exit().
+ * Writers unlink an object first and then hand it to ebr_retire();
+ * it is freed only after every reader that might still see it
+ * has left its critical section (two global epoch advances later).
+ */
+/*--------------------------------------------------------------------*/
+/**
+ * Begins a read-side critical section of the calling thread.
+ * Sections may nest.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int ebr_enter(void);
+/*--------------------------------------------------------------------*/
+/**
+ * Ends a read-side critical section of the calling thread.
+ */
+void ebr_exit(void);
+/*--------------------------------------------------------------------*/
+/**
+ * Defers free_fn(ptr) until no reader can hold a reference to ptr.
+ * ptr must already be unreachable for new readers.
+ * Returns -1 when any internal errors occur. (ptr is leaked)
+ * Returns 0 on success.
+ */
+int ebr_retire(void *ptr, void (*free_fn)(void *));
+/*--------------------------------------------------------------------*/
+/**
+ * Frees every retired object and all per-thread state.
+ * Call only when no other thread uses EBR any more.
+ */
+void ebr_destroy(void);
+/*--------------------------------------------------------------------*/
+#endif // _EBR_H
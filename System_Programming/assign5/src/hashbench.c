@@ -0,0 +1,439 @@
+/*--------------------------------------------------------------------*/
+/* hashbench.c                                                        */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <getopt.h>
+#include "common.h"
+#include "hashtable.h"
+#include "hashfn.h"
+#include "stats.h"
+#include "keydist.h"
+/*--------------------------------------------------------------------*/
+/**
+ * In-process benchmark of hashtable.c and rwlock.c.
+ * Every thread calls hash_read(), hash_insert(), hash_update() and
+ * hash_delete() directly on one shared table, so the numbers hold no
+ * socket, parsing or scheduling cost of the server. Each call is
+ * timed, and the bucket lock wait it reported through
+ * stats_lock_wait() is taken apart, so reads and writes show how long
+ * they queued on the rwlock separately from the work itself.
+ */
+#define HB_KEY_FMT "key%llu"
+/*--------------------------------------------------------------------*/
+enum HB_OP
+{
+    HB_READ,
+    HB_QREAD, // hash_read() with quick set
+    HB_INSERT,
+    HB_UPDATE,
+    HB_DELETE,
+    HB_OPS
+};
+static const char *g_op_names[HB_OPS] = {
+    "READ", "QREAD", "INSERT", "UPDATE", "DELETE"};
+/* lock waits are told apart by side */
+enum HB_SIDE
+{
+    HB_READER,
+    HB_WRITER,
+    HB_SIDES
+};
+/*--------------------------------------------------------------------*/
+struct hb_thread
+{
+    pthread_t tid;
+    uint64_t rng;
+    uint64_t ops[HB_OPS];
+    uint64_t found[HB_OPS]; // calls that returned 1
+    uint64_t errors;
+    uint64_t waited[HB_SIDES]; // calls that waited for a lock at all
+    struct stats_hist lat[HB_OPS];
+    struct stats_hist wait[HB_SIDES]; // lock wait of those calls
+};
+/*--------------------------------------------------------------------*/
+static hashtable_t *g_table;
+static int g_num_threads = NUM_THREADS;
+static uint64_t g_keys = 100000;
+static double g_read = 0.9;   // share of reads
+static double g_update = 0.5; // share of updates among writes
+static double g_theta = 0.0;  // zipfian skew, 0: uniform
+static double g_quick = 0.0;  // share of reads that are quick
+static size_t g_value_size = 16;
+static int g_seconds = 5;
+static char *g_value;
+static struct keydist_zipf g_zipf;
+static uint64_t g_end_ns;
+static pthread_barrier_t g_barrier;
+/*--------------------------------------------------------------------*/
+/* key of the next call */
+static void hb_key(struct hb_thread *t, char *key)
+{
+    uint64_t k;
+
+    if (g_theta > 0.0)
+        k = keydist_scramble(keydist_zipf(&g_zipf, &t->rng)) % g_keys;
+    else
+        k = keydist_rand(&t->rng) % g_keys;
+    snprintf(key, MAX_KEY_LEN + 1, HB_KEY_FMT, (unsigned long long)k);
+}
+/*--------------------------------------------------------------------*/
+/* operation of the next call */
+static int hb_op(struct hb_thread *t)
+{
+    double u = keydist_rand01(&t->rng);
+
+    if (u < g_read)
+        return keydist_rand01(&t->rng) < g_quick ? HB_QREAD : HB_READ;
+    // 쓰기 중 update를 빼고 남은 몫은 insert와 delete가 반씩 나눈다
+    u = (u - g_read) / (1.0 - g_read);
+    if (u < g_update)
+        return HB_UPDATE;
+    if (u < g_update + (1.0 - g_update) / 2)
+        return HB_INSERT;
+    return HB_DELETE;
+}
+/*--------------------------------------------------------------------*/
+static void *hb_thread_main(void *arg)
+{
+    struct hb_thread *t = (struct hb_thread *)arg;
+    char key[MAX_KEY_LEN + 1];
+    char *dst;
+    uint64_t start, now = 0, wait;
+    size_t len;
+    int op, side, ret;
+
+    dst = malloc(g_value_size + 1);
+    if (dst == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_wait(&g_barrier);
+
+    while (now < g_end_ns)
+    {
+        op = hb_op(t);
+        hb_key(t, key);
+
+        wait = t_stats_lock_ns;
+        start = stats_now();
+        switch (op)
+        {
+        case HB_READ:
+        case HB_QREAD:
+            ret = hash_read_n(g_table, key, dst, g_value_size + 1, &len,
+                              op == HB_QREAD);
+            break;
+        case HB_INSERT:
+            ret = hash_insert(g_table, key, g_value);
+            break;
+        case HB_UPDATE:
+            ret = hash_update(g_table, key, g_value);
+            break;
+        default:
+            ret = hash_delete(g_table, key);
+            break;
+        }
+        now = stats_now();
+        wait = t_stats_lock_ns - wait;
+
+        t->ops[op]++;
+        if (ret > 0)
+            t->found[op]++;
+        else if (ret < 0)
+            t->errors++;
+        stats_hist_add(&t->lat[op], now - start, 1);
+        if (wait > 0)
+        {
+            side = op <= HB_QREAD ? HB_READER : HB_WRITER;
+            t->waited[side]++;
+            stats_hist_add(&t->wait[side], wait, 1);
+        }
+    }
+
+    free(dst);
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* inserts every key once, so that reads start out hitting */
+static int hb_fill(void)
+{
+    char key[MAX_KEY_LEN + 1];
+    uint64_t k;
+
+    for (k = 0; k < g_keys; k++)
+    {
+        snprintf(key, sizeof(key), HB_KEY_FMT, (unsigned long long)k);
+        if (hash_insert(g_table, key, g_value) < 0)
+        {
+            fprintf(stderr, "Failed to insert %s\n", key);
+            return -1;
+        }
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* prints count, mean and quantiles of h in us, then pct in % */
+static void hb_print_hist(const char *name, const struct stats_hist *h,
+                          double pct)
+{
+    printf("%-8s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f %10.2f %5.1f%%\n",
+           name, (unsigned long long)h->count,
+           h->count ? h->sum / 1e3 / h->count : 0.0,
+           stats_quantile(h, 0.5) / 1e3, stats_quantile(h, 0.9) / 1e3,
+           stats_quantile(h, 0.99) / 1e3, stats_quantile(h, 0.999) / 1e3,
+           h->max / 1e3, pct);
+}
+/*--------------------------------------------------------------------*/
+static void hb_report(struct hb_thread *threads, double secs)
+{
+    static const char *side_names[HB_SIDES] = {"readers", "writers"};
+    struct stats_hist *h;
+    hash_stats_t st;
+    uint64_t ops[HB_OPS] = {0}, found[HB_OPS] = {0};
+    uint64_t sides[HB_SIDES] = {0}, waited[HB_SIDES] = {0};
+    uint64_t total = 0, errors = 0;
+    int t, op, side;
+
+    h = malloc(sizeof(struct stats_hist));
+    if (h == NULL)
+    {
+        perror("malloc");
+        return;
+    }
+
+    for (t = 0; t < g_num_threads; t++)
+    {
+        for (op = 0; op < HB_OPS; op++)
+        {
+            ops[op] += threads[t].ops[op];
+            found[op] += threads[t].found[op];
+        }
+        for (side = 0; side < HB_SIDES; side++)
+            waited[side] += threads[t].waited[side];
+        errors += threads[t].errors;
+    }
+    for (op = 0; op < HB_OPS; op++)
+    {
+        total += ops[op];
+        sides[op <= HB_QREAD ? HB_READER : HB_WRITER] += ops[op];
+    }
+
+    printf("%llu ops in %.1f s: %.0f ops/s, %llu errors\n",
+           (unsigned long long)total, secs, total / secs,
+           (unsigned long long)errors);
+
+    printf("\nlatency (us)\n");
+    printf("%-8s %10s %9s %9s %9s %9s %9s %10s %6s\n", "op", "count",
+           "mean", "p50", "p90", "p99", "p99.9", "max", "found");
+    for (op = 0; op < HB_OPS; op++)
+    {
+        if (ops[op] == 0)
+            continue;
+        memset(h, 0, sizeof(struct stats_hist));
+        for (t = 0; t < g_num_threads; t++)
+            stats_hist_merge(h, &threads[t].lat[op]);
+        // 마지막 열은 key를 찾은(insert는 새로 넣은) 비율
+        hb_print_hist(g_op_names[op], h, 100.0 * found[op] / ops[op]);
+    }
+
+    printf("\nrwlock wait (us), of the calls that waited at all\n");
+    printf("%-8s %10s %9s %9s %9s %9s %9s %10s %6s\n", "side", "count",
+           "mean", "p50", "p90", "p99", "p99.9", "max", "waited");
+    for (side = 0; side < HB_SIDES; side++)
+    {
+        if (sides[side] == 0)
+            continue;
+        memset(h, 0, sizeof(struct stats_hist));
+        for (t = 0; t < g_num_threads; t++)
+            stats_hist_merge(h, &threads[t].wait[side]);
+        hb_print_hist(side_names[side], h,
+                      100.0 * waited[side] / sides[side]);
+    }
+    if (hash_stats(g_table, &st) == 0)
+    {
+        printf("\n%zu hot bucket locks\n", st.hot_buckets);
+    }
+
+    free(h);
+}
+/*--------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+    int delay = RWLOCK_DELAY, hash_flags = 0, hash_fn = HASH_FN_FAST;
+    unsigned long num_locks = 0;
+    size_t hash_size = DEFAULT_HASH_SIZE;
+    struct hb_thread *threads;
+    uint64_t start;
+    int t, opt, lock_bits;
+
+    while ((opt = getopt(argc, argv, "t:d:s:L:lorH:n:R:U:z:q:v:T:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            g_num_threads = atoi(optarg);
+            break;
+        case 'd':
+            delay = atoi(optarg);
+            break;
+        case 's':
+            hash_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'L':
+            num_locks = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            hash_flags |= HASH_LOCKFREE_READ;
+            break;
+        case 'o':
+            hash_flags |= HASH_SEQLOCK_READ;
+            break;
+        case 'r':
+            hash_flags |= HASH_RESIZE;
+            break;
+        case 'H':
+            hash_fn = hash_fn_lookup(optarg);
+            if (hash_fn < 0)
+            {
+                fprintf(stderr, "Invalid hash function: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            g_keys = strtoull(optarg, NULL, 10);
+            break;
+        case 'R':
+            g_read = atof(optarg);
+            break;
+        case 'U':
+            g_update = atof(optarg);
+            break;
+        case 'z':
+            g_theta = atof(optarg);
+            break;
+        case 'q':
+            g_quick = atof(optarg);
+            break;
+        case 'v':
+            g_value_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            g_seconds = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            printf("Usage: %s [-t num_threads (%d)] "
+                   "[-d rwlock_delay (%d)] "
+                   "[-s hash_size (%d)] "
+                   "[-L num_locks (0: one per bucket)] "
+                   "[-l (lock-free reads)] "
+                   "[-o (optimistic reads)] "
+                   "[-r (resizable table)] "
+                   "[-H hash_fn (fast|siphash|legacy)] "
+                   "[-n keys (100000)] "
+                   "[-R read_ratio (0.9)] "
+                   "[-U update_share_of_writes (0.5)] "
+                   "[-z zipf_theta (0: uniform)] "
+                   "[-q quick_share_of_reads (0.0)] "
+                   "[-v value_size (16)] "
+                   "[-T seconds (5)]\n",
+                   argv[0], NUM_THREADS, RWLOCK_DELAY, DEFAULT_HASH_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // server의 -L처럼 2의 거듭제곱으로 올린다
+    lock_bits = num_locks > 1 ? 64 - __builtin_clzl(num_locks - 1) : 0;
+    if (g_num_threads <= 0 || delay < 0 || hash_size == 0 || g_keys < 2 ||
+        g_read < 0.0 || g_read > 1.0 || g_update < 0.0 || g_update > 1.0 ||
+        g_theta < 0.0 || g_theta >= 1.0 || g_quick < 0.0 || g_quick > 1.0 ||
+        g_value_size == 0 || g_value_size > BUF_SIZE || g_seconds <= 0 ||
+        lock_bits > HASH_LOCKS_OF(~0))
+    {
+        fprintf(stderr, "Invalid arguments (theta below 1, value at most "
+                        "%d)\n",
+                BUF_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    // 값은 공백 없는 고정 문자열
+    g_value = malloc(g_value_size + 1);
+    if (g_value == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(g_value, 'v', g_value_size);
+    g_value[g_value_size] = '\0';
+    if (g_theta > 0.0 && keydist_zipf_init(&g_zipf, g_keys, g_theta) < 0)
+    {
+        perror("keydist_zipf_init");
+        exit(EXIT_FAILURE);
+    }
+
+    g_table = hash_init(hash_size, delay,
+                        hash_flags | HASH_FN_FLAG(hash_fn) |
+                            HASH_LOCKS_FLAG(lock_bits));
+    if (g_table == NULL)
+    {
+        fprintf(stderr, "Failed to initialize hash table\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("%d threads, %llu keys (%s), read %.2f (quick %.2f), "
+           "update %.2f insert %.2f delete %.2f, %zuB values\n",
+           g_num_threads, (unsigned long long)g_keys,
+           g_theta > 0.0 ? "zipfian" : "uniform", g_read, g_quick,
+           (1.0 - g_read) * g_update, (1.0 - g_read) * (1.0 - g_update) / 2,
+           (1.0 - g_read) * (1.0 - g_update) / 2, g_value_size);
+    printf("table of %zu buckets, %zu locks%s%s%s, %s, rwlock delay %d\n",
+           hash_size,
+           lock_bits && (1UL << lock_bits) < hash_size ? 1UL << lock_bits
+                                                       : hash_size,
+           hash_flags & HASH_LOCKFREE_READ ? ", lock-free reads" : "",
+           hash_flags & HASH_SEQLOCK_READ ? ", optimistic reads" : "",
+           hash_flags & HASH_RESIZE ? ", resizable" : "",
+           hash_fn_name(hash_fn), delay);
+    if (hb_fill() < 0)
+        exit(EXIT_FAILURE);
+
+    threads = calloc(g_num_threads, sizeof(struct hb_thread));
+    if (threads == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_init(&g_barrier, NULL, g_num_threads + 1);
+    for (t = 0; t < g_num_threads; t++)
+    {
+        threads[t].rng = keydist_scramble(stats_now() + t) | 1;
+        if (pthread_create(&threads[t].tid, NULL, hb_thread_main,
+                           &threads[t]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // 모든 thread가 준비된 뒤 같은 시각에 출발시킨다
+    g_end_ns = stats_now() + (uint64_t)g_seconds * 1000000000ULL;
+    start = stats_now();
+    pthread_barrier_wait(&g_barrier);
+    for (t = 0; t < g_num_threads; t++)
+        pthread_join(threads[t].tid, NULL);
+
+    hb_report(threads, (stats_now() - start) / 1e9);
+
+    pthread_barrier_destroy(&g_barrier);
+    free(threads);
+    hash_destroy(g_table);
+    free(g_value);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
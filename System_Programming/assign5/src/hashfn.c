@@ -0,0 +1,210 @@
+/*--------------------------------------------------------------------*/
+/* hashfn.c                                                           */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/random.h>
+#include "hashfn.h"
+/*--------------------------------------------------------------------*/
+static const char *g_hash_fn_names[HASH_FN_COUNT] = {
+    [HASH_FN_FAST] = "fast",
+    [HASH_FN_SIPHASH] = "siphash",
+    [HASH_FN_LEGACY] = "legacy"};
+static const hash_fn_t g_hash_fns[HASH_FN_COUNT] = {
+    [HASH_FN_FAST] = hash_fast,
+    [HASH_FN_SIPHASH] = hash_siphash,
+    [HASH_FN_LEGACY] = hash_legacy};
+static uint32_t g_crc_table[256];
+static pthread_once_t g_crc_once = PTHREAD_ONCE_INIT;
+/*--------------------------------------------------------------------*/
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+/*--------------------------------------------------------------------*/
+/* loads up to 8 bytes as a little-endian word, unaligned */
+static inline uint64_t load_le(const unsigned char *p, size_t n)
+{
+    uint64_t w = 0;
+    size_t i;
+
+    if (n == 8)
+    {
+        memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        return w;
+    }
+    for (i = 0; i < n; i++)
+    {
+        w |= (uint64_t)p[i] << (8 * i);
+    }
+    return w;
+}
+/*--------------------------------------------------------------------*/
+/* 64x64->128 multiply folded to 64 bits */
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+/*--------------------------------------------------------------------*/
+uint64_t hash_fast(const void *key, size_t len, const uint64_t seed[2])
+{
+    const unsigned char *p = key;
+    uint64_t h = seed[0] ^ (len * 0x9e3779b97f4a7c15ULL);
+
+    // 키는 최대 MAX_KEY_LEN(32)바이트라 8바이트 단위로 4번 이내
+    while (len >= 8)
+    {
+        h = mix(h ^ load_le(p, 8), 0xbf58476d1ce4e5b9ULL);
+        p += 8;
+        len -= 8;
+    }
+    h = mix(h ^ load_le(p, len) ^ seed[1], 0x94d049bb133111ebULL);
+
+    return h ^ (h >> 31);
+}
+/*--------------------------------------------------------------------*/
+#define SIPROUND                       \
+    do                                 \
+    {                                  \
+        v0 += v1;                      \
+        v1 = ROTL64(v1, 13);           \
+        v1 ^= v0;                      \
+        v0 = ROTL64(v0, 32);           \
+        v2 += v3;                      \
+        v3 = ROTL64(v3, 16);           \
+        v3 ^= v2;                      \
+        v0 += v3;                      \
+        v3 = ROTL64(v3, 21);           \
+        v3 ^= v0;                      \
+        v2 += v1;                      \
+        v1 = ROTL64(v1, 17);           \
+        v1 ^= v2;                      \
+        v2 = ROTL64(v2, 32);           \
+    } while (0)
+/*--------------------------------------------------------------------*/
+uint64_t hash_siphash(const void *key, size_t len, const uint64_t seed[2])
+{
+    const unsigned char *p = key;
+    const unsigned char *end = p + (len & ~(size_t)7);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ seed[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ seed[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ seed[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ seed[1];
+    uint64_t m;
+
+    /* SipHash-2-4: two compression rounds per word */
+    for (; p != end; p += 8)
+    {
+        m = load_le(p, 8);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    m = load_le(p, len & 7) | ((uint64_t)len << 56);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+
+    /* four finalization rounds */
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+/*--------------------------------------------------------------------*/
+uint64_t hash_legacy(const void *key, size_t len, const uint64_t seed[2])
+{
+    const char *p = key;
+    unsigned int hash = 0;
+
+    (void)seed;
+    while (len--)
+    {
+        hash = (hash << 5) + *p++;
+    }
+
+    return hash;
+}
+/*--------------------------------------------------------------------*/
+hash_fn_t hash_fn_get(enum HASH_FN fn)
+{
+    return fn < HASH_FN_COUNT ? g_hash_fns[fn] : NULL;
+}
+/*--------------------------------------------------------------------*/
+const char *hash_fn_name(enum HASH_FN fn)
+{
+    return fn < HASH_FN_COUNT ? g_hash_fn_names[fn] : NULL;
+}
+/*--------------------------------------------------------------------*/
+int hash_fn_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < HASH_FN_COUNT; i++)
+    {
+        if (strcasecmp(name, g_hash_fn_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+/*--------------------------------------------------------------------*/
+int hash_fn_seed(uint64_t seed[2])
+{
+    TRACE_PRINT();
+    ssize_t n;
+
+    do
+    {
+        n = getrandom(seed, 2 * sizeof(uint64_t), 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != 2 * sizeof(uint64_t))
+    {
+        DEBUG_PRINT("Failed to get random hash seed");
+        return -1;
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+static void crc32_init(void)
+{
+    uint32_t c;
+    int i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (j = 0; j < 8; j++)
+        {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[i] = c;
+    }
+}
+/*--------------------------------------------------------------------*/
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    pthread_once(&g_crc_once, crc32_init);
+    crc = ~crc;
+    while (len--)
+    {
+        crc = g_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+/*--------------------------------------------------------------------*/
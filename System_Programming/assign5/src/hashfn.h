@@ -0,0 +1,61 @@
+/*--------------------------------------------------------------------*/
+/* hashfn.h                                                           */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _HASHFN_H
+#define _HASHFN_H
+/*--------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/* hash function family */
+enum HASH_FN
+{
+    HASH_FN_FAST,    // word-at-a-time multiply-mix, the default
+    HASH_FN_SIPHASH, // keyed SipHash-2-4, resists crafted keys
+    HASH_FN_LEGACY,  // original shift-and-add
+    HASH_FN_COUNT
+};
+/*--------------------------------------------------------------------*/
+/**
+ * Every function hashes len bytes of key with a 128-bit seed.
+ * HASH_FN_LEGACY ignores the seed.
+ */
+typedef uint64_t (*hash_fn_t)(const void *key, size_t len,
+                              const uint64_t seed[2]);
+/*--------------------------------------------------------------------*/
+uint64_t hash_fast(const void *key, size_t len, const uint64_t seed[2]);
+uint64_t hash_siphash(const void *key, size_t len, const uint64_t seed[2]);
+uint64_t hash_legacy(const void *key, size_t len, const uint64_t seed[2]);
+/*--------------------------------------------------------------------*/
+/**
+ * Returns the function of the given family.
+ */
+hash_fn_t hash_fn_get(enum HASH_FN fn);
+/*--------------------------------------------------------------------*/
+/**
+ * Returns the name of the given family ("fast", "siphash", "legacy").
+ */
+const char *hash_fn_name(enum HASH_FN fn);
+/*--------------------------------------------------------------------*/
+/**
+ * Finds a family by its name.
+ * Returns -1 when there is no such family.
+ */
+int hash_fn_lookup(const char *name);
+/*--------------------------------------------------------------------*/
+/**
+ * Fills seed with random bytes from the kernel.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int hash_fn_seed(uint64_t seed[2]);
+/*--------------------------------------------------------------------*/
+/**
+ * Extends the CRC-32 (IEEE) crc, 0 to start, over len bytes of data.
+ * Used to checksum the files the table is persisted to.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+/*--------------------------------------------------------------------*/
+#endif // _HASHFN_H
@@ -3,298 +3,2931 @@
 /* Author: Junghan Yoon, KyoungSoo Park                               */
 /* Modified by: Jaeun Park                                            */
 /*--------------------------------------------------------------------*/
+#include <stdint.h>
 #include "hashtable.h"
+#include "mmtable.h"
+/*--------------------------------------------------------------------*/
+/* bucket migration states */
+enum BUCKET_STATE
+{
+    BUCKET_NORMAL,    // entries live in this generation
+    BUCKET_MIGRATING, // entries are being moved to the next generation
+    BUCKET_MIGRATED   // entries live in the next generation
+};
+/*--------------------------------------------------------------------*/
+_Static_assert(sizeof(hblock_t) == HASH_CACHE_LINE,
+               "a bucket block must fill exactly one cache line");
+/*--------------------------------------------------------------------*/
+/* lock of bucket idx of ht, shared with its stripe */
+static inline rwlock_t *bucket_lock(htab_t *ht, size_t idx)
+{
+    return &ht->locks[idx & ht->lock_mask];
+}
 /*--------------------------------------------------------------------*/
 int hash(const char *key, size_t hash_size)
 {
-    TRACE_PRINT();
-    unsigned int hash = 0;
-    while (*key)
+    TRACE_PRINT();
+    return hash_legacy(key, strlen(key), NULL) % hash_size;
+}
+/*--------------------------------------------------------------------*/
+static inline uint64_t hash_key(hashtable_t *table, const char *key,
+                                size_t key_size)
+{
+    return table->hash_fn(key, key_size, table->seed);
+}
+/*--------------------------------------------------------------------*/
+/* low bits pick the bucket, so the slot tag takes high ones */
+static inline uint8_t hash_tag(uint64_t h)
+{
+    return (uint8_t)((h >> 24) ^ (h >> 56));
+}
+/*--------------------------------------------------------------------*/
+value_t *hash_value_alloc(size_t value_len)
+{
+    value_t *v = slab_alloc(sizeof(value_t) + value_len + 1);
+
+    if (v == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for value");
+        return NULL;
+    }
+    v->size = value_len;
+    v->refs = 1; // table의 참조
+    v->data[value_len] = '\0';
+    return v;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * copies value_len bytes of value into a new immutable value_t,
+ * null-terminated so text protocol values can be used as strings
+ */
+static value_t *value_alloc(const char *value, size_t value_len)
+{
+    value_t *v = hash_value_alloc(value_len);
+
+    if (v)
+    {
+        memcpy(v->data, value, value_len);
+    }
+    return v;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * drops a reference to a value outside a node, freeing it with the
+ * last one; the table's is dropped when the value is replaced
+ */
+static void value_free(void *ptr)
+{
+    value_t *v = (value_t *)ptr;
+
+    if (__atomic_sub_fetch(&v->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        slab_free(v, sizeof(value_t) + v->size + 1);
+    }
+}
+/*--------------------------------------------------------------------*/
+static inline value_t *node_inline(node_t *node)
+{
+    return (value_t *)node->inline_value;
+}
+/*--------------------------------------------------------------------*/
+static inline void value_set(value_t *v, const char *value, size_t value_len)
+{
+    v->size = value_len;
+    memcpy(v->data, value, value_len);
+    v->data[value_len] = '\0';
+}
+/*--------------------------------------------------------------------*/
+static inline size_t node_bytes(size_t inline_cap)
+{
+    return sizeof(node_t) +
+           (inline_cap ? sizeof(value_t) + inline_cap + 1 : 0);
+}
+/*--------------------------------------------------------------------*/
+/* allocates a node holding the key and room for cap bytes of value */
+static node_t *node_new(const char *key, size_t key_size, uint64_t h,
+                        size_t cap, uint64_t expire)
+{
+    node_t *node = slab_alloc(node_bytes(cap));
+
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    node->hash = h;
+    node->value = NULL;
+    node->expire = expire;
+    node->key_size = key_size;
+    node->inline_cap = cap;
+    node->ref = 0; // 읽힌 적 없는 key가 먼저 내보내진다
+    memcpy(node->key, key, key_size);
+    node->key[key_size] = '\0';
+
+    return node;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * allocates a node holding the key and, when it is small enough,
+ * the value in a single allocation
+ */
+static node_t *node_alloc(const char *key, size_t key_size, uint64_t h,
+                          const char *value, size_t value_len,
+                          uint64_t expire)
+{
+    size_t cap = 0;
+    node_t *node;
+
+    // 작은 값은 node 뒤에 붙여 할당 한 번으로 끝낸다
+    if (value_len <= HASH_INLINE_VALUE)
+    {
+        cap = ((value_len + 1 + 7) & ~(size_t)7) - 1;
+    }
+    node = node_new(key, key_size, h, cap, expire);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    if (cap)
+    {
+        node->value = node_inline(node);
+        node->value->refs = 0; // node와 함께 해제되므로 세지 않는다
+        value_set(node->value, value, value_len);
+    }
+    else
+    {
+        node->value = value_alloc(value, value_len);
+        if (node->value == NULL)
+        {
+            slab_free(node, node_bytes(cap));
+            return NULL;
+        }
+    }
+
+    return node;
+}
+/*--------------------------------------------------------------------*/
+static void node_free(void *ptr)
+{
+    node_t *node = (node_t *)ptr;
+
+    if (node->value != node_inline(node))
+    {
+        value_free(node->value);
+    }
+    slab_free(node, node_bytes(node->inline_cap));
+}
+/*--------------------------------------------------------------------*/
+static inline size_t value_mem(const value_t *v)
+{
+    return slab_size(sizeof(value_t) + v->size + 1);
+}
+/*--------------------------------------------------------------------*/
+/* bytes node takes with its key and value, as hash_set_limit() counts */
+static size_t node_mem(node_t *node)
+{
+    size_t bytes = slab_size(node_bytes(node->inline_cap));
+
+    if (node->value != node_inline(node))
+    {
+        bytes += value_mem(node->value);
+    }
+    return bytes;
+}
+/*--------------------------------------------------------------------*/
+/* charges add bytes and refunds sub bytes to the table's memory use */
+static inline void mem_account(hashtable_t *table, size_t add, size_t sub)
+{
+    // unsigned 덧셈이므로 줄어드는 경우도 그대로 더하면 된다
+    if (add != sub)
+    {
+        __atomic_add_fetch(&table->mem_used, add - sub, __ATOMIC_RELAXED);
+    }
+}
+/*--------------------------------------------------------------------*/
+/* sets the access bit of node, writing only when it is clear */
+static inline void node_touch(node_t *node)
+{
+    // 이미 켜져 있으면 cache line을 더럽히지 않는다
+    if (!__atomic_load_n(&node->ref, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&node->ref, 1, __ATOMIC_RELAXED);
+    }
+}
+/*--------------------------------------------------------------------*/
+static inline int node_match(node_t *node, uint64_t h,
+                             const char *key, size_t key_size)
+{
+    // 캐시된 hash가 다르면 key를 비교하지 않는다
+    return node->hash == h && node->key_size == key_size &&
+           memcmp(node->key, key, key_size) == 0;
+}
+/*--------------------------------------------------------------------*/
+uint64_t hash_clock(void)
+{
+    return wheel_now();
+}
+/*--------------------------------------------------------------------*/
+/* tells whether the deadline of node has passed */
+static inline int node_expired(hashtable_t *table, node_t *node)
+{
+    uint64_t expire = __atomic_load_n(&node->expire, __ATOMIC_RELAXED);
+
+    // TTL이 없는 key는 시계를 읽지 않는다
+    return expire && expire <= hash_clock() &&
+           !__atomic_load_n(&table->ttl_hold, __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+static hblock_t *block_alloc(void)
+{
+    hblock_t *blk = slab_alloc(sizeof(hblock_t));
+
+    if (blk == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for bucket block");
+        return NULL;
+    }
+    memset(blk, 0, sizeof(hblock_t));
+    return blk;
+}
+/*--------------------------------------------------------------------*/
+static void block_free(void *ptr)
+{
+    slab_free(ptr, sizeof(hblock_t));
+}
+/*--------------------------------------------------------------------*/
+/**
+ * frees an unlinked node, value or block, or defers it while
+ * lock-free or optimistic readers may still be looking at it
+ */
+static void retire(hashtable_t *table, void *ptr, void (*free_fn)(void *))
+{
+    if (!(table->flags & (HASH_LOCKFREE_READ | HASH_SEQLOCK_READ)))
+    {
+        free_fn(ptr);
+        return;
+    }
+    if (ebr_retire(ptr, free_fn) != 0)
+    {
+        // 안전하게 해제할 수 없으면 누수시킨다
+        DEBUG_PRINT("Failed to retire %p", ptr);
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * hands bucket idx of ht to the running hash_snapshot(), unless it has
+ * seen it already; called with the bucket locked, before changing it
+ */
+static void snap_visit(hashtable_t *table, htab_t *ht, size_t idx)
+{
+    hblock_t *blk;
+    node_t *node;
+    hash_scan_fn fn;
+    void *arg;
+    uint32_t id;
+    int i;
+
+    if (!__atomic_load_n(&table->snap_active, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    // id를 보면 같은 snapshot의 fn, arg도 보인다
+    id = __atomic_load_n(&table->snap_id, __ATOMIC_ACQUIRE);
+    if (ht->buckets[idx].snap_id == id)
+    {
+        return;
+    }
+    ht->buckets[idx].snap_id = id;
+    fn = __atomic_load_n(&table->snap_fn, __ATOMIC_RELAXED);
+    arg = __atomic_load_n(&table->snap_arg, __ATOMIC_RELAXED);
+
+    for (blk = &ht->buckets[idx]; blk; blk = blk->next)
+    {
+        for (i = 0; i < HASH_BLOCK_SLOTS; i++)
+        {
+            node = blk->nodes[i];
+            if (node && !node_expired(table, node) &&
+                fn(arg, node->key, node->key_size, node->value->data,
+                   node->value->size, node->expire) < 0)
+            {
+                __atomic_store_n(&table->snap_error, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * looks up key in a bucket under its lock.
+ * Returns 1 and sets blk and slot to the entry when found.
+ * Returns 0 when not found; blk and slot are then the first free slot,
+ * or the last block of the chain and -1 when every slot is taken.
+ */
+static int bucket_find(hblock_t *head, uint64_t h, const char *key,
+                       size_t key_size, hblock_t **blk, int *slot)
+{
+    hblock_t *b;
+    uint8_t tag = hash_tag(h);
+    int i;
+
+    *blk = NULL;
+    *slot = -1;
+    for (b = head; b; b = b->next)
+    {
+        for (i = 0; i < HASH_BLOCK_SLOTS; i++)
+        {
+            if (b->nodes[i] == NULL)
+            {
+                if (*slot < 0)
+                {
+                    *blk = b;
+                    *slot = i;
+                }
+                continue;
+            }
+            if (b->tags[i] == tag && node_match(b->nodes[i], h, key, key_size))
+            {
+                *blk = b;
+                *slot = i;
+                return 1;
+            }
+        }
+        if (b->next == NULL && *slot < 0)
+        {
+            *blk = b;
+        }
+    }
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * publishes node in a free slot found by bucket_find(),
+ * appending spare (or a new block) when there is none.
+ * Returns -1 when any internal errors occur.
+ */
+static int bucket_put(hblock_t *blk, int slot, node_t *node,
+                      hblock_t **spare)
+{
+    hblock_t *nb;
+
+    if (slot < 0)
+    {
+        if (spare && *spare)
+        {
+            nb = *spare;
+            *spare = nb->next;
+            memset(nb, 0, sizeof(hblock_t));
+        }
+        else if ((nb = block_alloc()) == NULL)
+        {
+            return -1;
+        }
+        nb->tags[0] = hash_tag(node->hash);
+        nb->nodes[0] = node;
+        // 완성된 block을 lock-free reader에게 공개
+        __atomic_store_n(&blk->next, nb, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // tag를 먼저 쓰고 node를 release로 공개
+    __atomic_store_n(&blk->tags[slot], hash_tag(node->hash),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&blk->nodes[slot], node, __ATOMIC_RELEASE);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+static int block_empty(hblock_t *blk)
+{
+    int i;
+
+    for (i = 0; i < HASH_BLOCK_SLOTS; i++)
+    {
+        if (blk->nodes[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * unlinks the overflow block blk from the chain of head
+ * once its last entry is gone
+ */
+static void bucket_shrink(hashtable_t *table, hblock_t *head, hblock_t *blk)
+{
+    hblock_t *prev;
+
+    if (blk == head || !block_empty(blk))
+    {
+        return;
+    }
+    for (prev = head; prev->next != blk; prev = prev->next)
+        ;
+    // blk->next는 그대로 두어 이 block을 읽는 reader가 계속 순회하게 한다
+    __atomic_store_n(&prev->next, blk->next, __ATOMIC_RELEASE);
+    retire(table, blk, block_free);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * frees a bucket array generation, but not the nodes in it
+ */
+static void htab_free(void *ptr)
+{
+    htab_t *ht = (htab_t *)ptr;
+    size_t i;
+
+    for (i = 0; i < ht->num_locks; i++)
+    {
+        rwlock_destroy(&ht->locks[i]);
+    }
+    free(ht->buckets);
+    free(ht->locks);
+    free(ht);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * allocates a generation of hash_size buckets, with 2^lock_bits locks
+ * shared by them, or one lock per bucket when lock_bits is 0 or gives
+ * as many locks as buckets
+ */
+static htab_t *htab_alloc(size_t hash_size, int lock_bits, int delay)
+{
+    size_t i, j;
+    void *buckets = NULL;
+    htab_t *ht = calloc(1, sizeof(htab_t));
+
+    if (ht == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table");
+        return NULL;
+    }
+
+    // bucket마다 크기, 상태가 담긴 첫 block이 cache line 단위로 놓인다
+    if (posix_memalign(&buckets, HASH_CACHE_LINE,
+                       hash_size * sizeof(hblock_t)) == 0)
+    {
+        memset(buckets, 0, hash_size * sizeof(hblock_t));
+    }
+    ht->hash_size = hash_size;
+    ht->buckets = buckets;
+    if (lock_bits > 0 && ((size_t)1 << lock_bits) < hash_size)
+    {
+        ht->num_locks = (size_t)1 << lock_bits;
+        ht->lock_mask = ht->num_locks - 1;
+    }
+    else
+    {
+        ht->num_locks = hash_size;
+        ht->lock_mask = SIZE_MAX;
+    }
+    ht->locks = calloc(ht->num_locks, sizeof(rwlock_t));
+    if (!ht->buckets || !ht->locks)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table buckets");
+        free(ht->buckets);
+        free(ht->locks);
+        free(ht);
+        return NULL;
+    }
+
+    for (i = 0; i < ht->num_locks; i++)
+    {
+        if (rwlock_init(&ht->locks[i], delay) != 0)
+        {
+            DEBUG_PRINT("Failed to initialize read-write lock");
+            for (j = 0; j < i; j++)
+            {
+                rwlock_destroy(&ht->locks[j]);
+            }
+            ht->num_locks = 0;
+            htab_free(ht);
+            return NULL;
+        }
+    }
+
+    return ht;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * pins the bucket array generations while the table can be resized,
+ * so an old generation is not freed under a thread still using it
+ */
+static inline int gen_enter(hashtable_t *table)
+{
+    return (table->flags & HASH_RESIZE) ? ebr_enter() : 0;
+}
+/*--------------------------------------------------------------------*/
+static inline void gen_exit(hashtable_t *table)
+{
+    if (table->flags & HASH_RESIZE)
+        ebr_exit();
+}
+/*--------------------------------------------------------------------*/
+/**
+ * write-locks the bucket of h in the generation where its entries live.
+ * Returns the generation, and NULL when any internal errors occur.
+ */
+static htab_t *bucket_write_lock(hashtable_t *table, uint64_t h,
+                                 size_t *idx)
+{
+    htab_t *ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE);
+
+    while (1)
+    {
+        *idx = h % ht->hash_size;
+        if (rwlock_write_lock(bucket_lock(ht, *idx)) != 0)
+        {
+            return NULL;
+        }
+        if (ht->buckets[*idx].state != BUCKET_MIGRATED)
+        {
+            return ht;
+        }
+        // 이미 다음 세대로 옮겨진 bucket
+        rwlock_write_unlock(bucket_lock(ht, *idx));
+        ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE);
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * read-locks the bucket of h in the generation where its entries live.
+ * Returns the generation, and NULL when any internal errors occur.
+ */
+static htab_t *bucket_read_lock(hashtable_t *table, uint64_t h,
+                                size_t *idx, int quick)
+{
+    htab_t *ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE);
+
+    while (1)
+    {
+        *idx = h % ht->hash_size;
+        if (rwlock_read_lock(bucket_lock(ht, *idx), quick) != 0)
+        {
+            return NULL;
+        }
+        if (ht->buckets[*idx].state != BUCKET_MIGRATED)
+        {
+            return ht;
+        }
+        rwlock_read_unlock(bucket_lock(ht, *idx));
+        ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE);
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * tops the spare block list up to n blocks.
+ * Returns -1 when any internal errors occur.
+ */
+static int spare_reserve(hblock_t **spare, size_t n)
+{
+    hblock_t *blk;
+    size_t have = 0;
+
+    for (blk = *spare; blk; blk = blk->next)
+    {
+        have++;
+    }
+    for (; have < n; have++)
+    {
+        blk = block_alloc();
+        if (blk == NULL)
+        {
+            return -1;
+        }
+        blk->next = *spare;
+        *spare = blk;
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * moves every entry of bucket b of ht to the next generation.
+ * Lock order is always an old bucket before a new one.
+ * Returns the number of entries moved, or -1 when the overflow blocks
+ * cannot be reserved; the bucket then stays in ht, and the resize
+ * never completes while both generations keep serving.
+ */
+static ssize_t bucket_migrate(hashtable_t *table, htab_t *ht, size_t b,
+                              hblock_t **spare)
+{
+    htab_t *nt = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE);
+    hblock_t *blk, *head = &ht->buckets[b], *next, *dst;
+    node_t *node;
+    size_t j;
+    ssize_t moved = 0;
+    int i, slot;
+
+    rwlock_write_lock(bucket_lock(ht, b));
+    if (ht->buckets[b].state != BUCKET_NORMAL)
+    {
+        rwlock_write_unlock(bucket_lock(ht, b));
+        return 0;
+    }
+
+    // 옮기는 도중에는 block을 할당하다 실패할 수 없도록 미리 확보
+    if (spare_reserve(spare, ht->buckets[b].size / HASH_BLOCK_SLOTS + 2) != 0)
+    {
+        rwlock_write_unlock(bucket_lock(ht, b));
+        return -1;
+    }
+
+    // lock-free reader가 옮겨지는 중인 bucket에서 놓친 key를
+    // 다시 찾을 수 있도록 먼저 표시한다
+    __atomic_store_n(&ht->buckets[b].state, BUCKET_MIGRATING, __ATOMIC_RELEASE);
+
+    for (blk = head; blk; blk = blk->next)
+    {
+        for (i = 0; i < HASH_BLOCK_SLOTS; i++)
+        {
+            node = blk->nodes[i];
+            if (node == NULL)
+            {
+                continue;
+            }
+            // 옮기는 도중 snapshot이 시작되면 남은 entry를 먼저 넘긴다
+            snap_visit(table, ht, b);
+            j = node->hash % nt->hash_size;
+            rwlock_write_lock(bucket_lock(nt, j));
+            snap_visit(table, nt, j);
+            bucket_find(&nt->buckets[j], node->hash, node->key,
+                        node->key_size, &dst, &slot);
+            bucket_put(dst, slot, node, spare);
+            nt->buckets[j].size++;
+            __atomic_store_n(&blk->nodes[i], NULL, __ATOMIC_RELEASE);
+            rwlock_write_unlock(bucket_lock(nt, j));
+            moved++;
+        }
+    }
+
+    // 비워진 overflow block은 reader가 떠난 뒤 해제
+    blk = head->next;
+    __atomic_store_n(&head->next, NULL, __ATOMIC_RELEASE);
+    for (; blk; blk = next)
+    {
+        next = blk->next;
+        retire(table, blk, block_free);
+    }
+    ht->buckets[b].size = 0;
+    __atomic_store_n(&ht->buckets[b].state, BUCKET_MIGRATED, __ATOMIC_RELEASE);
+    rwlock_write_unlock(bucket_lock(ht, b));
+
+    return moved;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * starts a resize when the load factor crosses a threshold and
+ * migrates a few buckets of an ongoing one.
+ * Must be called without holding any bucket lock.
+ */
+static void hash_resize_step(hashtable_t *table)
+{
+    htab_t *ht, *nt, *expected = NULL;
+    hblock_t *spare = NULL, *blk;
+    size_t entries, size, b;
+    ssize_t moved;
+    int i, busy = 0;
+
+    if (!(table->flags & HASH_RESIZE) || ebr_enter() != 0)
+    {
+        return;
+    }
+
+    ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE);
+    nt = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE);
+    if (nt == NULL)
+    {
+        entries = __atomic_load_n(&table->num_entries, __ATOMIC_RELAXED);
+        if (entries > ht->hash_size * HASH_MAX_LOAD)
+        {
+            size = ht->hash_size * 2;
+        }
+        else if (ht->hash_size > table->min_size &&
+                 entries < ht->hash_size / HASH_MIN_LOAD_DIV)
+        {
+            size = ht->hash_size / 2;
+        }
+        else
+        {
+            ebr_exit();
+            return;
+        }
+
+        nt = htab_alloc(size, HASH_LOCKS_OF(table->flags), table->delay);
+        if (nt == NULL)
+        {
+            ebr_exit();
+            return;
+        }
+        // snapshot 도중 생긴 세대의 entry는 모두 이미 본 것이거나
+        // snapshot 이후에 쓰인 것이므로 본 것으로 표시하고 연결
+        pthread_mutex_lock(&table->snap_lock);
+        if (table->snap_active)
+        {
+            for (b = 0; b < size; b++)
+            {
+                nt->buckets[b].snap_id = table->snap_id;
+            }
+        }
+        if (!__atomic_compare_exchange_n(&ht->next, &expected, nt, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            // 다른 스레드가 먼저 시작함
+            htab_free(nt);
+            nt = expected;
+        }
+        pthread_mutex_unlock(&table->snap_lock);
+    }
+
+    // 빈 bucket은 싸므로 STEP개의 비어있지 않은 bucket 또는
+    // 그 10배의 bucket을 볼 때까지 옮긴다
+    for (i = 0; i < HASH_REHASH_STEP * 10 && busy < HASH_REHASH_STEP; i++)
+    {
+        b = __atomic_fetch_add(&ht->rehash_idx, 1, __ATOMIC_RELAXED);
+        if (b >= ht->hash_size)
+        {
+            break;
+        }
+        moved = bucket_migrate(table, ht, b, &spare);
+        if (moved < 0)
+        {
+            DEBUG_PRINT("Failed to migrate bucket %zu", b);
+            break;
+        }
+        if (moved > 0)
+        {
+            busy++;
+        }
+
+        if (__atomic_add_fetch(&ht->rehash_done, 1, __ATOMIC_ACQ_REL) ==
+            ht->hash_size)
+        {
+            // 마지막 bucket: 새 세대로 교체하고 이전 세대는 EBR로 해제
+            __atomic_store_n(&table->ht, nt, __ATOMIC_RELEASE);
+            if (ebr_retire(ht, htab_free) != 0)
+            {
+                DEBUG_PRINT("Failed to retire old bucket array");
+            }
+            break;
+        }
+    }
+
+    ebr_exit();
+
+    // 쓰이지 않은 예비 block 반환
+    while (spare)
+    {
+        blk = spare;
+        spare = spare->next;
+        block_free(blk);
+    }
+}
+/*--------------------------------------------------------------------*/
+/* heap tables alive; the slab allocator and EBR are per process,
+   so only the last one to be destroyed tears them down */
+static int g_num_tables = 0;
+/*--------------------------------------------------------------------*/
+/* a table without storage, shared by hash_init() and hash_open() */
+static hashtable_t *table_alloc(size_t hash_size, int delay, int flags)
+{
+    hashtable_t *table;
+    int fn = HASH_FN_OF(flags);
+
+    // 두 읽기 방식은 in-place 갱신 여부가 달라 함께 쓸 수 없다
+    if (hash_fn_get(fn) == NULL ||
+        (flags & HASH_LOCKFREE_READ && flags & HASH_SEQLOCK_READ))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    table = calloc(1, sizeof(hashtable_t));
+    if (table == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for hash table");
+        return NULL;
+    }
+
+    // 매 실행마다 다른 seed로 미리 계산된 충돌 key를 막는다
+    table->hash_fn = hash_fn_get(fn);
+    if (fn != HASH_FN_LEGACY && hash_fn_seed(table->seed) != 0)
+    {
+        free(table);
+        return NULL;
+    }
+
+    table->num_entries = 0;
+    table->min_size = hash_size;
+    table->delay = delay;
+    table->flags = flags;
+
+    return table;
+}
+/*--------------------------------------------------------------------*/
+hashtable_t *hash_init(size_t hash_size, int delay, int flags)
+{
+    TRACE_PRINT();
+    hashtable_t *table = table_alloc(hash_size, delay, flags);
+
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    table->ht = htab_alloc(hash_size, HASH_LOCKS_OF(flags), delay);
+    if (table->ht == NULL)
+    {
+        free(table);
+        return NULL;
+    }
+    pthread_mutex_init(&table->snap_lock, NULL);
+    __atomic_add_fetch(&g_num_tables, 1, __ATOMIC_RELAXED);
+
+    return table;
+}
+/*--------------------------------------------------------------------*/
+hashtable_t *hash_open(const char *path, size_t hash_size, int delay,
+                       int flags)
+{
+    TRACE_PRINT();
+    hashtable_t *table;
+
+    // 파일 안의 chain은 한 세대뿐이고 lock 없이 따라가지 않는다
+    if (!path || HASH_LOCKS_OF(flags) ||
+        (flags & (HASH_LOCKFREE_READ | HASH_SEQLOCK_READ | HASH_RESIZE)))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    table = table_alloc(hash_size, delay, flags);
+    if (table == NULL)
+    {
+        return NULL;
+    }
+    if (mmtable_open(table, path, hash_size) != 0)
+    {
+        free(table);
+        return NULL;
+    }
+    pthread_mutex_init(&table->snap_lock, NULL);
+
+    return table;
+}
+/*--------------------------------------------------------------------*/
+void hash_set_log(hashtable_t *table, hash_log_fn fn, void *arg)
+{
+    TRACE_PRINT();
+    table->log_fn = fn;
+    table->log_arg = arg;
+}
+/*--------------------------------------------------------------------*/
+int hash_set_limit(hashtable_t *table, size_t bytes)
+{
+    TRACE_PRINT();
+    if (table->mm)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    table->mem_limit = bytes;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* reports a write to the log hook, if any */
+static inline int hash_log(hashtable_t *table, int op, const char *key,
+                           size_t key_size, const char *value,
+                           size_t value_len)
+{
+    if (table->log_fn == NULL)
+    {
+        return 0;
+    }
+    return table->log_fn(table->log_arg, op, key, key_size, value,
+                         value_len);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * reports a write and, when it was given a TTL, its deadline.
+ * Returns -1 when any internal errors occur.
+ */
+static int hash_log_ex(hashtable_t *table, int op, const char *key,
+                       size_t key_size, const char *value, size_t value_len,
+                       uint64_t expire)
+{
+    if (hash_log(table, op, key, key_size, value, value_len) != 0)
+    {
+        return -1;
+    }
+    if (expire == 0)
+    {
+        return 0;
+    }
+    return hash_log(table, HASH_OP_EXPIRE, key, key_size,
+                    (const char *)&expire, sizeof(expire));
+}
+/*--------------------------------------------------------------------*/
+/**
+ * logs and removes the node in slot of blk, under the bucket lock;
+ * blk may be freed. The caller updates num_entries.
+ * Returns -1 when the log hook failed, and the node stays.
+ */
+static int bucket_remove(hashtable_t *table, htab_t *ht, size_t idx,
+                         hblock_t *blk, int slot)
+{
+    node_t *node = blk->nodes[slot];
+
+    if (hash_log(table, HASH_OP_DELETE, node->key, node->key_size,
+                 NULL, 0) != 0)
+    {
+        return -1;
+    }
+    snap_visit(table, ht, idx);
+    // slot만 비우고, 비게 된 overflow block은 chain에서 뗀다
+    __atomic_store_n(&blk->nodes[slot], NULL, __ATOMIC_RELEASE);
+    mem_account(table, 0, node_mem(node));
+    retire(table, node, node_free);
+    bucket_shrink(table, &ht->buckets[idx], blk);
+    ht->buckets[idx].size--;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * expiry timer of a key given a TTL. Timers are never cancelled:
+ * one whose key has been deleted or given another deadline meanwhile
+ * is simply dropped when it fires.
+ */
+typedef struct ttl_timer_t
+{
+    struct wheel_timer timer; // first, so the wheel hands it back as is
+    uint64_t hash;
+    uint8_t key_size;
+    char key[MAX_KEY_LEN + 1];
+} ttl_timer_t;
+/*--------------------------------------------------------------------*/
+static void ttl_free(struct wheel_timer *t)
+{
+    slab_free(t, sizeof(ttl_timer_t));
+}
+/*--------------------------------------------------------------------*/
+/**
+ * wheel callback: reclaims the key of t if its deadline is still the
+ * one t was armed with and has passed
+ */
+static void ttl_fire(void *arg, struct wheel_timer *wt)
+{
+    hashtable_t *table = (hashtable_t *)arg;
+    ttl_timer_t *t = (ttl_timer_t *)wt;
+    size_t idx;
+    htab_t *ht;
+    hblock_t *blk;
+    node_t *node;
+    int slot, rearm = 0, removed = 0;
+
+    if (gen_enter(table) != 0)
+    {
+        ttl_free(wt);
+        return;
+    }
+    ht = bucket_write_lock(table, t->hash, &idx);
+    if (ht == NULL)
+    {
+        gen_exit(table);
+        ttl_free(wt);
+        return;
+    }
+
+    if (bucket_find(&ht->buckets[idx], t->hash, t->key, t->key_size,
+                    &blk, &slot) &&
+        (node = blk->nodes[slot])->expire == wt->expire)
+    {
+        // hold 중이거나 시계가 되돌아갔으면 다시 기다린다
+        if (!node_expired(table, node))
+            rearm = 1;
+        else
+            removed = bucket_remove(table, ht, idx, blk, slot) == 0;
+    }
+
+    rwlock_write_unlock(bucket_lock(ht, idx));
+    gen_exit(table);
+
+    if (rearm)
+        wheel_add(__atomic_load_n(&table->wheel, __ATOMIC_ACQUIRE), wt);
+    else
+        ttl_free(wt);
+    if (removed)
+    {
+        __atomic_sub_fetch(&table->num_entries, 1, __ATOMIC_RELAXED);
+        hash_resize_step(table);
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * allocates the timer of a key expiring at expire, starting the
+ * table's timing wheel on its first TTL.
+ * Returns NULL when any internal errors occur.
+ */
+static ttl_timer_t *ttl_alloc(hashtable_t *table, uint64_t h,
+                              const char *key, size_t key_size,
+                              uint64_t expire)
+{
+    struct wheel *w = __atomic_load_n(&table->wheel, __ATOMIC_ACQUIRE);
+    struct wheel *expected = NULL;
+    ttl_timer_t *t;
+
+    if (w == NULL)
+    {
+        // TTL을 쓰는 table만 timer 스레드를 띄운다
+        w = wheel_create(ttl_fire, table);
+        if (w == NULL)
+        {
+            return NULL;
+        }
+        if (!__atomic_compare_exchange_n(&table->wheel, &expected, w, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            wheel_destroy(w, ttl_free); // 다른 스레드가 먼저 띄움
+        }
+    }
+
+    t = slab_alloc(sizeof(ttl_timer_t));
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    t->timer.expire = expire;
+    t->hash = h;
+    t->key_size = key_size;
+    memcpy(t->key, key, key_size);
+    t->key[key_size] = '\0';
+    return t;
+}
+/*--------------------------------------------------------------------*/
+/* hands the timer of a successful write to the wheel, or frees it */
+static void ttl_arm(hashtable_t *table, ttl_timer_t *t, int armed)
+{
+    if (t == NULL)
+        return;
+    if (armed)
+        wheel_add(__atomic_load_n(&table->wheel, __ATOMIC_ACQUIRE),
+                  &t->timer);
+    else
+        ttl_free(&t->timer);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * moves the CLOCK hand one bucket on: clears the access bit of the
+ * keys it passes there and evicts the first one found clear, or
+ * expired. Threads share nothing but the hand, taken with an atomic
+ * add, and lock only the bucket under it.
+ * Returns 1 when a key was evicted, 0 when none in the bucket was,
+ * -1 when any internal errors occur.
+ */
+static int evict_step(hashtable_t *table)
+{
+    // hand 값을 hash처럼 써서 지금 key가 사는 세대의 bucket을 잠근다
+    uint64_t h = __atomic_fetch_add(&table->clock_hand, 1, __ATOMIC_RELAXED);
+    size_t idx;
+    htab_t *ht;
+    hblock_t *blk;
+    node_t *node;
+    int i, slot = -1, expired = 0, ret = 0;
+
+    // 빈 bucket은 잠그지 않고 넘어간다 (lock 없이 본 근사값)
+    ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE);
+    idx = h % ht->hash_size;
+    if (__atomic_load_n(&ht->buckets[idx].state, __ATOMIC_ACQUIRE) ==
+            BUCKET_NORMAL &&
+        __atomic_load_n(&ht->buckets[idx].size, __ATOMIC_RELAXED) == 0)
+    {
+        return 0;
+    }
+
+    ht = bucket_write_lock(table, h, &idx);
+    if (ht == NULL)
+    {
+        return -1;
+    }
+
+    for (blk = &ht->buckets[idx]; blk; blk = blk->next)
+    {
+        for (i = 0; i < HASH_BLOCK_SLOTS && slot < 0; i++)
+        {
+            if ((node = blk->nodes[i]) == NULL)
+            {
+                continue;
+            }
+            expired = node_expired(table, node);
+            if (!expired && __atomic_load_n(&node->ref, __ATOMIC_RELAXED))
+            {
+                // 최근에 읽힌 key는 bit만 지우고 한 번 더 기회를 준다
+                __atomic_store_n(&node->ref, 0, __ATOMIC_RELAXED);
+                continue;
+            }
+            slot = i;
+        }
+        if (slot >= 0)
+        {
+            break; // bucket_remove()가 blk를 해제할 수 있다
+        }
+    }
+    if (slot >= 0)
+    {
+        ret = bucket_remove(table, ht, idx, blk, slot) == 0 ? 1 : -1;
+    }
+
+    rwlock_write_unlock(bucket_lock(ht, idx));
+
+    if (ret > 0)
+    {
+        __atomic_sub_fetch(&table->num_entries, 1, __ATOMIC_RELAXED);
+        if (!expired)
+            __atomic_add_fetch(&table->evictions, 1, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * evicts keys until bytes more fit under the memory limit. Called
+ * before the writer locks any bucket, so the hand never waits for a
+ * lock its own thread holds.
+ * Returns -1 with errno ENOMEM when nothing is left to evict, and
+ * -1 when any internal errors occur.
+ */
+static int mem_reserve(hashtable_t *table, size_t bytes)
+{
+    size_t limit = table->mem_limit, sweep, idle = 0;
+    htab_t *ht;
+    int r = 0, evicted = 0;
+
+    if (limit == 0 ||
+        __atomic_load_n(&table->mem_used, __ATOMIC_RELAXED) + bytes <= limit)
+    {
+        return 0;
+    }
+    if (bytes > limit)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (gen_enter(table) != 0)
+    {
+        return -1;
+    }
+    // 한 바퀴면 모든 access bit가 지워지므로,
+    // 두 바퀴 동안 하나도 못 내보냈다면 남은 key가 없다
+    for (ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE); ht->next;
+         ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE))
+        ;
+    sweep = ht->hash_size;
+    while (__atomic_load_n(&table->mem_used, __ATOMIC_RELAXED) + bytes >
+           limit)
+    {
+        if (idle++ == 2 * sweep ||
+            __atomic_load_n(&table->num_entries, __ATOMIC_RELAXED) == 0)
+        {
+            errno = ENOMEM;
+            r = -1;
+            break;
+        }
+        if ((r = evict_step(table)) < 0)
+        {
+            break;
+        }
+        if (r > 0)
+        {
+            evicted++;
+            idle = 0;
+        }
+    }
+    gen_exit(table);
+
+    if (evicted)
+    {
+        hash_resize_step(table);
+    }
+    return r < 0 ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+int hash_destroy(hashtable_t *table)
+{
+    TRACE_PRINT();
+    htab_t *ht, *next;
+    hblock_t *blk, *nblk;
+    size_t i;
+    int j, ret;
+
+    // timer 스레드를 먼저 멈춰 정리 중인 bucket을 건드리지 않게 한다
+    wheel_destroy(table->wheel, ttl_free);
+
+    if (table->mm)
+    {
+        ret = mmtable_close(table);
+        pthread_mutex_destroy(&table->snap_lock);
+        free(table);
+        return ret;
+    }
+
+    // resize 중이었다면 두 세대 모두 정리
+    for (ht = table->ht; ht; ht = next)
+    {
+        next = ht->next;
+        for (i = 0; i < ht->hash_size; i++)
+        {
+            for (blk = &ht->buckets[i]; blk; blk = nblk)
+            {
+                nblk = blk->next;
+                for (j = 0; j < HASH_BLOCK_SLOTS; j++)
+                {
+                    if (blk->nodes[j])
+                    {
+                        node_free(blk->nodes[j]);
+                    }
+                }
+                if (blk != &ht->buckets[i])
+                {
+                    block_free(blk);
+                }
+            }
+        }
+        htab_free(ht);
+    }
+
+    // 다른 table이 남아 있으면 공유하는 allocator를 그대로 둔다
+    if (__atomic_sub_fetch(&g_num_tables, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        // 아직 회수되지 않은 retired node/value/block/bucket 배열 정리
+        ebr_destroy();
+        slab_destroy();
+    }
+    pthread_mutex_destroy(&table->snap_lock);
+    free(table);
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+int hash_insert(hashtable_t *table, const char *key, const char *value)
+{
+    TRACE_PRINT();
+    if (!value)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return hash_insert_n(table, key, value, strlen(value));
+}
+/*--------------------------------------------------------------------*/
+int hash_insert_n(hashtable_t *table, const char *key,
+                  const char *value, size_t value_len)
+{
+    TRACE_PRINT();
+    return hash_insert_ex(table, key, value, value_len, 0);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * links node, built outside the lock with its key, hash and value,
+ * unless its key exists (and has not expired). node is freed unless
+ * linked.
+ * Returns -1 when any internal errors occur, 1 when inserted and 0 on
+ * a collision, like hash_insert().
+ */
+static int insert_node(hashtable_t *table, node_t *node, uint64_t expire)
+{
+    const char *key = node->key;
+    size_t key_size = node->key_size;
+    uint64_t h = node->hash;
+    size_t idx;
+    htab_t *ht;
+    hblock_t *blk, *spare = NULL;
+    node_t *old;
+    ttl_timer_t *timer = NULL;
+    int slot, found;
+
+    // lock 밖에서 timer도 만들어 임계 구역을 줄인다
+    if (mem_reserve(table, node_mem(node)) != 0 ||
+        (expire && !(timer = ttl_alloc(table, h, key, key_size, expire))))
+    {
+        node_free(node);
+        return -1;
+    }
+
+    if (gen_enter(table) != 0)
+    {
+        ttl_arm(table, timer, 0);
+        node_free(node);
+        return -1;
+    }
+    ht = bucket_write_lock(table, h, &idx);
+    if (ht == NULL)
+    {
+        gen_exit(table);
+        ttl_arm(table, timer, 0);
+        node_free(node);
+        return -1;
+    }
+
+    // collision 체크, 만료된 key는 없는 것으로 본다
+    found = bucket_find(&ht->buckets[idx], h, key, key_size, &blk, &slot);
+    if (found && !node_expired(table, blk->nodes[slot]))
+    {
+        rwlock_write_unlock(bucket_lock(ht, idx));
+        gen_exit(table);
+        ttl_arm(table, timer, 0);
+        node_free(node);
+        return 0; // collision
+    }
+
+    snap_visit(table, ht, idx);
+    // 기록한 뒤에는 실패하지 않도록 overflow block을 먼저 만든다.
+    // bucket lock 안에서 기록해야 같은 key의 log 순서가 적용 순서와 같다.
+    // 만료된 key는 지운 것으로 기록해야 replay에서 collision이 나지 않는다
+    if ((!found && slot < 0 && (spare = block_alloc()) == NULL) ||
+        (found && hash_log(table, HASH_OP_DELETE, key, key_size,
+                           NULL, 0) != 0) ||
+        hash_log_ex(table, HASH_OP_INSERT, key, key_size,
+                    node->value->data, node->value->size, expire) != 0)
+    {
+        rwlock_write_unlock(bucket_lock(ht, idx));
+        gen_exit(table);
+        ttl_arm(table, timer, 0);
+        node_free(node);
+        block_free(spare);
+        return -1;
+    }
+    if (found)
+    {
+        // 만료된 node를 새 node로 교체
+        old = blk->nodes[slot];
+        __atomic_store_n(&blk->nodes[slot], node, __ATOMIC_RELEASE);
+        mem_account(table, node_mem(node), node_mem(old));
+        retire(table, old, node_free);
+    }
+    else
+    {
+        bucket_put(blk, slot, node, &spare);
+        ht->buckets[idx].size++;
+        mem_account(table, node_mem(node), 0);
+    }
+
+    rwlock_write_unlock(bucket_lock(ht, idx));
+    gen_exit(table);
+    ttl_arm(table, timer, 1);
+
+    if (!found)
+    {
+        __atomic_add_fetch(&table->num_entries, 1, __ATOMIC_RELAXED);
+        hash_resize_step(table);
+    }
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+int hash_insert_ex(hashtable_t *table, const char *key, const char *value,
+                   size_t value_len, uint64_t expire)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || !key || !value)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t key_size = strlen(key);
+    if (key_size > MAX_KEY_LEN)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t h = hash_key(table, key, key_size);
+    node_t *node;
+
+    if (table->mm)
+    {
+        if (expire)
+        {
+            errno = ENOTSUP;
+            return -1;
+        }
+        return mmtable_insert(table, h, key, key_size, value, value_len);
+    }
+
+    node = node_alloc(key, key_size, h, value, value_len, expire);
+    if (!node)
+    {
+        return -1;
+    }
+    /*--------------------------------------------------------------------*/
+    return insert_node(table, node, expire);
+}
+/*--------------------------------------------------------------------*/
+int hash_insert_value(hashtable_t *table, const char *key, value_t *value,
+                      uint64_t expire)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    size_t key_size;
+    node_t *node;
+    int ret;
+
+    if (!table || !key || !value || (key_size = strlen(key)) > MAX_KEY_LEN)
+    {
+        hash_release(value);
+        errno = EINVAL;
+        return -1;
+    }
+    // 파일에 있는 값은 고정할 수 없으므로 큰 값을 받지 않는다
+    if (table->mm)
+    {
+        hash_release(value);
+        errno = ENOTSUP;
+        return -1;
+    }
+    // 작은 값은 node 안에 복사하는 편이 낫다
+    if (value->size <= HASH_INLINE_VALUE)
+    {
+        ret = hash_insert_ex(table, key, value->data, value->size, expire);
+        hash_release(value);
+        return ret;
+    }
+
+    node = node_new(key, key_size, hash_key(table, key, key_size), 0,
+                    expire);
+    if (!node)
+    {
+        hash_release(value);
+        return -1;
+    }
+    node->value = value;
+    /*--------------------------------------------------------------------*/
+    return insert_node(table, node, expire);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * looks up key in a bucket chain, safely against concurrent writers.
+ * Returns the node, or NULL when not found or expired.
+ */
+static node_t *bucket_lookup(hashtable_t *table, hblock_t *blk, uint64_t h,
+                             const char *key, size_t key_size)
+{
+    uint8_t tag = hash_tag(h);
+    node_t *node;
+    int i;
+
+    // lock-free reader는 writer가 release로 공개한 포인터만 따라간다
+    while (blk)
+    {
+        for (i = 0; i < HASH_BLOCK_SLOTS; i++)
+        {
+            // tag가 다르면 node를 건드리지 않는다
+            if (__atomic_load_n(&blk->tags[i], __ATOMIC_RELAXED) != tag)
+            {
+                continue;
+            }
+            node = __atomic_load_n(&blk->nodes[i], __ATOMIC_ACQUIRE);
+            if (node != NULL && node_match(node, h, key, key_size))
+            {
+                if (node_expired(table, node))
+                {
+                    return NULL;
+                }
+                node_touch(node);
+                return node;
+            }
+        }
+        blk = __atomic_load_n(&blk->next, __ATOMIC_ACQUIRE);
+    }
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * looks up key in a bucket chain and copies its value to dst, or pins
+ * it in ref (when not NULL) if it is outside the node.
+ * Returns 1 when found, 0 when not found, -1 when dst is too small.
+ */
+static int bucket_read(hashtable_t *table, hblock_t *blk, uint64_t h,
+                       const char *key, size_t key_size, char *dst,
+                       size_t dst_size, size_t *value_len,
+                       const value_t **ref)
+{
+    node_t *node = bucket_lookup(table, blk, h, key, key_size);
+    value_t *value;
+    size_t size;
+
+    if (node == NULL)
+    {
+        return 0;
+    }
+    value = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+    // 낙관적 reader에게는 size가 바뀌는 중일 수 있으니 한 번만 읽는다
+    size = __atomic_load_n(&value->size, __ATOMIC_RELAXED);
+
+    // node 밖의 값은 복사하지 않고 참조를 늘려 넘긴다; table의 참조는
+    // lock 또는 EBR이 지키므로 아직 0이 아니다
+    if (ref && value != node_inline(node))
+    {
+        __atomic_add_fetch(&value->refs, 1, __ATOMIC_RELAXED);
+        *ref = value;
+        if (value_len)
+            *value_len = size;
+        return 1;
+    }
+
+    // 저장된 값은 항상 '\0'으로 끝나므로 공간이 있으면 함께 복사
+    if (size > dst_size)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    memcpy(dst, value->data, size < dst_size ? size + 1 : size);
+    if (value_len)
+        *value_len = size;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * reads key like bucket_read() without taking the bucket lock, keeping
+ * the result only when no writer held the lock meanwhile.
+ * Returns like bucket_read(), or -2 when writers kept getting in the
+ * way (or any internal errors occur), so the caller reads under the lock.
+ */
+static int bucket_read_seq(hashtable_t *table, uint64_t h, const char *key,
+                           size_t key_size, char *dst, size_t dst_size,
+                           size_t *value_len, const value_t **ref)
+{
+    htab_t *ht;
+    rwlock_t *lock;
+    size_t idx;
+    uint32_t seq;
+    int ret = -2, tries = 0, state;
+
+    // 읽는 도중 해제될 수 있는 node와 값은 EBR이 지켜준다
+    if (ebr_enter() != 0)
+    {
+        return -2;
+    }
+
+    ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE);
+    while (tries < HASH_SEQ_TRIES)
+    {
+        idx = h % ht->hash_size;
+        lock = bucket_lock(ht, idx);
+        seq = rwlock_seq_begin(lock);
+        state = __atomic_load_n(&ht->buckets[idx].state, __ATOMIC_ACQUIRE);
+        if (state == BUCKET_MIGRATED)
+        {
+            ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        // writer가 잡고 있으면 복사해봐야 버려진다
+        if (!(seq & 1))
+        {
+            ret = bucket_read(table, &ht->buckets[idx], h, key, key_size,
+                              dst, dst_size, value_len, ref);
+            if (!rwlock_seq_retry(lock, seq))
+            {
+                break;
+            }
+            // 이미 바뀐 값을 잡았을 수 있으니 놓는다
+            if (ref && *ref)
+            {
+                hash_release(*ref);
+                *ref = NULL;
+            }
+        }
+        ret = -2;
+        tries++;
+    }
+
+    ebr_exit();
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int hash_read(hashtable_t *table, const char *key, char *dst, int quick)
+{
+    TRACE_PRINT();
+    return hash_read_n(table, key, dst, SIZE_MAX, NULL, quick);
+}
+/*--------------------------------------------------------------------*/
+int hash_read_n(hashtable_t *table, const char *key, char *dst,
+                size_t dst_size, size_t *value_len, int quick)
+{
+    TRACE_PRINT();
+    return hash_read_ref(table, key, dst, dst_size, value_len, NULL, quick);
+}
+/*--------------------------------------------------------------------*/
+int hash_read_ref(hashtable_t *table, const char *key, char *dst,
+                  size_t dst_size, size_t *value_len, const value_t **ref,
+                  int quick)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || !key || !dst)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ref)
+    {
+        *ref = NULL;
+    }
+
+    size_t key_size = strlen(key);
+    uint64_t h = hash_key(table, key, key_size);
+    size_t idx;
+    htab_t *ht;
+    int ret, state;
+
+    if (table->mm)
+    {
+        return mmtable_read(table, h, key, key_size, dst, dst_size,
+                            value_len, quick);
+    }
+
+    if (table->flags & HASH_SEQLOCK_READ)
+    {
+        ret = bucket_read_seq(table, h, key, key_size, dst, dst_size,
+                              value_len, ref);
+        if (ret != -2)
+        {
+            return ret;
+        }
+        // 계속 writer와 겹치면 아래에서 lock을 잡고 읽는다
+    }
+
+    if (!(table->flags & HASH_LOCKFREE_READ))
+    {
+        if (gen_enter(table) != 0)
+        {
+            return -1;
+        }
+        ht = bucket_read_lock(table, h, &idx, quick);
+        if (ht == NULL)
+        {
+            gen_exit(table);
+            return -1;
+        }
+        ret = bucket_read(table, &ht->buckets[idx], h, key, key_size,
+                          dst, dst_size, value_len, ref);
+        rwlock_read_unlock(bucket_lock(ht, idx));
+        gen_exit(table);
+        return ret;
+    }
+
+    if (ebr_enter() != 0)
+    {
+        return -1;
+    }
+
+    ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE);
+    while (1)
+    {
+        idx = h % ht->hash_size;
+        state = __atomic_load_n(&ht->buckets[idx].state, __ATOMIC_ACQUIRE);
+        if (state == BUCKET_MIGRATED)
+        {
+            ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        if (state == BUCKET_MIGRATING)
+        {
+            // 옮기는 중에는 lock을 통해 migration이 끝나기를 기다림
+            if (rwlock_read_lock(bucket_lock(ht, idx), quick) != 0)
+            {
+                ret = -1;
+                break;
+            }
+            rwlock_read_unlock(bucket_lock(ht, idx));
+            continue;
+        }
+
+        ret = bucket_read(table, &ht->buckets[idx], h, key, key_size,
+                          dst, dst_size, value_len, ref);
+        // 찾았거나, 순회 중 migration이 시작되지 않았다면 결과 확정
+        if (ret != 0 ||
+            __atomic_load_n(&ht->buckets[idx].state, __ATOMIC_ACQUIRE) ==
+                BUCKET_NORMAL)
+        {
+            break;
+        }
+    }
+
+    ebr_exit();
+    /*--------------------------------------------------------------------*/
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+void hash_release(const value_t *ref)
+{
+    TRACE_PRINT();
+    if (ref)
+    {
+        value_free((value_t *)ref);
+    }
+}
+/*--------------------------------------------------------------------*/
+int hash_update(hashtable_t *table, const char *key, const char *value)
+{
+    TRACE_PRINT();
+    if (!value)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return hash_update_n(table, key, value, strlen(value));
+}
+/*--------------------------------------------------------------------*/
+int hash_update_n(hashtable_t *table, const char *key,
+                  const char *value, size_t value_len)
+{
+    TRACE_PRINT();
+    return hash_update_ex(table, key, value, value_len, 0);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * replaces the value of key with new_value, allocated outside the
+ * lock; new_value is freed unless linked.
+ * Returns -1 when any internal errors occur, 1 when updated and 0 when
+ * not found, like hash_update().
+ */
+static int update_value(hashtable_t *table, const char *key,
+                        size_t key_size, uint64_t h, value_t *new_value,
+                        uint64_t expire)
+{
+    const char *value = new_value->data;
+    size_t value_len = new_value->size;
+    size_t idx;
+    htab_t *ht;
+    hblock_t *blk;
+    node_t *node;
+    value_t *old_value;
+    ttl_timer_t *timer = NULL;
+    size_t old_mem;
+    int slot, ret = 0; // not found
+
+    // 이전 값만큼 줄어들겠지만 새 값 전체를 넣을 자리를 먼저 만든다
+    if (mem_reserve(table, value_mem(new_value)) != 0 ||
+        (expire && !(timer = ttl_alloc(table, h, key, key_size, expire))))
+    {
+        value_free(new_value);
+        return -1;
+    }
+
+    if (gen_enter(table) != 0)
+    {
+        ttl_arm(table, timer, 0);
+        value_free(new_value);
+        return -1;
+    }
+    ht = bucket_write_lock(table, h, &idx);
+    if (ht == NULL)
+    {
+        gen_exit(table);
+        ttl_arm(table, timer, 0);
+        value_free(new_value);
+        return -1;
+    }
+
+    if (bucket_find(&ht->buckets[idx], h, key, key_size, &blk, &slot) &&
+        !node_expired(table, blk->nodes[slot]) &&
+        (ret = hash_log_ex(table, HASH_OP_UPDATE, key, key_size, value,
+                           value_len, expire)) == 0)
+    {
+        snap_visit(table, ht, idx);
+        node = blk->nodes[slot];
+        old_value = node->value;
+        old_mem = node_mem(node);
+        ret = 1; // updated
+
+        if (!(table->flags & HASH_LOCKFREE_READ) &&
+            value_len <= node->inline_cap)
+        {
+            // reader가 lock을 잡거나 seq로 확인하므로 node 안의 공간을 재사용
+            value_set(node_inline(node), value, value_len);
+            __atomic_store_n(&node->value, node_inline(node),
+                             __ATOMIC_RELEASE);
+            if (old_value != node_inline(node))
+            {
+                retire(table, old_value, value_free);
+            }
+        }
+        else
+        {
+            // 값 전체를 원자적으로 교체, 이전 값은 reader가 끝난 뒤 해제
+            __atomic_store_n(&node->value, new_value, __ATOMIC_RELEASE);
+            if (old_value != node_inline(node))
+            {
+                retire(table, old_value, value_free);
+            }
+            new_value = NULL;
+        }
+        // TTL 없는 update는 이전 TTL도 없앤다
+        __atomic_store_n(&node->expire, expire, __ATOMIC_RELAXED);
+        mem_account(table, node_mem(node), old_mem);
+    }
+
+    rwlock_write_unlock(bucket_lock(ht, idx));
+    gen_exit(table);
+    ttl_arm(table, timer, ret > 0);
+
+    if (new_value)
+    {
+        value_free(new_value); // 찾지 못했거나 node 안에 썼음
+    }
+    hash_resize_step(table);
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int hash_update_ex(hashtable_t *table, const char *key, const char *value,
+                   size_t value_len, uint64_t expire)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || !key || !value)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t key_size = strlen(key);
+    uint64_t h = hash_key(table, key, key_size);
+    value_t *new_value;
+
+    if (table->mm)
+    {
+        if (expire)
+        {
+            errno = ENOTSUP;
+            return -1;
+        }
+        return mmtable_update(table, h, key, key_size, value, value_len);
+    }
+
+    // lock 밖에서 미리 할당해 임계 구역에서는 할당하지 않는다
+    new_value = value_alloc(value, value_len);
+    if (new_value == NULL)
+    {
+        return -1;
+    }
+    /*--------------------------------------------------------------------*/
+    return update_value(table, key, key_size, h, new_value, expire);
+}
+/*--------------------------------------------------------------------*/
+int hash_update_value(hashtable_t *table, const char *key, value_t *value,
+                      uint64_t expire)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    size_t key_size;
+
+    if (!table || !key || !value)
+    {
+        hash_release(value);
+        errno = EINVAL;
+        return -1;
+    }
+    if (table->mm)
+    {
+        hash_release(value);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    key_size = strlen(key);
+    /*--------------------------------------------------------------------*/
+    return update_value(table, key, key_size,
+                        hash_key(table, key, key_size), value, expire);
+}
+/*--------------------------------------------------------------------*/
+int hash_delete(hashtable_t *table, const char *key)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || !key)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t key_size = strlen(key);
+    uint64_t h = hash_key(table, key, key_size);
+    size_t idx;
+    htab_t *ht;
+    hblock_t *blk;
+    int slot, expired, removed = 0, ret = 0; // not found
+
+    if (table->mm)
+    {
+        return mmtable_delete(table, h, key, key_size);
+    }
+
+    if (gen_enter(table) != 0)
+    {
+        return -1;
+    }
+    ht = bucket_write_lock(table, h, &idx);
+    if (ht == NULL)
+    {
+        gen_exit(table);
+        return -1;
+    }
+
+    if (bucket_find(&ht->buckets[idx], h, key, key_size, &blk, &slot))
+    {
+        // 만료된 key도 지우지만 없던 것으로 답한다
+        expired = node_expired(table, blk->nodes[slot]);
+        if (bucket_remove(table, ht, idx, blk, slot) != 0)
+        {
+            ret = -1;
+        }
+        else
+        {
+            removed = 1;
+            ret = !expired; // deleted
+        }
+    }
+
+    rwlock_write_unlock(bucket_lock(ht, idx));
+    gen_exit(table);
+
+    if (removed)
+    {
+        __atomic_sub_fetch(&table->num_entries, 1, __ATOMIC_RELAXED);
+        hash_resize_step(table);
+    }
+    /*--------------------------------------------------------------------*/
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int hash_expire(hashtable_t *table, const char *key, uint64_t expire)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || !key)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (table->mm)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    size_t key_size = strlen(key);
+    uint64_t h = hash_key(table, key, key_size);
+    size_t idx;
+    htab_t *ht;
+    hblock_t *blk;
+    node_t *node;
+    ttl_timer_t *timer = NULL;
+    int slot, ret = 0; // not found
+
+    if (expire && !(timer = ttl_alloc(table, h, key, key_size, expire)))
+    {
+        return -1;
+    }
+
+    if (gen_enter(table) != 0)
+    {
+        ttl_arm(table, timer, 0);
+        return -1;
+    }
+    ht = bucket_write_lock(table, h, &idx);
+    if (ht == NULL)
+    {
+        gen_exit(table);
+        ttl_arm(table, timer, 0);
+        return -1;
+    }
+
+    if (bucket_find(&ht->buckets[idx], h, key, key_size, &blk, &slot) &&
+        !node_expired(table, (node = blk->nodes[slot])) &&
+        (ret = hash_log(table, HASH_OP_EXPIRE, key, key_size,
+                        (const char *)&expire, sizeof(expire))) == 0)
+    {
+        snap_visit(table, ht, idx);
+        __atomic_store_n(&node->expire, expire, __ATOMIC_RELAXED);
+        ret = 1; // set
+    }
+
+    rwlock_write_unlock(bucket_lock(ht, idx));
+    gen_exit(table);
+    ttl_arm(table, timer, ret > 0);
+    /*--------------------------------------------------------------------*/
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+void hash_hold_ttl(hashtable_t *table, int hold)
+{
+    TRACE_PRINT();
+    __atomic_store_n(&table->ttl_hold, hold, __ATOMIC_RELAXED);
+    // 이미 돌고 있던 timer가 끝나야 더 이상 key가 지워지지 않는다
+    wheel_sync(__atomic_load_n(&table->wheel, __ATOMIC_ACQUIRE));
+}
+/*--------------------------------------------------------------------*/
+/**
+ * checks the keys of a multi-key call and computes all their hashes
+ * up front. Returns -1 with errno EINVAL when n or a key is invalid.
+ */
+static int multi_hash(hashtable_t *table, const hash_entry_t *keys,
+                      size_t n, uint64_t *hashes)
+{
+    size_t i;
+
+    if (n > HASH_MULTI_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (!keys[i].key || keys[i].key_size == 0 ||
+            keys[i].key_size > MAX_KEY_LEN)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        hashes[i] = hash_key(table, keys[i].key, keys[i].key_size);
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+static int size_cmp(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+
+    return (x > y) - (x < y);
+}
+/*--------------------------------------------------------------------*/
+static void multi_unlock(htab_t *ht, const size_t *locked, size_t m,
+                         int write)
+{
+    size_t i;
+
+    for (i = 0; i < m; i++)
+    {
+        if (write)
+            rwlock_write_unlock(&ht->locks[locked[i]]);
+        else
+            rwlock_read_unlock(&ht->locks[locked[i]]);
+    }
+}
+/*--------------------------------------------------------------------*/
+/**
+ * prefetches the first block and the lock of the bucket of every key,
+ * then takes the distinct locks in ascending order, so that callers
+ * holding several buckets never wait for each other in a cycle.
+ * Sets locked[0 .. *num_locked) to the indices of the locks taken.
+ * Returns -1 when any internal errors occur, with nothing locked.
+ */
+static int multi_lock(htab_t *ht, const uint64_t *hashes, size_t n,
+                      int write, int quick, size_t *locked,
+                      size_t *num_locked)
+{
+    size_t i, m = 0, idx;
+
+    for (i = 0; i < n; i++)
+    {
+        idx = hashes[i] % ht->hash_size;
+        locked[i] = idx & ht->lock_mask;
+        __builtin_prefetch(&ht->buckets[idx]);
+        __builtin_prefetch(&ht->locks[locked[i]], 1);
+    }
+    qsort(locked, n, sizeof(size_t), size_cmp);
+
+    for (i = 0; i < n; i++)
+    {
+        // 같은 lock은 한 번만 잡는다 (stripe를 나눠 쓰는 bucket 포함)
+        if (m > 0 && locked[m - 1] == locked[i])
+        {
+            continue;
+        }
+        if ((write ? rwlock_write_lock(&ht->locks[locked[i]])
+                   : rwlock_read_lock(&ht->locks[locked[i]], quick)) != 0)
+        {
+            multi_unlock(ht, locked, m, write);
+            return -1;
+        }
+        locked[m++] = locked[i];
+    }
+
+    *num_locked = m;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * prefetches, for every key, the node in the first block of its bucket
+ * whose tag matches, so the lookups that follow mostly hit the cache
+ */
+static void multi_prefetch(htab_t *ht, const uint64_t *hashes, size_t n)
+{
+    hblock_t *blk;
+    uint8_t tag;
+    size_t i;
+    int j;
+
+    for (i = 0; i < n; i++)
     {
-        hash = (hash << 5) + *key++;
+        blk = &ht->buckets[hashes[i] % ht->hash_size];
+        tag = hash_tag(hashes[i]);
+        for (j = 0; j < HASH_BLOCK_SLOTS; j++)
+        {
+            if (__atomic_load_n(&blk->tags[j], __ATOMIC_RELAXED) == tag)
+            {
+                __builtin_prefetch(
+                    __atomic_load_n(&blk->nodes[j], __ATOMIC_RELAXED));
+                break;
+            }
+        }
     }
-
-    return hash % hash_size;
 }
 /*--------------------------------------------------------------------*/
-hashtable_t *hash_init(size_t hash_size, int delay)
+/* copies a key of a multi-key call into a string for the one-key calls */
+static const char *multi_key(const hash_entry_t *e, char *buf)
+{
+    memcpy(buf, e->key, e->key_size);
+    buf[e->key_size] = '\0';
+    return buf;
+}
+/*--------------------------------------------------------------------*/
+int hash_mread(hashtable_t *table, const hash_entry_t *keys, size_t n,
+               int quick, hash_mread_fn fn, void *arg)
 {
     TRACE_PRINT();
-    int i, j, ret;
-    hashtable_t *table = calloc(1, sizeof(hashtable_t));
-
-    if (table == NULL)
+    /*--------------------------------------------------------------------*/
+    if (!table || (!keys && n > 0) || !fn)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table");
-        return NULL;
+        errno = EINVAL;
+        return -1;
     }
 
-    table->hash_size = hash_size;
+    uint64_t hashes[HASH_MULTI_MAX];
+    size_t locked[HASH_MULTI_MAX];
+    size_t num_locked = 0, i, idx;
+    htab_t *ht;
+    node_t *node;
+    value_t *value;
+    int ret = 0;
 
-    table->buckets = calloc(hash_size, sizeof(node_t *));
-    if (table->buckets == NULL)
+    if (multi_hash(table, keys, n, hashes) != 0)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table buckets");
-        free(table);
-        return NULL;
+        return -1;
     }
 
-    table->locks = calloc(hash_size, sizeof(rwlock_t));
-    if (table->locks == NULL)
+    if (table->mm)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table locks");
-        free(table->buckets);
-        free(table);
-        return NULL;
+        for (i = 0; i < n && ret == 0; i++)
+        {
+            ret = mmtable_visit(table, hashes[i], keys[i].key,
+                                keys[i].key_size, quick, fn, arg, i);
+        }
+        return ret;
     }
 
-    table->bucket_sizes = calloc(hash_size, sizeof(*table->bucket_sizes));
-    if (table->bucket_sizes == NULL)
+    if (table->flags & HASH_RESIZE)
     {
-        DEBUG_PRINT("Failed to allocate memory for hash table "
-                    "bucket sizes");
-        free(table->buckets);
-        free(table->locks);
-        free(table);
-        return NULL;
+        // 세대가 바뀔 수 있으므로 bucket을 하나씩 잠근다
+        for (i = 0; i < n && ret == 0; i++)
+        {
+            if (gen_enter(table) != 0)
+            {
+                return -1;
+            }
+            ht = bucket_read_lock(table, hashes[i], &idx, quick);
+            if (ht == NULL)
+            {
+                gen_exit(table);
+                return -1;
+            }
+            node = bucket_lookup(table, &ht->buckets[idx], hashes[i],
+                                 keys[i].key, keys[i].key_size);
+            value = node ? __atomic_load_n(&node->value, __ATOMIC_ACQUIRE)
+                         : NULL;
+            ret = fn(arg, i, value ? value->data : NULL,
+                     value ? value->size : 0);
+            rwlock_read_unlock(bucket_lock(ht, idx));
+            gen_exit(table);
+        }
+        return ret < 0 ? -1 : 0;
     }
 
-    for (i = 0; i < hash_size; i++)
+    // hash를 모두 구하고 bucket을 미리 불러 cache miss를 겹치게 한다
+    ht = table->ht;
+    if (table->flags & HASH_LOCKFREE_READ)
     {
-        table->buckets[i] = NULL;
-        table->bucket_sizes[i] = 0;
-        ret = rwlock_init(&table->locks[i], delay);
-        if (ret != 0)
+        if (ebr_enter() != 0)
         {
-            DEBUG_PRINT("Failed to initialize read-write lock");
-            for (j = 0; j < i; j++)
-            {
-                rwlock_destroy(&table->locks[j]);
-            }
-            free(table->buckets);
-            free(table->locks);
-            free(table->bucket_sizes);
-            free(table);
-            return NULL;
+            return -1;
+        }
+        for (i = 0; i < n; i++)
+        {
+            __builtin_prefetch(&ht->buckets[hashes[i] % ht->hash_size]);
         }
     }
+    else if (multi_lock(ht, hashes, n, 0, quick, locked, &num_locked) != 0)
+    {
+        return -1;
+    }
+    multi_prefetch(ht, hashes, n);
 
-    return table;
+    for (i = 0; i < n && ret == 0; i++)
+    {
+        node = bucket_lookup(table, &ht->buckets[hashes[i] % ht->hash_size],
+                             hashes[i], keys[i].key, keys[i].key_size);
+        value = node ? __atomic_load_n(&node->value, __ATOMIC_ACQUIRE) : NULL;
+        ret = fn(arg, i, value ? value->data : NULL, value ? value->size : 0);
+    }
+
+    if (table->flags & HASH_LOCKFREE_READ)
+        ebr_exit();
+    else
+        multi_unlock(ht, locked, num_locked, 0);
+    /*--------------------------------------------------------------------*/
+    return ret < 0 ? -1 : 0;
 }
 /*--------------------------------------------------------------------*/
-int hash_destroy(hashtable_t *table)
+int hash_mset(hashtable_t *table, const hash_entry_t *entries, size_t n,
+              int *rets)
 {
     TRACE_PRINT();
-    node_t *node, *tmp;
-    int i;
+    /*--------------------------------------------------------------------*/
+    if (!table || (!entries && n > 0) || !rets)
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
-    for (i = 0; i < table->hash_size; i++)
+    uint64_t hashes[HASH_MULTI_MAX];
+    size_t locked[HASH_MULTI_MAX];
+    node_t *nodes[HASH_MULTI_MAX];
+    ttl_timer_t *timers[HASH_MULTI_MAX];
+    char key[MAX_KEY_LEN + 1];
+    size_t num_locked, inserted = 0, bytes = 0, i, idx;
+    htab_t *ht;
+    hblock_t *blk, *spare = NULL;
+    node_t *old;
+    int slot, found, expired, r, ret = 0;
+
+    if (multi_hash(table, entries, n, hashes) != 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (!entries[i].value)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if (table->mm || (table->flags & HASH_RESIZE))
     {
-        node = table->buckets[i];
-        while (node)
+        // 한 entry씩: 그 사이 다른 writer가 만들거나 지우면 다시 시도
+        for (i = 0; i < n; i++)
         {
-            tmp = node;
-            node = node->next;
-            free(tmp->key);
-            free(tmp->value);
-            free(tmp);
+            multi_key(&entries[i], key);
+            while ((rets[i] = hash_insert_ex(table, key, entries[i].value,
+                                             entries[i].value_len,
+                                             entries[i].expire)) == 0)
+            {
+                r = hash_update_ex(table, key, entries[i].value,
+                                   entries[i].value_len, entries[i].expire);
+                if (r != 0)
+                {
+                    rets[i] = r > 0 ? 0 : -1;
+                    break;
+                }
+            }
+            if (rets[i] < 0)
+                ret = -1;
         }
-        if (rwlock_destroy(&table->locks[i]) != 0)
+        return ret;
+    }
+
+    // lock 밖에서 node와 timer를 모두 만들어 임계 구역을 줄인다
+    for (i = 0; i < n; i++)
+    {
+        nodes[i] = node_alloc(entries[i].key, entries[i].key_size, hashes[i],
+                              entries[i].value, entries[i].value_len,
+                              entries[i].expire);
+        timers[i] = NULL;
+        if (nodes[i])
+            bytes += node_mem(nodes[i]);
+        if (!nodes[i] ||
+            (entries[i].expire &&
+             !(timers[i] = ttl_alloc(table, hashes[i], entries[i].key,
+                                     entries[i].key_size,
+                                     entries[i].expire))))
         {
-            DEBUG_PRINT("Failed to destroy read-write lock");
+            if (nodes[i])
+                node_free(nodes[i]);
+            while (i-- > 0)
+            {
+                ttl_arm(table, timers[i], 0);
+                node_free(nodes[i]);
+            }
             return -1;
         }
     }
 
-    free(table->buckets);
-    free(table->locks);
-    free(table->bucket_sizes);
-    free(table);
+    // bucket을 잠그기 전에 모든 node가 들어갈 자리를 만든다
+    ht = table->ht;
+    if (mem_reserve(table, bytes) != 0 ||
+        multi_lock(ht, hashes, n, 1, 0, locked, &num_locked) != 0)
+    {
+        for (i = 0; i < n; i++)
+        {
+            ttl_arm(table, timers[i], 0);
+            node_free(nodes[i]);
+        }
+        return -1;
+    }
+    multi_prefetch(ht, hashes, n);
 
-    return 0;
+    // 요청 순서대로 적용하므로 중복된 key는 나중 값이 남는다
+    for (i = 0; i < n; i++)
+    {
+        idx = hashes[i] % ht->hash_size;
+        found = bucket_find(&ht->buckets[idx], hashes[i], entries[i].key,
+                            entries[i].key_size, &blk, &slot);
+        // 만료된 key는 지운 뒤 새로 만든 것으로 기록한다.
+        // 기록한 뒤에는 실패하지 않도록 overflow block을 먼저 만든다
+        expired = found && node_expired(table, blk->nodes[slot]);
+        if ((!found && slot < 0 && !spare &&
+             (spare = block_alloc()) == NULL) ||
+            (expired && hash_log(table, HASH_OP_DELETE, entries[i].key,
+                                 entries[i].key_size, NULL, 0) != 0) ||
+            hash_log_ex(table,
+                        found && !expired ? HASH_OP_UPDATE : HASH_OP_INSERT,
+                        entries[i].key, entries[i].key_size,
+                        entries[i].value, entries[i].value_len,
+                        entries[i].expire) != 0)
+        {
+            rets[i] = ret = -1;
+            continue;
+        }
+        snap_visit(table, ht, idx);
+        if (found)
+        {
+            // node를 통째로 교체, 이전 node는 reader가 끝난 뒤 해제
+            old = blk->nodes[slot];
+            __atomic_store_n(&blk->nodes[slot], nodes[i], __ATOMIC_RELEASE);
+            mem_account(table, node_mem(nodes[i]), node_mem(old));
+            retire(table, old, node_free);
+            rets[i] = expired;
+        }
+        else
+        {
+            bucket_put(blk, slot, nodes[i], &spare);
+            ht->buckets[idx].size++;
+            mem_account(table, node_mem(nodes[i]), 0);
+            inserted++;
+            rets[i] = 1;
+        }
+        nodes[i] = NULL;
+    }
+
+    multi_unlock(ht, locked, num_locked, 1);
+    block_free(spare); // 기록에 실패해 쓰지 못한 block
+
+    for (i = 0; i < n; i++)
+    {
+        ttl_arm(table, timers[i], rets[i] >= 0);
+        if (nodes[i])
+            node_free(nodes[i]); // 쓰지 못한 node
+    }
+    __atomic_add_fetch(&table->num_entries, inserted, __ATOMIC_RELAXED);
+    /*--------------------------------------------------------------------*/
+    return ret;
 }
 /*--------------------------------------------------------------------*/
-int hash_insert(hashtable_t *table, const char *key, const char *value)
+int hash_mdelete(hashtable_t *table, const hash_entry_t *keys, size_t n,
+                 int *rets)
 {
     TRACE_PRINT();
     /*--------------------------------------------------------------------*/
-    if (!table || !key || !value)
+    if (!table || (!keys && n > 0) || !rets)
     {
         errno = EINVAL;
         return -1;
     }
 
-    int idx = hash(key, table->hash_size);
+    uint64_t hashes[HASH_MULTI_MAX];
+    size_t locked[HASH_MULTI_MAX];
+    char key[MAX_KEY_LEN + 1];
+    size_t num_locked, deleted = 0, i, idx;
+    htab_t *ht;
+    hblock_t *blk;
+    int slot, expired, ret = 0;
 
-    if (rwlock_write_lock(&table->locks[idx]) != 0)
+    if (multi_hash(table, keys, n, hashes) != 0)
     {
         return -1;
     }
 
-    // collision 체크
-    node_t *node = table->buckets[idx];
-    while (node)
+    if (table->mm || (table->flags & HASH_RESIZE))
     {
-        if (strcmp(node->key, key) == 0)
+        for (i = 0; i < n; i++)
         {
-            rwlock_write_unlock(&table->locks[idx]);
-            return 0; // collision
+            rets[i] = hash_delete(table, multi_key(&keys[i], key));
+            if (rets[i] < 0)
+                ret = -1;
         }
-        node = node->next;
+        return ret;
     }
 
-    // 새 노드 생성
-    node_t *new_node = malloc(sizeof(node_t));
-    if (!new_node)
+    ht = table->ht;
+    if (multi_lock(ht, hashes, n, 1, 0, locked, &num_locked) != 0)
     {
-        rwlock_write_unlock(&table->locks[idx]);
         return -1;
     }
+    multi_prefetch(ht, hashes, n);
 
-    new_node->key = strdup(key);
-    new_node->value = strdup(value);
-    if (!new_node->key || !new_node->value)
+    for (i = 0; i < n; i++)
     {
-        free(new_node->key);
-        free(new_node->value);
-        free(new_node);
-        rwlock_write_unlock(&table->locks[idx]);
-        return -1;
+        idx = hashes[i] % ht->hash_size;
+        rets[i] = 0; // not found
+        if (!bucket_find(&ht->buckets[idx], hashes[i], keys[i].key,
+                         keys[i].key_size, &blk, &slot))
+        {
+            continue;
+        }
+        expired = node_expired(table, blk->nodes[slot]);
+        if (bucket_remove(table, ht, idx, blk, slot) != 0)
+        {
+            rets[i] = ret = -1;
+            continue;
+        }
+        deleted++;
+        rets[i] = !expired;
     }
 
-    new_node->key_size = strlen(key);
-    new_node->value_size = strlen(value);
-    new_node->next = table->buckets[idx];
-    table->buckets[idx] = new_node;
-    table->bucket_sizes[idx]++;
+    multi_unlock(ht, locked, num_locked, 1);
 
-    rwlock_write_unlock(&table->locks[idx]);
+    __atomic_sub_fetch(&table->num_entries, deleted, __ATOMIC_RELAXED);
     /*--------------------------------------------------------------------*/
-    return 1;
+    return ret;
 }
 /*--------------------------------------------------------------------*/
-int hash_read(hashtable_t *table, const char *key, char *dst, int quick)
+static void stats_add_chain(hash_stats_t *st, size_t len)
+{
+    st->chains[len < HASH_STATS_CHAINS ? len : HASH_STATS_CHAINS]++;
+    if (len > st->max_chain)
+    {
+        st->max_chain = len;
+    }
+}
+/*--------------------------------------------------------------------*/
+int hash_stats(hashtable_t *table, hash_stats_t *st)
 {
     TRACE_PRINT();
     /*--------------------------------------------------------------------*/
-    if (!table || !key || !dst)
+    if (!table || !st)
     {
         errno = EINVAL;
         return -1;
     }
 
-    int idx = hash(key, table->hash_size);
+    htab_t *ht;
+    size_t i;
+
+    memset(st, 0, sizeof(*st));
+    st->hash_fn = HASH_FN_OF(table->flags);
+    if (table->mm)
+    {
+        return mmtable_stats(table, st);
+    }
 
-    if (rwlock_read_lock(&table->locks[idx], quick) != 0)
+    if (gen_enter(table) != 0)
     {
         return -1;
     }
 
-    node_t *node = table->buckets[idx];
-    while (node)
+    // lock 없이 읽으므로 writer가 도는 중에는 근사값
+    for (ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE); ht;
+         ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE))
     {
-        if (strcmp(node->key, key) == 0)
+        st->hash_size = ht->hash_size;
+        for (i = 0; i < ht->hash_size; i++)
+        {
+            // 옮겨진 bucket은 다음 세대에서 센다
+            if (__atomic_load_n(&ht->buckets[i].state, __ATOMIC_ACQUIRE) ==
+                BUCKET_MIGRATED)
+            {
+                continue;
+            }
+            stats_add_chain(st, __atomic_load_n(&ht->buckets[i].size,
+                                                __ATOMIC_RELAXED));
+        }
+        for (i = 0; i < ht->num_locks; i++)
         {
-            strcpy(dst, node->value);
-            rwlock_read_unlock(&table->locks[idx]);
-            return 1; // found
+            st->hot_buckets += rwlock_is_hot(&ht->locks[i]);
         }
-        node = node->next;
     }
+    st->num_entries = __atomic_load_n(&table->num_entries, __ATOMIC_RELAXED);
+    st->mem_used = __atomic_load_n(&table->mem_used, __ATOMIC_RELAXED);
+    st->mem_limit = table->mem_limit;
+    st->evictions = __atomic_load_n(&table->evictions, __ATOMIC_RELAXED);
 
-    rwlock_read_unlock(&table->locks[idx]);
+    gen_exit(table);
     /*--------------------------------------------------------------------*/
-    return 0; // not found
+    return 0;
 }
 /*--------------------------------------------------------------------*/
-int hash_update(hashtable_t *table, const char *key, const char *value)
+int hash_scan(hashtable_t *table, hash_scan_fn fn, void *arg)
 {
     TRACE_PRINT();
     /*--------------------------------------------------------------------*/
-    if (!table || !key || !value)
+    if (!table || !fn)
     {
         errno = EINVAL;
         return -1;
     }
 
-    int idx = hash(key, table->hash_size);
+    htab_t *ht;
+    hblock_t *blk;
+    node_t *node;
+    size_t i;
+    int j, ret = 0;
+
+    if (table->mm)
+    {
+        return mmtable_scan(table, fn, arg);
+    }
 
-    if (rwlock_write_lock(&table->locks[idx]) != 0)
+    // resize 중이어도 세대 배열이 해제되지 않도록 전체 순회 동안 유지
+    if (gen_enter(table) != 0)
     {
         return -1;
     }
 
-    node_t *node = table->buckets[idx];
-    while (node)
+    for (ht = __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE); ht && ret == 0;
+         ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE))
     {
-        if (strcmp(node->key, key) == 0)
+        for (i = 0; i < ht->hash_size && ret == 0; i++)
         {
-            char *new_value = strdup(value);
-            if (!new_value)
+            // 한 bucket씩만 read lock을 잡아 writer를 오래 막지 않는다
+            if (rwlock_read_lock(bucket_lock(ht, i), 0) != 0)
             {
-                rwlock_write_unlock(&table->locks[idx]);
-                return -1;
+                ret = -1;
+                break;
+            }
+            // 옮겨진 bucket의 entry는 다음 세대에서 만난다
+            if (ht->buckets[i].state != BUCKET_MIGRATED)
+            {
+                for (blk = &ht->buckets[i]; blk && ret == 0; blk = blk->next)
+                {
+                    for (j = 0; j < HASH_BLOCK_SLOTS && ret == 0; j++)
+                    {
+                        node = blk->nodes[j];
+                        if (node && !node_expired(table, node))
+                        {
+                            ret = fn(arg, node->key, node->key_size,
+                                     node->value->data, node->value->size,
+                                     node->expire);
+                        }
+                    }
+                }
             }
-            free(node->value);
-            node->value = new_value;
-            node->value_size = strlen(value);
-            rwlock_write_unlock(&table->locks[idx]);
-            return 1; // updated
+            rwlock_read_unlock(bucket_lock(ht, i));
         }
-        node = node->next;
     }
 
-    rwlock_write_unlock(&table->locks[idx]);
+    gen_exit(table);
     /*--------------------------------------------------------------------*/
-    return 0; // not found
+    return ret < 0 ? -1 : 0;
 }
 /*--------------------------------------------------------------------*/
-int hash_delete(hashtable_t *table, const char *key)
+int hash_snapshot(hashtable_t *table, hash_scan_fn fn, void *arg)
 {
     TRACE_PRINT();
     /*--------------------------------------------------------------------*/
-    if (!table || !key)
+    if (!table || !fn)
     {
         errno = EINVAL;
         return -1;
     }
 
-    int idx = hash(key, table->hash_size);
+    htab_t *ht;
+    size_t i;
+    int ret = 0, entered;
+
+    // 파일의 bucket에는 snapshot이 본 표시를 둘 곳이 없다
+    if (table->mm)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    pthread_mutex_lock(&table->snap_lock);
+    if (table->snap_active)
+    {
+        pthread_mutex_unlock(&table->snap_lock);
+        errno = EBUSY;
+        return -1;
+    }
+    // 이 시점 이후 bucket을 바꾸는 writer는 바꾸기 전에 먼저 넘겨준다
+    __atomic_store_n(&table->snap_fn, fn, __ATOMIC_RELAXED);
+    __atomic_store_n(&table->snap_arg, arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&table->snap_error, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&table->snap_id, table->snap_id + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&table->snap_active, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&table->snap_lock);
+
+    entered = gen_enter(table) == 0;
+    if (!entered)
+    {
+        ret = -1;
+    }
+    for (ht = ret ? NULL : __atomic_load_n(&table->ht, __ATOMIC_ACQUIRE); ht;
+         ht = __atomic_load_n(&ht->next, __ATOMIC_ACQUIRE))
+    {
+        for (i = 0; i < ht->hash_size; i++)
+        {
+            if (rwlock_read_lock(bucket_lock(ht, i), 0) != 0)
+            {
+                ret = -1;
+                break;
+            }
+            // 옮겨진 bucket은 옮길 때 넘겨졌거나 다음 세대에서 만난다
+            if (ht->buckets[i].state != BUCKET_MIGRATED)
+            {
+                snap_visit(table, ht, i);
+            }
+            rwlock_read_unlock(bucket_lock(ht, i));
+        }
+        if (ret < 0)
+        {
+            break;
+        }
+    }
+    // 훑기에 실패해도 나가야 EBR이 다시 회수할 수 있다
+    if (entered)
+    {
+        gen_exit(table);
+    }
+
+    // 모든 bucket을 본 뒤에는 writer가 넘겨줄 것이 없다
+    pthread_mutex_lock(&table->snap_lock);
+    __atomic_store_n(&table->snap_active, 0, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&table->snap_error, __ATOMIC_RELAXED))
+    {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&table->snap_lock);
+    /*--------------------------------------------------------------------*/
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+/* work of one hash_load() thread */
+struct load_arg
+{
+    hashtable_t *table;
+    const hash_entry_t *entries;
+    node_t **nodes;
+    size_t *idx;  // bucket of each node
+    size_t n;
+    int num_threads;
+    int t;
+    size_t loaded;
+    size_t bytes;   // node_mem() of the loaded nodes, without a limit
+    size_t dropped; // entries left out by the limit
+    int *error;
+};
+/*--------------------------------------------------------------------*/
+/* phase 1: builds the nodes of this thread's share of the entries */
+static void *load_nodes(void *arg)
+{
+    struct load_arg *la = (struct load_arg *)arg;
+    hashtable_t *table = la->table;
+    const hash_entry_t *e;
+    size_t i, lo, hi;
+    uint64_t h, now = hash_clock();
+
+    lo = la->n * la->t / la->num_threads;
+    hi = la->n * (la->t + 1) / la->num_threads;
+    for (i = lo; i < hi; i++)
+    {
+        e = &la->entries[i];
+        if (e->key_size == 0 || e->key_size > MAX_KEY_LEN ||
+            (e->expire && e->expire <= now && !table->ttl_hold))
+        {
+            continue;
+        }
+        h = hash_key(table, e->key, e->key_size);
+        la->idx[i] = h % table->ht->hash_size;
+        la->nodes[i] = node_alloc(e->key, e->key_size, h,
+                                  e->value, e->value_len, e->expire);
+        if (la->nodes[i] == NULL)
+        {
+            __atomic_store_n(la->error, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * phase 2: links the nodes of this thread's range of buckets;
+ * no other thread touches these buckets, so no lock is taken.
+ * With a memory limit, every node is charged to mem_used before it is
+ * linked, and the ones that would go over it are left out.
+ */
+static void *load_link(void *arg)
+{
+    struct load_arg *la = (struct load_arg *)arg;
+    hashtable_t *table = la->table;
+    htab_t *ht = table->ht;
+    size_t i, lo, hi, mem, limit = table->mem_limit;
+    hblock_t *blk;
+    node_t *node;
+    ttl_timer_t *timer;
+    int slot, full;
+
+    lo = ht->hash_size * la->t / la->num_threads;
+    hi = ht->hash_size * (la->t + 1) / la->num_threads;
+    for (i = 0; i < la->n; i++)
+    {
+        // phase 1이 끝났으니 nodes[]는 읽기만 한다. 건너뛴 entry는
+        // NULL이고 idx[i]도 정해지지 않았으므로 먼저 확인한다
+        if ((node = la->nodes[i]) == NULL ||
+            la->idx[i] < lo || la->idx[i] >= hi)
+        {
+            continue;
+        }
+        // 제한이 있을 때만 공유 카운터에 바로 더해 넘치는지 본다
+        mem = node_mem(node);
+        full = limit && __atomic_add_fetch(&table->mem_used, mem,
+                                           __ATOMIC_RELAXED) > limit;
+        if (full ||
+            bucket_find(&ht->buckets[la->idx[i]], node->hash, node->key,
+                        node->key_size, &blk, &slot) ||
+            bucket_put(blk, slot, node, NULL) != 0)
+        {
+            // 제한을 넘거나 중복 key이거나 block 할당 실패
+            if (limit)
+            {
+                __atomic_sub_fetch(&table->mem_used, mem, __ATOMIC_RELAXED);
+            }
+            la->dropped += full;
+            node_free(node);
+            continue;
+        }
+        ht->buckets[la->idx[i]].size++;
+        la->loaded++;
+        if (!limit)
+        {
+            la->bytes += mem;
+        }
+
+        // timer를 만들지 못해도 만료된 key는 읽히지 않는다
+        if (node->expire &&
+            (timer = ttl_alloc(table, node->hash, node->key,
+                               node->key_size, node->expire)) != NULL)
+        {
+            ttl_arm(table, timer, 1);
+        }
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* runs fn on every load_arg, the caller taking the first one */
+static void load_run(struct load_arg *la, int num_threads,
+                     void *(*fn)(void *))
+{
+    pthread_t threads[num_threads];
+    int created[num_threads];
+    int i;
 
-    if (rwlock_write_lock(&table->locks[idx]) != 0)
+    for (i = 1; i < num_threads; i++)
+    {
+        created[i] = pthread_create(&threads[i], NULL, fn, &la[i]) == 0;
+    }
+    fn(&la[0]);
+    for (i = 1; i < num_threads; i++)
+    {
+        if (created[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn(&la[i]); // 스레드를 못 만들면 직접 처리
+    }
+}
+/*--------------------------------------------------------------------*/
+ssize_t hash_load(hashtable_t *table, const hash_entry_t *entries, size_t n,
+                  int num_threads)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || (!entries && n) || table->num_entries)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (table->mm)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (table->ht->next)
     {
+        errno = EINVAL;
         return -1;
     }
 
-    node_t *node = table->buckets[idx];
-    node_t *prev = NULL;
+    struct load_arg *la;
+    node_t **nodes;
+    size_t *idx, i, size = table->ht->hash_size, bytes = 0, dropped = 0;
+    ssize_t loaded = 0;
+    htab_t *ht;
+    int t, error = 0;
+
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
 
-    while (node)
+    // 한 번에 올바른 크기로 만들어 resize를 거치지 않는다
+    if (table->flags & HASH_RESIZE)
     {
-        if (strcmp(node->key, key) == 0)
+        while (n > size * HASH_MAX_LOAD)
         {
-            if (prev)
+            size *= 2;
+        }
+        if (size != table->ht->hash_size)
+        {
+            ht = htab_alloc(size, HASH_LOCKS_OF(table->flags), table->delay);
+            if (ht == NULL)
             {
-                prev->next = node->next;
+                return -1;
             }
-            else
+            htab_free(table->ht);
+            table->ht = ht;
+        }
+    }
+
+    nodes = calloc(n, sizeof(node_t *));
+    idx = calloc(n, sizeof(size_t));
+    la = calloc(num_threads, sizeof(struct load_arg));
+    if ((n && (!nodes || !idx)) || !la)
+    {
+        DEBUG_PRINT("Failed to allocate memory for bulk load");
+        free(nodes);
+        free(idx);
+        free(la);
+        return -1;
+    }
+    for (t = 0; t < num_threads; t++)
+    {
+        la[t].table = table;
+        la[t].entries = entries;
+        la[t].nodes = nodes;
+        la[t].idx = idx;
+        la[t].n = n;
+        la[t].num_threads = num_threads;
+        la[t].t = t;
+        la[t].error = &error;
+    }
+
+    load_run(la, num_threads, load_nodes);
+    if (!error)
+    {
+        load_run(la, num_threads, load_link);
+    }
+
+    for (t = 0; t < num_threads; t++)
+    {
+        loaded += la[t].loaded;
+        bytes += la[t].bytes;
+        dropped += la[t].dropped;
+    }
+    if (dropped)
+    {
+        DEBUG_PRINT("Left %zu entries out under the memory limit", dropped);
+    }
+    if (error)
+    {
+        // 만들어진 node를 모두 버린다
+        for (i = 0; i < n; i++)
+        {
+            if (nodes[i])
             {
-                table->buckets[idx] = node->next;
+                node_free(nodes[i]);
             }
-            free(node->key);
-            free(node->value);
-            free(node);
-            table->bucket_sizes[idx]--;
-            rwlock_write_unlock(&table->locks[idx]);
-            return 1; // deleted
         }
-        prev = node;
-        node = node->next;
     }
+    table->num_entries += loaded;
+    table->mem_used += bytes;
 
-    rwlock_write_unlock(&table->locks[idx]);
+    free(nodes);
+    free(idx);
+    free(la);
     /*--------------------------------------------------------------------*/
-    return 0; // not found
+    return error ? -1 : loaded;
 }
 /*--------------------------------------------------------------------*/
 /**
@@ -304,34 +2937,50 @@ int hash_delete(hashtable_t *table, const char *key)
 void hash_dump(hashtable_t *table)
 {
     TRACE_PRINT();
-    node_t *node;
-    int i;
-    size_t total_entries = 0;
+    htab_t *ht;
+    hblock_t *blk;
+    size_t i;
+    int j;
 
-    printf("[Hash Table Dump]");
-    for (i = 0; i < table->hash_size; i++)
+    if (table->mm)
     {
-        total_entries += table->bucket_sizes[i];
+        mmtable_dump(table);
+        return;
     }
-    printf("Total Entries: %ld\n", total_entries);
 
-    for (i = 0; i < table->hash_size; i++)
+    printf("[Hash Table Dump]");
+    printf("Total Entries: %ld\n", table->num_entries);
+
+    // resize 중이면 아직 옮겨지지 않은 bucket과 새 세대를 모두 출력
+    for (ht = table->ht; ht; ht = ht->next)
     {
-        if (!table->bucket_sizes[i])
+        if (ht != table->ht)
         {
-            continue;
+            printf("Resizing to %ld buckets\n", ht->hash_size);
         }
-        printf("Bucket %d: %ld entries\n", i, table->bucket_sizes[i]);
-        printf("  Lock State -> Read Count: %d, Write Count: %d\n",
-               rwlock_current_readers(&table->locks[i]),
-               rwlock_current_writers(&table->locks[i]));
-        node = table->buckets[i];
-        while (node)
+        for (i = 0; i < ht->hash_size; i++)
         {
-            printf("    K/V: %s / %s\n", node->key, node->value);
-            node = node->next;
+            if (!ht->buckets[i].size)
+            {
+                continue;
+            }
+            printf("Bucket %ld: %u entries\n", i, ht->buckets[i].size);
+            printf("  Lock State -> Read Count: %d, Write Count: %d\n",
+                   rwlock_current_readers(bucket_lock(ht, i)),
+                   rwlock_current_writers(bucket_lock(ht, i)));
+            for (blk = &ht->buckets[i]; blk; blk = blk->next)
+            {
+                for (j = 0; j < HASH_BLOCK_SLOTS; j++)
+                {
+                    if (blk->nodes[j])
+                    {
+                        printf("    K/V: %s / %s\n", blk->nodes[j]->key,
+                               blk->nodes[j]->value->data);
+                    }
+                }
+            }
         }
     }
     printf("End of Dump\n");
 }
-/*--------------------------------------------------------------------*/
\ No newline at end of file
+/*--------------------------------------------------------------------*/
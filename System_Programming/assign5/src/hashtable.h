@@ -9,27 +9,171 @@
 #include <stdlib.h>
 #include <string.h>
 #include "rwlock.h"
+#include "ebr.h"
+#include "hashfn.h"
+#include "slab.h"
+#include "wheel.h"
 #include "common.h"
 /*--------------------------------------------------------------------*/
 #define DEFAULT_HASH_SIZE 1024
 /*--------------------------------------------------------------------*/
+/* hash_init() flags */
+#define HASH_LOCKFREE_READ 0x1 // lookups do not take the bucket lock
+#define HASH_RESIZE 0x2        // grow and shrink with the number of entries
+#define HASH_SEQLOCK_READ 0x4  // lookups validate by the lock sequence
+#define HASH_FN_SHIFT 8        // enum HASH_FN (hashfn.h) in bits 8 ~ 11
+#define HASH_FN_FLAG(fn) ((fn) << HASH_FN_SHIFT)
+#define HASH_FN_OF(flags) (((flags) >> HASH_FN_SHIFT) & 0xf)
+#define HASH_LOCKS_SHIFT 12    // log2 of the lock stripes in bits 12 ~ 16
+#define HASH_LOCKS_FLAG(bits) ((bits) << HASH_LOCKS_SHIFT)
+#define HASH_LOCKS_OF(flags) (((flags) >> HASH_LOCKS_SHIFT) & 0x1f)
+/*--------------------------------------------------------------------*/
+/* HASH_RESIZE tunables */
+#define HASH_MAX_LOAD 2     // grow x2 above this many entries per bucket
+#define HASH_MIN_LOAD_DIV 8 // shrink /2 below 1/8 entries per bucket
+#define HASH_REHASH_STEP 4  // non-empty buckets migrated by each write
+/* HASH_SEQLOCK_READ tunables */
+#define HASH_SEQ_TRIES 4 // optimistic reads before taking the lock
+/*--------------------------------------------------------------------*/
+typedef struct value_t
+{
+    size_t size;
+    uint32_t refs; // the table's and hash_read_ref()'s, 0 inside a node
+    char data[];   // size bytes followed by '\0'
+} value_t;
+/*--------------------------------------------------------------------*/
+#define HASH_INLINE_VALUE 64 // values up to this size live inside the node
+/*--------------------------------------------------------------------*/
+/* one entry, allocated together with its key and a small value */
 typedef struct node_t
 {
-    char *key;
-    size_t key_size;
-    char *value;
-    size_t value_size;
-    struct node_t *next;
+    uint64_t hash;      // cached hash of key, compared before the key
+    value_t *value;     // immutable, replaced as a whole on update
+    uint64_t expire;    // deadline in ms of hash_clock(), 0 for none
+    uint8_t key_size;
+    uint8_t inline_cap; // longest value that fits in inline_value
+    uint8_t ref;        // access bit: set by reads, cleared by eviction
+    char key[MAX_KEY_LEN + 1];
+    _Alignas(value_t) char inline_value[]; // value_t of a small value
 } node_t;
 /*--------------------------------------------------------------------*/
-typedef struct hashtable_t
+#define HASH_CACHE_LINE 64
+#define HASH_BLOCK_SLOTS 5
+/**
+ * one cache line of a bucket chain. The first block of each bucket is
+ * the bucket itself: it also holds the bucket's size, migration state
+ * and snapshot id, so a lookup or write touches one line besides the
+ * lock.
+ */
+typedef struct hblock_t
+{
+    node_t *nodes[HASH_BLOCK_SLOTS]; // NULL for a free slot
+    uint8_t tags[HASH_BLOCK_SLOTS];  // 8 bits of each node's hash
+    /* first block of a bucket only */
+    uint8_t state;                   // enum BUCKET_STATE (hashtable.c)
+    uint32_t size;                   // number of entries in the bucket
+    uint32_t snap_id;                // last hash_snapshot() that saw it
+    struct hblock_t *next;           // overflow block
+} __attribute__((aligned(HASH_CACHE_LINE))) hblock_t;
+/*--------------------------------------------------------------------*/
+/* one generation of the bucket array */
+typedef struct htab_t
 {
-    node_t **buckets;
-    rwlock_t *locks;
-    size_t *bucket_sizes; // number of entries in each bucket
+    hblock_t *buckets;     // first block of each bucket, inline
+    rwlock_t *locks;       // bucket i takes locks[i & lock_mask]
+    size_t num_locks;
+    size_t lock_mask;      // SIZE_MAX for one lock per bucket
     size_t hash_size;
+    size_t rehash_idx;     // next bucket to migrate
+    size_t rehash_done;    // buckets already migrated
+    struct htab_t *next;   // generation being resized into, or NULL
+} htab_t;
+/*--------------------------------------------------------------------*/
+/* writes reported to the log hook */
+enum HASH_OP
+{
+    HASH_OP_INSERT,
+    HASH_OP_UPDATE,
+    HASH_OP_DELETE,
+    HASH_OP_EXPIRE
+};
+/**
+ * Called under the bucket lock before a write is applied, so the calls
+ * for one key come in the order the writes hit the table.
+ * value is NULL for HASH_OP_DELETE, and the 8-byte deadline (host byte
+ * order, 0 for none) for HASH_OP_EXPIRE, which follows every insert or
+ * update given a TTL. A key reclaimed on expiry is logged as deleted.
+ * Returns -1 when any internal errors occur, and the write is dropped.
+ */
+typedef int (*hash_log_fn)(void *arg, int op, const char *key,
+                           size_t key_len, const char *value,
+                           size_t value_len);
+/* entry visitor of hash_scan(); expire is the deadline, or 0 */
+typedef int (*hash_scan_fn)(void *arg, const char *key, size_t key_len,
+                            const char *value, size_t value_len,
+                            uint64_t expire);
+/* result visitor of hash_mread(); value is NULL when key i is missing */
+typedef int (*hash_mread_fn)(void *arg, size_t i, const char *value,
+                             size_t value_len);
+/*--------------------------------------------------------------------*/
+struct mmtable; // mmtable.h
+typedef struct hashtable_t
+{
+    htab_t *ht;         // oldest live generation
+    size_t num_entries;
+    size_t min_size;    // never shrink below the initial size
+    int delay;
+    int flags;
+    hash_fn_t hash_fn;
+    uint64_t seed[2];   // random per table, unused by HASH_FN_LEGACY
+    hash_log_fn log_fn; // see hash_set_log()
+    void *log_arg;
+    /* hash_snapshot() in progress */
+    pthread_mutex_t snap_lock; // orders snapshot starts and new generations
+    int snap_active;
+    uint32_t snap_id;
+    hash_scan_fn snap_fn;
+    void *snap_arg;
+    int snap_error;
+    struct mmtable *mm; // storage of hash_open(), NULL for hash_init()
+    struct wheel *wheel; // expiry timers, created by the first TTL
+    int ttl_hold;        // see hash_hold_ttl()
+    /* hash_set_limit() */
+    size_t mem_limit;  // 0 for no limit
+    size_t mem_used;   // bytes of the linked nodes, keys and values
+    size_t clock_hand; // next bucket the eviction hand visits
+    size_t evictions;
 } hashtable_t;
 /*--------------------------------------------------------------------*/
+/* one entry handed to hash_load(); key and value need not be strings */
+typedef struct hash_entry_t
+{
+    const char *key;
+    const char *value;
+    size_t key_size;
+    size_t value_len;
+    uint64_t expire; // deadline for hash_load() and hash_mset(), or 0
+} hash_entry_t;
+/*--------------------------------------------------------------------*/
+#define HASH_MULTI_MAX 256 // keys of one hash_mread(), hash_mset(), ...
+/*--------------------------------------------------------------------*/
+#define HASH_STATS_CHAINS 8 // chain lengths counted one by one
+/* bucket distribution reported by hash_stats() */
+typedef struct hash_stats_t
+{
+    int hash_fn;        // enum HASH_FN
+    size_t hash_size;   // buckets of the newest generation
+    size_t num_entries;
+    size_t max_chain;
+    /* chains[i]: buckets holding i entries,
+       chains[HASH_STATS_CHAINS]: buckets holding more */
+    size_t chains[HASH_STATS_CHAINS + 1];
+    size_t hot_buckets; // bucket locks whose readers use per-thread slots
+    size_t mem_used;    // see hash_set_limit()
+    size_t mem_limit;
+    size_t evictions;
+} hash_stats_t;
+/*--------------------------------------------------------------------*/
 /**
  * Calculates hash of key
  */
@@ -37,8 +181,77 @@ int hash(const char *key, size_t hash_size);
 /*--------------------------------------------------------------------*/
 /**
  * Initializes a hash table
+ *
+ * With HASH_LOCKFREE_READ in flags, hash_read() walks the bucket
+ * without taking its rwlock. Writers still serialize on the bucket
+ * lock, publish nodes and values with atomic stores and retire
+ * unlinked ones through EBR (ebr.h). Reads then ignore quick and
+ * the rwlock delay.
+ *
+ * With HASH_SEQLOCK_READ in flags, hash_read() copies the value
+ * without taking nor writing the bucket lock, and keeps the copy only
+ * if the sequence of the lock (rwlock_seq_begin()) did not move
+ * meanwhile; after HASH_SEQ_TRIES collisions with writers it reads
+ * under the lock, so only those reads honor quick and the rwlock
+ * delay. Small values are still rewritten in place, and
+ * unlinked memory is retired through EBR as with HASH_LOCKFREE_READ.
+ * The two flags exclude each other.
+ *
+ * With HASH_RESIZE in flags, the bucket array doubles when the load
+ * factor exceeds HASH_MAX_LOAD and halves when it drops below
+ * 1/HASH_MIN_LOAD_DIV. Entries are moved to the new array a few
+ * buckets at a time by the following writes, so no single request
+ * pays for a full rehash; lookups check both arrays meanwhile.
+ *
+ * HASH_LOCKS_FLAG(bits) in flags stripes the bucket locks: bucket i
+ * then shares lock i % 2^bits with the other buckets of that stripe,
+ * so the locks cost the same however many buckets there are. Without
+ * it (bits 0), or with more stripes than buckets, every bucket has
+ * its own lock.
+ *
+ * HASH_FN_FLAG(fn) in flags selects the hash function family
+ * (HASH_FN_FAST by default). Seeded families draw a random seed
+ * for every table.
  */
-hashtable_t *hash_init(size_t hash_size, int delay);
+hashtable_t *hash_init(size_t hash_size, int delay, int flags);
+/*--------------------------------------------------------------------*/
+/**
+ * Opens a hash table resident in the memory-mapped file at path
+ * (mmtable.h), creating it with hash_size buckets if it does not exist.
+ * A reopened table serves at once, keeping the bucket count, hash
+ * function and seed it was created with; one not closed cleanly by
+ * hash_destroy() is checked and repaired first.
+ * HASH_LOCKFREE_READ, HASH_SEQLOCK_READ, HASH_RESIZE and lock stripes
+ * are not supported, nor are hash_snapshot() and hash_load().
+ * Returns NULL with errno EBADMSG when the file is not a table.
+ * Returns NULL when any internal errors occur.
+ */
+hashtable_t *hash_open(const char *path, size_t hash_size, int delay,
+                       int flags);
+/*--------------------------------------------------------------------*/
+/**
+ * Makes every following insert, update and delete call fn first.
+ * Pass NULL to stop logging. Not thread-safe against concurrent writes.
+ */
+void hash_set_log(hashtable_t *table, hash_log_fn fn, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Caps the memory held by the keys and values of the table at bytes
+ * (0 for no cap), counting every node, key and value as the size
+ * class it takes in the slab allocator.
+ * A write that would go over the cap first evicts keys by CLOCK, an
+ * approximation of LRU: a hand sweeps the buckets, clearing the
+ * access bit that reads set on a key and evicting the first key found
+ * with the bit clear, so a key read since the last sweep survives it.
+ * Writers share only the hand and lock one bucket at a time, so
+ * writes running at once may overshoot the cap by what they add.
+ * Evicted keys are logged as deleted. The write fails with ENOMEM
+ * when nothing is left to evict.
+ * Call before serving any request.
+ * Returns -1 with errno ENOTSUP in hash_open() tables.
+ * Returns 0 on success.
+ */
+int hash_set_limit(hashtable_t *table, size_t bytes);
 /*--------------------------------------------------------------------*/
 /**
  * Destroys a hash table
@@ -53,6 +266,43 @@ int hash_destroy(hashtable_t *table);
  */
 int hash_insert(hashtable_t *table, const char *key, const char *value);
 /*--------------------------------------------------------------------*/
+/**
+ * Same as hash_insert(), but the value is value_len opaque bytes
+ * that may contain spaces or '\0'.
+ */
+int hash_insert_n(hashtable_t *table, const char *key,
+                  const char *value, size_t value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Same as hash_insert_n(), but the entry expires at expire, a deadline
+ * in ms of hash_clock() (0 for none). An expired key reads as missing
+ * at once and is reclaimed by the table's timing wheel (wheel.h) soon
+ * after, so no scan of the buckets is ever needed; an insert over it
+ * succeeds.
+ * Returns -1 with errno ENOTSUP for a TTL in hash_open() tables.
+ */
+int hash_insert_ex(hashtable_t *table, const char *key, const char *value,
+                   size_t value_len, uint64_t expire);
+/*--------------------------------------------------------------------*/
+/**
+ * Allocates a value of value_len bytes for hash_insert_value() or
+ * hash_update_value(), to be filled by the caller (e.g. straight from
+ * a socket); data[value_len] is already '\0'. A value never handed to
+ * the table is freed with hash_release().
+ * Returns NULL when any internal errors occur.
+ */
+value_t *hash_value_alloc(size_t value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Same as hash_insert_ex(), but links value of hash_value_alloc() to
+ * the entry instead of copying it (a value of HASH_INLINE_VALUE bytes
+ * or less is still copied into the node). value is taken over in every
+ * case, and freed unless inserted.
+ * Returns -1 with errno ENOTSUP in hash_open() tables.
+ */
+int hash_insert_value(hashtable_t *table, const char *key, value_t *value,
+                      uint64_t expire);
+/*--------------------------------------------------------------------*/
 /**
  * Searches a key-value pair in the hash table,
  * and copy the searched value to dst.
@@ -66,6 +316,36 @@ int hash_insert(hashtable_t *table, const char *key, const char *value);
 int hash_read(hashtable_t *table, const char *key, char *dst,
               int quick);
 /*--------------------------------------------------------------------*/
+/**
+ * Same as hash_read(), but copies at most dst_size bytes and
+ * sets value_len (if not NULL) to the length of the value.
+ * dst is null-terminated only when the value is shorter than dst_size.
+ * Returns -1 with errno ENOSPC when the value does not fit in dst.
+ */
+int hash_read_n(hashtable_t *table, const char *key, char *dst,
+                size_t dst_size, size_t *value_len, int quick);
+/*--------------------------------------------------------------------*/
+/**
+ * Same as hash_read_n(), but a value kept outside its node (longer
+ * than HASH_INLINE_VALUE) is not copied: ref is set to the value
+ * itself, pinned so that it stays intact after the key is updated or
+ * deleted, until hash_release(). A smaller value is copied to dst and
+ * ref set to NULL, and so is every value when ref is NULL.
+ * The read lock is held only to pin or copy the value.
+ * Returns -1 with errno ENOSPC when a copied value does not fit in dst.
+ */
+int hash_read_ref(hashtable_t *table, const char *key, char *dst,
+                  size_t dst_size, size_t *value_len, const value_t **ref,
+                  int quick);
+/*--------------------------------------------------------------------*/
+/**
+ * Unpins a value pinned by hash_read_ref(), freeing it if the table
+ * has let it go meanwhile, or frees a value of hash_value_alloc().
+ * May be called from any thread, but every value must be released
+ * before its table is destroyed.
+ */
+void hash_release(const value_t *ref);
+/*--------------------------------------------------------------------*/
 /**
  * Updates a key-value pair in the hash table.
  * Returns -1 when any internal errors occur.
@@ -74,6 +354,53 @@ int hash_read(hashtable_t *table, const char *key, char *dst,
  */
 int hash_update(hashtable_t *table, const char *key, const char *value);
 /*--------------------------------------------------------------------*/
+/**
+ * Same as hash_update(), but the value is value_len opaque bytes.
+ */
+int hash_update_n(hashtable_t *table, const char *key,
+                  const char *value, size_t value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Same as hash_update_n(), but the entry then expires at expire
+ * (0 for none) like hash_insert_ex(); an update without a TTL
+ * drops the one the key had. An expired key is not found.
+ */
+int hash_update_ex(hashtable_t *table, const char *key, const char *value,
+                   size_t value_len, uint64_t expire);
+/*--------------------------------------------------------------------*/
+/**
+ * Same as hash_update_ex(), but takes over value of hash_value_alloc()
+ * like hash_insert_value().
+ * Returns -1 with errno ENOTSUP in hash_open() tables.
+ */
+int hash_update_value(hashtable_t *table, const char *key, value_t *value,
+                      uint64_t expire);
+/*--------------------------------------------------------------------*/
+/**
+ * Makes key expire at expire, a deadline in ms of hash_clock(),
+ * or never when expire is 0. A deadline already past expires it.
+ * Returns -1 with errno ENOTSUP in hash_open() tables.
+ * Returns -1 when any internal errors occur.
+ * Returns 1 when successfully set.
+ * Returns 0 when there is no such key found (or it expired).
+ */
+int hash_expire(hashtable_t *table, const char *key, uint64_t expire);
+/*--------------------------------------------------------------------*/
+/**
+ * While hold is set, no key expires: past deadlines count as not yet
+ * reached, so a replayed log applies its writes as they were made.
+ * Keys due meanwhile expire once it is cleared. Setting it also waits
+ * for an expiry already under way, so that no key is removed after
+ * the return, e.g. while the table is dumped at shutdown.
+ */
+void hash_hold_ttl(hashtable_t *table, int hold);
+/*--------------------------------------------------------------------*/
+/**
+ * Current time in ms, the clock of every deadline (wall clock, so
+ * deadlines stay meaningful across restarts).
+ */
+uint64_t hash_clock(void);
+/*--------------------------------------------------------------------*/
 /**
  * Deletes a key-value pair from the hash table.
  * Returns -1 when any internal errors occur.
@@ -82,6 +409,92 @@ int hash_update(hashtable_t *table, const char *key, const char *value);
  */
 int hash_delete(hashtable_t *table, const char *key);
 /*--------------------------------------------------------------------*/
+/**
+ * Looks up the n (at most HASH_MULTI_MAX) keys of keys[] at once and
+ * calls fn for each of them in order, with its value or NULL.
+ * All the hashes are computed first and the buckets and first nodes
+ * prefetched, so the cache misses of different keys overlap.
+ * The buckets are read-locked together, in bucket order, so the keys
+ * are read as of one moment; with HASH_LOCKFREE_READ no lock is taken,
+ * and with HASH_RESIZE and in hash_open() tables one bucket is locked
+ * at a time instead.
+ * fn runs under the locks, and its value is valid only until it
+ * returns; the first fn returning -1 stops the lookups.
+ * Returns -1 when any internal errors occur or fn returned -1.
+ * Returns 0 on success.
+ */
+int hash_mread(hashtable_t *table, const hash_entry_t *keys, size_t n,
+               int quick, hash_mread_fn fn, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Inserts or replaces the n (at most HASH_MULTI_MAX) entries at once,
+ * the later of duplicate keys winning, and sets rets[i] to 1 when
+ * entry i was inserted, 0 when it replaced a value, -1 on failure.
+ * The buckets are write-locked together, in bucket order, so readers
+ * see all the writes or none; with HASH_RESIZE and in hash_open()
+ * tables the entries are written one by one instead.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int hash_mset(hashtable_t *table, const hash_entry_t *entries, size_t n,
+              int *rets);
+/*--------------------------------------------------------------------*/
+/**
+ * Deletes the n (at most HASH_MULTI_MAX) keys of keys[] at once like
+ * hash_mset(), setting rets[i] as hash_delete() would return.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int hash_mdelete(hashtable_t *table, const hash_entry_t *keys, size_t n,
+                 int *rets);
+/*--------------------------------------------------------------------*/
+/**
+ * Collects the chain length histogram of the hash table.
+ * Bucket sizes are read without locks, so the result is approximate
+ * while writers run. During a resize, every bucket that still holds
+ * entries in either array is counted.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int hash_stats(hashtable_t *table, hash_stats_t *st);
+/*--------------------------------------------------------------------*/
+/**
+ * Calls fn for every entry, holding the read lock of one bucket at a
+ * time, and stops at the first fn returning -1. Expired keys are skipped.
+ * Entries written during the scan may be seen or not; during a resize
+ * an entry may be seen twice, once in each array.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int hash_scan(hashtable_t *table, hash_scan_fn fn, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Calls fn for every entry as of the start of the call (a consistent
+ * point-in-time view), without ever holding more than one bucket lock.
+ * The caller visits the buckets one by one; a writer about to change a
+ * bucket not visited yet visits it first, so fn is also called from
+ * writer threads, concurrently, and must be thread-safe.
+ * Only one snapshot runs at a time.
+ * Returns -1 with errno EBUSY when another snapshot is running.
+ * Returns -1 when any internal errors occur or fn returned -1.
+ * Returns 0 on success.
+ */
+int hash_snapshot(hashtable_t *table, hash_scan_fn fn, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Bulk-loads n entries into an empty table with num_threads threads,
+ * building the nodes in parallel and linking every bucket without
+ * locks. With HASH_RESIZE the bucket array is sized for n first.
+ * Duplicate keys keep the first entry, and expired ones are skipped;
+ * so are the entries that would take the table over its memory limit
+ * (see hash_set_limit()), which thus never starts out above it.
+ * Call before the table is shared with other threads.
+ * Returns -1 when any internal errors occur.
+ * Returns the number of loaded entries on success.
+ */
+ssize_t hash_load(hashtable_t *table, const hash_entry_t *entries, size_t n,
+                  int num_threads);
+/*--------------------------------------------------------------------*/
 /**
  * Dumps the hash table
  */
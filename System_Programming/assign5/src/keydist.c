@@ -0,0 +1,61 @@
+/*--------------------------------------------------------------------*/
+/* keydist.c                                                          */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <math.h>
+#include "keydist.h"
+/*--------------------------------------------------------------------*/
+uint64_t keydist_scramble(uint64_t v)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        h ^= v & 0xff;
+        h *= 0x100000001B3ULL;
+        v >>= 8;
+    }
+    return h;
+}
+/*--------------------------------------------------------------------*/
+int keydist_zipf_init(struct keydist_zipf *z, uint64_t n, double theta)
+{
+    TRACE_PRINT();
+    double zeta2;
+    uint64_t i;
+
+    if (n < 2 || !(theta > 0.0 && theta < 1.0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0.0;
+    for (i = 1; i <= n; i++)
+    {
+        z->zetan += 1.0 / pow((double)i, theta);
+    }
+    zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+    z->half_pow = pow(0.5, theta);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+uint64_t keydist_zipf(const struct keydist_zipf *z, uint64_t *s)
+{
+    double u = keydist_rand01(s), uz = u * z->zetan;
+    uint64_t r;
+
+    // 상위 두 rank는 따로 처리하고 나머지는 역함수로 근사
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + z->half_pow)
+        return 1;
+    r = (uint64_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+/*--------------------------------------------------------------------*/
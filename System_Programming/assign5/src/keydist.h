@@ -0,0 +1,65 @@
+/*--------------------------------------------------------------------*/
+/* keydist.h                                                          */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _KEYDIST_H
+#define _KEYDIST_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Random key choice for the load generator and the benchmark:
+ * a per-thread xorshift64* generator and the zipfian distribution of
+ * Gray et al. ("Quickly generating billion-record synthetic
+ * databases"), the one YCSB uses, where rank r is drawn with
+ * probability proportional to 1 / (r + 1)^theta.
+ */
+struct keydist_zipf
+{
+    uint64_t n;
+    double theta;
+    double zetan; // sum of 1 / i^theta for i = 1 ~ n
+    double alpha;
+    double eta;
+    double half_pow; // 0.5^theta
+};
+/*--------------------------------------------------------------------*/
+/* next value of the generator whose nonzero state is s */
+static inline uint64_t keydist_rand(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+/*--------------------------------------------------------------------*/
+/* uniform in [0, 1) */
+static inline double keydist_rand01(uint64_t *s)
+{
+    return (keydist_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Mixes v (64-bit FNV-1a of its bytes), e.g. to spread the popular
+ * zipfian ranks over the key space (YCSB's scrambled zipfian) or to
+ * seed a generator.
+ */
+uint64_t keydist_scramble(uint64_t v);
+/*--------------------------------------------------------------------*/
+/**
+ * Prepares z for ranks in [0, n) with skew theta (0 < theta < 1).
+ * Takes O(n) time.
+ * Returns -1 when the arguments are out of range.
+ * Returns 0 on success.
+ */
+int keydist_zipf_init(struct keydist_zipf *z, uint64_t n, double theta);
+/*--------------------------------------------------------------------*/
+/**
+ * Draws a rank in [0, n), 0 the most popular, with the generator s.
+ */
+uint64_t keydist_zipf(const struct keydist_zipf *z, uint64_t *s);
+/*--------------------------------------------------------------------*/
+#endif // _KEYDIST_H
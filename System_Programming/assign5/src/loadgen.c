@@ -0,0 +1,738 @@
+/*--------------------------------------------------------------------*/
+/* loadgen.c                                                          */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "common.h"
+#include "stats.h"
+#include "keydist.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Load generator for the SKVS text protocol.
+ * Each thread drives its share of the connections with poll(),
+ * keeping up to -d requests in flight per connection.
+ * Closed loop sends the next request as soon as a slot frees up.
+ * Open loop (-r) gives every request an intended start time on a
+ * fixed schedule and measures latency from that time, not from when
+ * it could actually be sent, so a stalled server is charged for the
+ * requests queued behind the stall (no coordinated omission).
+ */
+#define LG_MAX_DEPTH 1024
+#define LG_RBUF_SIZE (16 * BUF_SIZE)
+#define LG_WBUF_SIZE (4 * BUF_SIZE)
+#define LG_LOAD_BATCH 128 // CREATEs pipelined per round while loading
+#define LG_ZIPF_THETA 0.99
+#define LG_MAX_SCAN 100
+#define LG_DRAIN_NS 2000000000ULL // waits this long for late responses
+/*--------------------------------------------------------------------*/
+/* operations, each with its own latency histogram */
+enum LG_OP
+{
+    LG_READ,
+    LG_QREAD,
+    LG_UPDATE,
+    LG_INSERT, // CREATE of a new key
+    LG_SCAN,   // MGET of consecutive keys, as SKVS has no range scan
+    LG_RMW,    // READ then UPDATE of the same key
+    LG_OPS
+};
+static const char *g_op_names[LG_OPS] = {
+    "READ", "QREAD", "UPDATE", "INSERT", "SCAN", "RMW"};
+/*--------------------------------------------------------------------*/
+/* YCSB core workloads; reads go out as QREAD with -q probability */
+struct lg_workload
+{
+    char name;
+    double read, update, insert, scan, rmw;
+    int latest; // reads favor the newest keys (D)
+};
+static const struct lg_workload g_workloads[] = {
+    {'A', 0.50, 0.50, 0.00, 0.00, 0.00, 0},
+    {'B', 0.95, 0.05, 0.00, 0.00, 0.00, 0},
+    {'C', 1.00, 0.00, 0.00, 0.00, 0.00, 0},
+    {'D', 0.95, 0.00, 0.05, 0.00, 0.00, 1},
+    {'E', 0.00, 0.00, 0.05, 0.95, 0.00, 0},
+    {'F', 0.50, 0.00, 0.00, 0.00, 0.50, 0}};
+/*--------------------------------------------------------------------*/
+/* a request in flight */
+struct lg_req
+{
+    uint64_t start; // intended (open loop) or actual send time
+    int op;
+    int lines; // response lines still to come
+};
+struct lg_conn
+{
+    int fd;
+    int dead;                         // closed by the server
+    struct lg_req reqs[LG_MAX_DEPTH]; // ring of requests in flight
+    size_t head, count;
+    uint64_t next_due; // open loop: intended time of the next request
+    size_t rlen;
+    char rbuf[LG_RBUF_SIZE];
+};
+struct lg_thread
+{
+    pthread_t thread;
+    int idx;
+    struct lg_conn *conns;
+    int num_conns;
+    uint64_t rng;
+    /* results */
+    struct stats_hist hist[LG_OPS];
+    uint64_t errors;
+};
+/*--------------------------------------------------------------------*/
+/* run parameters, set once by main() */
+static struct sockaddr_in g_addr;
+static const struct lg_workload *g_wl;
+static int g_num_threads = 2;
+static int g_num_conns = 8;
+static int g_depth = 1;
+static int g_zipfian = 1;
+static uint64_t g_records = 100000;
+static size_t g_value_size = 100;
+static double g_qread = 0.0;
+static double g_rate = 0.0; // requests/s over all connections, 0: closed
+static int g_seconds = 10;
+static int g_max_scan;
+static char *g_value;
+static struct keydist_zipf g_zipf; // over g_records
+/* the next key an INSERT creates */
+static uint64_t g_next_key;
+static uint64_t g_start_ns, g_end_ns;
+/*--------------------------------------------------------------------*/
+/* key number of the next request */
+static uint64_t lg_key(uint64_t *s)
+{
+    uint64_t last;
+
+    if (g_wl->latest)
+    {
+        // workload D: 최근에 넣은 key일수록 자주 읽는다
+        last = __atomic_load_n(&g_next_key, __ATOMIC_RELAXED) - 1;
+        return last - (g_zipfian ? keydist_zipf(&g_zipf, s)
+                                 : keydist_rand(s) % g_records);
+    }
+    if (!g_zipfian)
+        return keydist_rand(s) % g_records;
+    // 인기 key가 한 곳에 몰리지 않도록 rank를 섞는다 (scrambled zipfian)
+    return keydist_scramble(keydist_zipf(&g_zipf, s)) % g_records;
+}
+/*--------------------------------------------------------------------*/
+static int lg_connect(void)
+{
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0)
+    {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+/*--------------------------------------------------------------------*/
+/* sends all len bytes. Returns -1 when the connection fails. */
+static int lg_send(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * appends a request of a random operation to wbuf and queues it on c
+ * with the given start time.
+ * Returns the length of the request.
+ */
+static size_t lg_request(struct lg_thread *t, struct lg_conn *c,
+                         uint64_t start, char *wbuf)
+{
+    const struct lg_workload *wl = g_wl;
+    struct lg_req *r = &c->reqs[(c->head + c->count) % LG_MAX_DEPTH];
+    double p = keydist_rand01(&t->rng);
+    uint64_t key;
+    size_t len = 0;
+    int i, n;
+
+    r->start = start;
+    r->lines = 1;
+    if (p < wl->read)
+    {
+        r->op = keydist_rand01(&t->rng) < g_qread ? LG_QREAD : LG_READ;
+        len = sprintf(wbuf, "%s user%012llu\n", g_op_names[r->op],
+                      (unsigned long long)lg_key(&t->rng));
+    }
+    else if ((p -= wl->read) < wl->update)
+    {
+        r->op = LG_UPDATE;
+        len = sprintf(wbuf, "UPDATE user%012llu %s\n",
+                      (unsigned long long)lg_key(&t->rng), g_value);
+    }
+    else if ((p -= wl->update) < wl->insert)
+    {
+        r->op = LG_INSERT;
+        key = __atomic_fetch_add(&g_next_key, 1, __ATOMIC_RELAXED);
+        len = sprintf(wbuf, "CREATE user%012llu %s\n",
+                      (unsigned long long)key, g_value);
+    }
+    else if ((p -= wl->insert) < wl->scan)
+    {
+        // SCAN: 연속한 key 번호를 MGET으로 읽는다
+        r->op = LG_SCAN;
+        key = lg_key(&t->rng);
+        n = 1 + keydist_rand(&t->rng) % g_max_scan;
+        r->lines = n + 1; // 값 n줄과 END
+        len = sprintf(wbuf, "MGET");
+        for (i = 0; i < n; i++)
+        {
+            len += sprintf(wbuf + len, " user%012llu",
+                           (unsigned long long)(key + i));
+        }
+        wbuf[len++] = '\n';
+    }
+    else
+    {
+        r->op = LG_RMW;
+        r->lines = 2;
+        key = lg_key(&t->rng);
+        len = sprintf(wbuf, "READ user%012llu\nUPDATE user%012llu %s\n",
+                      (unsigned long long)key, (unsigned long long)key,
+                      g_value);
+    }
+
+    c->count++;
+    return len;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * sends the requests c may send now, as one batch.
+ * Returns -1 when the connection fails.
+ */
+static int lg_issue(struct lg_thread *t, struct lg_conn *c, uint64_t now)
+{
+    char wbuf[LG_WBUF_SIZE];
+    size_t len = 0;
+    uint64_t interval;
+
+    if (c->dead)
+    {
+        return 0;
+    }
+    interval = g_rate > 0 ? (uint64_t)(1e9 * g_num_conns / g_rate) : 0;
+    while (c->count < (size_t)g_depth && len + BUF_SIZE <= sizeof(wbuf))
+    {
+        if (g_rate > 0)
+        {
+            // open loop: 예정 시각이 된 요청만, latency는 예정 시각부터
+            if (c->next_due > now || c->next_due >= g_end_ns)
+                break;
+            len += lg_request(t, c, c->next_due, wbuf + len);
+            c->next_due += interval;
+        }
+        else
+        {
+            if (now >= g_end_ns)
+                break;
+            len += lg_request(t, c, now, wbuf + len);
+        }
+    }
+    return len > 0 ? lg_send(c->fd, wbuf, len) : 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * reads the responses waiting on c and completes their requests.
+ * Returns -1 when the connection is closed or fails.
+ */
+static int lg_receive(struct lg_thread *t, struct lg_conn *c)
+{
+    struct lg_req *r;
+    char *line, *lf, *end;
+    uint64_t now;
+    ssize_t n;
+
+    n = recv(c->fd, c->rbuf + c->rlen, sizeof(c->rbuf) - c->rlen, 0);
+    if (n <= 0)
+    {
+        if (n < 0 && errno == EINTR)
+            return 0;
+        return -1;
+    }
+    c->rlen += n;
+    now = stats_now();
+
+    line = c->rbuf;
+    end = c->rbuf + c->rlen;
+    while ((lf = memchr(line, '\n', end - line)) != NULL)
+    {
+        if (c->count == 0)
+        {
+            t->errors++; // 보낸 적 없는 응답
+            line = lf + 1;
+            continue;
+        }
+        r = &c->reqs[c->head];
+        if ((lf - line == 11 && memcmp(line, "INVALID CMD", 11) == 0) ||
+            (lf - line == 12 && memcmp(line, "INTERNAL ERR", 12) == 0))
+        {
+            t->errors++;
+            if (r->op == LG_SCAN)
+                r->lines = 1; // MGET이 거절되면 한 줄뿐
+        }
+        line = lf + 1;
+        if (--r->lines > 0)
+            continue;
+
+        stats_hist_add(&t->hist[r->op], now - r->start, 1);
+        c->head = (c->head + 1) % LG_MAX_DEPTH;
+        c->count--;
+    }
+
+    c->rlen = end - line;
+    if (c->rlen == sizeof(c->rbuf))
+    {
+        return -1; // BUF_SIZE보다 긴 응답은 오지 않는다
+    }
+    if (c->rlen > 0 && line != c->rbuf)
+        memmove(c->rbuf, line, c->rlen);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * creates this thread's share of the g_records keys through its first
+ * connection, LG_LOAD_BATCH requests at a time.
+ * Returns -1 when the connection fails.
+ */
+static int lg_load(struct lg_thread *t)
+{
+    struct lg_conn *c = &t->conns[0];
+    uint64_t first = g_records * t->idx / g_num_threads;
+    uint64_t last = g_records * (t->idx + 1) / g_num_threads;
+    char *wbuf, *lf;
+    size_t len, lines, batch;
+    ssize_t n;
+
+    wbuf = malloc(LG_LOAD_BATCH * (32 + g_value_size));
+    if (wbuf == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+    while (first < last)
+    {
+        batch = last - first < LG_LOAD_BATCH ? last - first : LG_LOAD_BATCH;
+        for (len = 0, lines = 0; lines < batch; lines++)
+        {
+            len += sprintf(wbuf + len, "CREATE user%012llu %s\n",
+                           (unsigned long long)(first + lines), g_value);
+        }
+        if (lg_send(c->fd, wbuf, len) < 0)
+        {
+            free(wbuf);
+            return -1;
+        }
+        // 응답 줄 수만 센다 (이미 있는 key의 COLLISION도 괜찮다)
+        while (lines > 0)
+        {
+            n = recv(c->fd, c->rbuf, sizeof(c->rbuf), 0);
+            if (n <= 0)
+            {
+                free(wbuf);
+                return -1;
+            }
+            for (lf = c->rbuf; (lf = memchr(lf, '\n', c->rbuf + n - lf));
+                 lf++)
+            {
+                lines--;
+            }
+        }
+        first += batch;
+    }
+    free(wbuf);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+static void *lg_thread_main(void *arg)
+{
+    struct lg_thread *t = (struct lg_thread *)arg;
+    struct pollfd fds[t->num_conns];
+    struct timespec ts;
+    uint64_t now, wake, inflight;
+    int i, n;
+
+    for (;;)
+    {
+        now = stats_now();
+        inflight = 0;
+        wake = now + 100000000ULL; // 100ms마다 종료를 확인
+        for (i = 0; i < t->num_conns; i++)
+        {
+            struct lg_conn *c = &t->conns[i];
+
+            if (!c->dead && lg_issue(t, c, now) < 0)
+            {
+                fprintf(stderr, "thread %d: connection lost\n", t->idx);
+                c->dead = 1;
+            }
+            if (c->dead)
+            {
+                fds[i].fd = -1;
+                continue;
+            }
+            inflight += c->count;
+            fds[i].fd = c->fd;
+            fds[i].events = POLLIN;
+            // open loop: 자리가 있으면 다음 예정 시각에 깨어난다
+            if (g_rate > 0 && c->count < (size_t)g_depth &&
+                c->next_due < g_end_ns && c->next_due < wake)
+            {
+                wake = c->next_due;
+            }
+        }
+        if (now >= g_end_ns && (inflight == 0 ||
+                                now >= g_end_ns + LG_DRAIN_NS))
+        {
+            break;
+        }
+
+        wake = wake > now ? wake - now : 0;
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        n = ppoll(fds, t->num_conns, &ts, NULL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ppoll");
+            break;
+        }
+        for (i = 0; i < t->num_conns && n > 0; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            n--;
+            if (lg_receive(t, &t->conns[i]) < 0)
+            {
+                fprintf(stderr, "thread %d: connection closed\n", t->idx);
+                t->conns[i].dead = 1;
+            }
+        }
+    }
+
+    // 끝내 받지 못한 요청은 오류로 센다
+    for (i = 0; i < t->num_conns; i++)
+    {
+        t->errors += t->conns[i].count;
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+static void *lg_load_main(void *arg)
+{
+    struct lg_thread *t = (struct lg_thread *)arg;
+
+    if (lg_load(t) < 0)
+    {
+        fprintf(stderr, "thread %d: failed to load the keys\n", t->idx);
+        t->errors++;
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* runs fn on every thread and waits for them all */
+static int lg_run(struct lg_thread *threads, void *(*fn)(void *))
+{
+    int i;
+
+    for (i = 0; i < g_num_threads; i++)
+    {
+        if (pthread_create(&threads[i].thread, NULL, fn, &threads[i]) != 0)
+        {
+            perror("pthread_create");
+            while (--i >= 0)
+                pthread_join(threads[i].thread, NULL);
+            return -1;
+        }
+    }
+    for (i = 0; i < g_num_threads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+static void lg_report(struct lg_thread *threads, double secs)
+{
+    struct stats_hist *h, total;
+    uint64_t errors = 0;
+    int i, op;
+
+    h = calloc(LG_OPS, sizeof(struct stats_hist));
+    if (h == NULL)
+    {
+        perror("calloc");
+        return;
+    }
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < g_num_threads; i++)
+    {
+        for (op = 0; op < LG_OPS; op++)
+        {
+            stats_hist_merge(&h[op], &threads[i].hist[op]);
+            stats_hist_merge(&total, &threads[i].hist[op]);
+        }
+        errors += threads[i].errors;
+    }
+
+    printf("%-7s %10s %10s %9s %9s %9s %9s\n", "op", "count", "ops/s",
+           "p50_us", "p99_us", "p999_us", "max_us");
+    for (op = 0; op <= LG_OPS; op++)
+    {
+        struct stats_hist *oh = op < LG_OPS ? &h[op] : &total;
+
+        if (oh->count == 0)
+            continue;
+        printf("%-7s %10llu %10.0f %9.1f %9.1f %9.1f %9.1f\n",
+               op < LG_OPS ? g_op_names[op] : "TOTAL",
+               (unsigned long long)oh->count, oh->count / secs,
+               stats_quantile(oh, 0.5) / 1e3, stats_quantile(oh, 0.99) / 1e3,
+               stats_quantile(oh, 0.999) / 1e3, oh->max / 1e3);
+    }
+    printf("errors %llu\n", (unsigned long long)errors);
+    free(h);
+}
+/*--------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+    char *ip = DEFAULT_LOOPBACK_IP;
+    int port = DEFAULT_PORT, load = 1, opt;
+    char workload = 'A';
+    struct lg_thread *threads;
+    size_t i;
+    int t, c;
+
+    while ((opt = getopt(argc, argv, "i:p:t:c:d:w:k:n:v:q:r:s:Ph")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            ip = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 't':
+            g_num_threads = atoi(optarg);
+            break;
+        case 'c':
+            g_num_conns = atoi(optarg);
+            break;
+        case 'd':
+            g_depth = atoi(optarg);
+            break;
+        case 'w':
+            workload = toupper((unsigned char)optarg[0]);
+            break;
+        case 'k':
+            if (strcmp(optarg, "uniform") == 0)
+                g_zipfian = 0;
+            else if (strcmp(optarg, "zipfian") == 0)
+                g_zipfian = 1;
+            else
+            {
+                fprintf(stderr, "Invalid key distribution: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            g_records = strtoull(optarg, NULL, 10);
+            break;
+        case 'v':
+            g_value_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            g_qread = atof(optarg);
+            break;
+        case 'r':
+            g_rate = atof(optarg);
+            break;
+        case 's':
+            g_seconds = atoi(optarg);
+            break;
+        case 'P':
+            load = 0;
+            break;
+        case 'h':
+        default:
+            printf("Usage: %s [-i server_ip (%s)] [-p port (%d)] "
+                   "[-t num_threads (2)] "
+                   "[-c num_connections (8)] "
+                   "[-d pipeline_depth (1)] "
+                   "[-w workload (A|B|C|D|E|F) (A)] "
+                   "[-k key_dist (zipfian|uniform) (zipfian)] "
+                   "[-n records (100000)] "
+                   "[-v value_size (100)] "
+                   "[-q qread_ratio (0.0)] "
+                   "[-r rate_per_sec (0: closed loop)] "
+                   "[-s seconds (10)] "
+                   "[-P (skip loading the records)]\n",
+                   argv[0], DEFAULT_LOOPBACK_IP, DEFAULT_PORT);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (i = 0; i < sizeof(g_workloads) / sizeof(g_workloads[0]); i++)
+    {
+        if (g_workloads[i].name == workload)
+            g_wl = &g_workloads[i];
+    }
+    if (g_wl == NULL)
+    {
+        fprintf(stderr, "Invalid workload: %c\n", workload);
+        exit(EXIT_FAILURE);
+    }
+    if (g_num_threads <= 0 || g_num_conns < g_num_threads ||
+        g_depth <= 0 || g_depth > LG_MAX_DEPTH || g_records < 2 ||
+        g_value_size == 0 || g_value_size > BUF_SIZE / 2 ||
+        g_qread < 0.0 || g_qread > 1.0 || g_rate < 0.0 || g_seconds <= 0)
+    {
+        fprintf(stderr, "Invalid arguments (connections must be at least "
+                        "threads, depth at most %d, value at most %d)\n",
+                LG_MAX_DEPTH, BUF_SIZE / 2);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &g_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "Invalid server ip: %s\n", ip);
+        exit(EXIT_FAILURE);
+    }
+
+    // 값은 공백 없는 고정 문자열, SCAN은 응답이 BUF_SIZE에 들어가게
+    g_value = malloc(g_value_size + 1);
+    if (g_value == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(g_value, 'v', g_value_size);
+    g_value[g_value_size] = '\0';
+    g_max_scan = (BUF_SIZE - 8) / (g_value_size + 1);
+    if (g_max_scan > LG_MAX_SCAN)
+        g_max_scan = LG_MAX_SCAN;
+    if (g_zipfian)
+        keydist_zipf_init(&g_zipf, g_records, LG_ZIPF_THETA);
+    g_next_key = g_records;
+
+    threads = calloc(g_num_threads, sizeof(struct lg_thread));
+    if (threads == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (t = 0; t < g_num_threads; t++)
+    {
+        threads[t].idx = t;
+        threads[t].rng = keydist_scramble(stats_now() + t) | 1;
+        threads[t].num_conns = g_num_conns * (t + 1) / g_num_threads -
+                               g_num_conns * t / g_num_threads;
+        threads[t].conns = calloc(threads[t].num_conns,
+                                  sizeof(struct lg_conn));
+        if (threads[t].conns == NULL)
+        {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        for (c = 0; c < threads[t].num_conns; c++)
+        {
+            threads[t].conns[c].fd = lg_connect();
+            if (threads[t].conns[c].fd < 0)
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("workload %c (read %.2f update %.2f insert %.2f scan %.2f "
+           "rmw %.2f), %s keys, %llu records, %zuB values\n",
+           g_wl->name, g_wl->read, g_wl->update, g_wl->insert, g_wl->scan,
+           g_wl->rmw, g_zipfian ? "zipfian" : "uniform",
+           (unsigned long long)g_records, g_value_size);
+    if (load)
+    {
+        printf("loading %llu records...\n", (unsigned long long)g_records);
+        if (lg_run(threads, lg_load_main) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    printf("%d connections on %d threads, pipeline depth %d, ",
+           g_num_conns, g_num_threads, g_depth);
+    if (g_rate > 0)
+        printf("open loop at %.0f requests/s, ", g_rate);
+    else
+        printf("closed loop, ");
+    printf("%d s\n", g_seconds);
+
+    g_start_ns = stats_now();
+    g_end_ns = g_start_ns + (uint64_t)g_seconds * 1000000000ULL;
+    for (t = 0; t < g_num_threads; t++)
+    {
+        threads[t].errors = 0;
+        // 연결마다 예정 시각을 고르게 어긋나게 시작한다
+        for (c = 0; c < threads[t].num_conns; c++)
+        {
+            threads[t].conns[c].next_due = g_start_ns;
+            if (g_rate > 0)
+                threads[t].conns[c].next_due +=
+                    (uint64_t)(1e9 * (c * g_num_threads + t) / g_rate);
+        }
+    }
+    if (lg_run(threads, lg_thread_main) < 0)
+        exit(EXIT_FAILURE);
+
+    lg_report(threads, (double)g_seconds);
+
+    for (t = 0; t < g_num_threads; t++)
+    {
+        for (c = 0; c < threads[t].num_conns; c++)
+            close(threads[t].conns[c].fd);
+        free(threads[t].conns);
+    }
+    free(threads);
+    free(g_value);
+    return 0;
+}
@@ -0,0 +1,852 @@
+/*--------------------------------------------------------------------*/
+/* mmtable.c                                                          */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmtable.h"
+/*--------------------------------------------------------------------*/
+_Static_assert(sizeof(struct mm_hdr) <= MM_PAGE,
+               "the table header must fit in its page");
+/*--------------------------------------------------------------------*/
+/* a mapped table file */
+struct mmtable
+{
+    char *base; // MM_MAP_MAX bytes reserved, file_size of them backed
+    struct mm_hdr *hdr;
+    uint64_t *buckets; // offset of the first node of each bucket
+    rwlock_t *locks;
+    size_t hash_size;
+    size_t file_size;
+    int fd;
+    pthread_mutex_t grow_lock; // brk and file_size
+    pthread_mutex_t class_locks[MM_NUM_CLASSES]; // free lists
+};
+/*--------------------------------------------------------------------*/
+/* two classes per power of two, from 64B */
+static inline size_t mm_class_size(int cls)
+{
+    return (size_t)(2 + (cls & 1)) << (cls / 2 + 5);
+}
+/*--------------------------------------------------------------------*/
+/* Returns the smallest class of at least size bytes, or -1. */
+static int mm_class_of(size_t size)
+{
+    int cls;
+
+    for (cls = 0; cls < MM_NUM_CLASSES; cls++)
+    {
+        if (mm_class_size(cls) >= size)
+        {
+            return cls;
+        }
+    }
+    return -1;
+}
+/*--------------------------------------------------------------------*/
+/* the heap starts at the first page after the bucket array */
+static inline size_t mm_heap_of(size_t hash_size)
+{
+    return (MM_PAGE + hash_size * sizeof(uint64_t) + MM_PAGE - 1) /
+           MM_PAGE * MM_PAGE;
+}
+/*--------------------------------------------------------------------*/
+static inline struct mm_node *mm_node(struct mmtable *mm, uint64_t off)
+{
+    return (struct mm_node *)(mm->base + off);
+}
+/*--------------------------------------------------------------------*/
+static inline struct mm_block *mm_block(struct mmtable *mm, uint64_t off)
+{
+    return (struct mm_block *)(mm->base + off - sizeof(struct mm_block));
+}
+/*--------------------------------------------------------------------*/
+static inline int bit_test(const uint64_t *map, size_t i)
+{
+    return (map[i / 64] >> (i % 64)) & 1;
+}
+/*--------------------------------------------------------------------*/
+static inline void bit_set(uint64_t *map, size_t i)
+{
+    map[i / 64] |= (uint64_t)1 << (i % 64);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * extends the file to at least size bytes; grow_lock held.
+ * Returns -1 when any internal errors occur.
+ */
+static int mm_grow(struct mmtable *mm, size_t size)
+{
+    size_t new_size = mm->file_size ? mm->file_size : MM_PAGE;
+    int ret;
+
+    while (new_size < size)
+    {
+        new_size += new_size < MM_GROW_MAX ? new_size : MM_GROW_MAX;
+    }
+    if (new_size > MM_MAP_MAX)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    // hole로 두면 디스크가 찼을 때 쓰는 도중 SIGBUS를 받는다
+    ret = posix_fallocate(mm->fd, mm->file_size, new_size - mm->file_size);
+    if (ret != 0)
+    {
+        DEBUG_PRINT("Failed to grow the table file to %zu bytes", new_size);
+        errno = ret;
+        return -1;
+    }
+    mm->file_size = new_size;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * allocates a block of at least size bytes.
+ * Returns its offset, or 0 when any internal errors occur.
+ */
+static uint64_t mm_alloc(struct mmtable *mm, size_t size)
+{
+    int cls = mm_class_of(size + sizeof(struct mm_block));
+    struct mm_block *blk;
+    uint64_t off;
+
+    if (cls < 0)
+    {
+        errno = EFBIG;
+        return 0;
+    }
+
+    pthread_mutex_lock(&mm->class_locks[cls]);
+    off = mm->hdr->free_lists[cls];
+    if (off)
+    {
+        mm->hdr->free_lists[cls] = *(uint64_t *)(mm->base + off);
+    }
+    pthread_mutex_unlock(&mm->class_locks[cls]);
+    if (off)
+    {
+        return off;
+    }
+
+    pthread_mutex_lock(&mm->grow_lock);
+    off = mm->hdr->brk;
+    if (off + mm_class_size(cls) > mm->file_size &&
+        mm_grow(mm, off + mm_class_size(cls)) != 0)
+    {
+        pthread_mutex_unlock(&mm->grow_lock);
+        return 0;
+    }
+    // class를 먼저 써야 중간에 죽어도 heap을 처음부터 따라갈 수 있다
+    blk = (struct mm_block *)(mm->base + off);
+    blk->cls = cls;
+    blk->pad = 0;
+    __atomic_store_n(&mm->hdr->brk, off + mm_class_size(cls),
+                     __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mm->grow_lock);
+
+    return off + sizeof(struct mm_block);
+}
+/*--------------------------------------------------------------------*/
+/* returns a block to the free list of its class */
+static void mm_free(struct mmtable *mm, uint64_t off)
+{
+    int cls = mm_block(mm, off)->cls;
+
+    pthread_mutex_lock(&mm->class_locks[cls]);
+    *(uint64_t *)(mm->base + off) = mm->hdr->free_lists[cls];
+    mm->hdr->free_lists[cls] = off;
+    pthread_mutex_unlock(&mm->class_locks[cls]);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * allocates and fills an unlinked node.
+ * Returns its offset, or 0 when any internal errors occur.
+ */
+static uint64_t mm_node_new(struct mmtable *mm, uint64_t h,
+                            const char *key, size_t key_size,
+                            const char *value, size_t value_len)
+{
+    struct mm_node *node;
+    uint64_t off;
+
+    if (value_len > UINT32_MAX)
+    {
+        errno = EFBIG;
+        return 0;
+    }
+    off = mm_alloc(mm, sizeof(struct mm_node) + key_size + value_len + 2);
+    if (off == 0)
+    {
+        return 0;
+    }
+
+    node = mm_node(mm, off);
+    node->next = 0;
+    node->hash = h;
+    node->value_len = value_len;
+    node->key_size = key_size;
+    memset(node->pad, 0, sizeof(node->pad));
+    memcpy(node->data, key, key_size);
+    node->data[key_size] = '\0';
+    memcpy(node->data + key_size + 1, value, value_len);
+    node->data[key_size + 1 + value_len] = '\0';
+
+    return off;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * looks up key in bucket idx under its lock.
+ * Returns the link (bucket head or next of a node) holding the offset
+ * of its node, or the terminating link holding 0 when not found.
+ */
+static uint64_t *mm_find(struct mmtable *mm, size_t idx, uint64_t h,
+                         const char *key, size_t key_size)
+{
+    uint64_t *link = &mm->buckets[idx];
+    struct mm_node *node;
+
+    while (*link)
+    {
+        node = mm_node(mm, *link);
+        if (node->hash == h && node->key_size == key_size &&
+            memcmp(node->data, key, key_size) == 0)
+        {
+            break;
+        }
+        link = &node->next;
+    }
+    return link;
+}
+/*--------------------------------------------------------------------*/
+/* reports a write to the log hook of the table, if any */
+static inline int mm_log(hashtable_t *table, int op, const char *key,
+                         size_t key_size, const char *value,
+                         size_t value_len)
+{
+    if (table->log_fn == NULL)
+    {
+        return 0;
+    }
+    return table->log_fn(table->log_arg, op, key, key_size, value,
+                         value_len);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * tells whether off is a whole node of bucket idx that no other link
+ * reaches, given the carved blocks (starts) and the nodes already
+ * reached (marks)
+ */
+static int mm_node_valid(hashtable_t *table, uint64_t off, size_t idx,
+                         const uint64_t *starts, const uint64_t *marks)
+{
+    struct mmtable *mm = table->mm;
+    uint64_t heap = mm->hdr->heap;
+    struct mm_node *node;
+    size_t unit, cap;
+
+    if (off < heap + sizeof(struct mm_block) || off >= mm->hdr->brk ||
+        (off - sizeof(struct mm_block) - heap) % MM_BLOCK_ALIGN)
+    {
+        return 0;
+    }
+    unit = (off - sizeof(struct mm_block) - heap) / MM_BLOCK_ALIGN;
+    if (!bit_test(starts, unit) || bit_test(marks, unit))
+    {
+        return 0;
+    }
+
+    cap = mm_class_size(mm_block(mm, off)->cls) - sizeof(struct mm_block);
+    node = mm_node(mm, off);
+    if (cap < sizeof(*node) + 2 || node->key_size == 0 ||
+        node->key_size > MAX_KEY_LEN ||
+        cap - sizeof(*node) - 2 < (size_t)node->key_size + node->value_len)
+    {
+        return 0;
+    }
+    return node->data[node->key_size] == '\0' &&
+           node->data[node->key_size + 1 + node->value_len] == '\0' &&
+           table->hash_fn(node->data, node->key_size, table->seed) ==
+               node->hash &&
+           node->hash % mm->hash_size == idx;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * repairs a file that was not closed cleanly: cuts every chain at its
+ * first node that is not a whole node, rebuilds the free lists from
+ * the blocks no chain reaches and recounts the entries.
+ * Returns -1 when any internal errors occur.
+ */
+static int mm_check(hashtable_t *table, const char *path)
+{
+    struct mmtable *mm = table->mm;
+    struct mm_hdr *hdr = mm->hdr;
+    struct mm_block *blk;
+    struct mm_node *node;
+    uint64_t *starts, *marks, *link, off;
+    size_t units, i, num = 0, cut = 0;
+
+    // 두 bitmap 모두 MM_BLOCK_ALIGN 단위로 heap을 덮는다
+    units = (hdr->brk - hdr->heap) / MM_BLOCK_ALIGN;
+    starts = calloc(units / 64 + 1, sizeof(uint64_t));
+    marks = calloc(units / 64 + 1, sizeof(uint64_t));
+    if (!starts || !marks)
+    {
+        free(starts);
+        free(marks);
+        return -1;
+    }
+
+    // 1. heap을 처음부터 따라가며 block의 시작을 표시
+    for (off = hdr->heap; off < hdr->brk; off += mm_class_size(blk->cls))
+    {
+        blk = (struct mm_block *)(mm->base + off);
+        if (blk->cls >= MM_NUM_CLASSES ||
+            hdr->brk - off < mm_class_size(blk->cls))
+        {
+            // 여기부터는 block 경계를 알 수 없으므로 버린다
+            hdr->brk = off;
+            break;
+        }
+        bit_set(starts, (off - hdr->heap) / MM_BLOCK_ALIGN);
+    }
+
+    // 2. 각 chain을 온전한 node까지만 남긴다
+    for (i = 0; i < mm->hash_size; i++)
+    {
+        for (link = &mm->buckets[i]; *link; link = &node->next)
+        {
+            if (!mm_node_valid(table, *link, i, starts, marks))
+            {
+                *link = 0;
+                cut++;
+                break;
+            }
+            bit_set(marks, (*link - sizeof(struct mm_block) - hdr->heap) /
+                               MM_BLOCK_ALIGN);
+            node = mm_node(mm, *link);
+            num++;
+        }
+    }
+
+    // 3. 어느 chain에도 없는 block으로 free list를 다시 만든다
+    memset(hdr->free_lists, 0, sizeof(hdr->free_lists));
+    for (off = hdr->heap; off < hdr->brk; off += mm_class_size(blk->cls))
+    {
+        blk = (struct mm_block *)(mm->base + off);
+        if (!bit_test(marks, (off - hdr->heap) / MM_BLOCK_ALIGN))
+        {
+            mm_free(mm, off + sizeof(struct mm_block));
+        }
+    }
+    table->num_entries = num;
+
+    fprintf(stderr, "%s: not closed cleanly, kept %zu entries, "
+                    "cut %zu broken chains\n",
+            path, num, cut);
+
+    free(starts);
+    free(marks);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * lays out an empty table in a new or half-created file.
+ * Returns -1 when any internal errors occur.
+ */
+static int mm_create(hashtable_t *table, size_t hash_size)
+{
+    struct mmtable *mm = table->mm;
+    struct mm_hdr *hdr = mm->hdr;
+    size_t heap = mm_heap_of(hash_size);
+
+    if (mm->file_size < heap + MM_PAGE && mm_grow(mm, heap + MM_PAGE) != 0)
+    {
+        return -1;
+    }
+
+    memset(mm->base, 0, heap);
+    hdr->hash_fn = HASH_FN_OF(table->flags);
+    memcpy(hdr->seed, table->seed, sizeof(hdr->seed));
+    hdr->hash_size = hash_size;
+    hdr->heap = heap;
+    hdr->brk = heap;
+
+    // magic은 나머지가 디스크에 닿은 뒤에 쓴다
+    if (msync(mm->base, heap, MS_SYNC) < 0)
+    {
+        return -1;
+    }
+    memcpy(hdr->magic, MM_MAGIC, sizeof(hdr->magic));
+    return msync(mm->base, MM_PAGE, MS_SYNC);
+}
+/*--------------------------------------------------------------------*/
+int mmtable_open(hashtable_t *table, const char *path, size_t hash_size)
+{
+    TRACE_PRINT();
+    /*--------------------------------------------------------------------*/
+    if (!table || !path || hash_size == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    static const char zero_magic[sizeof(MM_MAGIC) - 1];
+    struct mmtable *mm;
+    struct mm_hdr *hdr;
+    struct stat st;
+    size_t i;
+    int err;
+
+    mm = calloc(1, sizeof(struct mmtable));
+    if (mm == NULL)
+    {
+        return -1;
+    }
+    mm->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mm->fd < 0)
+    {
+        free(mm);
+        return -1;
+    }
+    if (fstat(mm->fd, &st) < 0)
+    {
+        goto fail;
+    }
+    if ((st.st_size > 0 && st.st_size < MM_PAGE) ||
+        (uint64_t)st.st_size > MM_MAP_MAX)
+    {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    // 최대 크기를 한 번에 예약해 파일이 커져도 주소가 바뀌지 않는다
+    mm->base = mmap(NULL, MM_MAP_MAX, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    mm->fd, 0);
+    if (mm->base == MAP_FAILED)
+    {
+        mm->base = NULL;
+        goto fail;
+    }
+    mm->hdr = hdr = (struct mm_hdr *)mm->base;
+    mm->file_size = st.st_size;
+    table->mm = mm;
+
+    // magic이 없으면 만들다 멈춘 파일이므로 새로 만든다
+    if (st.st_size == 0 ||
+        memcmp(hdr->magic, zero_magic, sizeof(hdr->magic)) == 0)
+    {
+        if (mm_create(table, hash_size) < 0)
+        {
+            goto fail;
+        }
+    }
+    else if (memcmp(hdr->magic, MM_MAGIC, sizeof(hdr->magic)) != 0 ||
+             hdr->hash_fn >= HASH_FN_COUNT || hdr->hash_size == 0 ||
+             hdr->hash_size > mm->file_size / sizeof(uint64_t) ||
+             hdr->heap != mm_heap_of(hdr->hash_size) ||
+             hdr->brk < hdr->heap || hdr->brk > mm->file_size)
+    {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    // bucket 수와 hash 함수는 파일을 만들 때 정해진 것을 따른다
+    table->flags = (table->flags & ~HASH_FN_FLAG(0xf)) |
+                   HASH_FN_FLAG(hdr->hash_fn);
+    table->hash_fn = hash_fn_get(hdr->hash_fn);
+    memcpy(table->seed, hdr->seed, sizeof(table->seed));
+    table->min_size = hdr->hash_size;
+    mm->hash_size = hdr->hash_size;
+    mm->buckets = (uint64_t *)(mm->base + MM_PAGE);
+
+    pthread_mutex_init(&mm->grow_lock, NULL);
+    for (i = 0; i < MM_NUM_CLASSES; i++)
+    {
+        pthread_mutex_init(&mm->class_locks[i], NULL);
+    }
+    mm->locks = calloc(mm->hash_size, sizeof(rwlock_t));
+    if (mm->locks == NULL)
+    {
+        goto fail_locks;
+    }
+    for (i = 0; i < mm->hash_size; i++)
+    {
+        rwlock_init(&mm->locks[i], table->delay);
+    }
+
+    if (!hdr->clean)
+    {
+        if (mm_check(table, path) < 0)
+        {
+            goto fail_locks;
+        }
+    }
+    else
+    {
+        table->num_entries = hdr->num_entries;
+    }
+
+    // 이후의 쓰기보다 먼저 디스크에서 clean 표시를 지운다
+    hdr->clean = 0;
+    if (msync(mm->base, MM_PAGE, MS_SYNC) < 0)
+    {
+        goto fail_locks;
+    }
+    /*--------------------------------------------------------------------*/
+    return 0;
+
+fail_locks:
+    err = errno;
+    if (mm->locks)
+    {
+        for (i = 0; i < mm->hash_size; i++)
+        {
+            rwlock_destroy(&mm->locks[i]);
+        }
+        free(mm->locks);
+    }
+    for (i = 0; i < MM_NUM_CLASSES; i++)
+    {
+        pthread_mutex_destroy(&mm->class_locks[i]);
+    }
+    pthread_mutex_destroy(&mm->grow_lock);
+    errno = err;
+fail:
+    err = errno;
+    if (mm->base)
+    {
+        munmap(mm->base, MM_MAP_MAX);
+    }
+    close(mm->fd);
+    free(mm);
+    table->mm = NULL;
+    errno = err;
+    return -1;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_close(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    size_t i;
+    int ret = 0;
+
+    mm->hdr->num_entries = table->num_entries;
+    // 모든 내용이 디스크에 닿은 뒤에야 clean으로 표시
+    if (msync(mm->base, mm->file_size, MS_SYNC) < 0)
+    {
+        ret = -1;
+    }
+    else
+    {
+        mm->hdr->clean = 1;
+        if (msync(mm->base, MM_PAGE, MS_SYNC) < 0)
+        {
+            ret = -1;
+        }
+    }
+
+    munmap(mm->base, MM_MAP_MAX);
+    close(mm->fd);
+    for (i = 0; i < mm->hash_size; i++)
+    {
+        rwlock_destroy(&mm->locks[i]);
+    }
+    free(mm->locks);
+    for (i = 0; i < MM_NUM_CLASSES; i++)
+    {
+        pthread_mutex_destroy(&mm->class_locks[i]);
+    }
+    pthread_mutex_destroy(&mm->grow_lock);
+    free(mm);
+    table->mm = NULL;
+
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_insert(hashtable_t *table, uint64_t h, const char *key,
+                   size_t key_size, const char *value, size_t value_len)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    size_t idx = h % mm->hash_size;
+    uint64_t off, *link;
+
+    // lock 밖에서 node를 채워 임계 구역을 줄인다
+    off = mm_node_new(mm, h, key, key_size, value, value_len);
+    if (off == 0)
+    {
+        return -1;
+    }
+    if (rwlock_write_lock(&mm->locks[idx]) != 0)
+    {
+        mm_free(mm, off);
+        return -1;
+    }
+
+    link = mm_find(mm, idx, h, key, key_size);
+    if (*link)
+    {
+        rwlock_write_unlock(&mm->locks[idx]);
+        mm_free(mm, off);
+        return 0; // collision
+    }
+    if (mm_log(table, HASH_OP_INSERT, key, key_size, value, value_len) != 0)
+    {
+        rwlock_write_unlock(&mm->locks[idx]);
+        mm_free(mm, off);
+        return -1;
+    }
+    // 다 채워진 node를 한 번의 store로 연결
+    __atomic_store_n(link, off, __ATOMIC_RELEASE);
+
+    rwlock_write_unlock(&mm->locks[idx]);
+    __atomic_add_fetch(&table->num_entries, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_read(hashtable_t *table, uint64_t h, const char *key,
+                 size_t key_size, char *dst, size_t dst_size,
+                 size_t *value_len, int quick)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    size_t idx = h % mm->hash_size;
+    struct mm_node *node;
+    uint64_t *link;
+    int ret = 0; // not found
+
+    if (rwlock_read_lock(&mm->locks[idx], quick) != 0)
+    {
+        return -1;
+    }
+
+    link = mm_find(mm, idx, h, key, key_size);
+    if (*link)
+    {
+        node = mm_node(mm, *link);
+        // 저장된 값은 항상 '\0'으로 끝나므로 공간이 있으면 함께 복사
+        if (node->value_len > dst_size)
+        {
+            errno = ENOSPC;
+            ret = -1;
+        }
+        else
+        {
+            memcpy(dst, node->data + node->key_size + 1,
+                   node->value_len < dst_size ? node->value_len + 1
+                                              : node->value_len);
+            if (value_len)
+                *value_len = node->value_len;
+            ret = 1;
+        }
+    }
+
+    rwlock_read_unlock(&mm->locks[idx]);
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_visit(hashtable_t *table, uint64_t h, const char *key,
+                  size_t key_size, int quick, hash_mread_fn fn, void *arg,
+                  size_t i)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    size_t idx = h % mm->hash_size;
+    struct mm_node *node;
+    uint64_t *link;
+    int ret;
+
+    if (rwlock_read_lock(&mm->locks[idx], quick) != 0)
+    {
+        return -1;
+    }
+
+    link = mm_find(mm, idx, h, key, key_size);
+    if (*link)
+    {
+        node = mm_node(mm, *link);
+        ret = fn(arg, i, node->data + node->key_size + 1, node->value_len);
+    }
+    else
+    {
+        ret = fn(arg, i, NULL, 0);
+    }
+
+    rwlock_read_unlock(&mm->locks[idx]);
+    return ret < 0 ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_update(hashtable_t *table, uint64_t h, const char *key,
+                   size_t key_size, const char *value, size_t value_len)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    size_t idx = h % mm->hash_size;
+    uint64_t off, old, *link;
+
+    // 제자리에서 고치면 죽었을 때 값이 찢어지므로 새 node로 바꾼다
+    off = mm_node_new(mm, h, key, key_size, value, value_len);
+    if (off == 0)
+    {
+        return -1;
+    }
+    if (rwlock_write_lock(&mm->locks[idx]) != 0)
+    {
+        mm_free(mm, off);
+        return -1;
+    }
+
+    link = mm_find(mm, idx, h, key, key_size);
+    old = *link;
+    if (old == 0 ||
+        mm_log(table, HASH_OP_UPDATE, key, key_size, value, value_len) != 0)
+    {
+        rwlock_write_unlock(&mm->locks[idx]);
+        mm_free(mm, off);
+        return old ? -1 : 0;
+    }
+    mm_node(mm, off)->next = mm_node(mm, old)->next;
+    __atomic_store_n(link, off, __ATOMIC_RELEASE);
+
+    rwlock_write_unlock(&mm->locks[idx]);
+    // reader도 lock을 잡으므로 떼어낸 node는 바로 해제
+    mm_free(mm, old);
+
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_delete(hashtable_t *table, uint64_t h, const char *key,
+                   size_t key_size)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    size_t idx = h % mm->hash_size;
+    uint64_t old, *link;
+
+    if (rwlock_write_lock(&mm->locks[idx]) != 0)
+    {
+        return -1;
+    }
+
+    link = mm_find(mm, idx, h, key, key_size);
+    old = *link;
+    if (old == 0 ||
+        mm_log(table, HASH_OP_DELETE, key, key_size, NULL, 0) != 0)
+    {
+        rwlock_write_unlock(&mm->locks[idx]);
+        return old ? -1 : 0;
+    }
+    __atomic_store_n(link, mm_node(mm, old)->next, __ATOMIC_RELEASE);
+
+    rwlock_write_unlock(&mm->locks[idx]);
+    mm_free(mm, old);
+    __atomic_sub_fetch(&table->num_entries, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_stats(hashtable_t *table, hash_stats_t *st)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    uint64_t off;
+    size_t i, len;
+
+    st->hash_size = mm->hash_size;
+    for (i = 0; i < mm->hash_size; i++)
+    {
+        // 길이를 따로 두지 않으므로 chain을 따라가며 센다
+        if (rwlock_read_lock(&mm->locks[i], 1) != 0)
+        {
+            return -1;
+        }
+        for (len = 0, off = mm->buckets[i]; off; off = mm_node(mm, off)->next)
+        {
+            len++;
+        }
+        rwlock_read_unlock(&mm->locks[i]);
+
+        st->chains[len < HASH_STATS_CHAINS ? len : HASH_STATS_CHAINS]++;
+        st->hot_buckets += rwlock_is_hot(&mm->locks[i]);
+        if (len > st->max_chain)
+        {
+            st->max_chain = len;
+        }
+    }
+    st->num_entries = __atomic_load_n(&table->num_entries, __ATOMIC_RELAXED);
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+int mmtable_scan(hashtable_t *table, hash_scan_fn fn, void *arg)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    struct mm_node *node;
+    uint64_t off;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < mm->hash_size && ret == 0; i++)
+    {
+        // 한 bucket씩만 read lock을 잡아 writer를 오래 막지 않는다
+        if (rwlock_read_lock(&mm->locks[i], 0) != 0)
+        {
+            return -1;
+        }
+        for (off = mm->buckets[i]; off && ret == 0; off = node->next)
+        {
+            node = mm_node(mm, off);
+            ret = fn(arg, node->data, node->key_size,
+                     node->data + node->key_size + 1, node->value_len, 0);
+        }
+        rwlock_read_unlock(&mm->locks[i]);
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+void mmtable_dump(hashtable_t *table)
+{
+    TRACE_PRINT();
+    struct mmtable *mm = table->mm;
+    struct mm_node *node;
+    uint64_t off;
+    size_t i, len;
+
+    printf("[Hash Table Dump]");
+    printf("Total Entries: %ld\n", table->num_entries);
+    printf("Mapped file: %zu bytes, %zu in blocks\n", mm->file_size,
+           (size_t)(mm->hdr->brk - mm->hdr->heap));
+
+    for (i = 0; i < mm->hash_size; i++)
+    {
+        for (len = 0, off = mm->buckets[i]; off; off = mm_node(mm, off)->next)
+        {
+            len++;
+        }
+        if (!len)
+        {
+            continue;
+        }
+        printf("Bucket %ld: %ld entries\n", i, len);
+        printf("  Lock State -> Read Count: %d, Write Count: %d\n",
+               rwlock_current_readers(&mm->locks[i]),
+               rwlock_current_writers(&mm->locks[i]));
+        for (off = mm->buckets[i]; off; off = node->next)
+        {
+            node = mm_node(mm, off);
+            printf("    K/V: %s / %s\n", node->data,
+                   node->data + node->key_size + 1);
+        }
+    }
+    printf("End of Dump\n");
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,113 @@
+/*--------------------------------------------------------------------*/
+/* mmtable.h                                                          */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _MMTABLE_H
+#define _MMTABLE_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "hashtable.h"
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Storage of a hash table opened with hash_open(), resident in a
+ * memory-mapped file so that a restarted server serves at once.
+ *
+ * The file is an mm_hdr, the bucket array and a heap of blocks, linked
+ * by file offsets (0 for none) so it can be mapped at any address.
+ * Every block is an mm_block followed by an mm_node, or by the offset
+ * of the next free block of its class once freed. Blocks come in
+ * MM_NUM_CLASSES sizes and are carved from the end of the heap,
+ * growing the file as needed.
+ *
+ * A write fills a new node completely before one 8-byte store links
+ * it, and unlinks a node before freeing it, so a process dying at any
+ * point leaves every chain walkable and every key with its old or new
+ * value; only blocks may leak and the free lists and entry count may be
+ * stale. Opening a file that was not closed cleanly checks every chain
+ * and rebuilds them. A power loss may still lose or tear writes that
+ * the kernel had not flushed; use the append-only log for those.
+ */
+#define MM_MAGIC "SKVSMMT1"
+#define MM_PAGE 4096
+#define MM_MAP_MAX (64ULL << 30) // address space reserved for the file
+#define MM_GROW_MAX (64 << 20)   // the file grows by at most this at once
+#define MM_BLOCK_ALIGN 32        // every block size is a multiple of it
+#define MM_NUM_CLASSES 42        // 64B, 96B, 128B, 192B ... 96MB
+struct mm_hdr
+{
+    char magic[8];
+    uint32_t hash_fn; // enum HASH_FN
+    uint32_t clean;   // 1 when closed by mmtable_close()
+    uint64_t seed[2];
+    uint64_t hash_size;
+    uint64_t heap;        // offset of the first block
+    uint64_t brk;         // end of the carved blocks
+    uint64_t num_entries; // up to date when clean
+    uint64_t free_lists[MM_NUM_CLASSES]; // up to date when clean
+};
+struct mm_block
+{
+    uint32_t cls;
+    uint32_t pad;
+};
+struct mm_node
+{
+    uint64_t next; // offset of the next node of the bucket
+    uint64_t hash;
+    uint32_t value_len;
+    uint8_t key_size;
+    uint8_t pad[3];
+    char data[]; // key, '\0', value, '\0'
+};
+/*--------------------------------------------------------------------*/
+/**
+ * Maps the table file at path into table, creating it with hash_size
+ * buckets and the hash function and seed of table if it does not
+ * exist. An existing file keeps its own bucket count, hash function
+ * and seed, which are copied into table.
+ * Returns -1 with errno EBADMSG when the file is not a table.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int mmtable_open(hashtable_t *table, const char *path, size_t hash_size);
+/*--------------------------------------------------------------------*/
+/**
+ * Syncs the file, marks it clean and unmaps it.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int mmtable_close(hashtable_t *table);
+/*--------------------------------------------------------------------*/
+/**
+ * Same as hash_insert_n(), hash_read_n(), hash_update_n(),
+ * hash_delete(), hash_stats(), hash_scan() and hash_dump(),
+ * with the hash h of key already computed.
+ */
+int mmtable_insert(hashtable_t *table, uint64_t h, const char *key,
+                   size_t key_size, const char *value, size_t value_len);
+int mmtable_read(hashtable_t *table, uint64_t h, const char *key,
+                 size_t key_size, char *dst, size_t dst_size,
+                 size_t *value_len, int quick);
+int mmtable_update(hashtable_t *table, uint64_t h, const char *key,
+                   size_t key_size, const char *value, size_t value_len);
+int mmtable_delete(hashtable_t *table, uint64_t h, const char *key,
+                   size_t key_size);
+int mmtable_stats(hashtable_t *table, hash_stats_t *st);
+int mmtable_scan(hashtable_t *table, hash_scan_fn fn, void *arg);
+void mmtable_dump(hashtable_t *table);
+/*--------------------------------------------------------------------*/
+/**
+ * Calls fn with the value of key (NULL when missing) under the read
+ * lock of its bucket, for hash_mread(); i is passed on to fn.
+ * Returns -1 when any internal errors occur or fn returned -1.
+ * Returns 0 on success.
+ */
+int mmtable_visit(hashtable_t *table, uint64_t h, const char *key,
+                  size_t key_size, int quick, hash_mread_fn fn, void *arg,
+                  size_t i);
+/*--------------------------------------------------------------------*/
+#endif // _MMTABLE_H
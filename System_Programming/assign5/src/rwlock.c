@@ -3,15 +3,246 @@
 /* Author: Junghan Yoon, KyoungSoo Park                               */
 /* Modified by: Jaeun Park                                            */
 /*--------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <limits.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "rwlock.h"
+#include "stats.h"
 /*--------------------------------------------------------------------*/
-struct uctx
+#define RWLOCK_SPIN_MAX 200 // upper bound of the adaptive spin
+#define RWLOCK_HOT 64       // reader collisions that make a lock hot
+#define RWLOCK_SLOTS 8      // hot read locks a thread may hold at once
+#define RWLOCK_CACHE_LINE 64
+/*--------------------------------------------------------------------*/
+/* hot read locks held by one thread, swept by the writers */
+struct rwlock_slots
 {
-    pthread_cond_t read_cv;
-    pthread_cond_t write_cv;
-    int waiting_writers;
+    /* written by the owner only, so readers never share a line */
+    _Alignas(RWLOCK_CACHE_LINE) rwlock_t *held[RWLOCK_SLOTS];
+    _Alignas(RWLOCK_CACHE_LINE) struct rwlock_slots *next; // never unlinked
+    int in_use;                                            // by a live thread
 };
 /*--------------------------------------------------------------------*/
+/* spin bound of every lock, 0 on a single CPU where spinning never helps */
+static int g_spin_max = -1;
+static struct rwlock_slots *g_slots = NULL;
+static pthread_key_t g_slots_key; // gives the slots back at thread exit
+static pthread_once_t g_slots_once = PTHREAD_ONCE_INIT;
+static __thread struct rwlock_slots *t_slots = NULL;
+static __thread int t_slots_held = 0; // entries of t_slots in use
+/*--------------------------------------------------------------------*/
+static inline void rwlock_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+/*--------------------------------------------------------------------*/
+static inline void rwlock_futex_wait(uint32_t *seq, uint32_t val)
+{
+    // seq가 이미 바뀌었으면 곧바로 EAGAIN으로 돌아온다
+    syscall(SYS_futex, seq, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+/*--------------------------------------------------------------------*/
+static inline void rwlock_futex_wake(uint32_t *seq, int n)
+{
+    __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+/*--------------------------------------------------------------------*/
+/* spins worth trying on rw before sleeping */
+static inline uint32_t rwlock_spin_limit(rwlock_t *rw)
+{
+    uint32_t limit = __atomic_load_n(&rw->spin, __ATOMIC_RELAXED) * 2 + 10;
+
+    return limit < (uint32_t)g_spin_max ? limit : (uint32_t)g_spin_max;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * moves the spin estimate of rw toward the n spins that took the lock,
+ * or toward 0 when spinning did not help and the thread slept
+ */
+static inline void rwlock_spin_update(rwlock_t *rw, uint32_t n, int slept)
+{
+    uint32_t spin = __atomic_load_n(&rw->spin, __ATOMIC_RELAXED);
+
+    if (slept)
+    {
+        n = 0; // 헛돌기만 한 lock은 점점 덜 돈다
+    }
+    __atomic_store_n(&rw->spin, spin + ((int32_t)(n - spin) / 8),
+                     __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+static void rwlock_slots_release(void *arg)
+{
+    struct rwlock_slots *sl = (struct rwlock_slots *)arg;
+
+    __atomic_store_n(&sl->in_use, 0, __ATOMIC_RELEASE);
+}
+/*--------------------------------------------------------------------*/
+static void rwlock_slots_key_init(void)
+{
+    pthread_key_create(&g_slots_key, rwlock_slots_release);
+}
+/*--------------------------------------------------------------------*/
+/* slots of the calling thread, taken on first use */
+static struct rwlock_slots *rwlock_slots_self(void)
+{
+    struct rwlock_slots *sl = t_slots;
+    int unused;
+
+    if (sl)
+    {
+        return sl;
+    }
+    pthread_once(&g_slots_once, rwlock_slots_key_init);
+
+    // 끝난 thread의 slot을 먼저 물려받는다
+    for (sl = __atomic_load_n(&g_slots, __ATOMIC_ACQUIRE); sl; sl = sl->next)
+    {
+        unused = 0;
+        if (__atomic_load_n(&sl->in_use, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&sl->in_use, &unused, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+    if (sl == NULL)
+    {
+        if (posix_memalign((void **)&sl, RWLOCK_CACHE_LINE,
+                           sizeof(struct rwlock_slots)) != 0)
+        {
+            DEBUG_PRINT("Failed to allocate memory for rwlock slots");
+            return NULL;
+        }
+        memset(sl, 0, sizeof(struct rwlock_slots));
+        sl->in_use = 1;
+        sl->next = __atomic_load_n(&g_slots, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&g_slots, &sl->next, sl, 1,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(g_slots_key, sl);
+
+    return t_slots = sl;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * read-locks hot rw by publishing it in a slot of the calling thread.
+ * Returns 0 when no slot is free or rw cooled down meanwhile.
+ */
+static int rwlock_hot_enter(rwlock_t *rw)
+{
+    struct rwlock_slots *sl;
+    int i;
+
+    if (t_slots_held == RWLOCK_SLOTS || (sl = rwlock_slots_self()) == NULL)
+    {
+        return 0;
+    }
+    for (i = 0; sl->held[i]; i++)
+        ;
+
+    // 게시한 뒤에도 hot이면, 이후의 writer는 이 slot을 보고 기다린다
+    __atomic_store_n(&sl->held[i], rw, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rw->state, __ATOMIC_SEQ_CST) & RWLOCK_HOT_BIT)
+    {
+        t_slots_held++;
+        return 1;
+    }
+    __atomic_store_n(&sl->held[i], NULL, __ATOMIC_RELEASE);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* releases rw if the calling thread holds it in a slot; returns 1 then */
+static int rwlock_hot_exit(rwlock_t *rw)
+{
+    int i;
+
+    if (t_slots_held == 0)
+    {
+        return 0;
+    }
+    for (i = 0; i < RWLOCK_SLOTS; i++)
+    {
+        if (t_slots->held[i] == rw)
+        {
+            __atomic_store_n(&t_slots->held[i], NULL, __ATOMIC_RELEASE);
+            t_slots_held--;
+            return 1;
+        }
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * counts a reader colliding with another on rw in state s, and makes
+ * rw hot at the RWLOCK_HOT-th collision since the last write
+ */
+static void rwlock_hot_count(rwlock_t *rw, uint32_t s)
+{
+    // semantic test(-d)에서는 순서를 바꾸지 않도록 hot으로 만들지 않는다
+    if ((s & RWLOCK_HOT_BIT) || rw->delay > 0 ||
+        __atomic_add_fetch(&rw->hot, 1, __ATOMIC_RELAXED) != RWLOCK_HOT)
+    {
+        return;
+    }
+    // writer가 잡고 있지 않을 때만 켠다
+    s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    while (!(s & RWLOCK_WRITER) &&
+           !__atomic_compare_exchange_n(&rw->state, &s, s | RWLOCK_HOT_BIT,
+                                        1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+        ;
+}
+/*--------------------------------------------------------------------*/
+/* waits for the readers holding rw in their slots, once it cooled down */
+static void rwlock_hot_drain(rwlock_t *rw)
+{
+    struct rwlock_slots *sl;
+    int i, n;
+
+    for (sl = __atomic_load_n(&g_slots, __ATOMIC_ACQUIRE); sl; sl = sl->next)
+    {
+        for (i = 0; i < RWLOCK_SLOTS; i++)
+        {
+            for (n = 0; __atomic_load_n(&sl->held[i], __ATOMIC_SEQ_CST) == rw;
+                 n++)
+            {
+                if (n < g_spin_max)
+                    rwlock_relax();
+                else
+                    sched_yield();
+            }
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+/* marks the data of rw as changing, right after a writer took it */
+static inline void rwlock_seq_enter(rwlock_t *rw)
+{
+    __atomic_store_n(&rw->seq, rw->seq + 1, __ATOMIC_RELAXED);
+    // 홀수가 된 seq가 이후의 데이터 변경보다 먼저 보이게 한다
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+/*--------------------------------------------------------------------*/
+/* whether a reader may enter in state s; pass skips waiting writers */
+static inline int rwlock_read_ok(uint32_t s, int pass)
+{
+    return !(s & RWLOCK_WRITER) && (pass || !(s & RWLOCK_WAITERS));
+}
+/*--------------------------------------------------------------------*/
+/* whether a writer may enter in state s */
+static inline int rwlock_write_ok(uint32_t s)
+{
+    return !(s & RWLOCK_WRITER) && (s >> RWLOCK_READER_SHIFT) == 0;
+}
+/*--------------------------------------------------------------------*/
 int rwlock_init(rwlock_t *rw, int delay)
 {
     TRACE_PRINT();
@@ -22,26 +253,21 @@ int rwlock_init(rwlock_t *rw, int delay)
         return -1;
     }
 
-    if (pthread_mutex_init(&rw->lock, NULL) != 0)
+    if (__atomic_load_n(&g_spin_max, __ATOMIC_RELAXED) < 0)
     {
-        return -1;
+        __atomic_store_n(&g_spin_max,
+                         sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RWLOCK_SPIN_MAX
+                                                           : 0,
+                         __ATOMIC_RELAXED);
     }
 
-    rw->current_readers = 0;
-    rw->current_writers = 0;
+    rw->state = 0;
+    rw->read_seq = 0;
+    rw->write_seq = 0;
+    rw->spin = 0;
+    rw->hot = 0;
+    rw->seq = 0;
     rw->delay = delay;
-
-    rw->uctx = malloc(sizeof(struct uctx));
-    if (!rw->uctx)
-    {
-        pthread_mutex_destroy(&rw->lock);
-        return -1;
-    }
-
-    struct uctx *ctx = (struct uctx *)rw->uctx;
-    pthread_cond_init(&ctx->read_cv, NULL);
-    pthread_cond_init(&ctx->write_cv, NULL);
-    ctx->waiting_writers = 0;
     /*--------------------------------------------------------------------*/
     return 0;
 }
@@ -56,28 +282,82 @@ int rwlock_read_lock(rwlock_t *rw, int quick)
         return -1;
     }
 
-    struct uctx *ctx = (struct uctx *)rw->uctx;
-    pthread_mutex_lock(&rw->lock);
+    uint32_t s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+    uint32_t seq, n, limit, flag;
+    uint64_t start;
+    int pass = quick, slept = 0;
 
-    if (quick)
+    // hot lock은 공유 word에 쓰지 않고 자기 slot에만 쓴다
+    if ((s & RWLOCK_HOT_BIT) && rwlock_read_ok(s, pass) &&
+        rwlock_hot_enter(rw))
     {
-        // quick read: writer만 없으면 즉시 진입
-        while (rw->current_writers > 0)
+        return 0;
+    }
+
+    // 경쟁이 없으면 CAS 한 번으로 끝낸다
+    if (rwlock_read_ok(s, pass))
+    {
+        if (__atomic_compare_exchange_n(&rw->state, &s, s + RWLOCK_READER, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return 0;
+        }
+        // 다른 reader와 부딪혔다면 hot 후보
+        if (rwlock_read_ok(s, pass))
         {
-            pthread_cond_wait(&ctx->read_cv, &rw->lock);
+            rwlock_hot_count(rw, s);
         }
     }
-    else
+
+    // 대기 writer보다 먼저 온 reader는 그 writer들보다 먼저 들어간다
+    if (!(s & RWLOCK_WAITERS))
+    {
+        pass = 1;
+    }
+    flag = pass ? RWLOCK_READERS_AHEAD : RWLOCK_READERS_BEHIND;
+
+    // 기다려야 할 때만 시각을 재어 lock 대기 시간으로 기록
+    start = stats_now();
+    limit = rwlock_spin_limit(rw);
+    for (n = 0;; n++)
     {
-        // 일반 read: FIFO (대기 writer가 있으면 대기)
-        while (rw->current_writers > 0 || ctx->waiting_writers > 0)
+        s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+        if (rwlock_read_ok(s, pass))
+        {
+            if (__atomic_compare_exchange_n(&rw->state, &s,
+                                            s + RWLOCK_READER, 0,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+            {
+                break;
+            }
+            continue;
+        }
+        if (n < limit)
+        {
+            rwlock_relax();
+            continue;
+        }
+
+        // seq를 먼저 읽어 두면 그 뒤의 깨우기는 놓치지 않는다
+        seq = __atomic_load_n(&rw->read_seq, __ATOMIC_SEQ_CST);
+        s = __atomic_load_n(&rw->state, __ATOMIC_SEQ_CST);
+        if (rwlock_read_ok(s, pass))
+        {
+            continue;
+        }
+        if (!(s & flag) &&
+            !__atomic_compare_exchange_n(&rw->state, &s, s | flag, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
         {
-            pthread_cond_wait(&ctx->read_cv, &rw->lock);
+            continue;
         }
+        rwlock_futex_wait(&rw->read_seq, seq);
+        slept = 1;
     }
 
-    rw->current_readers++;
-    pthread_mutex_unlock(&rw->lock);
+    rwlock_spin_update(rw, n, slept);
+    stats_lock_wait(stats_now() - start);
     /*--------------------------------------------------------------------*/
     return 0;
 }
@@ -90,20 +370,25 @@ int rwlock_read_unlock(rwlock_t *rw)
         errno = EINVAL;
         return -1;
     }
-    sleep(rw->delay);
+    if (rw->delay > 0)
+    {
+        sleep(rw->delay);
+    }
     /*--------------------------------------------------------------------*/
-    struct uctx *ctx = (struct uctx *)rw->uctx;
-    pthread_mutex_lock(&rw->lock);
+    if (rwlock_hot_exit(rw))
+    {
+        return 0;
+    }
 
-    rw->current_readers--;
+    uint32_t s = __atomic_sub_fetch(&rw->state, RWLOCK_READER,
+                                    __ATOMIC_SEQ_CST);
 
     // 마지막 reader면 대기 중인 writer 깨우기
-    if (rw->current_readers == 0 && ctx->waiting_writers > 0)
+    if ((s >> RWLOCK_READER_SHIFT) == 0 && (s & RWLOCK_WAITERS) &&
+        !(s & RWLOCK_WRITER))
     {
-        pthread_cond_signal(&ctx->write_cv);
+        rwlock_futex_wake(&rw->write_seq, 1);
     }
-
-    pthread_mutex_unlock(&rw->lock);
     /*--------------------------------------------------------------------*/
     return 0;
 }
@@ -118,18 +403,78 @@ int rwlock_write_lock(rwlock_t *rw)
         return -1;
     }
 
-    struct uctx *ctx = (struct uctx *)rw->uctx;
-    pthread_mutex_lock(&rw->lock);
+    uint32_t s = 0, next, seq, n, limit, waiter = 0;
+    uint64_t start;
+    int slept = 0;
 
-    ctx->waiting_writers++;
-    while (rw->current_readers > 0 || rw->current_writers > 0)
+    if (__atomic_compare_exchange_n(&rw->state, &s, RWLOCK_WRITER, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
     {
-        pthread_cond_wait(&ctx->write_cv, &rw->lock);
+        if (__atomic_load_n(&rw->hot, __ATOMIC_RELAXED))
+        {
+            __atomic_store_n(&rw->hot, 0, __ATOMIC_RELAXED); // 쓰기마다 식힌다
+        }
+        rwlock_seq_enter(rw);
+        return 0;
     }
-    ctx->waiting_writers--;
 
-    rw->current_writers++;
-    pthread_mutex_unlock(&rw->lock);
+    start = stats_now();
+    limit = rwlock_spin_limit(rw);
+    for (n = 0;; n++)
+    {
+        s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED);
+        if (rwlock_write_ok(s))
+        {
+            // 대기 writer로 등록했었다면 들어가면서 함께 빼고,
+            // hot이었다면 식혀서 새 reader가 slot을 쓰지 못하게 한다
+            next = ((s | RWLOCK_WRITER) & ~RWLOCK_HOT_BIT) - waiter;
+            if (__atomic_compare_exchange_n(&rw->state, &s, next, 0,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_RELAXED))
+            {
+                break;
+            }
+            continue;
+        }
+        if (n < limit)
+        {
+            rwlock_relax();
+            continue;
+        }
+
+        seq = __atomic_load_n(&rw->write_seq, __ATOMIC_SEQ_CST);
+        s = __atomic_load_n(&rw->state, __ATOMIC_SEQ_CST);
+        if (rwlock_write_ok(s))
+        {
+            continue;
+        }
+        // 잠들기 전에 등록해야 새 reader가 뒤에서 기다린다
+        if (!waiter)
+        {
+            if (!__atomic_compare_exchange_n(&rw->state, &s,
+                                             s + RWLOCK_WAITER, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+            {
+                continue;
+            }
+            waiter = RWLOCK_WAITER;
+        }
+        rwlock_futex_wait(&rw->write_seq, seq);
+        slept = 1;
+    }
+
+    if (s & RWLOCK_HOT_BIT)
+    {
+        rwlock_hot_drain(rw);
+    }
+    if (__atomic_load_n(&rw->hot, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&rw->hot, 0, __ATOMIC_RELAXED);
+    }
+    rwlock_seq_enter(rw);
+    rwlock_spin_update(rw, n, slept);
+    stats_lock_wait(stats_now() - start);
     /*--------------------------------------------------------------------*/
     return 0;
 }
@@ -142,24 +487,38 @@ int rwlock_write_unlock(rwlock_t *rw)
         errno = EINVAL;
         return -1;
     }
-    sleep(rw->delay);
+    if (rw->delay > 0)
+    {
+        sleep(rw->delay);
+    }
     /*--------------------------------------------------------------------*/
-    struct uctx *ctx = (struct uctx *)rw->uctx;
-    pthread_mutex_lock(&rw->lock);
+    uint32_t s = __atomic_load_n(&rw->state, __ATOMIC_RELAXED), next;
+
+    // 변경을 마친 뒤 seq를 다시 짝수로 (낙관적 reader가 확인)
+    __atomic_store_n(&rw->seq, rw->seq + 1, __ATOMIC_RELEASE);
 
-    rw->current_writers--;
+    // 뒤에 선 reader들은 대기 writer가 더 없을 때만 함께 깨운다
+    do
+    {
+        next = s & ~(RWLOCK_WRITER | RWLOCK_READERS_AHEAD);
+        if (!(s & RWLOCK_WAITERS))
+        {
+            next &= ~RWLOCK_READERS_BEHIND;
+        }
+    } while (!__atomic_compare_exchange_n(&rw->state, &s, next, 0,
+                                          __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
 
-    // writer 우선, 없으면 reader들 깨우기
-    if (ctx->waiting_writers > 0)
+    // 이 writer보다 먼저 온 reader들 먼저, 없으면 다음 writer 깨우기
+    if ((s & RWLOCK_READERS_AHEAD) ||
+        ((s & RWLOCK_READERS_BEHIND) && !(s & RWLOCK_WAITERS)))
     {
-        pthread_cond_signal(&ctx->write_cv);
+        rwlock_futex_wake(&rw->read_seq, INT_MAX);
     }
-    else
+    else if (s & RWLOCK_WAITERS)
     {
-        pthread_cond_broadcast(&ctx->read_cv);
+        rwlock_futex_wake(&rw->write_seq, 1);
     }
-
-    pthread_mutex_unlock(&rw->lock);
     /*--------------------------------------------------------------------*/
     return 0;
 }
@@ -173,13 +532,9 @@ int rwlock_destroy(rwlock_t *rw)
         errno = EINVAL;
         return -1;
     }
-
-    struct uctx *ctx = (struct uctx *)rw->uctx;
-    pthread_cond_destroy(&ctx->read_cv);
-    pthread_cond_destroy(&ctx->write_cv);
-    free(ctx);
-    pthread_mutex_destroy(&rw->lock);
+    // 상태가 word 하나뿐이라 따로 풀어 줄 자원이 없다
     /*--------------------------------------------------------------------*/
 
     return 0;
 }
+/*--------------------------------------------------------------------*/
@@ -1,6 +1,7 @@
 /*--------------------------------------------------------------------*/
 /* rwlock.h                                                           */
 /* Author: Junghan Yoon, KyoungSoo Park                               */
+/* Modified by: Jaeun Park                                            */
 /*--------------------------------------------------------------------*/
 #ifndef _RWLOCK_H
 #define _RWLOCK_H
@@ -14,13 +15,45 @@
 #include <unistd.h>
 #define WRITER_RING_SIZE NUM_THREADS
 /*--------------------------------------------------------------------*/
+/**
+ * The whole lock state is one 32-bit word, so an uncontended lock or
+ * unlock is a single atomic operation:
+ * bit 0 is set while a writer holds the lock, bits 1 and 2 while
+ * readers sleep ahead of or behind the waiting writers, bit 3 while
+ * the lock is hot (below), bits 4 ~ 12 count the writers sleeping
+ * (or about to) and bits 13 ~ 31 count the readers holding it.
+ * A contended thread spins for a while (adaptively, per lock) and then
+ * sleeps on a futex; the sequence words only carry the wake-ups.
+ * Requests are served in arrival order: a reader waits for the writers
+ * already waiting when it came, and a writer for the readers that came
+ * before it. Quick readers only wait for a writer holding the lock.
+ *
+ * A lock whose readers keep colliding on the reader count turns hot:
+ * readers then only publish the lock in a slot of their own thread
+ * and never write the shared word, and a writer clears the hot bit
+ * along with taking the lock and waits for the slots holding it to
+ * drain. It cools down on every write and turns hot again only after
+ * another RWLOCK_HOT collisions, so read-mostly buckets stay hot and
+ * the rest keep the plain word.
+ */
+#define RWLOCK_WRITER 0x1u
+#define RWLOCK_READERS_AHEAD 0x2u  // readers sleeping, before the writers
+#define RWLOCK_READERS_BEHIND 0x4u // readers sleeping, after them
+#define RWLOCK_HOT_BIT 0x8u        // readers use their thread's slots
+#define RWLOCK_WAITER 0x10u        // one waiting writer
+#define RWLOCK_WAITERS 0x1ff0u
+#define RWLOCK_READER_SHIFT 13
+#define RWLOCK_READER (1u << RWLOCK_READER_SHIFT)
+/*--------------------------------------------------------------------*/
 typedef struct
 {
-    pthread_mutex_t lock;         // mutex lock for protecting others
-    unsigned int current_readers; // number of current readers
-    unsigned int current_writers; // number of current writers
-    unsigned int delay;           // for semantic test
-    void *uctx;                   // free to use
+    uint32_t state;     // see above
+    uint32_t read_seq;  // bumped to wake sleeping readers
+    uint32_t write_seq; // bumped to wake a sleeping writer
+    uint32_t spin;      // spins that usually suffice, adapted on the fly
+    uint32_t hot;       // reader collisions since the last write
+    uint32_t seq;       // odd while a writer holds the lock, see below
+    unsigned int delay; // for semantic test
 } rwlock_t;
 /*--------------------------------------------------------------------*/
 /**
@@ -70,16 +103,49 @@ int rwlock_write_unlock(rwlock_t *rw);
  */
 int rwlock_destroy(rwlock_t *rw);
 /*--------------------------------------------------------------------*/
+/**
+ * Begins an optimistic read of the data rw protects, taking no lock and
+ * writing nothing: every write lock and unlock bumps the sequence, so
+ * the data read in between is valid only if rwlock_seq_retry() says so.
+ * Returns the sequence to hand to rwlock_seq_retry().
+ */
+static inline uint32_t
+rwlock_seq_begin(rwlock_t *rw)
+{
+    return __atomic_load_n(&rw->seq, __ATOMIC_ACQUIRE);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Returns 1 when a writer held or took rw since rwlock_seq_begin()
+ * returned seq, so that what was read must be thrown away.
+ * Returns 0 when it is consistent.
+ */
+static inline int
+rwlock_seq_retry(rwlock_t *rw, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seq & 1) || __atomic_load_n(&rw->seq, __ATOMIC_RELAXED) != seq;
+}
+/*--------------------------------------------------------------------*/
+/* readers in the slots are not counted */
 static inline int
 rwlock_current_readers(rwlock_t *rw)
 {
-    return rw->current_readers;
+    return __atomic_load_n(&rw->state, __ATOMIC_RELAXED) >>
+           RWLOCK_READER_SHIFT;
 }
 /*--------------------------------------------------------------------*/
 static inline int
 rwlock_current_writers(rwlock_t *rw)
 {
-    return rw->current_writers;
+    return __atomic_load_n(&rw->state, __ATOMIC_RELAXED) & RWLOCK_WRITER;
+}
+/*--------------------------------------------------------------------*/
+static inline int
+rwlock_is_hot(rwlock_t *rw)
+{
+    return (__atomic_load_n(&rw->state, __ATOMIC_RELAXED) &
+            RWLOCK_HOT_BIT) != 0;
 }
 /*--------------------------------------------------------------------*/
 #endif // _RWLOCK_H
\ No newline at end of file
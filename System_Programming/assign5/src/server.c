@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -14,8 +16,19 @@
 #include <getopt.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sched.h>
 #include "common.h"
 #include "skvslib.h"
+#include "conn.h"
+#include "spsc.h"
+#include "stats.h"
+/*--------------------------------------------------------------------*/
+#define MAX_EVENTS 64
+#define SHARD_RING_SIZE 256 // messages in flight from one shard to another
 /*--------------------------------------------------------------------*/
 struct thread_args
 {
@@ -32,6 +45,21 @@ struct thread_args
 volatile static sig_atomic_t g_shutdown = 0;
 static pthread_mutex_t accept_mutex = PTHREAD_MUTEX_INITIALIZER;
 /*--------------------------------------------------------------------*/
+/* event mode: connections ready to be served, handed to the workers */
+struct ready_queue
+{
+    struct conn *head;
+    struct conn *tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+};
+static struct ready_queue g_ready = {NULL, NULL,
+                                     PTHREAD_MUTEX_INITIALIZER,
+                                     PTHREAD_COND_INITIALIZER};
+static int g_epfd = -1;
+static struct conn *g_conns = NULL; // all open connections
+static pthread_mutex_t conns_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*--------------------------------------------------------------------*/
 void *handle_client(void *arg)
 {
     TRACE_PRINT();
@@ -40,8 +68,7 @@ void *handle_client(void *arg)
     int idx = args->idx;
     int listenfd = args->listenfd;
     /*--------------------------------------------------------------------*/
-    char rbuf[BUF_SIZE];
-    char wbuf[BUF_SIZE];
+    struct conn *c;
     int connfd;
     struct sockaddr_in client_addr;
     socklen_t client_len;
@@ -72,85 +99,693 @@ void *handle_client(void *arg)
             continue;
         }
 
-        // 클라이언트 처리
-        while (!g_shutdown)
+        // 클라이언트 처리: 블로킹 소켓이므로 연결 종료 또는
+        // 수신 타임아웃(TIMEOUT, listenfd에서 상속)까지 반환하지 않음.
+        // 양보할 다른 연결이 없으므로 CONN_BUSY면 바로 이어서 처리
+        c = conn_alloc(connfd);
+        if (!c)
+        {
+            close(connfd);
+            continue;
+        }
+        while (conn_handle(ctx, c) == CONN_BUSY)
+            ;
+        conn_free(c);
+    }
+    /*--------------------------------------------------------------------*/
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+static void conn_track(struct conn *c)
+{
+    pthread_mutex_lock(&conns_mutex);
+    c->all_prev = NULL;
+    c->all_next = g_conns;
+    if (g_conns)
+        g_conns->all_prev = c;
+    g_conns = c;
+    pthread_mutex_unlock(&conns_mutex);
+}
+/*--------------------------------------------------------------------*/
+static void conn_close(struct conn *c)
+{
+    pthread_mutex_lock(&conns_mutex);
+    if (c->all_prev)
+        c->all_prev->all_next = c->all_next;
+    else
+        g_conns = c->all_next;
+    if (c->all_next)
+        c->all_next->all_prev = c->all_prev;
+    pthread_mutex_unlock(&conns_mutex);
+
+    // close()가 epoll 등록도 해제한다
+    conn_free(c);
+}
+/*--------------------------------------------------------------------*/
+/* hands a connection to the workers of event mode */
+static void ready_push(struct conn *c)
+{
+    pthread_mutex_lock(&g_ready.lock);
+    c->next = NULL;
+    if (g_ready.tail)
+        g_ready.tail->next = c;
+    else
+        g_ready.head = c;
+    g_ready.tail = c;
+    pthread_cond_signal(&g_ready.cv);
+    pthread_mutex_unlock(&g_ready.lock);
+}
+/*--------------------------------------------------------------------*/
+static void accept_clients(int listenfd)
+{
+    TRACE_PRINT();
+    struct epoll_event ev;
+    struct conn *c;
+    int connfd;
+
+    // edge-triggered이므로 EAGAIN까지 accept
+    while (1)
+    {
+        connfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if (connfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept4");
+            return;
+        }
+
+        c = conn_alloc(connfd);
+        if (!c)
         {
-            memset(rbuf, 0, BUF_SIZE);
-            int total_read = 0;
+            close(connfd);
+            continue;
+        }
+        conn_track(c);
 
-            // recv로 데이터 읽기
-            while (1)
+        ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(g_epfd, EPOLL_CTL_ADD, connfd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            conn_close(c);
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+/* Reactor thread for event mode */
+void *handle_events(void *arg)
+{
+    TRACE_PRINT();
+    struct thread_args *args = (struct thread_args *)arg;
+    int listenfd = args->listenfd;
+    /*--------------------------------------------------------------------*/
+    struct epoll_event events[MAX_EVENTS];
+    struct conn *c;
+    int n, i;
+    /*--------------------------------------------------------------------*/
+
+    free(args);
+    printf("reactor ready\n");
+
+    /*--------------------------------------------------------------------*/
+    while (!g_shutdown)
+    {
+        n = epoll_wait(g_epfd, events, MAX_EVENTS, TIMEOUT * 1000);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
             {
-                ssize_t n = recv(connfd, rbuf + total_read, BUF_SIZE - total_read - 1, 0);
-
-                if (n < 0)
-                {
-                    if (errno == EINTR)
-                        continue;
-                    break;
-                }
-                else if (n == 0)
-                {
-                    // 연결 종료
-                    goto close_conn;
-                }
-
-                total_read += n;
-                rbuf[total_read] = '\0';
-
-                // 메시지 완료 확인: \n 또는 \n\n으로 종료
-                if (total_read > 0 && rbuf[total_read - 1] == '\n')
-                {
-                    if (rbuf[0] == '\n' || (total_read >= 2 && rbuf[0] == '\r' && rbuf[1] == '\n'))
-                    {
-                        // 빈 줄: 연결 종료
-                        goto close_conn;
-                    }
-                    break;
-                }
-
-                if (total_read >= BUF_SIZE - 1)
-                    break;
+                // listening socket
+                accept_clients(listenfd);
+                continue;
             }
 
-            if (total_read == 0)
-                break;
+            // EPOLLONESHOT: 다시 arm될 때까지 이 연결은 한 worker만 처리
+            ready_push(c);
+        }
+    }
 
-            // SKVS 요청 처리
-            size_t wlen = 0;
-            int ret = skvs_serve(ctx, rbuf, total_read, wbuf, &wlen);
+    // worker 깨우기
+    g_shutdown = 1;
+    pthread_mutex_lock(&g_ready.lock);
+    pthread_cond_broadcast(&g_ready.cv);
+    pthread_mutex_unlock(&g_ready.lock);
+    /*--------------------------------------------------------------------*/
 
-            if (ret < 0)
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* Worker thread for event mode */
+void *handle_ready(void *arg)
+{
+    TRACE_PRINT();
+    struct thread_args *args = (struct thread_args *)arg;
+    struct skvs_ctx *ctx = args->ctx;
+    int idx = args->idx;
+    /*--------------------------------------------------------------------*/
+    struct epoll_event ev;
+    enum CONN_STATE state;
+    struct conn *c;
+    /*--------------------------------------------------------------------*/
+
+    free(args);
+    printf("%dth worker ready\n", idx);
+
+    /*--------------------------------------------------------------------*/
+    while (1)
+    {
+        pthread_mutex_lock(&g_ready.lock);
+        while (!g_ready.head && !g_shutdown)
+        {
+            pthread_cond_wait(&g_ready.cv, &g_ready.lock);
+        }
+        c = g_ready.head;
+        if (!c)
+        {
+            pthread_mutex_unlock(&g_ready.lock);
+            break;
+        }
+        g_ready.head = c->next;
+        if (!g_ready.head)
+            g_ready.tail = NULL;
+        pthread_mutex_unlock(&g_ready.lock);
+
+        state = conn_handle(ctx, c);
+        if (state == CONN_CLOSING)
+        {
+            conn_close(c);
+            continue;
+        }
+        if (state == CONN_BUSY)
+        {
+            // 이벤트를 기다리지 않고 queue 뒤에서 다시 차례를 기다린다
+            ready_push(c);
+            continue;
+        }
+
+        // 다음 이벤트를 위해 다시 arm (이후 c에 접근하지 않음)
+        ev.events = (state == CONN_WRITING ? EPOLLOUT : EPOLLIN) |
+                    EPOLLET | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(g_epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            conn_close(c);
+        }
+    }
+    /*--------------------------------------------------------------------*/
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+/* sharded mode: every shard has its own listener, event loop and table,
+   and a request for a key of another shard (skvs_shard()) is handed
+   over to its owner and back through lock-free single-producer rings */
+struct fwd_msg
+{
+    struct conn *c;       // connection waiting for the response
+    int src;              // shard of the connection
+    int dst;              // shard the message goes to next
+    int binary;           // protocol of the request
+    int cmd;              // command served, for its STATS_SEND time
+    size_t req_len;
+    size_t res_len;
+    value_t *value;       // value of a large frame, after req
+    struct skvs_ref ref;  // value of a READ, sent in place after res
+    struct fwd_msg *next; // list of messages to send again
+    char req[BUF_SIZE];
+    char res[BUF_SIZE];
+};
+struct shard
+{
+    int idx;
+    int listenfd;           // SO_REUSEPORT listener of this shard
+    int epfd;
+    int efd;                // eventfd the other shards wake it up with
+    int sleeping;           // set while blocked (or about to) in epoll_wait
+    struct skvs_ctx *ctx;   // table of the keys this shard owns
+    struct spsc_ring **in;  // in[src]: messages from shard src
+    struct fwd_msg *retry;  // messages a full ring could not take yet
+    struct conn *conns;     // open connections, touched by this shard only
+    struct conn *busy;      // CONN_BUSY connections to serve again
+};
+static struct shard *g_shards = NULL;
+static int g_num_shards = 0;
+/*--------------------------------------------------------------------*/
+static void shard_close(struct shard *sh, struct conn *c)
+{
+    if (c->all_prev)
+        c->all_prev->all_next = c->all_next;
+    else
+        sh->conns = c->all_next;
+    if (c->all_next)
+        c->all_next->all_prev = c->all_prev;
+
+    // 아직 돌아오지 않은 메시지의 값도 함께 놓아준다
+    if (c->uctx)
+    {
+        struct fwd_msg *m = c->uctx;
+
+        hash_release(m->value);
+        hash_release(m->ref.value);
+        free(m);
+    }
+    conn_free(c);
+}
+/*--------------------------------------------------------------------*/
+/* wakes the shard up if it sleeps; call after pushing to its ring */
+static void shard_wake(struct shard *sh)
+{
+    uint64_t one = 1;
+
+    // handle_shard()에서 ring을 다시 확인하는 것과 짝을 이루는 barrier
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sh->sleeping, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&sh->sleeping, 0, __ATOMIC_RELAXED))
+    {
+        if (write(sh->efd, &one, sizeof(one)) < 0)
+            perror("eventfd write");
+    }
+}
+/*--------------------------------------------------------------------*/
+static void shard_send(struct shard *sh, struct fwd_msg *m)
+{
+    struct shard *dst = &g_shards[m->dst];
+
+    // ring이 가득 차면 다음 loop에서 다시 보낸다
+    if (spsc_push(dst->in[sh->idx], m) < 0)
+    {
+        m->next = sh->retry;
+        sh->retry = m;
+        return;
+    }
+    shard_wake(dst);
+}
+/*--------------------------------------------------------------------*/
+static void shard_serve(struct shard *sh, struct conn *c)
+{
+    TRACE_PRINT();
+    struct fwd_msg *m;
+
+    switch (conn_handle(sh->ctx, c))
+    {
+    case CONN_CLOSING:
+        shard_close(sh, c);
+        break;
+    case CONN_FORWARD:
+        // 연결마다 메시지 하나를 재사용 (한 번에 하나만 넘기므로)
+        m = c->uctx;
+        if (!m)
+            m = c->uctx = malloc(sizeof(struct fwd_msg));
+        if (!m)
+        {
+            perror("malloc");
+            shard_close(sh, c);
+            break;
+        }
+        m->c = c;
+        m->src = sh->idx;
+        m->dst = c->fwd_shard;
+        m->binary = c->proto == CONN_PROTO_BINARY;
+        m->req_len = c->fwd_len;
+        memcpy(m->req, c->fwd_req, c->fwd_len);
+        // 큰 frame의 값은 복사하지 않고 연결에서 넘겨받는다
+        m->value = c->value;
+        c->value = NULL;
+        m->ref.value = NULL;
+        shard_send(sh, m);
+        break;
+    case CONN_BUSY:
+        // 다른 연결의 이벤트를 처리한 뒤 loop에서 이어서 처리
+        c->next = sh->busy;
+        sh->busy = c;
+        break;
+    default:
+        // edge-triggered: 다음 이벤트를 기다린다
+        break;
+    }
+}
+/*--------------------------------------------------------------------*/
+/* serves the requests of other shards and completes the forwarded
+   requests of this shard's connections */
+static void shard_receive(struct shard *sh)
+{
+    TRACE_PRINT();
+    struct fwd_msg *m;
+    ssize_t ret;
+    int src;
+
+    for (src = 0; src < g_num_shards; src++)
+    {
+        if (src == sh->idx)
+            continue;
+        while ((m = spsc_pop(sh->in[src])) != NULL)
+        {
+            if (m->src == sh->idx)
             {
-                break;
+                // 돌아온 응답: 연결을 이어서 처리
+                conn_forwarded(m->c, m->res, m->res_len, &m->ref);
+                m->ref.value = NULL;
+                stats_unsent(m->cmd);
+                shard_serve(sh, m->c);
+                continue;
             }
 
-            if (ret > 0 && wlen > 0)
+            // 읽은 값은 고정해서 연결의 shard가 table에서 바로 보낸다
+            m->res_len = 0;
+            if (m->value)
+                ret = skvs_serve_value(sh->ctx, m->req, m->req_len,
+                                       m->value, m->res, &m->res_len);
+            else if (m->binary)
+                ret = skvs_serve_bin(sh->ctx, m->req, m->req_len,
+                                     m->res, &m->res_len, &m->ref);
+            else
+                ret = skvs_serve(sh->ctx, m->req, m->req_len,
+                                 m->res, &m->res_len, &m->ref);
+            m->value = NULL;
+            if (ret <= 0)
+                m->res_len = 0;
+            // 응답은 연결의 shard가 보내므로 send 시간도 그쪽에서 잰다
+            m->cmd = stats_handoff();
+            m->dst = m->src;
+            shard_send(sh, m);
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+static void shard_accept(struct shard *sh)
+{
+    TRACE_PRINT();
+    struct epoll_event ev;
+    struct conn *c;
+    int connfd;
+
+    // edge-triggered이므로 EAGAIN까지 accept
+    while (1)
+    {
+        connfd = accept4(sh->listenfd, NULL, NULL, SOCK_NONBLOCK);
+        if (connfd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept4");
+            return;
+        }
+
+        c = conn_alloc(connfd);
+        if (!c)
+        {
+            close(connfd);
+            continue;
+        }
+        c->all_prev = NULL;
+        c->all_next = sh->conns;
+        if (sh->conns)
+            sh->conns->all_prev = c;
+        sh->conns = c;
+
+        // 한 스레드만 다루므로 oneshot 없이 읽기와 쓰기를 함께 등록
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            shard_close(sh, c);
+        }
+    }
+}
+/*--------------------------------------------------------------------*/
+/* Event loop of a shard for sharded mode */
+void *handle_shard(void *arg)
+{
+    TRACE_PRINT();
+    struct shard *sh = (struct shard *)arg;
+    /*--------------------------------------------------------------------*/
+    struct epoll_event events[MAX_EVENTS];
+    struct conn *c, *next;
+    cpu_set_t cpus;
+    uint64_t count;
+    int n, i, src, timeout;
+    /*--------------------------------------------------------------------*/
+
+    // shard마다 core 하나에 고정 (실패해도 동작에는 지장 없음)
+    CPU_ZERO(&cpus);
+    CPU_SET(sh->idx % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    printf("%dth shard ready\n", sh->idx);
+
+    /*--------------------------------------------------------------------*/
+    while (!g_shutdown)
+    {
+        shard_receive(sh);
+        if (sh->busy)
+        {
+            c = sh->busy;
+            sh->busy = NULL;
+            for (; c; c = next)
             {
-                // send로 응답 전송
-                size_t total_sent = 0;
-                while (total_sent < wlen)
-                {
-                    ssize_t n = send(connfd, wbuf + total_sent, wlen - total_sent, 0);
-                    if (n < 0)
-                    {
-                        if (errno == EINTR)
-                            continue;
-                        goto close_conn;
-                    }
-                    total_sent += n;
-                }
+                next = c->next;
+                shard_serve(sh, c);
             }
         }
+        if (sh->retry)
+        {
+            struct fwd_msg *m = sh->retry, *next;
 
-    close_conn:
-        close(connfd);
+            sh->retry = NULL;
+            for (; m; m = next)
+            {
+                next = m->next;
+                shard_send(sh, m);
+            }
+        }
+
+        // 잠들기 전에 sleeping을 세우고 ring을 다시 확인 (shard_wake()와 짝)
+        timeout = sh->busy ? 0 : sh->retry ? 1 : TIMEOUT * 1000;
+        __atomic_store_n(&sh->sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (src = 0; src < g_num_shards && timeout > 0; src++)
+        {
+            if (src != sh->idx && !spsc_empty(sh->in[src]))
+                timeout = 0;
+        }
+
+        n = epoll_wait(sh->epfd, events, MAX_EVENTS, timeout);
+        __atomic_store_n(&sh->sleeping, 0, __ATOMIC_RELAXED);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            c = events[i].data.ptr;
+            if (c == NULL)
+            {
+                // listening socket
+                shard_accept(sh);
+            }
+            else if ((void *)c == (void *)sh)
+            {
+                // 다른 shard가 깨움: ring은 loop 처음에 확인
+                if (read(sh->efd, &count, sizeof(count)) < 0 &&
+                    errno != EAGAIN)
+                    perror("eventfd read");
+            }
+            else if (c->state != CONN_FORWARD && c->state != CONN_BUSY)
+            {
+                // 응답을 기다리는 연결은 응답이 오면,
+                // 양보한 연결은 loop 처음에 이어서 처리
+                shard_serve(sh, c);
+            }
+        }
     }
     /*--------------------------------------------------------------------*/
 
     return NULL;
 }
 /*--------------------------------------------------------------------*/
+/* opens a non-blocking listener sharing the port with the other shards */
+static int shard_listen(const char *ip, int port)
+{
+    struct sockaddr_in server_addr;
+    int fd, reuse = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    // 커널이 같은 port의 listener들에 연결을 나눠준다
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+    {
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(ip);
+    server_addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, NUM_BACKLOG) < 0)
+    {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+/*--------------------------------------------------------------------*/
+/* closes the connections and frees the shards; call after joining them */
+static void shards_destroy(int dump)
+{
+    struct shard *sh;
+    int i, src;
+
+    // 메시지는 연결이 소유하므로 연결과 함께 해제된다.
+    // 다른 shard의 값을 고정했을 수 있으므로 table보다 먼저 모두 닫는다
+    for (i = 0; i < g_num_shards; i++)
+    {
+        sh = &g_shards[i];
+        while (sh->conns)
+            shard_close(sh, sh->conns);
+    }
+    for (i = 0; i < g_num_shards; i++)
+    {
+        sh = &g_shards[i];
+        if (sh->in)
+        {
+            for (src = 0; src < g_num_shards; src++)
+                spsc_free(sh->in[src]);
+            free(sh->in);
+        }
+        if (sh->efd >= 0)
+            close(sh->efd);
+        if (sh->epfd >= 0)
+            close(sh->epfd);
+        if (sh->listenfd >= 0)
+            close(sh->listenfd);
+        if (sh->ctx)
+        {
+            if (dump)
+                printf("Shard %d\n", i);
+            skvs_destroy(sh->ctx, dump);
+        }
+    }
+    free(g_shards);
+    g_shards = NULL;
+    g_num_shards = 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * sets up num_shards shards, each with 1/num_shards of the buckets
+ * and of the memory cap (0 for none)
+ */
+static int shards_init(const char *ip, int port, int num_shards,
+                       size_t hash_size, int delay, int flags,
+                       size_t mem_limit)
+{
+    struct epoll_event ev;
+    struct shard *sh;
+    int i, src;
+
+    g_shards = calloc(num_shards, sizeof(struct shard));
+    if (!g_shards)
+    {
+        perror("calloc");
+        return -1;
+    }
+    g_num_shards = num_shards;
+    for (i = 0; i < num_shards; i++)
+    {
+        g_shards[i].idx = i;
+        g_shards[i].listenfd = -1;
+        g_shards[i].epfd = -1;
+        g_shards[i].efd = -1;
+    }
+
+    for (i = 0; i < num_shards; i++)
+    {
+        sh = &g_shards[i];
+        sh->ctx = skvs_init((hash_size + num_shards - 1) / num_shards,
+                            delay, flags, NULL);
+        if (!sh->ctx)
+            return -1;
+        if (mem_limit && skvs_set_limit(sh->ctx, (mem_limit + num_shards - 1) /
+                                                     num_shards) < 0)
+            return -1;
+        skvs_set_shard(sh->ctx, i, num_shards);
+
+        // 자기 자신으로부터의 ring은 필요 없다
+        sh->in = calloc(num_shards, sizeof(struct spsc_ring *));
+        if (!sh->in)
+        {
+            perror("calloc");
+            return -1;
+        }
+        for (src = 0; src < num_shards; src++)
+        {
+            if (src != i && !(sh->in[src] = spsc_alloc(SHARD_RING_SIZE)))
+                return -1;
+        }
+
+        sh->listenfd = shard_listen(ip, port);
+        if (sh->listenfd < 0)
+            return -1;
+        sh->epfd = epoll_create1(0);
+        sh->efd = eventfd(0, EFD_NONBLOCK);
+        if (sh->epfd < 0 || sh->efd < 0)
+        {
+            perror("epoll/eventfd");
+            return -1;
+        }
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->listenfd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            return -1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = sh;
+        if (epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->efd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
 /* Signal handler for SIGINT */
 void handle_sigint(int sig)
 {
@@ -159,6 +794,43 @@ void handle_sigint(int sig)
     g_shutdown = 1;
 }
 /*--------------------------------------------------------------------*/
+/**
+ * parses a byte count with an optional K, M or G suffix.
+ * Returns -1 when str is not such a count.
+ */
+static int parse_size(const char *str, size_t *bytes)
+{
+    unsigned long long n;
+    char *end;
+    int shift = 0;
+
+    if (!isdigit((unsigned char)*str))
+    {
+        return -1;
+    }
+    errno = 0;
+    n = strtoull(str, &end, 10);
+    switch (toupper((unsigned char)*end))
+    {
+    case 'G':
+        shift += 10;
+        /* fall through */
+    case 'M':
+        shift += 10;
+        /* fall through */
+    case 'K':
+        shift += 10;
+        end++;
+        break;
+    }
+    if (errno != 0 || *end != '\0' || n > (SIZE_MAX >> shift))
+    {
+        return -1;
+    }
+    *bytes = (size_t)n << shift;
+    return 0;
+}
+/*--------------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
     size_t hash_size = DEFAULT_HASH_SIZE;
@@ -166,16 +838,29 @@ int main(int argc, char *argv[])
     int port = DEFAULT_PORT, opt;
     int num_threads = NUM_THREADS;
     int delay = RWLOCK_DELAY;
+    int event_mode = 0;
+    int hash_flags = 0;
+    int hash_fn = HASH_FN_FAST;
+    char *aof_path = NULL;
+    int fsync_ms = AOF_FSYNC_DEFAULT;
+    char *endptr = "";
+    char *snap_path = NULL;
+    int snap_interval = 0;
+    char *map_path = NULL;
+    int shard_mode = 0;
+    size_t mem_limit = 0;
+    unsigned long num_locks = 0;
+    int lock_bits = 0;
     /*--------------------------------------------------------------------*/
-    int listenfd, i;
+    int listenfd, i, num_created = 0;
     struct sockaddr_in server_addr;
-    pthread_t threads[num_threads];
+    pthread_t *threads;
     struct skvs_ctx *ctx;
     struct sigaction sa;
     /*--------------------------------------------------------------------*/
 
     /* parse command line options */
-    while ((opt = getopt(argc, argv, "p:t:s:d:h")) != -1)
+    while ((opt = getopt(argc, argv, "p:t:s:L:d:m:elorH:a:f:S:T:M:Rh")) != -1)
     {
         switch (opt)
         {
@@ -193,25 +878,145 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'L':
+            // 2의 거듭제곱으로 올려 bucket 번호의 하위 bit로 고른다
+            num_locks = strtoul(optarg, &endptr, 10);
+            lock_bits = num_locks > 1 ? 64 - __builtin_clzl(num_locks - 1)
+                                      : 0;
+            if (*endptr != '\0' || num_locks == 1 ||
+                lock_bits > HASH_LOCKS_OF(~0))
+            {
+                fprintf(stderr, "Invalid number of locks: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            if (parse_size(optarg, &mem_limit) < 0)
+            {
+                fprintf(stderr, "Invalid memory limit: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'd':
             delay = atoi(optarg);
             break;
+        case 'e':
+            event_mode = 1;
+            break;
+        case 'l':
+            hash_flags |= HASH_LOCKFREE_READ;
+            break;
+        case 'o':
+            hash_flags |= HASH_SEQLOCK_READ;
+            break;
+        case 'r':
+            hash_flags |= HASH_RESIZE;
+            break;
+        case 'H':
+            hash_fn = hash_fn_lookup(optarg);
+            if (hash_fn < 0)
+            {
+                fprintf(stderr, "Invalid hash function: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            aof_path = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "always") == 0)
+                fsync_ms = AOF_FSYNC_ALWAYS;
+            else if (strcmp(optarg, "never") == 0)
+                fsync_ms = AOF_FSYNC_NEVER;
+            else
+                fsync_ms = strtol(optarg, &endptr, 10);
+            if (fsync_ms < AOF_FSYNC_NEVER || *endptr != '\0')
+            {
+                fprintf(stderr, "Invalid fsync policy: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            snap_path = optarg;
+            break;
+        case 'T':
+            snap_interval = atoi(optarg);
+            break;
+        case 'M':
+            map_path = optarg;
+            break;
+        case 'R':
+            shard_mode = 1;
+            break;
         case 'h':
         default:
             printf("Usage: %s [-p port (%d)] "
                    "[-t num_threads (%d)] "
                    "[-d rwlock_delay (%d)] "
-                   "[-s hash_size (%d)]\n",
+                   "[-s hash_size (%d)] "
+                   "[-L num_locks (0: one per bucket)] "
+                   "[-m mem_limit[K|M|G] (0: none)] "
+                   "[-e (epoll event mode)] "
+                   "[-l (lock-free reads)] "
+                   "[-o (optimistic reads)] "
+                   "[-r (online resizing)] "
+                   "[-H hash_fn (fast|siphash|legacy)] "
+                   "[-a aof_path] "
+                   "[-f fsync (always|never|ms) (%d)] "
+                   "[-S snapshot_path] "
+                   "[-T snapshot_interval_sec] "
+                   "[-M map_path] "
+                   "[-R (shard per thread)]\n",
                    argv[0],
                    DEFAULT_PORT,
                    NUM_THREADS,
                    RWLOCK_DELAY,
-                   DEFAULT_HASH_SIZE);
+                   DEFAULT_HASH_SIZE,
+                   AOF_FSYNC_DEFAULT);
             exit(EXIT_FAILURE);
         }
     }
 
     /*--------------------------------------------------------------------*/
+    if (num_threads <= 0)
+    {
+        fprintf(stderr, "Invalid number of threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((hash_flags & HASH_LOCKFREE_READ) && (hash_flags & HASH_SEQLOCK_READ))
+    {
+        fprintf(stderr, "-l cannot be combined with -o\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 파일에 상주하는 table은 그 자체로 남으며 크기가 고정된다
+    if (map_path && ((hash_flags & (HASH_LOCKFREE_READ | HASH_SEQLOCK_READ |
+                                    HASH_RESIZE)) ||
+                     aof_path || snap_path || mem_limit || lock_bits))
+    {
+        fprintf(stderr,
+                "-M cannot be combined with -l, -o, -r, -a, -S, -m or -L\n");
+        exit(EXIT_FAILURE);
+    }
+
+    hash_flags |= HASH_FN_FLAG(hash_fn) | HASH_LOCKS_FLAG(lock_bits);
+
+    // shard마다 따로 동작하므로 공유하는 log, snapshot, file이 없어야 한다
+    if (shard_mode && (event_mode || aof_path || snap_path || map_path))
+    {
+        fprintf(stderr, "-R cannot be combined with -e, -a, -S or -M\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // event mode는 reactor 스레드가 하나 더 필요
+    threads = calloc(num_threads + 1, sizeof(pthread_t));
+    if (!threads)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
     // SIGINT 핸들러 등록
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_sigint;
@@ -223,13 +1028,68 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    // sharded mode: -t개의 shard가 listener, event loop, table을 따로 가진다
+    if (shard_mode)
+    {
+        if (shards_init(ip, port, num_threads, hash_size, delay,
+                        hash_flags, mem_limit) < 0)
+        {
+            fprintf(stderr, "Failed to initialize shards\n");
+            shards_destroy(0);
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < num_threads; i++)
+        {
+            if (pthread_create(&threads[i], NULL, handle_shard,
+                               &g_shards[i]) != 0)
+            {
+                perror("pthread_create");
+                g_shutdown = 1;
+                break;
+            }
+            num_created++;
+        }
+        for (i = 0; i < num_created; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        free(threads);
+        shards_destroy(1);
+        return 0;
+    }
+
     // SKVS 초기화
-    ctx = skvs_init(hash_size, delay);
+    ctx = skvs_init(hash_size, delay, hash_flags, map_path);
     if (!ctx)
     {
         fprintf(stderr, "Failed to initialize SKVS\n");
         exit(EXIT_FAILURE);
     }
+    if (mem_limit && skvs_set_limit(ctx, mem_limit) < 0)
+    {
+        fprintf(stderr, "Failed to set the memory limit\n");
+        skvs_destroy(ctx, 0);
+        exit(EXIT_FAILURE);
+    }
+
+    // log가 없을 때만 snapshot으로 시작한다 (log가 더 최신)
+    if (snap_path && skvs_set_snapshot(ctx, snap_path, snap_interval,
+                                       aof_path == NULL, num_threads) < 0)
+    {
+        fprintf(stderr, "Failed to load %s\n", snap_path);
+        skvs_destroy(ctx, 0);
+        exit(EXIT_FAILURE);
+    }
+
+    // log가 있으면 worker 수만큼의 스레드로 복구한 뒤 기록 시작
+    if (aof_path && skvs_persist(ctx, aof_path, fsync_ms, num_threads) < 0)
+    {
+        fprintf(stderr, "Failed to load %s\n", aof_path);
+        skvs_destroy(ctx, 0);
+        exit(EXIT_FAILURE);
+    }
 
     // listening socket 생성
     listenfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -285,8 +1145,36 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    // event mode: non-blocking listening socket을 epoll에 등록
+    if (event_mode)
+    {
+        struct epoll_event ev;
+
+        g_epfd = epoll_create1(0);
+        if (g_epfd < 0)
+        {
+            perror("epoll_create1");
+            close(listenfd);
+            skvs_destroy(ctx, 0);
+            exit(EXIT_FAILURE);
+        }
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = NULL;
+        if (fcntl(listenfd, F_SETFL,
+                  fcntl(listenfd, F_GETFL, 0) | O_NONBLOCK) < 0 ||
+            epoll_ctl(g_epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+        {
+            perror("epoll setup");
+            close(g_epfd);
+            close(listenfd);
+            skvs_destroy(ctx, 0);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // 워커 스레드 생성
-    for (i = 0; i < num_threads; i++)
+    for (i = 0; i < num_threads + event_mode; i++)
     {
         struct thread_args *args = malloc(sizeof(struct thread_args));
         if (!args)
@@ -300,22 +1188,41 @@ int main(int argc, char *argv[])
         args->idx = i;
         args->ctx = ctx;
 
-        if (pthread_create(&threads[i], NULL, handle_client, args) != 0)
+        void *(*routine)(void *) = handle_client;
+        if (event_mode)
+            routine = (i < num_threads) ? handle_ready : handle_events;
+
+        if (pthread_create(&threads[i], NULL, routine, args) != 0)
         {
             perror("pthread_create");
             free(args);
             g_shutdown = 1;
             break;
         }
+        num_created++;
     }
 
     // 스레드 종료 대기
-    for (i = 0; i < num_threads; i++)
+    if (event_mode && num_created < num_threads + 1)
+    {
+        // reactor 없이 대기 중인 worker 깨우기
+        pthread_mutex_lock(&g_ready.lock);
+        pthread_cond_broadcast(&g_ready.cv);
+        pthread_mutex_unlock(&g_ready.lock);
+    }
+    for (i = 0; i < num_created; i++)
     {
         pthread_join(threads[i], NULL);
     }
 
     // 정리
+    while (g_conns)
+    {
+        conn_close(g_conns);
+    }
+    if (g_epfd >= 0)
+        close(g_epfd);
+    free(threads);
     close(listenfd);
     skvs_destroy(ctx, 1);
     /*--------------------------------------------------------------------*/
@@ -2,7 +2,12 @@
 /* skvslib.c                                                          */
 /* Author: Junghan Yoon, KyoungSoo Park                               */
 /*--------------------------------------------------------------------*/
+#include <arpa/inet.h>
+#include <strings.h>
+#include <time.h>
 #include "skvslib.h"
+#include "hashfn.h"
+#include "stats.h"
 /*--------------------------------------------------------------------*/
 /* response messages and commands */
 const char *g_msgs[MSG_COUNT] = {
@@ -12,153 +17,1197 @@ const char *g_msgs[MSG_COUNT] = {
     "NOT FOUND",
     "UPDATE OK",
     "DELETE OK",
-    "INTERNAL ERR"};
+    "INTERNAL ERR",
+    "SNAPSHOT OK",
+    "EXPIRE OK"};
 const char *g_cmds[CMD_COUNT] = {
     "CREATE",
     "READ",
     "QREAD",
     "UPDATE",
-    "DELETE"};
+    "DELETE",
+    "STATS",
+    "SNAPSHOT",
+    "MGET",
+    "MSET",
+    "MDEL",
+    "EXPIRE"};
 const char *g_lf = "\n";
+_Static_assert(CMD_COUNT <= STATS_CMDS, "enum CMD must fit in stats.h");
+/* STATS LATENCY: names of enum STATS_PHASE */
+static const char *g_phases[STATS_PHASES] = {"parse", "lock", "exec", "send"};
+/* binary protocol: whether each command carries a value */
+static const uint8_t g_bin_has_value[CMD_COUNT] = {
+    [CMD_CREATE] = 1,
+    [CMD_UPDATE] = 1,
+    [CMD_MGET] = 1,
+    [CMD_MSET] = 1,
+    [CMD_MDEL] = 1,
+    [CMD_EXPIRE] = 1};
+/* binary protocol: status for hash_*() returning 0 and 1 */
+static const uint8_t g_bin_status[CMD_COUNT][2] = {
+    [CMD_CREATE] = {BIN_COLLISION, BIN_OK},
+    [CMD_READ] = {BIN_NOT_FOUND, BIN_OK},
+    [CMD_QREAD] = {BIN_NOT_FOUND, BIN_OK},
+    [CMD_UPDATE] = {BIN_NOT_FOUND, BIN_OK},
+    [CMD_DELETE] = {BIN_NOT_FOUND, BIN_OK},
+    [CMD_STATS] = {BIN_INVALID, BIN_OK},
+    [CMD_SNAPSHOT] = {BIN_INVALID, BIN_OK},
+    [CMD_MGET] = {BIN_INVALID, BIN_OK},
+    [CMD_MSET] = {BIN_INVALID, BIN_OK},
+    [CMD_MDEL] = {BIN_INVALID, BIN_OK},
+    [CMD_EXPIRE] = {BIN_NOT_FOUND, BIN_OK}};
+/* bytes of the large values being received, shared by every shard */
+static size_t g_value_inflight = 0;
 /*--------------------------------------------------------------------*/
 static inline enum CMD
-skvs_parse(char *buffer, size_t len, const char **key, const char **value)
+skvs_parse(char *buffer, size_t len, const char **key, const char **value,
+           const char **ttl)
 {
     TRACE_PRINT();
-    char *cmd;
+    char *cmd, *lf_ptr, *saveptr;
     int i;
 
-    if (len > BUF_SIZE)
+    /* the request ends at the first line feed;
+       anything after it belongs to the next pipelined request */
+    lf_ptr = memchr(buffer, *g_lf, len < BUF_SIZE ? len : BUF_SIZE);
+    if (lf_ptr == NULL)
     {
-        /* too large message */
+        if (len >= BUF_SIZE)
+        {
+            /* too large message */
+            return CMD_INVALID;
+        }
+        return CMD_INCOMPLETE;
+    }
+
+    /* remove line feed */
+    *lf_ptr = '\0';
+
+    cmd = strtok_r(buffer, " ", &saveptr);
+    if (cmd == NULL)
+    {
+        /* no command found */
         return CMD_INVALID;
     }
-    if (len == BUF_SIZE)
+
+    /* convert command to uppercase for case-insensitive comparison */
+    for (i = 0; cmd[i]; i++)
+    {
+        cmd[i] = toupper(cmd[i]);
+    }
+
+    for (i = 0; i < CMD_COUNT; i++)
+    {
+        if (strcmp(cmd, g_cmds[i]) == 0)
+        {
+            if (i == CMD_SNAPSHOT)
+            {
+                /* SNAPSHOT takes no argument */
+                return strtok_r(NULL, " ", &saveptr) ? CMD_INVALID : i;
+            }
+            if (CMD_IS_MULTI(i))
+            {
+                /* the rest of the line, split by skvs_parse_multi() */
+                *key = strtok_r(NULL, "", &saveptr);
+                return *key ? i : CMD_INVALID;
+            }
+
+            *key = strtok_r(NULL, " ", &saveptr);
+            if (*key == NULL)
+            {
+                /* no key found; a bare STATS reports SERVER */
+                return i == CMD_STATS ? i : CMD_INVALID;
+            }
+            if (strlen(*key) > MAX_KEY_LEN)
+            {
+                /* too large key */
+                return CMD_INVALID;
+            }
+
+            *value = strtok_r(NULL, " ", &saveptr);
+
+            /* handle specific cases for READ and DELETE;
+               the value of STATS is the argument of its subject */
+            if ((i == CMD_READ || i == CMD_DELETE) && *value != NULL)
+            {
+                /* READ or DELETE should not have a value */
+                return CMD_INVALID;
+            }
+
+            /* handle specific cases for CREATE, UPDATE and EXPIRE */
+            if ((i == CMD_CREATE || i == CMD_UPDATE || i == CMD_EXPIRE) &&
+                *value == NULL)
+            {
+                /* CREATE or UPDATE must have a value, EXPIRE a TTL */
+                return CMD_INVALID;
+            }
+
+            /* CREATE and UPDATE may end with a TTL */
+            if (i == CMD_CREATE || i == CMD_UPDATE)
+            {
+                *ttl = strtok_r(NULL, " ", &saveptr);
+            }
+
+            /* check for extra tokens after value */
+            if (strtok_r(NULL, " ", &saveptr) != NULL)
+            {
+                /* extra tokens found */
+                return CMD_INVALID;
+            }
+
+            /* return the corresponding command enum */
+            return i;
+        }
+    }
+
+    /* command not recognized */
+    return CMD_INVALID;
+}
+/*--------------------------------------------------------------------*/
+/* deadline of a TTL of sec seconds from now, 0 for none */
+static inline uint64_t skvs_deadline(uint64_t sec)
+{
+    return sec ? hash_clock() + sec * 1000 : 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * turns the TTL argument of a text request (NULL when omitted)
+ * into a deadline.
+ * Returns -1 when it is not a number of seconds up to SKVS_MAX_TTL.
+ */
+static int skvs_expire(const char *ttl, uint64_t *expire)
+{
+    TRACE_PRINT();
+    unsigned long sec;
+    char *end;
+
+    if (ttl == NULL)
+    {
+        *expire = 0;
+        return 0;
+    }
+    if (!isdigit((unsigned char)*ttl))
+    {
+        return -1;
+    }
+    errno = 0;
+    sec = strtoul(ttl, &end, 10);
+    if (*end != '\0' || errno != 0 || sec > SKVS_MAX_TTL)
+    {
+        return -1;
+    }
+    *expire = skvs_deadline(sec);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * binary counterpart of skvs_expire(): takes the 4-byte TTL off the
+ * front of the value of len bytes.
+ * Returns -1 when it is missing or longer than SKVS_MAX_TTL.
+ */
+static int skvs_expire_bin(const char **value, size_t *len,
+                           uint64_t *expire)
+{
+    TRACE_PRINT();
+    uint32_t sec;
+
+    if (*len < sizeof(sec))
+    {
+        return -1;
+    }
+    memcpy(&sec, *value, sizeof(sec));
+    sec = ntohl(sec);
+    if (sec > SKVS_MAX_TTL)
+    {
+        return -1;
+    }
+    *value += sizeof(sec);
+    *len -= sizeof(sec);
+    *expire = skvs_deadline(sec);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * STATS HASH: hash function, chain length histogram and memory use.
+ * Returns the report length, which is >= size when truncated,
+ * or -1 when any internal errors occur.
+ */
+static ssize_t skvs_stats_hash(struct skvs_ctx *ctx, const char *arg,
+                               char *buf, size_t size)
+{
+    TRACE_PRINT();
+    hash_stats_t st;
+    size_t off;
+    int i;
+
+    (void)arg;
+    if (hash_stats(ctx->table, &st) < 0)
+    {
+        return -1;
+    }
+
+    off = snprintf(buf, size,
+                   "STAT hash_fn %s\n"
+                   "STAT hash_size %zu\n"
+                   "STAT entries %zu\n"
+                   "STAT max_chain %zu\n"
+                   "STAT hot_buckets %zu\n"
+                   "STAT mem_used %zu\n"
+                   "STAT mem_limit %zu\n"
+                   "STAT evictions %zu\n",
+                   hash_fn_name(st.hash_fn), st.hash_size,
+                   st.num_entries, st.max_chain, st.hot_buckets,
+                   st.mem_used, st.mem_limit, st.evictions);
+    for (i = 0; i <= HASH_STATS_CHAINS && off < size; i++)
+    {
+        off += snprintf(buf + off, size - off,
+                        i < HASH_STATS_CHAINS ? "STAT chain_%d %zu\n"
+                                              : "STAT chain_%d+ %zu\n",
+                        i, st.chains[i]);
+    }
+    return off;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * STATS SLAB: memory use of every slab size class in use.
+ * Returns the report length, which is >= size when truncated.
+ */
+static ssize_t skvs_stats_slab(struct skvs_ctx *ctx, const char *arg,
+                               char *buf, size_t size)
+{
+    TRACE_PRINT();
+    struct slab_class_stats st[SLAB_NUM_CLASSES];
+    size_t off = 0, bytes = 0;
+    int i;
+
+    (void)ctx;
+    (void)arg;
+    slab_stats(st);
+    for (i = 0; i < SLAB_NUM_CLASSES && off < size; i++)
+    {
+        if (st[i].slabs == 0)
+        {
+            continue;
+        }
+        bytes += st[i].slabs * SLAB_SIZE;
+        off += snprintf(buf + off, size - off,
+                        "STAT slab_%zu_slabs %zu\n"
+                        "STAT slab_%zu_used %zu\n",
+                        st[i].obj_size, st[i].slabs,
+                        st[i].obj_size, st[i].used);
+    }
+    if (off < size)
+    {
+        off += snprintf(buf + off, size - off,
+                        "STAT slab_bytes %zu\n", bytes);
+    }
+    return off;
+}
+/*--------------------------------------------------------------------*/
+/* lowercase name of cmd for the STAT lines, e.g. "mget" */
+static const char *skvs_cmd_name(int cmd, char *name)
+{
+    int i;
+
+    for (i = 0; g_cmds[cmd][i]; i++)
+    {
+        name[i] = tolower((unsigned char)g_cmds[cmd][i]);
+    }
+    name[i] = '\0';
+    return name;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * STATS SERVER (or a bare STATS): connections, traffic, hit and miss
+ * counts, and the requests served per command, for the whole process.
+ * Returns the report length, which is >= size when truncated.
+ */
+static ssize_t skvs_stats_server(struct skvs_ctx *ctx, const char *arg,
+                                 char *buf, size_t size)
+{
+    TRACE_PRINT();
+    struct stats_hist h;
+    uint64_t opened, closed;
+    char name[16];
+    size_t off;
+    int i;
+
+    (void)ctx;
+    (void)arg;
+    opened = stats_counter(STATS_CONN_OPENED);
+    closed = stats_counter(STATS_CONN_CLOSED);
+    off = snprintf(buf, size,
+                   "STAT curr_connections %llu\n"
+                   "STAT total_connections %llu\n"
+                   "STAT bytes_read %llu\n"
+                   "STAT bytes_written %llu\n"
+                   "STAT hits %llu\n"
+                   "STAT misses %llu\n"
+                   "STAT collisions %llu\n"
+                   "STAT invalid %llu\n",
+                   (unsigned long long)(opened > closed ? opened - closed
+                                                        : 0),
+                   (unsigned long long)opened,
+                   (unsigned long long)stats_counter(STATS_BYTES_IN),
+                   (unsigned long long)stats_counter(STATS_BYTES_OUT),
+                   (unsigned long long)stats_counter(STATS_HITS),
+                   (unsigned long long)stats_counter(STATS_MISSES),
+                   (unsigned long long)stats_counter(STATS_COLLISIONS),
+                   (unsigned long long)stats_counter(STATS_INVALID));
+    for (i = 0; i < CMD_COUNT && off < size; i++)
+    {
+        stats_hist(i, STATS_EXEC, &h);
+        off += snprintf(buf + off, size - off, "STAT cmd_%s %llu\n",
+                        skvs_cmd_name(i, name), (unsigned long long)h.count);
+    }
+    return off;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * STATS LATENCY: median and 99th percentile of every phase of every
+ * command served so far; STATS LATENCY <command>: count, mean,
+ * percentiles and maximum of every phase of that command.
+ * All times are in ns.
+ * Returns the report length, which is >= size when truncated,
+ * or -1 with errno EINVAL when the command is unknown.
+ */
+static ssize_t skvs_stats_latency(struct skvs_ctx *ctx, const char *arg,
+                                  char *buf, size_t size)
+{
+    TRACE_PRINT();
+    static const struct
+    {
+        const char *name;
+        double q;
+    } quantiles[] = {{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99},
+                     {"p999", 0.999}};
+    struct stats_hist h;
+    char name[16];
+    size_t off = 0, q;
+    int cmd, first = 0, last = CMD_COUNT - 1, phase;
+
+    (void)ctx;
+    if (arg != NULL)
+    {
+        for (cmd = 0; cmd < CMD_COUNT; cmd++)
+        {
+            if (strcasecmp(arg, g_cmds[cmd]) == 0)
+            {
+                break;
+            }
+        }
+        if (cmd == CMD_COUNT)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        first = last = cmd;
+    }
+
+    for (cmd = first; cmd <= last && off < size; cmd++)
+    {
+        // 요약에서는 처리한 적 없는 명령을 건너뛴다
+        stats_hist(cmd, STATS_EXEC, &h);
+        if (arg == NULL && h.count == 0)
+        {
+            continue;
+        }
+        skvs_cmd_name(cmd, name);
+        for (phase = 0; phase < STATS_PHASES && off < size; phase++)
+        {
+            stats_hist(cmd, phase, &h);
+            if (arg == NULL)
+            {
+                off += snprintf(buf + off, size - off,
+                                "STAT %s_%s_p50_ns %llu\n"
+                                "STAT %s_%s_p99_ns %llu\n",
+                                name, g_phases[phase],
+                                (unsigned long long)stats_quantile(&h, 0.5),
+                                name, g_phases[phase],
+                                (unsigned long long)stats_quantile(&h, 0.99));
+                continue;
+            }
+            off += snprintf(buf + off, size - off,
+                            "STAT %s_%s_count %llu\n"
+                            "STAT %s_%s_mean_ns %llu\n",
+                            name, g_phases[phase],
+                            (unsigned long long)h.count,
+                            name, g_phases[phase],
+                            (unsigned long long)(h.count ? h.sum / h.count
+                                                         : 0));
+            for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]) &&
+                        off < size;
+                 q++)
+            {
+                off += snprintf(buf + off, size - off,
+                                "STAT %s_%s_%s_ns %llu\n",
+                                name, g_phases[phase], quantiles[q].name,
+                                (unsigned long long)stats_quantile(
+                                    &h, quantiles[q].q));
+            }
+            if (off < size)
+            {
+                off += snprintf(buf + off, size - off,
+                                "STAT %s_%s_max_ns %llu\n",
+                                name, g_phases[phase],
+                                (unsigned long long)h.max);
+            }
+        }
+    }
+    return off;
+}
+/*--------------------------------------------------------------------*/
+/* STATS subjects */
+static const struct
+{
+    const char *name;
+    int has_arg; // takes an optional argument after the subject
+    ssize_t (*report)(struct skvs_ctx *ctx, const char *arg,
+                      char *buf, size_t size);
+} g_stats[] = {
+    {"SERVER", 0, skvs_stats_server},
+    {"HASH", 0, skvs_stats_hash},
+    {"SLAB", 0, skvs_stats_slab},
+    {"LATENCY", 1, skvs_stats_latency}};
+/*--------------------------------------------------------------------*/
+/**
+ * writes the report of the given STATS subject (SERVER when NULL),
+ * with its argument arg (may be NULL), to buf,
+ * one "STAT <name> <value>" line per item followed by "END".
+ * Returns 1 on success, 0 when the subject or its argument is unknown
+ * or the report does not fit in size, -1 on internal errors.
+ */
+static int skvs_stats(struct skvs_ctx *ctx, const char *subject,
+                      const char *arg, char *buf, size_t size, size_t *len)
+{
+    TRACE_PRINT();
+    ssize_t off;
+    size_t i;
+
+    if (subject == NULL)
+    {
+        subject = g_stats[0].name;
+    }
+    for (i = 0; i < sizeof(g_stats) / sizeof(g_stats[0]); i++)
+    {
+        if (strcasecmp(subject, g_stats[i].name) == 0)
+        {
+            break;
+        }
+    }
+    if (i == sizeof(g_stats) / sizeof(g_stats[0]) ||
+        (arg != NULL && !g_stats[i].has_arg))
+    {
+        return 0;
+    }
+
+    off = g_stats[i].report(ctx, arg, buf, size);
+    if (off < 0)
+    {
+        return errno == EINVAL ? 0 : -1;
+    }
+    if ((size_t)off < size)
+    {
+        off += snprintf(buf + off, size - off, "END");
+    }
+    if ((size_t)off >= size)
+    {
+        return 0;
+    }
+
+    *len = off;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * records the phases of a request of cmd (CMD_INVALID when malformed)
+ * that started at start and was parsed at parsed, while the calling
+ * thread had waited lock_ns for locks, and marks its response unsent.
+ */
+static void skvs_account(int cmd, uint64_t start, uint64_t parsed,
+                         uint64_t lock_ns)
+{
+    uint64_t exec = stats_now() - parsed;
+
+    if (cmd < 0)
+    {
+        stats_count(STATS_INVALID, 1);
+        stats_unsent(cmd);
+        return;
+    }
+    lock_ns = t_stats_lock_ns - lock_ns;
+    stats_record(cmd, STATS_PARSE, parsed - start);
+    stats_record(cmd, STATS_LOCK, lock_ns);
+    stats_record(cmd, STATS_EXEC, exec > lock_ns ? exec - lock_ns : 0);
+    stats_unsent(cmd);
+}
+/*--------------------------------------------------------------------*/
+/* shard owning key; every shard must agree, so no per-table seed */
+static int skvs_owner(const char *key, size_t key_len, int num_shards)
+{
+    static const uint64_t seed[2] = {0, 0};
+
+    return hash_fast(key, key_len, seed) % num_shards;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * splits the arguments of a text multi-key request, space separated
+ * keys (and values, for MSET), into e.
+ * Returns the number of entries, -1 when malformed.
+ */
+static ssize_t skvs_parse_multi(char *args, int cmd, hash_entry_t *e)
+{
+    TRACE_PRINT();
+    char *tok, *saveptr;
+    size_t n = 0;
+
+    for (tok = strtok_r(args, " ", &saveptr); tok;
+         tok = strtok_r(NULL, " ", &saveptr))
+    {
+        if (n == HASH_MULTI_MAX || strlen(tok) > MAX_KEY_LEN)
+        {
+            return -1;
+        }
+        e[n].key = tok;
+        e[n].key_size = strlen(tok);
+        e[n].value = NULL;
+        e[n].value_len = 0;
+        e[n].expire = 0;
+        if (cmd == CMD_MSET)
+        {
+            tok = strtok_r(NULL, " ", &saveptr);
+            if (tok == NULL)
+            {
+                return -1;
+            }
+            e[n].value = tok;
+            e[n].value_len = strlen(tok);
+        }
+        n++;
+    }
+
+    return n > 0 ? (ssize_t)n : -1;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * binary protocol counterpart of skvs_parse_multi(), for the len
+ * bytes of key list at buf (see skvslib.h); leaves buf untouched.
+ */
+static ssize_t skvs_parse_multi_bin(const char *buf, size_t len, int cmd,
+                                    hash_entry_t *e)
+{
+    TRACE_PRINT();
+    const char *p = buf, *end = buf + len;
+    uint32_t value_len;
+    size_t n = 0;
+
+    while (p < end)
     {
-        if (memcmp(&buffer[BUF_SIZE - 1], g_lf, strlen(g_lf)))
+        if (n == HASH_MULTI_MAX)
+        {
+            return -1;
+        }
+        e[n].key_size = (uint8_t)*p++;
+        if (e[n].key_size == 0 || e[n].key_size > MAX_KEY_LEN ||
+            (size_t)(end - p) < e[n].key_size ||
+            memchr(p, '\0', e[n].key_size) != NULL)
+        {
+            return -1;
+        }
+        e[n].key = p;
+        p += e[n].key_size;
+        e[n].value = NULL;
+        e[n].value_len = 0;
+        e[n].expire = 0;
+        if (cmd == CMD_MSET)
+        {
+            if (end - p < (ssize_t)sizeof(value_len))
+            {
+                return -1;
+            }
+            memcpy(&value_len, p, sizeof(value_len));
+            value_len = ntohl(value_len);
+            p += sizeof(value_len);
+            if ((size_t)(end - p) < value_len)
+            {
+                return -1;
+            }
+            e[n].value = p;
+            e[n].value_len = value_len;
+            p += value_len;
+        }
+        n++;
+    }
+
+    return n > 0 ? (ssize_t)n : -1;
+}
+/*--------------------------------------------------------------------*/
+/* response of a multi-key command being built */
+struct skvs_multi
+{
+    int binary;
+    char *buf;
+    size_t size;
+    size_t len;
+    int full; // a result did not fit in size
+};
+/*--------------------------------------------------------------------*/
+/**
+ * appends one result to the response: in text, the line msg (or the
+ * value, for MGET); in binary, the status byte (and, for MGET, the
+ * length and the value).
+ * Returns -1 when it does not fit.
+ */
+static int skvs_multi_add(struct skvs_multi *m, const char *msg,
+                          uint8_t status, const char *value,
+                          size_t value_len, int with_value)
+{
+    uint32_t len = htonl(value_len);
+    size_t need;
+
+    if (!m->binary)
+    {
+        if (value == NULL)
+        {
+            value = msg;
+            value_len = strlen(msg);
+        }
+        if (m->size - m->len < value_len + 1)
+        {
+            m->full = 1;
+            return -1;
+        }
+        memcpy(m->buf + m->len, value, value_len);
+        m->len += value_len;
+        m->buf[m->len++] = *g_lf;
+        return 0;
+    }
+
+    need = 1 + (with_value ? sizeof(len) + value_len : 0);
+    if (m->size - m->len < need)
+    {
+        m->full = 1;
+        return -1;
+    }
+    m->buf[m->len++] = status;
+    if (with_value)
+    {
+        memcpy(m->buf + m->len, &len, sizeof(len));
+        m->len += sizeof(len);
+        if (value_len > 0) // 없는 key면 value가 NULL이다
+        {
+            memcpy(m->buf + m->len, value, value_len);
+            m->len += value_len;
+        }
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* hash_mread() visitor adding each MGET result in key order */
+static int skvs_mget_add(void *arg, size_t i, const char *value,
+                         size_t value_len)
+{
+    (void)i;
+    stats_count(value ? STATS_HITS : STATS_MISSES, 1);
+    return skvs_multi_add(arg, g_msgs[MSG_NOT_FOUND],
+                          value ? BIN_OK : BIN_NOT_FOUND,
+                          value, value ? value_len : 0, 1);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * serves a multi-key command on the n entries of e, writing the
+ * results to buf: a line per key and "END" in text, or the binary
+ * response value.
+ * Returns 1 on success, 0 when a key belongs to another shard or
+ * the results do not fit in size, -1 on internal errors.
+ */
+static int skvs_multi(struct skvs_ctx *ctx, int cmd, const hash_entry_t *e,
+                      size_t n, int binary, char *buf, size_t size,
+                      size_t *len)
+{
+    TRACE_PRINT();
+    struct skvs_multi m = {binary, buf, size, 0, 0};
+    int rets[HASH_MULTI_MAX];
+    const char *msg;
+    uint8_t status;
+    size_t i;
+
+    // sharded mode: 모든 key가 이 shard에 있어야 한다
+    for (i = 0; ctx->num_shards > 1 && i < n; i++)
+    {
+        if (skvs_owner(e[i].key, e[i].key_size, ctx->num_shards) !=
+            ctx->shard)
+        {
+            return 0;
+        }
+    }
+
+    if (cmd == CMD_MGET)
+    {
+        if (hash_mread(ctx->table, e, n, 0, skvs_mget_add, &m) < 0)
+        {
+            return m.full ? 0 : -1;
+        }
+    }
+    else
+    {
+        // 실패한 key만 INTERNAL ERR로 알린다
+        for (i = 0; i < n; i++)
+        {
+            rets[i] = -1;
+        }
+        if (cmd == CMD_MSET)
+            hash_mset(ctx->table, e, n, rets);
+        else
+            hash_mdelete(ctx->table, e, n, rets);
+
+        for (i = 0; i < n; i++)
+        {
+            if (rets[i] < 0)
+            {
+                msg = g_msgs[MSG_INTERNAL_ERR];
+                status = BIN_INTERNAL_ERR;
+            }
+            else if (cmd == CMD_MSET)
+            {
+                msg = g_msgs[rets[i] ? MSG_CREATE_OK : MSG_UPDATE_OK];
+                status = BIN_OK;
+            }
+            else
+            {
+                msg = g_msgs[rets[i] ? MSG_DELETE_OK : MSG_NOT_FOUND];
+                status = rets[i] ? BIN_OK : BIN_NOT_FOUND;
+            }
+            if (skvs_multi_add(&m, msg, status, NULL, 0, 0) < 0)
+            {
+                return 0;
+            }
+        }
+    }
+
+    if (!binary)
+    {
+        if (m.size - m.len < 3)
+        {
+            return 0;
+        }
+        memcpy(m.buf + m.len, "END", 3);
+        m.len += 3;
+    }
+
+    *len = m.len;
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+struct skvs_ctx *
+skvs_init(size_t hash_size, int delay, int flags, const char *map_path)
+{
+    TRACE_PRINT();
+    struct skvs_ctx *ctx = calloc(1, sizeof(struct skvs_ctx));
+    pthread_condattr_t attr;
+    /* initialize the global hash table */
+    if (map_path)
+        ctx->table = hash_open(map_path, hash_size, delay, flags);
+    else
+        ctx->table = hash_init(hash_size, delay, flags);
+    if (ctx->table == NULL)
+    {
+        DEBUG_PRINT("Failed to initialize global hash table");
+        return NULL;
+    }
+
+    pthread_mutex_init(&ctx->snap_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctx->snap_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return ctx;
+}
+/*--------------------------------------------------------------------*/
+/* applies a replayed log record to the hash table */
+static int skvs_replay(void *arg, int op, const char *key, size_t key_len,
+                       const char *value, size_t value_len)
+{
+    TRACE_PRINT();
+    hashtable_t *table = (hashtable_t *)arg;
+    char key_buf[MAX_KEY_LEN + 1];
+    uint64_t expire;
+    int ret;
+
+    memcpy(key_buf, key, key_len);
+    key_buf[key_len] = '\0';
+
+    switch (op)
+    {
+    case HASH_OP_INSERT:
+        ret = hash_insert_n(table, key_buf, value, value_len);
+        break;
+    case HASH_OP_UPDATE:
+        ret = hash_update_n(table, key_buf, value, value_len);
+        break;
+    case HASH_OP_DELETE:
+        ret = hash_delete(table, key_buf);
+        break;
+    case HASH_OP_EXPIRE:
+        if (value_len != sizeof(expire))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&expire, value, sizeof(expire));
+        ret = hash_expire(table, key_buf, expire);
+        break;
+    default:
+        DEBUG_PRINT("Unknown log record op %d", op);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+/*--------------------------------------------------------------------*/
+/* hash table log hook */
+static int skvs_log(void *arg, int op, const char *key, size_t key_len,
+                    const char *value, size_t value_len)
+{
+    return aof_append((struct aof *)arg, op, key, key_len, value, value_len);
+}
+/*--------------------------------------------------------------------*/
+/* dumps the live entries for a log rewrite */
+static int skvs_dump(void *arg, aof_emit_fn emit, void *emit_arg)
+{
+    TRACE_PRINT();
+    return hash_scan((hashtable_t *)arg, emit, emit_arg);
+}
+/*--------------------------------------------------------------------*/
+int skvs_persist(struct skvs_ctx *ctx, const char *path, int fsync_ms,
+                 int num_threads)
+{
+    TRACE_PRINT();
+    ssize_t n;
+
+    // 지난 deadline도 기록된 순서대로 적용되도록 만료를 멈춘다
+    hash_hold_ttl(ctx->table, 1);
+    n = aof_replay(path, num_threads, skvs_replay, ctx->table);
+    hash_hold_ttl(ctx->table, 0);
+    if (n < 0)
+    {
+        DEBUG_PRINT("Failed to replay %s", path);
+        return -1;
+    }
+
+    ctx->aof = aof_open(path, fsync_ms, skvs_dump, ctx->table);
+    if (ctx->aof == NULL)
+    {
+        return -1;
+    }
+    hash_set_log(ctx->table, skvs_log, ctx->aof);
+
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * writes a snapshot, waiting for one already running.
+ * Returns 1 on success, 0 when snapshots are disabled,
+ * -1 when any internal errors occur.
+ */
+static int skvs_snapshot(struct skvs_ctx *ctx)
+{
+    TRACE_PRINT();
+    ssize_t n;
+
+    if (ctx->snap_path == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ctx->snap_lock);
+    n = snapshot_save(ctx->table, ctx->snap_path);
+    pthread_mutex_unlock(&ctx->snap_lock);
+
+    return n < 0 ? -1 : 1;
+}
+/*--------------------------------------------------------------------*/
+/* takes a snapshot every snap_interval seconds until skvs_destroy() */
+static void *skvs_snapshot_timer(void *arg)
+{
+    TRACE_PRINT();
+    struct skvs_ctx *ctx = (struct skvs_ctx *)arg;
+    struct timespec deadline;
+    int ret;
+
+    pthread_mutex_lock(&ctx->snap_lock);
+    while (!ctx->snap_stop)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ctx->snap_interval;
+        ret = 0;
+        while (!ctx->snap_stop && ret != ETIMEDOUT)
+        {
+            ret = pthread_cond_timedwait(&ctx->snap_cond, &ctx->snap_lock,
+                                         &deadline);
+        }
+        if (ctx->snap_stop)
         {
-            /* too large message */
-            return CMD_INVALID;
+            break;
+        }
+        // snap_lock을 쥔 채로 찍으므로 SNAPSHOT 명령과 겹치지 않는다
+        if (snapshot_save(ctx->table, ctx->snap_path) < 0)
+        {
+            fprintf(stderr, "Failed to write snapshot %s\n", ctx->snap_path);
         }
-
-        /* remove line feed */
-        buffer[BUF_SIZE - 1] = '\0';
     }
-    else
-    {
-        /* make it null-terminated */
-        buffer[len] = '\0';
+    pthread_mutex_unlock(&ctx->snap_lock);
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+int skvs_set_snapshot(struct skvs_ctx *ctx, const char *path, int interval,
+                      int load, int num_threads)
+{
+    TRACE_PRINT();
+    ssize_t n;
 
-        char *lf_ptr = strstr(buffer, g_lf);
-        if (lf_ptr == NULL)
+    if (load)
+    {
+        n = snapshot_load(ctx->table, path, num_threads);
+        if (n < 0)
         {
-            return CMD_INCOMPLETE;
+            DEBUG_PRINT("Failed to load %s", path);
+            return -1;
         }
-
-        /* remove line feed */
-        *lf_ptr = '\0';
     }
 
-    cmd = strtok(buffer, " ");
-    if (cmd == NULL)
+    ctx->snap_path = strdup(path);
+    if (ctx->snap_path == NULL)
     {
-        /* no command found */
-        return CMD_INVALID;
+        return -1;
     }
 
-    /* convert command to uppercase for case-insensitive comparison */
-    for (i = 0; cmd[i]; i++)
+    if (interval > 0)
     {
-        cmd[i] = toupper(cmd[i]);
+        ctx->snap_interval = interval;
+        if (pthread_create(&ctx->snap_timer, NULL, skvs_snapshot_timer,
+                           ctx) != 0)
+        {
+            ctx->snap_interval = 0;
+            return -1;
+        }
     }
 
-    for (i = 0; i < CMD_COUNT; i++)
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+int skvs_set_limit(struct skvs_ctx *ctx, size_t bytes)
+{
+    TRACE_PRINT();
+    return hash_set_limit(ctx->table, bytes);
+}
+/*--------------------------------------------------------------------*/
+void skvs_set_shard(struct skvs_ctx *ctx, int shard, int num_shards)
+{
+    TRACE_PRINT();
+    ctx->shard = shard;
+    ctx->num_shards = num_shards;
+}
+/*--------------------------------------------------------------------*/
+int skvs_shard(const char *rbuf, size_t rlen, int binary, int num_shards,
+               size_t *req_len)
+{
+    TRACE_PRINT();
+    hash_entry_t e[HASH_MULTI_MAX];
+    struct skvs_bin_hdr hdr;
+    const char *cmd, *tok, *p, *end;
+    size_t len, i, k;
+    ssize_t n;
+    int shard = -1, owner;
+
+    if (binary)
     {
-        if (strcmp(cmd, g_cmds[i]) == 0)
+        if (rlen < sizeof(hdr))
         {
-            *key = strtok(NULL, " ");
-            if (*key == NULL)
-            {
-                /* no key found */
-                return CMD_INVALID;
-            }
-            if (strlen(*key) > MAX_KEY_LEN)
+            return -1;
+        }
+        memcpy(&hdr, rbuf, sizeof(hdr));
+        len = sizeof(hdr) + hdr.key_len + (size_t)ntohl(hdr.value_len);
+        // 큰 frame은 값 앞까지만 보고, 값은 호출한 쪽이 따로 넘긴다
+        if ((n = skvs_value_req(rbuf, rlen, &k)) != 0)
+        {
+            len = n;
+        }
+        if (hdr.magic != SKVS_BIN_REQ_MAGIC || n < 0 || len > BUF_SIZE ||
+            rlen < len || hdr.opcode >= CMD_COUNT ||
+            hdr.opcode == CMD_STATS || hdr.opcode == CMD_SNAPSHOT)
+        {
+            return -1;
+        }
+        if (!CMD_IS_MULTI(hdr.opcode))
+        {
+            e[0].key = rbuf + sizeof(hdr);
+            e[0].key_size = hdr.key_len;
+            n = 1;
+        }
+        else if (hdr.key_len != 0 ||
+                 (n = skvs_parse_multi_bin(rbuf + sizeof(hdr),
+                                           len - sizeof(hdr), hdr.opcode,
+                                           e)) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        // skvs_parse()처럼 첫 line feed까지가 하나의 요청
+        end = memchr(rbuf, *g_lf, rlen < BUF_SIZE ? rlen : BUF_SIZE);
+        if (end == NULL)
+        {
+            return -1;
+        }
+        len = end - rbuf + 1;
+
+        // 명령어를 찾고, 이어지는 인자 중 key를 모은다 (rbuf는 그대로)
+        for (p = rbuf; p < end && *p == ' '; p++)
+            ;
+        for (cmd = p; p < end && *p != ' '; p++)
+            ;
+        for (i = 0; i < CMD_COUNT; i++)
+        {
+            if (strlen(g_cmds[i]) == (size_t)(p - cmd) &&
+                strncasecmp(cmd, g_cmds[i], p - cmd) == 0)
             {
-                /* too large key */
-                return CMD_INVALID;
+                break;
             }
-
-            *value = strtok(NULL, " ");
-
-            /* handle specific cases for READ and DELETE */
-            if ((i == CMD_READ || i == CMD_DELETE) && *value != NULL)
+        }
+        if (i == CMD_COUNT || i == CMD_STATS || i == CMD_SNAPSHOT)
+        {
+            return -1;
+        }
+        for (n = 0, k = 0; n < HASH_MULTI_MAX; k++)
+        {
+            for (; p < end && *p == ' '; p++)
+                ;
+            for (tok = p; p < end && *p != ' '; p++)
+                ;
+            if (tok == p)
             {
-                /* READ or DELETE should not have a value */
-                return CMD_INVALID;
+                break;
             }
-
-            /* handle specific cases for CREATE and UPDATE */
-            if ((i == CMD_CREATE || i == CMD_UPDATE) && *value == NULL)
+            // MSET은 key와 value가 번갈아 온다
+            if (i != CMD_MSET || k % 2 == 0)
             {
-                /* CREATE or UPDATE must have a value */
-                return CMD_INVALID;
+                e[n].key = tok;
+                e[n].key_size = p - tok;
+                n++;
             }
-
-            /* check for extra tokens after value */
-            if (strtok(NULL, " ") != NULL)
+            if (!CMD_IS_MULTI(i))
             {
-                /* extra tokens found */
-                return CMD_INVALID;
+                break; // 단일 key 명령은 첫 인자만
             }
+        }
+    }
 
-            /* return the corresponding command enum */
-            return i;
+    // 모든 key가 한 shard에 있어야 그 shard로 넘긴다
+    for (i = 0; i < (size_t)n; i++)
+    {
+        if (e[i].key_size == 0 || e[i].key_size > MAX_KEY_LEN)
+        {
+            return -1;
+        }
+        owner = skvs_owner(e[i].key, e[i].key_size, num_shards);
+        if (shard >= 0 && owner != shard)
+        {
+            return -1;
         }
+        shard = owner;
     }
 
-    /* command not recognized */
-    return CMD_INVALID;
+    if (shard >= 0)
+    {
+        *req_len = len;
+    }
+    return shard;
 }
 /*--------------------------------------------------------------------*/
-struct skvs_ctx *
-skvs_init(size_t hash_size, int delay)
+int skvs_commit(struct skvs_ctx *ctx)
 {
     TRACE_PRINT();
-    struct skvs_ctx *ctx = calloc(1, sizeof(struct skvs_ctx));
-    /* initialize the global hash table */
-    ctx->table = hash_init(hash_size, delay);
-    if (ctx->table == NULL)
+    return aof_commit(ctx->aof);
+}
+/*--------------------------------------------------------------------*/
+/* prints the report of a STATS subject to stdout */
+static void skvs_print_stats(struct skvs_ctx *ctx, const char *subject)
+{
+    char buf[BUF_SIZE];
+    size_t len;
+
+    if (skvs_stats(ctx, subject, NULL, buf, sizeof(buf) - 1, &len) > 0)
     {
-        DEBUG_PRINT("Failed to initialize global hash table");
-        return NULL;
+        buf[len] = '\0';
+        printf("STATS %s\n%s\n", subject, buf);
     }
-
-    return ctx;
 }
 /*--------------------------------------------------------------------*/
 int skvs_destroy(struct skvs_ctx *ctx, int dump)
 {
     TRACE_PRINT();
+    int ret = 0;
+
+    // lock 없이 도는 dump 중에 timer가 key를 지우지 않도록 만료를 멈춘다
+    hash_hold_ttl(ctx->table, 1);
     if (dump)
     {
         hash_dump(ctx->table);
+        // 통계는 process 전체의 것이므로 shard 0에서 한 번만 출력
+        skvs_print_stats(ctx, "HASH");
+        if (ctx->shard == 0)
+        {
+            skvs_print_stats(ctx, "SERVER");
+            skvs_print_stats(ctx, "LATENCY");
+        }
+    }
+    // 주기적 snapshot을 멈추고, 남은 log를 모두 쓴 뒤 table을 정리
+    if (ctx->snap_interval > 0)
+    {
+        pthread_mutex_lock(&ctx->snap_lock);
+        ctx->snap_stop = 1;
+        pthread_cond_signal(&ctx->snap_cond);
+        pthread_mutex_unlock(&ctx->snap_lock);
+        pthread_join(ctx->snap_timer, NULL);
+    }
+    hash_set_log(ctx->table, NULL, NULL);
+    if (aof_close(ctx->aof) < 0)
+    {
+        ret = -1;
     }
     if (hash_destroy(ctx->table) < 0)
     {
         return -1;
     }
+    pthread_mutex_destroy(&ctx->snap_lock);
+    pthread_cond_destroy(&ctx->snap_cond);
+    free(ctx->snap_path);
 
-    return 0;
+    return ret;
 }
 /*--------------------------------------------------------------------*/
 int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
-               char *wbuf, size_t *wlen)
+               char *wbuf, size_t *wlen, struct skvs_ref *ref)
 {
     TRACE_PRINT();
-    const char *key = NULL, *value = NULL;
+    const char *key = NULL, *value = NULL, *ttl = NULL;
+    hash_entry_t entries[HASH_MULTI_MAX];
+    uint64_t expire = 0, start, parsed, lock_ns;
+    size_t value_len;
     enum CMD cmd;
+    ssize_t n;
     int ret;
 
+    if (ref)
+    {
+        ref->value = NULL;
+    }
     if (ctx == NULL || rbuf == NULL || rlen == 0 ||
         wbuf == NULL || wlen == NULL)
     {
@@ -167,7 +1216,16 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
     }
 
     /* parse the command */
-    cmd = skvs_parse(rbuf, rlen, &key, &value);
+    start = stats_now();
+    cmd = skvs_parse(rbuf, rlen, &key, &value, &ttl);
+    if ((cmd == CMD_CREATE || cmd == CMD_UPDATE || cmd == CMD_EXPIRE) &&
+        skvs_expire(cmd == CMD_EXPIRE ? value : ttl, &expire) < 0)
+    {
+        /* malformed TTL */
+        cmd = CMD_INVALID;
+    }
+    parsed = stats_now();
+    lock_ns = t_stats_lock_ns;
 
     /* handle request */
     switch (cmd)
@@ -175,7 +1233,7 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
     case CMD_INCOMPLETE:
         return 0;
     case CMD_CREATE:
-        ret = hash_insert(ctx->table, key, value);
+        ret = hash_insert_ex(ctx->table, key, value, strlen(value), expire);
         if (ret > 0)
         {
             strcpy(wbuf, g_msgs[MSG_CREATE_OK]);
@@ -183,32 +1241,49 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
         else if (ret == 0)
         {
             strcpy(wbuf, g_msgs[MSG_COLLISION]);
+            stats_count(STATS_COLLISIONS, 1);
         }
         else
         {
-            strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
+            /* TTLs are not supported by every table */
+            strcpy(wbuf, g_msgs[errno == ENOTSUP ? MSG_INVALID
+                                                 : MSG_INTERNAL_ERR]);
         }
         break;
     case CMD_READ:
-        ret = hash_read(ctx->table, key, wbuf, 0);
+    case CMD_QREAD:
+        ret = hash_read_ref(ctx->table, key, wbuf, BUF_SIZE - 1, &value_len,
+                            ref ? &ref->value : NULL, cmd == CMD_QREAD);
         if (ret > 0)
         {
-            ; // hash_read() has already copied the value to wbuf
+            /* a value handed out in ref goes before the line feed */
+            if (ref && ref->value)
+            {
+                ref->off = 0;
+                value_len = 0;
+            }
+            /* the length is known, so no strcat() nor strlen() */
+            wbuf[value_len] = *g_lf;
+            *wlen = value_len + 1;
+            stats_count(STATS_HITS, 1);
+            skvs_account(cmd, start, parsed, lock_ns);
+            return 1;
         }
         else if (ret == 0)
         {
             strcpy(wbuf, g_msgs[MSG_NOT_FOUND]);
+            stats_count(STATS_MISSES, 1);
         }
         else
         {
             strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
         }
         break;
-    case CMD_QREAD:
-        ret = hash_read(ctx->table, key, wbuf, 1);
+    case CMD_UPDATE:
+        ret = hash_update_ex(ctx->table, key, value, strlen(value), expire);
         if (ret > 0)
         {
-            ; // hash_read() has already copied the value to wbuf
+            strcpy(wbuf, g_msgs[MSG_UPDATE_OK]);
         }
         else if (ret == 0)
         {
@@ -216,14 +1291,15 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
         }
         else
         {
-            strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
+            strcpy(wbuf, g_msgs[errno == ENOTSUP ? MSG_INVALID
+                                                 : MSG_INTERNAL_ERR]);
         }
         break;
-    case CMD_UPDATE:
-        ret = hash_update(ctx->table, key, value);
+    case CMD_EXPIRE:
+        ret = hash_expire(ctx->table, key, expire);
         if (ret > 0)
         {
-            strcpy(wbuf, g_msgs[MSG_UPDATE_OK]);
+            strcpy(wbuf, g_msgs[MSG_EXPIRE_OK]);
         }
         else if (ret == 0)
         {
@@ -231,7 +1307,8 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
         }
         else
         {
-            strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
+            strcpy(wbuf, g_msgs[errno == ENOTSUP ? MSG_INVALID
+                                                 : MSG_INTERNAL_ERR]);
         }
         break;
     case CMD_DELETE:
@@ -249,6 +1326,48 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
             strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
         }
         break;
+    case CMD_STATS:
+        ret = skvs_stats(ctx, key, value, wbuf, BUF_SIZE - 1, wlen);
+        if (ret == 0)
+        {
+            strcpy(wbuf, g_msgs[MSG_INVALID]);
+        }
+        else if (ret < 0)
+        {
+            strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
+        }
+        break;
+    case CMD_SNAPSHOT:
+        ret = skvs_snapshot(ctx);
+        if (ret > 0)
+        {
+            strcpy(wbuf, g_msgs[MSG_SNAPSHOT_OK]);
+        }
+        else if (ret == 0)
+        {
+            strcpy(wbuf, g_msgs[MSG_INVALID]);
+        }
+        else
+        {
+            strcpy(wbuf, g_msgs[MSG_INTERNAL_ERR]);
+        }
+        break;
+    case CMD_MGET:
+    case CMD_MSET:
+    case CMD_MDEL:
+        n = skvs_parse_multi((char *)key, cmd, entries);
+        ret = n < 0 ? 0
+                    : skvs_multi(ctx, cmd, entries, n, 0, wbuf,
+                                 BUF_SIZE - 1, wlen);
+        if (ret > 0)
+        {
+            /* values may hold '\0', so not through strcat() */
+            wbuf[(*wlen)++] = *g_lf;
+            skvs_account(cmd, start, parsed, lock_ns);
+            return 1;
+        }
+        strcpy(wbuf, g_msgs[ret == 0 ? MSG_INVALID : MSG_INTERNAL_ERR]);
+        break;
     case CMD_INVALID:
     default:
         strcpy(wbuf, g_msgs[MSG_INVALID]);
@@ -257,7 +1376,317 @@ int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
 
     strcat(wbuf, g_lf);
     *wlen = strlen(wbuf);
+    skvs_account(cmd, start, parsed, lock_ns);
+
+    return 1;
+}
+/*--------------------------------------------------------------------*/
+ssize_t skvs_serve_bin(struct skvs_ctx *ctx, const char *rbuf, size_t rlen,
+                       char *wbuf, size_t *wlen, struct skvs_ref *ref)
+{
+    TRACE_PRINT();
+    struct skvs_bin_hdr req, res;
+    hash_entry_t entries[HASH_MULTI_MAX];
+    char key[MAX_KEY_LEN + 1];
+    const char *value;
+    char *arg = NULL;
+    size_t frame_len, arg_len, value_len = 0;
+    uint64_t expire = 0, start, parsed, lock_ns;
+    ssize_t n;
+    int ret = 0, ttl_ok = 1, key_ok;
+
+    if (ref)
+    {
+        ref->value = NULL;
+    }
+    if (ctx == NULL || rbuf == NULL || wbuf == NULL || wlen == NULL)
+    {
+        DEBUG_PRINT("Invalid arguments to skvs_serve_bin");
+        return -1;
+    }
+
+    if (rlen < sizeof(req))
+    {
+        return 0;
+    }
+
+    start = stats_now();
+    /* header may be unaligned in rbuf */
+    memcpy(&req, rbuf, sizeof(req));
+    req.value_len = ntohl(req.value_len);
+    frame_len = sizeof(req) + req.key_len + (size_t)req.value_len;
+    if (req.magic != SKVS_BIN_REQ_MAGIC || frame_len > BUF_SIZE)
+    {
+        return -1;
+    }
+    if (rlen < frame_len)
+    {
+        return 0;
+    }
+
+    /* SNAPSHOT and multi-key requests have no key, STATS may have one:
+       "<subject>" or "<subject> <argument>". key_len comes from the
+       client: a key that would not fit in key[] is never copied, and the
+       request gets BIN_INVALID */
+    if (req.opcode == CMD_SNAPSHOT || CMD_IS_MULTI(req.opcode))
+        key_ok = req.key_len == 0;
+    else if (req.opcode == CMD_STATS)
+        key_ok = req.key_len <= MAX_KEY_LEN;
+    else
+        key_ok = req.key_len > 0 && req.key_len <= MAX_KEY_LEN;
+
+    /* keys are still strings inside the hash table */
+    if (req.key_len <= MAX_KEY_LEN)
+    {
+        memcpy(key, rbuf + sizeof(req), req.key_len);
+        key[req.key_len] = '\0';
+        key_ok = key_ok && memchr(key, '\0', req.key_len) == NULL;
+    }
+    value = rbuf + sizeof(req) + req.key_len;
+    arg_len = req.value_len;
+
+    /* a TTL comes before the value, or is the value of EXPIRE */
+    if (req.opcode == CMD_EXPIRE ||
+        ((req.opcode == CMD_CREATE || req.opcode == CMD_UPDATE) &&
+         (req.status & SKVS_BIN_TTL)))
+    {
+        ttl_ok = skvs_expire_bin(&value, &arg_len, &expire) == 0 &&
+                 (req.opcode != CMD_EXPIRE || arg_len == 0);
+    }
+
+    res.magic = SKVS_BIN_RES_MAGIC;
+    res.opcode = req.opcode;
+    res.key_len = 0;
+    res.status = BIN_INVALID;
+
+    if (key_ok && req.opcode == CMD_STATS &&
+        (arg = strchr(key, ' ')) != NULL)
+    {
+        *arg++ = '\0';
+    }
+    parsed = stats_now();
+    lock_ns = t_stats_lock_ns;
+
+    if (req.opcode < CMD_COUNT && ttl_ok && key_ok &&
+        (g_bin_has_value[req.opcode] || req.value_len == 0))
+    {
+        switch (req.opcode)
+        {
+        case CMD_CREATE:
+            ret = hash_insert_ex(ctx->table, key, value, arg_len, expire);
+            if (ret == 0)
+                stats_count(STATS_COLLISIONS, 1);
+            break;
+        case CMD_READ:
+        case CMD_QREAD:
+            ret = hash_read_ref(ctx->table, key, wbuf + sizeof(res),
+                                BUF_SIZE - sizeof(res), &value_len,
+                                ref ? &ref->value : NULL,
+                                req.opcode == CMD_QREAD);
+            if (ret >= 0)
+                stats_count(ret > 0 ? STATS_HITS : STATS_MISSES, 1);
+            break;
+        case CMD_UPDATE:
+            ret = hash_update_ex(ctx->table, key, value, arg_len, expire);
+            break;
+        case CMD_EXPIRE:
+            ret = hash_expire(ctx->table, key, expire);
+            break;
+        case CMD_DELETE:
+            ret = hash_delete(ctx->table, key);
+            break;
+        case CMD_STATS:
+            ret = skvs_stats(ctx, req.key_len ? key : NULL, arg,
+                             wbuf + sizeof(res), BUF_SIZE - sizeof(res),
+                             &value_len);
+            break;
+        case CMD_SNAPSHOT:
+            ret = skvs_snapshot(ctx);
+            break;
+        case CMD_MGET:
+        case CMD_MSET:
+        case CMD_MDEL:
+            n = skvs_parse_multi_bin(value, req.value_len, req.opcode,
+                                     entries);
+            ret = n < 0 ? 0
+                        : skvs_multi(ctx, req.opcode, entries, n, 1,
+                                     wbuf + sizeof(res),
+                                     BUF_SIZE - sizeof(res), &value_len);
+            break;
+        }
+        if (ret < 0)
+            res.status = errno == ENOTSUP ? BIN_INVALID : BIN_INTERNAL_ERR;
+        else
+            res.status = g_bin_status[req.opcode][ret > 0];
+        skvs_account(req.opcode, start, parsed, lock_ns);
+    }
+    else
+    {
+        skvs_account(CMD_INVALID, start, parsed, lock_ns);
+    }
+
+    if (res.status != BIN_OK)
+    {
+        value_len = 0;
+    }
+    res.value_len = htonl(value_len);
+    memcpy(wbuf, &res, sizeof(res));
+    *wlen = sizeof(res) + value_len;
+    if (ref && ref->value)
+    {
+        /* the value follows the header from the table itself */
+        ref->off = sizeof(res);
+        *wlen = sizeof(res);
+    }
+
+    return frame_len;
+}
+/*--------------------------------------------------------------------*/
+ssize_t skvs_value_req(const char *rbuf, size_t rlen, size_t *value_len)
+{
+    TRACE_PRINT();
+    struct skvs_bin_hdr hdr;
+    size_t ttl_len;
+
+    if (rbuf == NULL || value_len == NULL || rlen < sizeof(hdr))
+    {
+        return 0;
+    }
+    memcpy(&hdr, rbuf, sizeof(hdr));
+    hdr.value_len = ntohl(hdr.value_len);
+    if (hdr.magic != SKVS_BIN_REQ_MAGIC ||
+        (hdr.opcode != CMD_CREATE && hdr.opcode != CMD_UPDATE) ||
+        sizeof(hdr) + hdr.key_len + (size_t)hdr.value_len <= BUF_SIZE)
+    {
+        return 0;
+    }
+
+    // TTL은 요청 쪽에 두고 순수한 값만 따로 받는다
+    ttl_len = hdr.status & SKVS_BIN_TTL ? sizeof(uint32_t) : 0;
+    if (hdr.value_len - ttl_len > SKVS_MAX_VALUE)
+    {
+        return -1;
+    }
+    *value_len = hdr.value_len - ttl_len;
+    return sizeof(hdr) + hdr.key_len + ttl_len;
+}
+/*--------------------------------------------------------------------*/
+int skvs_value_admit(struct skvs_ctx *ctx, const char *req,
+                     size_t value_len, char *wbuf, size_t *wlen)
+{
+    TRACE_PRINT();
+    struct skvs_bin_hdr hdr, res;
+    size_t limit;
+
+    if (ctx == NULL || req == NULL || wbuf == NULL || wlen == NULL)
+    {
+        DEBUG_PRINT("Invalid arguments to skvs_value_admit");
+        return -1;
+    }
+
+    // 값을 할당하기 전에 들어갈 수 없는 값과 과한 동시 수신을 거른다
+    limit = ctx->table->mem_limit;
+    res.status = BIN_INVALID;
+    if (limit == 0 || value_len <= limit)
+    {
+        if (__atomic_add_fetch(&g_value_inflight, value_len,
+                               __ATOMIC_RELAXED) <= SKVS_VALUE_INFLIGHT)
+        {
+            return 1;
+        }
+        __atomic_sub_fetch(&g_value_inflight, value_len, __ATOMIC_RELAXED);
+        res.status = BIN_INTERNAL_ERR;
+    }
+
+    memcpy(&hdr, req, sizeof(hdr));
+    res.magic = SKVS_BIN_RES_MAGIC;
+    res.opcode = hdr.opcode;
+    res.key_len = 0;
+    res.value_len = 0;
+    memcpy(wbuf, &res, sizeof(res));
+    *wlen = sizeof(res);
+    skvs_account(CMD_INVALID, 0, stats_now(), 0);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+void skvs_value_done(size_t value_len)
+{
+    __atomic_sub_fetch(&g_value_inflight, value_len, __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+int skvs_serve_value(struct skvs_ctx *ctx, const char *req, size_t req_len,
+                     value_t *value, char *wbuf, size_t *wlen)
+{
+    TRACE_PRINT();
+    struct skvs_bin_hdr hdr, res;
+    char key[MAX_KEY_LEN + 1];
+    const char *ttl;
+    size_t ttl_len;
+    uint64_t expire = 0, start, parsed, lock_ns;
+    int ret, ok;
+
+    if (ctx == NULL || req == NULL || value == NULL || wbuf == NULL ||
+        wlen == NULL || req_len < sizeof(hdr))
+    {
+        DEBUG_PRINT("Invalid arguments to skvs_serve_value");
+        hash_release(value);
+        return -1;
+    }
+
+    start = stats_now();
+    memcpy(&hdr, req, sizeof(hdr));
+    ok = (hdr.opcode == CMD_CREATE || hdr.opcode == CMD_UPDATE) &&
+         hdr.key_len > 0 && hdr.key_len <= MAX_KEY_LEN &&
+         req_len >= sizeof(hdr) + hdr.key_len;
+    if (ok)
+    {
+        memcpy(key, req + sizeof(hdr), hdr.key_len);
+        key[hdr.key_len] = '\0';
+        ok = memchr(key, '\0', hdr.key_len) == NULL;
+    }
+    if (ok && (hdr.status & SKVS_BIN_TTL))
+    {
+        ttl = req + sizeof(hdr) + hdr.key_len;
+        ttl_len = req_len - sizeof(hdr) - hdr.key_len;
+        ok = skvs_expire_bin(&ttl, &ttl_len, &expire) == 0;
+    }
+    parsed = stats_now();
+    lock_ns = t_stats_lock_ns;
+
+    res.magic = SKVS_BIN_RES_MAGIC;
+    res.opcode = hdr.opcode;
+    res.key_len = 0;
+    res.status = BIN_INVALID;
+    res.value_len = 0;
+
+    if (ok)
+    {
+        // 받은 값을 복사하지 않고 그대로 table에 넘긴다
+        if (hdr.opcode == CMD_CREATE)
+        {
+            ret = hash_insert_value(ctx->table, key, value, expire);
+            if (ret == 0)
+                stats_count(STATS_COLLISIONS, 1);
+        }
+        else
+        {
+            ret = hash_update_value(ctx->table, key, value, expire);
+        }
+        if (ret < 0)
+            res.status = errno == ENOTSUP ? BIN_INVALID : BIN_INTERNAL_ERR;
+        else
+            res.status = g_bin_status[hdr.opcode][ret > 0];
+        skvs_account(hdr.opcode, start, parsed, lock_ns);
+    }
+    else
+    {
+        hash_release(value);
+        skvs_account(CMD_INVALID, start, parsed, lock_ns);
+    }
+
+    memcpy(wbuf, &res, sizeof(res));
+    *wlen = sizeof(res);
 
     return 1;
 }
-/*--------------------------------------------------------------------*/
\ No newline at end of file
+/*--------------------------------------------------------------------*/
@@ -8,7 +8,12 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include "hashtable.h"
+#include "aof.h"
+#include "snapshot.h"
 #include "common.h"
 /*--------------------------------------------------------------------*/
 /* response message indices */
@@ -21,6 +26,8 @@ enum MSG
     MSG_UPDATE_OK,
     MSG_DELETE_OK,
     MSG_INTERNAL_ERR,
+    MSG_SNAPSHOT_OK,
+    MSG_EXPIRE_OK,
     MSG_COUNT
 };
 /* command indices */
@@ -33,25 +40,179 @@ enum CMD
     CMD_QREAD, // Quick READ
     CMD_UPDATE,
     CMD_DELETE,
+    CMD_STATS,    // STATS [<subject> [<arg>]], lines ending with "END"
+    CMD_SNAPSHOT, // SNAPSHOT, no key (key_len 0 in binary)
+    /* multi-key commands, one result per key (see below for binary) */
+    CMD_MGET, // MGET <key> ..., a value or NOT FOUND per key, then END
+    CMD_MSET, // MSET <key> <value> ..., CREATE OK or UPDATE OK per key
+    CMD_MDEL, // MDEL <key> ..., DELETE OK or NOT FOUND per key
+    CMD_EXPIRE, // EXPIRE <key> <ttl>, seconds from now, 0 for none
     CMD_COUNT
 };
+#define CMD_IS_MULTI(cmd) ((cmd) >= CMD_MGET && (cmd) <= CMD_MDEL)
+/* CREATE <key> <value> [<ttl>] and UPDATE <key> <value> [<ttl>] take
+   an optional TTL in seconds; an UPDATE without one drops the TTL */
+#define SKVS_MAX_TTL (10 * 365 * 24 * 3600) // ten years
+/*--------------------------------------------------------------------*/
+/**
+ * Binary protocol.
+ * A connection whose first byte is SKVS_BIN_REQ_MAGIC speaks binary
+ * for its whole lifetime; any other first byte selects the text protocol.
+ * Every request is a header followed by key_len bytes of key and
+ * value_len opaque bytes of value; every response is a header
+ * (opcode echoed, key_len 0) followed by value_len bytes of value.
+ * The whole request frame is at most BUF_SIZE bytes.
+ *
+ * A CREATE or UPDATE request with SKVS_BIN_TTL in status carries a
+ * 4-byte TTL in seconds (network byte order) before the value, and
+ * an EXPIRE request carries exactly that TTL as its value.
+ *
+ * Multi-key requests have key_len 0 and carry their keys in the value:
+ * per key, a 1-byte key length and the key, followed for MSET by a
+ * 4-byte value length (network byte order) and the value. The response
+ * value holds a status byte per key, followed for MGET by the 4-byte
+ * length and the value. At most HASH_MULTI_MAX keys, and the response
+ * must fit in BUF_SIZE bytes, or the header status is BIN_INVALID.
+ *
+ * Only a CREATE or UPDATE frame may exceed BUF_SIZE, with a value of
+ * up to SKVS_MAX_VALUE bytes; it is not buffered whole but received
+ * into the value itself (see skvs_value_req()).
+ */
+#define SKVS_BIN_REQ_MAGIC 0x80
+#define SKVS_BIN_RES_MAGIC 0x81
+#define SKVS_BIN_TTL 0x1 // request status flag
+struct skvs_bin_hdr
+{
+    uint8_t magic;      // SKVS_BIN_REQ_MAGIC or SKVS_BIN_RES_MAGIC
+    uint8_t opcode;     // enum CMD
+    uint8_t key_len;    // 1 ~ MAX_KEY_LEN in requests
+    uint8_t status;     // enum BIN_STATUS in responses, flags in requests
+    uint32_t value_len; // network byte order
+};
+#define SKVS_MAX_VALUE (64 << 20) // longest value of a large frame
+/* most bytes of large values received at once, by every connection */
+#define SKVS_VALUE_INFLIGHT (256 << 20)
+/* longest large frame before its value: header, key and TTL */
+#define SKVS_VALUE_REQ_MAX \
+    (sizeof(struct skvs_bin_hdr) + UINT8_MAX + sizeof(uint32_t))
+/* binary response status */
+enum BIN_STATUS
+{
+    BIN_OK,
+    BIN_INVALID,
+    BIN_COLLISION,
+    BIN_NOT_FOUND,
+    BIN_INTERNAL_ERR
+};
+/*--------------------------------------------------------------------*/
+/**
+ * A value a response sends in place instead of copying it to wbuf:
+ * the response is the first off bytes it wrote to wbuf, then the value
+ * pinned by hash_read_ref(), then the rest. Whoever sends it calls
+ * hash_release(value) once it is sent.
+ */
+struct skvs_ref
+{
+    const value_t *value; // NULL when the whole response is in wbuf
+    size_t off;
+};
 /*--------------------------------------------------------------------*/
 /* SKVS context */
 struct skvs_ctx
 {
     hashtable_t *table;
+    struct aof *aof; // NULL unless skvs_persist() was called
+    /* skvs_set_snapshot() */
+    char *snap_path;           // NULL when SNAPSHOT is disabled
+    int snap_interval;         // seconds between timed snapshots, or 0
+    pthread_mutex_t snap_lock; // one snapshot at a time
+    pthread_cond_t snap_cond;  // wakes the timer thread up to stop
+    pthread_t snap_timer;
+    int snap_stop;
+    /* skvs_set_shard() */
+    int shard;      // index of this shard
+    int num_shards; // 0 unless the keys are split among shards
 };
 /*--------------------------------------------------------------------*/
 /**
  * Initiates SKVS context including a thread-safe global hash table.
+ * flags are passed to hash_init(), or to hash_open() when map_path is
+ * not NULL, keeping the table in that memory-mapped file.
  * Returns NULL when any internal errors occur.
  * Returns the SKVS context pointer on success.
  */
-struct skvs_ctx *skvs_init(size_t hash_size, int delay);
+struct skvs_ctx *skvs_init(size_t hash_size, int delay, int flags,
+                           const char *map_path);
+/*--------------------------------------------------------------------*/
+/**
+ * Makes the hash table persistent in the append-only log at path.
+ * Replays the existing log with num_threads threads, then logs every
+ * following write with the given fsync policy (see aof.h).
+ * Call before serving any request.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int skvs_persist(struct skvs_ctx *ctx, const char *path, int fsync_ms,
+                 int num_threads);
+/*--------------------------------------------------------------------*/
+/**
+ * Enables SNAPSHOT, which writes a point-in-time image of the table
+ * to path (snapshot.h). When load is set, first loads the image at
+ * path, if any, into the still empty table with num_threads threads.
+ * When interval is positive, a timer thread also takes a snapshot
+ * every interval seconds.
+ * Call before serving any request.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int skvs_set_snapshot(struct skvs_ctx *ctx, const char *path, int interval,
+                      int load, int num_threads);
+/*--------------------------------------------------------------------*/
+/**
+ * Caps the memory of the keys and values at bytes, evicting the least
+ * recently read keys to stay under it (see hash_set_limit()).
+ * Call before serving any request, and before skvs_persist() so that
+ * the replayed log is held to the cap too.
+ * Returns -1 when any internal errors occur.
+ * Returns 0 on success.
+ */
+int skvs_set_limit(struct skvs_ctx *ctx, size_t bytes);
+/*--------------------------------------------------------------------*/
+/**
+ * Makes ctx the shard-th of num_shards contexts that split the keys
+ * among them (see skvs_shard()); the connections of ctx then hand the
+ * requests for keys of other shards over to their owners.
+ */
+void skvs_set_shard(struct skvs_ctx *ctx, int shard, int num_shards);
+/*--------------------------------------------------------------------*/
+/**
+ * Finds which of num_shards shards owns the key of the request at the
+ * start of rbuf, a text line or, when binary is set, a binary frame.
+ * The owner depends on the key bytes only, not on any table seed.
+ * Leaves rbuf untouched and sets req_len to the length of the request,
+ * which for a large frame (skvs_value_req()) stops before its value.
+ * Returns -1 when the request is incomplete, oversized or has no key
+ * to route by (STATS, SNAPSHOT), so it is served where it arrived;
+ * so is a multi-key request whose keys span several shards, which
+ * skvs_serve() then rejects.
+ * Returns the owning shard otherwise.
+ */
+int skvs_shard(const char *rbuf, size_t rlen, int binary, int num_shards,
+               size_t *req_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Waits until the writes served so far by the calling thread are
+ * as durable as the fsync policy promises; call before replying.
+ * Returns -1 when the log could not be written.
+ * Returns 0 on success.
+ */
+int skvs_commit(struct skvs_ctx *ctx);
 /*--------------------------------------------------------------------*/
 /**
  * Destroys SKVS context and the hash table.
- * when set dump, dumps the hash table before destroy it.
+ * when set dump, dumps the hash table and prints the statistics
+ * (STATS HASH, and STATS SERVER and LATENCY unless ctx is a shard
+ * other than the first) before destroy it.
  * Returns -1 when any internal errors occur.
  * Returns 0 on success.
  */
@@ -65,10 +226,77 @@ int skvs_destroy(struct skvs_ctx *ctx, int dump);
  * 3. returns 1 when the given request in rbuf is complete.
  * 4. returns 0 when the given request in rbuf is incomplete.
  *
+ * A request ends at the first line feed in rbuf; pipelined requests
+ * following it are left untouched for the caller to serve next.
+ *
+ * When ref is not NULL, a READ or QREAD of a value kept outside its
+ * node leaves the value in the table and hands it out in ref (see
+ * struct skvs_ref); wlen then counts only the bytes in wbuf.
+ * Otherwise, and for every other request, ref->value is set to NULL.
+ *
  * On failure, this function:
  * Returns -1 when any internal errors occur.
  */
 int skvs_serve(struct skvs_ctx *ctx, char *rbuf, size_t rlen,
-               char *wbuf, size_t *wlen);
+               char *wbuf, size_t *wlen, struct skvs_ref *ref);
+/*--------------------------------------------------------------------*/
+/**
+ * Binary protocol counterpart of skvs_serve().
+ * Serves the request frame at the start of rbuf, writes the response
+ * (at most BUF_SIZE bytes) to wbuf and sets wlen, handing the value of
+ * a READ or QREAD out in ref like skvs_serve().
+ * Returns the length of the consumed frame when it is complete.
+ * Returns 0 when the frame in rbuf is incomplete.
+ * Returns -1 when the framing is broken (bad magic or oversized frame),
+ * after which the stream cannot be resynchronized.
+ * A large frame (skvs_value_req()) must not be passed.
+ */
+ssize_t skvs_serve_bin(struct skvs_ctx *ctx, const char *rbuf, size_t rlen,
+                       char *wbuf, size_t *wlen, struct skvs_ref *ref);
+/*--------------------------------------------------------------------*/
+/**
+ * Tells whether the binary frame at the start of rbuf is a large one,
+ * a CREATE or UPDATE longer than BUF_SIZE. The caller then takes the
+ * request before its value (header, key and TTL, at most
+ * SKVS_VALUE_REQ_MAX bytes), admits it with skvs_value_admit(),
+ * receives the value_len bytes of the value into
+ * hash_value_alloc(value_len) and serves both with skvs_serve_value().
+ * Returns the length of the request before the value, which rlen may
+ * not cover yet, or 0 when the frame is not large or rlen does not
+ * hold its header yet.
+ * Returns -1 when the value is longer than SKVS_MAX_VALUE.
+ */
+ssize_t skvs_value_req(const char *rbuf, size_t rlen, size_t *value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Decides whether the value of the large frame whose request is req
+ * may be received, before it is allocated. A value longer than the
+ * memory limit of the table (skvs_set_limit()) is refused with
+ * BIN_INVALID, and one that would take the large values being
+ * received past SKVS_VALUE_INFLIGHT bytes with BIN_INTERNAL_ERR.
+ * Returns 1 when admitted; value_len then counts as being received
+ * until skvs_value_done().
+ * Returns 0 when refused, writing the response to wbuf and setting
+ * wlen; the caller reads and drops the value_len bytes of the value.
+ * Returns -1 when any internal errors occur.
+ */
+int skvs_value_admit(struct skvs_ctx *ctx, const char *req,
+                     size_t value_len, char *wbuf, size_t *wlen);
+/*--------------------------------------------------------------------*/
+/**
+ * Stops counting the value_len bytes admitted by skvs_value_admit(),
+ * once the value is received or its connection is gone.
+ */
+void skvs_value_done(size_t value_len);
+/*--------------------------------------------------------------------*/
+/**
+ * Serves the large frame made of req, the req_len bytes before its
+ * value, and value, which it takes over, writing the response to wbuf
+ * and setting wlen like skvs_serve_bin().
+ * Returns -1 when any internal errors occur.
+ * Returns 1 on success.
+ */
+int skvs_serve_value(struct skvs_ctx *ctx, const char *req, size_t req_len,
+                     value_t *value, char *wbuf, size_t *wlen);
 /*--------------------------------------------------------------------*/
 #endif // _SKVSLIB_H
\ No newline at end of file
@@ -0,0 +1,348 @@
+/*--------------------------------------------------------------------*/
+/* slab.c                                                             */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "slab.h"
+/*--------------------------------------------------------------------*/
+#define SLAB_HDR_SIZE 64 // keeps 64-byte objects cache line aligned
+/*--------------------------------------------------------------------*/
+struct slab_cache;
+/* header at the start of every SLAB_SIZE aligned slab */
+struct slab
+{
+    struct slab_cache *owner; // thread whose free list gets the objects
+    struct slab *next;        // list of all slabs
+    int cls;
+};
+/* a free object, linked through its first word */
+struct slab_obj
+{
+    struct slab_obj *next;
+};
+/*--------------------------------------------------------------------*/
+struct slab_class
+{
+    struct slab_obj *free;   // freed objects, owner only
+    struct slab_obj *remote; // objects freed by other threads
+    char *bump, *end;        // uncarved part of the newest slab
+    /* written only by the owning thread */
+    size_t allocs;
+    size_t frees; // frees done by this thread, of any owner
+    size_t slabs;
+};
+/* per-thread allocator state, never unlinked until slab_destroy() */
+struct slab_cache
+{
+    struct slab_class cls[SLAB_NUM_CLASSES];
+    struct slab_cache *next;
+    struct slab_cache *next_orphan;
+};
+/*--------------------------------------------------------------------*/
+static struct slab_cache *g_caches = NULL;
+static struct slab_cache *g_orphans = NULL; // caches of exited threads
+static struct slab *g_slabs = NULL;
+static pthread_mutex_t g_slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_slab_key;
+static unsigned g_slab_gen = 0; // bumped by slab_destroy()
+static __thread struct slab_cache *t_cache = NULL;
+static __thread unsigned t_gen;
+/*--------------------------------------------------------------------*/
+/**
+ * 16-byte classes up to 128, then four classes per power of two
+ * (160, 192, 224, 256, 320, ...) up to SLAB_MAX_OBJ
+ */
+static inline int slab_class_of(size_t size)
+{
+    int lg;
+
+    if (size <= 128)
+    {
+        return size ? (size - 1) / 16 : 0;
+    }
+    lg = 63 - __builtin_clzl(size - 1);
+    return 8 + (lg - 7) * 4 + (int)((size - 1) >> (lg - 2)) - 4;
+}
+/*--------------------------------------------------------------------*/
+static inline size_t slab_class_size(int cls)
+{
+    if (cls < 8)
+    {
+        return (cls + 1) * 16;
+    }
+    cls -= 8;
+    return ((size_t)128 << (cls / 4)) +
+           (cls % 4 + 1) * ((size_t)32 << (cls / 4));
+}
+/*--------------------------------------------------------------------*/
+/* counters have a single writer, readers only need a torn-free load */
+static inline void stat_inc(size_t *counter)
+{
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+/**
+ * hands the cache of an exiting thread to the next new thread, so the
+ * objects it owns (e.g. loaded by short-lived startup threads) are
+ * still reused when other threads free them
+ */
+static void slab_orphan(void *arg)
+{
+    struct slab_cache *c = (struct slab_cache *)arg;
+
+    pthread_mutex_lock(&g_slab_lock);
+    if (t_gen == g_slab_gen) // slab_destroy() has not freed it
+    {
+        c->next_orphan = g_orphans;
+        g_orphans = c;
+    }
+    pthread_mutex_unlock(&g_slab_lock);
+    t_cache = NULL;
+}
+/*--------------------------------------------------------------------*/
+static void slab_key_init(void)
+{
+    pthread_key_create(&g_slab_key, slab_orphan);
+}
+/*--------------------------------------------------------------------*/
+static struct slab_cache *slab_self(void)
+{
+    struct slab_cache *c = t_cache;
+
+    if (c)
+    {
+        return c;
+    }
+
+    pthread_once(&g_slab_once, slab_key_init);
+
+    // 종료된 스레드의 cache가 있으면 물려받는다
+    pthread_mutex_lock(&g_slab_lock);
+    c = g_orphans;
+    if (c)
+    {
+        g_orphans = c->next_orphan;
+    }
+    t_gen = g_slab_gen;
+    pthread_mutex_unlock(&g_slab_lock);
+
+    if (c == NULL)
+    {
+        c = calloc(1, sizeof(struct slab_cache));
+        if (c == NULL)
+        {
+            DEBUG_PRINT("Failed to allocate memory for slab cache");
+            return NULL;
+        }
+
+        pthread_mutex_lock(&g_slab_lock);
+        c->next = g_caches;
+        g_caches = c;
+        pthread_mutex_unlock(&g_slab_lock);
+    }
+
+    t_cache = c;
+    pthread_setspecific(g_slab_key, c);
+    return c;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * gives the class a fresh slab to carve objects from.
+ * Returns -1 when any internal errors occur.
+ */
+static int slab_grow(struct slab_cache *c, int cls)
+{
+    struct slab_class *sc = &c->cls[cls];
+    size_t size = slab_class_size(cls);
+    struct slab *s;
+    void *mem;
+
+    if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE) != 0)
+    {
+        DEBUG_PRINT("Failed to allocate memory for slab");
+        return -1;
+    }
+    s = mem;
+    s->owner = c;
+    s->cls = cls;
+
+    pthread_mutex_lock(&g_slab_lock);
+    s->next = g_slabs;
+    g_slabs = s;
+    pthread_mutex_unlock(&g_slab_lock);
+
+    sc->bump = (char *)s + SLAB_HDR_SIZE;
+    sc->end = sc->bump + (SLAB_SIZE - SLAB_HDR_SIZE) / size * size;
+    stat_inc(&sc->slabs);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+void *slab_alloc(size_t size)
+{
+    TRACE_PRINT();
+#ifdef SLAB_DISABLE
+    void *mem;
+
+    if (size % 64 == 0)
+    {
+        return posix_memalign(&mem, 64, size) == 0 ? mem : NULL;
+    }
+    return malloc(size);
+#else
+    struct slab_cache *c;
+    struct slab_class *sc;
+    struct slab_obj *obj;
+    int cls;
+
+    if (size > SLAB_MAX_OBJ)
+    {
+        return malloc(size);
+    }
+    c = slab_self();
+    if (c == NULL)
+    {
+        return NULL;
+    }
+    cls = slab_class_of(size);
+    sc = &c->cls[cls];
+
+    // 다른 스레드가 돌려준 객체는 로컬 free list가 비었을 때 한 번에 가져옴
+    if (sc->free == NULL &&
+        __atomic_load_n(&sc->remote, __ATOMIC_RELAXED) != NULL)
+    {
+        sc->free = __atomic_exchange_n(&sc->remote, NULL, __ATOMIC_ACQUIRE);
+    }
+
+    obj = sc->free;
+    if (obj)
+    {
+        sc->free = obj->next;
+    }
+    else
+    {
+        if (sc->bump == sc->end && slab_grow(c, cls) != 0)
+        {
+            return NULL;
+        }
+        obj = (struct slab_obj *)sc->bump;
+        sc->bump += slab_class_size(cls);
+    }
+
+    stat_inc(&sc->allocs);
+    return obj;
+#endif
+}
+/*--------------------------------------------------------------------*/
+size_t slab_size(size_t size)
+{
+#ifdef SLAB_DISABLE
+    return size;
+#else
+    return size > SLAB_MAX_OBJ ? size : slab_class_size(slab_class_of(size));
+#endif
+}
+/*--------------------------------------------------------------------*/
+void slab_free(void *ptr, size_t size)
+{
+    TRACE_PRINT();
+#ifdef SLAB_DISABLE
+    (void)size;
+    free(ptr);
+#else
+    struct slab_cache *c;
+    struct slab_class *sc;
+    struct slab_obj *obj = ptr, *head;
+    struct slab *s;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    if (size > SLAB_MAX_OBJ)
+    {
+        free(ptr);
+        return;
+    }
+
+    s = (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+    c = slab_self();
+    if (c)
+    {
+        stat_inc(&c->cls[s->cls].frees);
+    }
+
+    if (s->owner == c)
+    {
+        sc = &c->cls[s->cls];
+        obj->next = sc->free;
+        sc->free = obj;
+        return;
+    }
+
+    // 소유 스레드의 remote list에 넣어 그 스레드가 재사용하게 한다
+    sc = &s->owner->cls[s->cls];
+    head = __atomic_load_n(&sc->remote, __ATOMIC_RELAXED);
+    do
+    {
+        obj->next = head;
+    } while (!__atomic_compare_exchange_n(&sc->remote, &head, obj, 1,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+#endif
+}
+/*--------------------------------------------------------------------*/
+void slab_stats(struct slab_class_stats *st)
+{
+    TRACE_PRINT();
+    struct slab_cache *c;
+    size_t allocs, frees;
+    int i;
+
+    for (i = 0; i < SLAB_NUM_CLASSES; i++)
+    {
+        st[i].obj_size = slab_class_size(i);
+        st[i].slabs = 0;
+        allocs = frees = 0;
+
+        pthread_mutex_lock(&g_slab_lock);
+        for (c = g_caches; c; c = c->next)
+        {
+            st[i].slabs += __atomic_load_n(&c->cls[i].slabs,
+                                           __ATOMIC_RELAXED);
+            allocs += __atomic_load_n(&c->cls[i].allocs, __ATOMIC_RELAXED);
+            frees += __atomic_load_n(&c->cls[i].frees, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&g_slab_lock);
+
+        st[i].used = allocs > frees ? allocs - frees : 0;
+    }
+}
+/*--------------------------------------------------------------------*/
+void slab_destroy(void)
+{
+    TRACE_PRINT();
+    struct slab_cache *c;
+    struct slab *s;
+
+    pthread_mutex_lock(&g_slab_lock);
+    while (g_slabs)
+    {
+        s = g_slabs;
+        g_slabs = s->next;
+        free(s);
+    }
+    while (g_caches)
+    {
+        c = g_caches;
+        g_caches = c->next;
+        free(c);
+    }
+    g_orphans = NULL;
+    g_slab_gen++;
+    t_cache = NULL;
+    pthread_mutex_unlock(&g_slab_lock);
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,67 @@
+/*--------------------------------------------------------------------*/
+/* slab.h                                                             */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _SLAB_H
+#define _SLAB_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Per-thread size-class allocator for hash table entries.
+ * Each thread carves objects from its own 64KB slabs and keeps freed
+ * ones on a per-class free list, so the steady state neither locks
+ * nor calls into the system allocator. An object freed by another
+ * thread (e.g. by EBR reclamation) is pushed back to the free list
+ * of the thread owning its slab.
+ * Objects larger than SLAB_MAX_OBJ fall back to malloc().
+ * Build with -DSLAB_DISABLE to use malloc() for everything.
+ */
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_MAX_OBJ 8192
+#define SLAB_NUM_CLASSES 32
+/*--------------------------------------------------------------------*/
+/* memory use of one size class, summed over all threads */
+struct slab_class_stats
+{
+    size_t obj_size;
+    size_t slabs; // 64KB slabs carved for this class
+    size_t used;  // objects currently allocated
+};
+/*--------------------------------------------------------------------*/
+/**
+ * Allocates size bytes.
+ * Objects whose size is a multiple of 64 are 64-byte aligned,
+ * others are 16-byte aligned.
+ * Returns NULL when any internal errors occur.
+ */
+void *slab_alloc(size_t size);
+/*--------------------------------------------------------------------*/
+/**
+ * Returns the bytes an object of size takes, i.e. size rounded up to
+ * its size class (size itself for objects left to malloc()).
+ */
+size_t slab_size(size_t size);
+/*--------------------------------------------------------------------*/
+/**
+ * Frees ptr allocated by slab_alloc() with the same size.
+ * May be called from any thread.
+ */
+void slab_free(void *ptr, size_t size);
+/*--------------------------------------------------------------------*/
+/**
+ * Fills st[SLAB_NUM_CLASSES] with the memory use of each size class.
+ * The counters are read without locks, so they are approximate
+ * while other threads allocate.
+ */
+void slab_stats(struct slab_class_stats *st);
+/*--------------------------------------------------------------------*/
+/**
+ * Frees every slab and all per-thread state.
+ * Call only when no other thread uses the allocator any more.
+ */
+void slab_destroy(void);
+/*--------------------------------------------------------------------*/
+#endif // _SLAB_H
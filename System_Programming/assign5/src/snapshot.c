@@ -0,0 +1,457 @@
+/*--------------------------------------------------------------------*/
+/* snapshot.c                                                         */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+/*--------------------------------------------------------------------*/
+/* a chunk of entries being filled or waiting to be written */
+struct snap_buf
+{
+    struct snap_buf *next;
+    size_t len, cap;
+    uint32_t count;
+    char data[];
+};
+/* output of snapshot_save(), fed by several threads */
+struct snap_out
+{
+    pthread_mutex_t lock;
+    pthread_t owner;       // the saving thread, the only one doing I/O
+    int fd;
+    struct snap_buf *cur;  // chunk being filled
+    struct snap_buf *full; // chunks waiting to be written
+    uint64_t num_entries;
+    uint64_t num_chunks;
+    int error;
+};
+/*--------------------------------------------------------------------*/
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * writes and frees a list of chunks.
+ * Returns -1 when any internal errors occur.
+ */
+static int snap_write(struct snap_out *out, struct snap_buf *list)
+{
+    struct snap_chunk ch;
+    struct snap_buf *b;
+    int ret = 0;
+
+    while (list)
+    {
+        b = list;
+        list = b->next;
+        if (ret == 0)
+        {
+            ch.len = b->len;
+            ch.count = b->count;
+            ch.crc = crc32_update(0, b->data, b->len);
+            ch.pad = 0;
+            if (write_all(out->fd, &ch, sizeof(ch)) < 0 ||
+                write_all(out->fd, b->data, b->len) < 0)
+            {
+                ret = -1;
+            }
+            out->num_chunks++;
+        }
+        free(b);
+    }
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+/* hash_snapshot() callback, called by the saver and by writers */
+static int snap_emit(void *arg, const char *key, size_t key_len,
+                     const char *value, size_t value_len, uint64_t expire)
+{
+    struct snap_out *out = (struct snap_out *)arg;
+    size_t ttl_len = expire ? sizeof(expire) : 0;
+    size_t n = sizeof(struct snap_ent) + ttl_len + key_len + value_len;
+    size_t cap = n > SNAP_CHUNK ? n : SNAP_CHUNK;
+    struct snap_ent ent;
+    struct snap_buf *b, *full = NULL;
+    char *p;
+
+    pthread_mutex_lock(&out->lock);
+    b = out->cur;
+    if (b && b->len + n > b->cap)
+    {
+        b->next = out->full;
+        out->full = b;
+        b = out->cur = NULL;
+    }
+    if (b == NULL)
+    {
+        // writer 스레드는 메모리에 복사만 하고 쓰기는 저장 스레드가 한다
+        b = malloc(sizeof(struct snap_buf) + cap);
+        if (b == NULL)
+        {
+            out->error = 1;
+            pthread_mutex_unlock(&out->lock);
+            return -1;
+        }
+        b->next = NULL;
+        b->len = 0;
+        b->cap = cap;
+        b->count = 0;
+        out->cur = b;
+    }
+
+    ent.value_len = value_len;
+    ent.key_len = key_len;
+    ent.flags = expire ? SNAP_ENT_EXPIRE : 0;
+    memset(ent.pad, 0, sizeof(ent.pad));
+    p = b->data + b->len;
+    memcpy(p, &ent, sizeof(ent));
+    memcpy(p + sizeof(ent), &expire, ttl_len);
+    memcpy(p + sizeof(ent) + ttl_len, key, key_len);
+    memcpy(p + sizeof(ent) + ttl_len + key_len, value, value_len);
+    b->len += n;
+    b->count++;
+    out->num_entries++;
+
+    if (pthread_equal(pthread_self(), out->owner))
+    {
+        full = out->full;
+        out->full = NULL;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    if (full && snap_write(out, full) < 0)
+    {
+        pthread_mutex_lock(&out->lock);
+        out->error = 1;
+        pthread_mutex_unlock(&out->lock);
+        return -1;
+    }
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/* makes a rename in the directory of path durable */
+static int sync_dir(const char *path)
+{
+    char *dir, *slash;
+    int fd, ret;
+
+    dir = strdup(path);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+    slash = strrchr(dir, '/');
+    if (slash == NULL)
+    {
+        strcpy(dir, ".");
+    }
+    else
+    {
+        slash[slash == dir] = '\0'; // keep "/" for the root
+    }
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(dir);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+/*--------------------------------------------------------------------*/
+ssize_t snapshot_save(hashtable_t *table, const char *path)
+{
+    TRACE_PRINT();
+    struct snap_out out;
+    struct snap_hdr hdr;
+    struct snap_buf *rest;
+    char *tmp_path;
+    int ret;
+
+    tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp_path == NULL)
+    {
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+
+    memset(&out, 0, sizeof(out));
+    out.owner = pthread_self();
+    out.fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out.fd < 0)
+    {
+        DEBUG_PRINT("Failed to open %s", tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    pthread_mutex_init(&out.lock, NULL);
+
+    // header는 개수를 안 뒤에 채운다
+    memset(&hdr, 0, sizeof(hdr));
+    ret = write_all(out.fd, &hdr, sizeof(hdr));
+    if (ret == 0)
+    {
+        ret = hash_snapshot(table, snap_emit, &out);
+    }
+
+    // hash_snapshot()이 끝나면 writer가 더 넘겨주지 않는다
+    rest = out.full;
+    if (out.cur)
+    {
+        out.cur->next = rest;
+        rest = out.cur;
+    }
+    if (snap_write(&out, rest) < 0 || out.error)
+    {
+        ret = -1;
+    }
+
+    if (ret == 0)
+    {
+        memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+        hdr.num_entries = out.num_entries;
+        hdr.num_chunks = out.num_chunks;
+        hdr.crc = crc32_update(0, &hdr, offsetof(struct snap_hdr, crc));
+        if (pwrite(out.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            fdatasync(out.fd) < 0 || rename(tmp_path, path) < 0)
+        {
+            ret = -1;
+        }
+        else
+        {
+            sync_dir(path);
+        }
+    }
+
+    close(out.fd);
+    if (ret < 0)
+    {
+        DEBUG_PRINT("Failed to write snapshot %s", path);
+        unlink(tmp_path);
+    }
+    pthread_mutex_destroy(&out.lock);
+    free(tmp_path);
+
+    return ret < 0 ? -1 : (ssize_t)out.num_entries;
+}
+/*--------------------------------------------------------------------*/
+/* state shared by the loader threads */
+struct snap_load
+{
+    const char *map;
+    size_t *chunks;        // offset of each chunk header
+    size_t *first;         // index of the first entry of each chunk
+    size_t num_chunks;
+    size_t next_chunk;     // next chunk to claim
+    hash_entry_t *entries;
+    int error;
+};
+/*--------------------------------------------------------------------*/
+/* checks and parses chunks until none is left */
+static void *snap_parse(void *arg)
+{
+    struct snap_load *sl = (struct snap_load *)arg;
+    struct snap_chunk ch;
+    struct snap_ent ent;
+    hash_entry_t *e;
+    const char *p, *end;
+    size_t c;
+    uint32_t i;
+
+    while ((c = __atomic_fetch_add(&sl->next_chunk, 1, __ATOMIC_RELAXED)) <
+           sl->num_chunks)
+    {
+        memcpy(&ch, sl->map + sl->chunks[c], sizeof(ch));
+        p = sl->map + sl->chunks[c] + sizeof(ch);
+        end = p + ch.len;
+        if (crc32_update(0, p, ch.len) != ch.crc)
+        {
+            __atomic_store_n(&sl->error, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        // key와 value는 mmap된 파일을 그대로 가리킨다
+        e = &sl->entries[sl->first[c]];
+        for (i = 0; i < ch.count; i++, e++)
+        {
+            if ((size_t)(end - p) < sizeof(ent))
+            {
+                break;
+            }
+            memcpy(&ent, p, sizeof(ent));
+            p += sizeof(ent);
+            e->expire = 0;
+            if (ent.flags & SNAP_ENT_EXPIRE)
+            {
+                if ((size_t)(end - p) < sizeof(e->expire))
+                {
+                    break;
+                }
+                memcpy(&e->expire, p, sizeof(e->expire));
+                p += sizeof(e->expire);
+            }
+            if (ent.key_len == 0 || ent.key_len > MAX_KEY_LEN ||
+                (size_t)(end - p) < ent.key_len + (size_t)ent.value_len)
+            {
+                break;
+            }
+            e->key = p;
+            e->key_size = ent.key_len;
+            e->value = p + ent.key_len;
+            e->value_len = ent.value_len;
+            p += ent.key_len + ent.value_len;
+        }
+        if (i < ch.count || p != end)
+        {
+            __atomic_store_n(&sl->error, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+ssize_t snapshot_load(hashtable_t *table, const char *path,
+                      int num_threads)
+{
+    TRACE_PRINT();
+    struct snap_load sl;
+    struct snap_hdr hdr;
+    struct snap_chunk ch;
+    struct stat st;
+    pthread_t *threads = NULL;
+    size_t off, c, n = 0;
+    ssize_t ret = -1;
+    int fd, i, created = 0, bad = 1;
+
+    memset(&sl, 0, sizeof(sl));
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(hdr))
+    {
+        close(fd);
+        errno = EBADMSG;
+        return -1;
+    }
+    sl.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (sl.map == MAP_FAILED)
+    {
+        return -1;
+    }
+    posix_madvise((void *)sl.map, st.st_size, POSIX_MADV_WILLNEED);
+
+    memcpy(&hdr, sl.map, sizeof(hdr));
+    if (memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic)) != 0 ||
+        crc32_update(0, &hdr, offsetof(struct snap_hdr, crc)) != hdr.crc ||
+        hdr.num_chunks > (size_t)st.st_size / sizeof(ch))
+    {
+        goto out;
+    }
+
+    // chunk 경계는 header만 따라가며 찾는다
+    sl.num_chunks = hdr.num_chunks;
+    sl.chunks = malloc(sl.num_chunks * sizeof(size_t) + 1);
+    sl.first = malloc(sl.num_chunks * sizeof(size_t) + 1);
+    if (!sl.chunks || !sl.first)
+    {
+        bad = 0;
+        goto out;
+    }
+    for (c = 0, off = sizeof(hdr); c < sl.num_chunks; c++)
+    {
+        if ((size_t)st.st_size - off < sizeof(ch))
+        {
+            goto out;
+        }
+        memcpy(&ch, sl.map + off, sizeof(ch));
+        if ((size_t)st.st_size - off - sizeof(ch) < ch.len)
+        {
+            goto out;
+        }
+        sl.chunks[c] = off;
+        sl.first[c] = n;
+        n += ch.count;
+        off += sizeof(ch) + ch.len;
+    }
+    if (off != (size_t)st.st_size || n != hdr.num_entries ||
+        n > (size_t)st.st_size / sizeof(struct snap_ent))
+    {
+        goto out;
+    }
+
+    bad = 0;
+    sl.entries = malloc(n * sizeof(hash_entry_t) + 1);
+    threads = calloc(num_threads > 0 ? num_threads : 1, sizeof(pthread_t));
+    if (!sl.entries || !threads)
+    {
+        goto out;
+    }
+    for (i = 1; i < num_threads; i++)
+    {
+        // 만들지 못한 스레드 몫은 나머지가 가져간다
+        if (pthread_create(&threads[created], NULL, snap_parse, &sl) == 0)
+        {
+            created++;
+        }
+    }
+    snap_parse(&sl);
+    while (created > 0)
+    {
+        pthread_join(threads[--created], NULL);
+    }
+    if (sl.error)
+    {
+        bad = 1;
+        goto out;
+    }
+
+    ret = hash_load(table, sl.entries, n, num_threads);
+
+out:
+    if (bad)
+    {
+        DEBUG_PRINT("Corrupted snapshot %s", path);
+        errno = EBADMSG;
+    }
+    munmap((void *)sl.map, st.st_size);
+    free(sl.chunks);
+    free(sl.first);
+    free(sl.entries);
+    free(threads);
+
+    return ret;
+}
+/*--------------------------------------------------------------------*/
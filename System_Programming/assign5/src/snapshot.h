@@ -0,0 +1,70 @@
+/*--------------------------------------------------------------------*/
+/* snapshot.h                                                         */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "hashtable.h"
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Point-in-time image of a hash table.
+ * The file is a snap_hdr followed by num_chunks chunks; every chunk
+ * is a snap_chunk followed by len bytes of count entries, and every
+ * entry is a snap_ent followed by its 8-byte deadline (only when it
+ * has a TTL, see flags), its key and value. All fields are
+ * in host byte order. Chunks can be checked and parsed independently,
+ * so a loader spreads them over threads.
+ */
+#define SNAP_MAGIC "SKVSSNP1"
+#define SNAP_CHUNK (1024 * 1024) // entries are grouped up to this size
+struct snap_hdr
+{
+    char magic[8];
+    uint64_t num_entries;
+    uint64_t num_chunks;
+    uint32_t crc; // of the fields above
+    uint32_t pad;
+};
+struct snap_chunk
+{
+    uint32_t len;
+    uint32_t count;
+    uint32_t crc; // of the len bytes of entries
+    uint32_t pad;
+};
+#define SNAP_ENT_EXPIRE 0x1 // the entry has a deadline
+struct snap_ent
+{
+    uint32_t value_len;
+    uint8_t key_len;
+    uint8_t flags;
+    uint8_t pad[2];
+};
+/*--------------------------------------------------------------------*/
+/**
+ * Writes a point-in-time image of table to path, through a temporary
+ * file renamed over it once synced. Writers keep running; one that
+ * changes a bucket not written yet copies it out first (hash_snapshot).
+ * Returns -1 when any internal errors occur.
+ * Returns the number of written entries on success.
+ */
+ssize_t snapshot_save(hashtable_t *table, const char *path);
+/*--------------------------------------------------------------------*/
+/**
+ * Loads the image at path into the empty table: num_threads threads
+ * check and parse the mmap()ed chunks, then hash_load() builds the
+ * table. A missing image is an empty one.
+ * Returns -1 with errno EBADMSG when the image is corrupted.
+ * Returns -1 when any internal errors occur.
+ * Returns the number of loaded entries on success.
+ */
+ssize_t snapshot_load(hashtable_t *table, const char *path,
+                      int num_threads);
+/*--------------------------------------------------------------------*/
+#endif // _SNAPSHOT_H
@@ -0,0 +1,37 @@
+/*--------------------------------------------------------------------*/
+/* spsc.c                                                             */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <string.h>
+#include "spsc.h"
+/*--------------------------------------------------------------------*/
+struct spsc_ring *spsc_alloc(size_t size)
+{
+    TRACE_PRINT();
+    struct spsc_ring *r;
+    size_t n = 1;
+
+    while (n < size)
+    {
+        n <<= 1;
+    }
+
+    // head와 tail이 각자의 cache line에 있도록 정렬해서 할당
+    if (posix_memalign((void **)&r, SPSC_CACHE_LINE,
+                       sizeof(struct spsc_ring) + n * sizeof(void *)) != 0)
+    {
+        DEBUG_PRINT("Failed to allocate memory for queue");
+        return NULL;
+    }
+    memset(r, 0, sizeof(struct spsc_ring));
+    r->mask = n - 1;
+
+    return r;
+}
+/*--------------------------------------------------------------------*/
+void spsc_free(struct spsc_ring *r)
+{
+    TRACE_PRINT();
+    free(r);
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,97 @@
+/*--------------------------------------------------------------------*/
+/* spsc.h                                                             */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _SPSC_H
+#define _SPSC_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Bounded lock-free queue of pointers from exactly one producer thread
+ * to exactly one consumer thread.
+ * The producer only writes tail and the consumer only writes head,
+ * each on its own cache line. Each side keeps a private copy of the
+ * other's index and rereads the shared one only when its copy says
+ * the queue is full (or empty), so in steady state a push or a pop
+ * touches no line the other side writes, besides the slot itself.
+ */
+#define SPSC_CACHE_LINE 64
+struct spsc_ring
+{
+    _Alignas(SPSC_CACHE_LINE) size_t head; // next slot to pop
+    size_t tail_cache;                     // consumer's copy of tail
+    _Alignas(SPSC_CACHE_LINE) size_t tail; // next slot to push
+    size_t head_cache;                     // producer's copy of head
+    _Alignas(SPSC_CACHE_LINE) size_t mask; // number of slots - 1
+    void *slots[];
+};
+/*--------------------------------------------------------------------*/
+/**
+ * Allocates an empty queue of size slots, rounded up to a power of 2.
+ * Returns NULL when any internal errors occur.
+ */
+struct spsc_ring *spsc_alloc(size_t size);
+/*--------------------------------------------------------------------*/
+/**
+ * Frees the queue; the pointers still queued are not freed.
+ */
+void spsc_free(struct spsc_ring *r);
+/*--------------------------------------------------------------------*/
+/**
+ * Queues p; producer only.
+ * Returns -1 when the queue is full.
+ * Returns 0 on success.
+ */
+static inline int spsc_push(struct spsc_ring *r, void *p)
+{
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    if (tail - r->head_cache > r->mask)
+    {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail - r->head_cache > r->mask)
+        {
+            return -1;
+        }
+    }
+    r->slots[tail & r->mask] = p;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Dequeues the oldest pointer; consumer only.
+ * Returns NULL when the queue is empty.
+ */
+static inline void *spsc_pop(struct spsc_ring *r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    void *p;
+
+    if (head == r->tail_cache)
+    {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head == r->tail_cache)
+        {
+            return NULL;
+        }
+    }
+    p = r->slots[head & r->mask];
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return p;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Tells whether the queue is empty, rereading the producer's index
+ * with a full barrier; consumer only, e.g. before going to sleep.
+ */
+static inline int spsc_empty(struct spsc_ring *r)
+{
+    return __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) ==
+           __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+#endif // _SPSC_H
@@ -0,0 +1,295 @@
+/*--------------------------------------------------------------------*/
+/* stats.c                                                            */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <pthread.h>
+#include <string.h>
+#include "stats.h"
+/*--------------------------------------------------------------------*/
+/* per-thread statistics, never unlinked */
+struct stats_thread
+{
+    /* written only by the owning thread, read by any */
+    uint64_t counters[STATS_COUNTERS];
+    struct stats_hist hist[STATS_CMDS][STATS_PHASES];
+    /* owner only */
+    uint32_t unsent[STATS_CMDS]; // responses waiting for stats_sent()
+    int last;                    // command marked last, or -1
+    struct stats_thread *next;
+};
+/*--------------------------------------------------------------------*/
+static struct stats_thread *g_threads = NULL;
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct stats_thread *t_stats = NULL;
+__thread uint64_t t_stats_lock_ns = 0;
+/*--------------------------------------------------------------------*/
+/* block of the calling thread, registered on first use */
+static struct stats_thread *stats_self(void)
+{
+    struct stats_thread *st = t_stats;
+
+    if (st)
+    {
+        return st;
+    }
+    st = calloc(1, sizeof(struct stats_thread));
+    if (st == NULL)
+    {
+        DEBUG_PRINT("Failed to allocate memory for statistics");
+        return NULL;
+    }
+    st->last = -1;
+
+    pthread_mutex_lock(&g_stats_lock);
+    st->next = g_threads;
+    g_threads = st;
+    pthread_mutex_unlock(&g_stats_lock);
+
+    return t_stats = st;
+}
+/*--------------------------------------------------------------------*/
+/* adds n to a counter of the calling thread's block */
+static inline void stats_add(uint64_t *p, uint64_t n)
+{
+    // 쓰는 thread는 하나뿐이므로 RMW 없이 relaxed store로 충분
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+/*--------------------------------------------------------------------*/
+/* bucket of ns: exact below STATS_SUB, then STATS_SUB per power of two */
+static inline int stats_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns > STATS_MAX_NS)
+    {
+        ns = STATS_MAX_NS;
+    }
+    if (ns < STATS_SUB)
+    {
+        return ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return (msb - STATS_SUB_BITS + 1) * STATS_SUB +
+           (int)((ns >> (msb - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+/*--------------------------------------------------------------------*/
+/* highest value in bucket b */
+static inline uint64_t stats_bucket_max(int b)
+{
+    int shift;
+
+    if (b < STATS_SUB)
+    {
+        return b;
+    }
+    shift = b / STATS_SUB - 1;
+    return (((uint64_t)STATS_SUB + b % STATS_SUB + 1) << shift) - 1;
+}
+/*--------------------------------------------------------------------*/
+/* records n samples of ns into h, owned by the calling thread */
+static inline void stats_hist_inc(struct stats_hist *h, uint64_t ns,
+                                  uint64_t n)
+{
+    stats_add(&h->buckets[stats_bucket(ns)], n);
+    stats_add(&h->count, n);
+    stats_add(&h->sum, ns * n);
+    if (ns > h->max)
+    {
+        __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+    }
+}
+/*--------------------------------------------------------------------*/
+void stats_record(int cmd, int phase, uint64_t ns)
+{
+    struct stats_thread *st = stats_self();
+
+    if (st == NULL || cmd < 0 || cmd >= STATS_CMDS ||
+        phase < 0 || phase >= STATS_PHASES)
+    {
+        return;
+    }
+    stats_hist_inc(&st->hist[cmd][phase], ns, 1);
+}
+/*--------------------------------------------------------------------*/
+void stats_count(int counter, uint64_t n)
+{
+    struct stats_thread *st = stats_self();
+
+    if (st == NULL || counter < 0 || counter >= STATS_COUNTERS)
+    {
+        return;
+    }
+    stats_add(&st->counters[counter], n);
+}
+/*--------------------------------------------------------------------*/
+void stats_unsent(int cmd)
+{
+    struct stats_thread *st = stats_self();
+
+    if (st == NULL)
+    {
+        return;
+    }
+    if (cmd < 0 || cmd >= STATS_CMDS)
+    {
+        st->last = -1; // 세지 않는 응답도 stats_handoff()의 대상은 아니다
+        return;
+    }
+    st->unsent[cmd]++;
+    st->last = cmd;
+}
+/*--------------------------------------------------------------------*/
+int stats_handoff(void)
+{
+    struct stats_thread *st = stats_self();
+    int cmd;
+
+    if (st == NULL || st->last < 0)
+    {
+        return -1;
+    }
+    cmd = st->last;
+    st->unsent[cmd]--;
+    st->last = -1;
+    return cmd;
+}
+/*--------------------------------------------------------------------*/
+void stats_sent(uint64_t ns, size_t bytes)
+{
+    struct stats_thread *st = stats_self();
+    int cmd;
+
+    if (st == NULL)
+    {
+        return;
+    }
+    stats_add(&st->counters[STATS_BYTES_OUT], bytes);
+    // 한 번의 send로 나간 응답은 모두 그 send 시간을 기다린 셈
+    for (cmd = 0; cmd < STATS_CMDS; cmd++)
+    {
+        if (st->unsent[cmd] > 0)
+        {
+            stats_hist_inc(&st->hist[cmd][STATS_SEND], ns, st->unsent[cmd]);
+            st->unsent[cmd] = 0;
+        }
+    }
+    st->last = -1;
+}
+/*--------------------------------------------------------------------*/
+uint64_t stats_counter(int counter)
+{
+    struct stats_thread *st;
+    uint64_t sum = 0;
+
+    if (counter < 0 || counter >= STATS_COUNTERS)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&g_stats_lock);
+    for (st = g_threads; st; st = st->next)
+    {
+        sum += __atomic_load_n(&st->counters[counter], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+
+    return sum;
+}
+/*--------------------------------------------------------------------*/
+void stats_hist(int cmd, int phase, struct stats_hist *h)
+{
+    struct stats_thread *st;
+    struct stats_hist *src;
+    uint64_t max;
+    int i;
+
+    memset(h, 0, sizeof(struct stats_hist));
+    if (cmd < 0 || cmd >= STATS_CMDS || phase < 0 || phase >= STATS_PHASES)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&g_stats_lock);
+    for (st = g_threads; st; st = st->next)
+    {
+        src = &st->hist[cmd][phase];
+        if (__atomic_load_n(&src->count, __ATOMIC_RELAXED) == 0)
+        {
+            continue;
+        }
+        h->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+        max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+        if (max > h->max)
+        {
+            h->max = max;
+        }
+        // count는 bucket의 합으로 다시 세어 quantile과 어긋나지 않게 한다
+        for (i = 0; i < STATS_BUCKETS; i++)
+        {
+            h->buckets[i] += __atomic_load_n(&src->buckets[i],
+                                             __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        h->count += h->buckets[i];
+    }
+}
+/*--------------------------------------------------------------------*/
+void stats_hist_add(struct stats_hist *h, uint64_t ns, uint64_t n)
+{
+    stats_hist_inc(h, ns, n);
+}
+/*--------------------------------------------------------------------*/
+void stats_hist_merge(struct stats_hist *dst, const struct stats_hist *src)
+{
+    int i;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+/*--------------------------------------------------------------------*/
+uint64_t stats_quantile(const struct stats_hist *h, double q)
+{
+    uint64_t rank, seen = 0, v;
+    int i;
+
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    if (q < 0.0)
+        q = 0.0;
+    if (q > 1.0)
+        q = 1.0;
+    // q 위치의 sample(1부터 셈)이 들어있는 bucket을 찾는다
+    rank = (uint64_t)(q * h->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+    if (i == STATS_BUCKETS)
+    {
+        return h->max;
+    }
+    v = stats_bucket_max(i);
+    return v < h->max ? v : h->max;
+}
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,145 @@
+/*--------------------------------------------------------------------*/
+/* stats.h                                                            */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _STATS_H
+#define _STATS_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Per-thread request statistics.
+ * Every thread records into its own block of counters and latency
+ * histograms with plain relaxed stores, so recording never locks nor
+ * bounces a cache line between threads; a report sums the blocks.
+ * The histograms are log-linear like HdrHistogram: values below
+ * STATS_SUB nanoseconds are exact, and every power of two above is
+ * split into STATS_SUB equal buckets, so any value is known within
+ * 1/STATS_SUB (about 6%) from 1ns up to STATS_MAX_NS.
+ */
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS 40 // 2^40ns, about 18 minutes
+#define STATS_MAX_NS ((1ULL << STATS_MAX_BITS) - 1)
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB)
+#define STATS_CMDS 16 // command slots, indexed by enum CMD
+/*--------------------------------------------------------------------*/
+/* phases of a request, each timed by its own histogram */
+enum STATS_PHASE
+{
+    STATS_PARSE, // decoding the request
+    STATS_LOCK,  // waiting for bucket locks
+    STATS_EXEC,  // serving it, without the lock waits
+    STATS_SEND,  // send() of the batch holding its response
+    STATS_PHASES
+};
+/* event counters */
+enum STATS_COUNTER
+{
+    STATS_HITS,       // keys found by READ, QREAD and MGET
+    STATS_MISSES,     // keys not found by them
+    STATS_COLLISIONS, // CREATE of an existing key
+    STATS_INVALID,    // malformed or unknown requests
+    STATS_BYTES_IN,
+    STATS_BYTES_OUT,
+    STATS_CONN_OPENED,
+    STATS_CONN_CLOSED,
+    STATS_COUNTERS
+};
+/*--------------------------------------------------------------------*/
+/* a histogram summed over all threads */
+struct stats_hist
+{
+    uint64_t count;
+    uint64_t sum; // ns
+    uint64_t max; // ns
+    uint64_t buckets[STATS_BUCKETS];
+};
+/*--------------------------------------------------------------------*/
+/* lock wait of the calling thread so far, see stats_lock_wait() */
+extern __thread uint64_t t_stats_lock_ns;
+/*--------------------------------------------------------------------*/
+/* monotonic clock in ns, for the phase timings */
+static inline uint64_t stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Adds ns to the lock wait of the calling thread; called by the locks
+ * only when they had to wait. Any thread may call it.
+ */
+static inline void stats_lock_wait(uint64_t ns)
+{
+    t_stats_lock_ns += ns;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Records one request of command cmd (< STATS_CMDS) that spent ns
+ * nanoseconds in the given phase.
+ */
+void stats_record(int cmd, int phase, uint64_t ns);
+/*--------------------------------------------------------------------*/
+/**
+ * Adds n to the given counter.
+ */
+void stats_count(int counter, uint64_t n);
+/*--------------------------------------------------------------------*/
+/**
+ * Marks the response of a request of command cmd as waiting to be
+ * sent by the calling thread; the next stats_sent() records its
+ * STATS_SEND time. A negative cmd (a malformed request) is not timed.
+ */
+void stats_unsent(int cmd);
+/*--------------------------------------------------------------------*/
+/**
+ * Takes back the response marked last by stats_unsent(), when another
+ * thread sends it instead (which calls stats_unsent() with the result).
+ * Returns its command, or -1 when none is marked.
+ */
+int stats_handoff(void);
+/*--------------------------------------------------------------------*/
+/**
+ * Records that a send() of ns nanoseconds wrote bytes bytes, and
+ * charges ns as STATS_SEND to every response marked since the last one.
+ */
+void stats_sent(uint64_t ns, size_t bytes);
+/*--------------------------------------------------------------------*/
+/**
+ * Sums the given counter over all threads.
+ * Counters are read without stopping the threads, so they are
+ * approximate while requests are served.
+ */
+uint64_t stats_counter(int counter);
+/*--------------------------------------------------------------------*/
+/**
+ * Sums the histogram of the given command and phase over all threads
+ * into h.
+ */
+void stats_hist(int cmd, int phase, struct stats_hist *h);
+/*--------------------------------------------------------------------*/
+/**
+ * Records n samples of ns into h, a histogram of the caller's own
+ * (not one of the per-thread blocks above).
+ */
+void stats_hist_add(struct stats_hist *h, uint64_t ns, uint64_t n);
+/*--------------------------------------------------------------------*/
+/**
+ * Adds every sample of src to dst.
+ */
+void stats_hist_merge(struct stats_hist *dst, const struct stats_hist *src);
+/*--------------------------------------------------------------------*/
+/**
+ * Returns the value at quantile q (0.0 ~ 1.0) of h, as the highest
+ * value its bucket holds (but at most h->max), or 0 when h is empty.
+ */
+uint64_t stats_quantile(const struct stats_hist *h, double q);
+/*--------------------------------------------------------------------*/
+#endif // _STATS_H
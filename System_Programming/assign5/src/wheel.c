@@ -0,0 +1,246 @@
+/*--------------------------------------------------------------------*/
+/* wheel.c                                                            */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#include <pthread.h>
+#include <string.h>
+#include "wheel.h"
+/*--------------------------------------------------------------------*/
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_CACHE_LINE 64
+/*--------------------------------------------------------------------*/
+struct wheel
+{
+    /* pushed by any thread, taken as a whole by the wheel thread */
+    _Alignas(WHEEL_CACHE_LINE) struct wheel_timer *pending;
+    /* owned by the wheel thread */
+    _Alignas(WHEEL_CACHE_LINE) uint64_t tick; // next tick to run
+    size_t count;                              // timers in the slots
+    struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    wheel_fn fn;
+    void *arg;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // wakes the thread up to stop
+    int stop;
+};
+/*--------------------------------------------------------------------*/
+/* puts t in the lowest level whose span reaches its deadline */
+static void wheel_place(struct wheel *w, struct wheel_timer *t)
+{
+    uint64_t at = (t->expire + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    uint64_t delta;
+    int level;
+
+    if (at < w->tick)
+    {
+        at = w->tick; // 이미 지난 deadline은 이번 tick에
+    }
+    delta = at - w->tick;
+    for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+        {
+            break;
+        }
+    }
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+    {
+        // wheel보다 먼 deadline은 가장 먼 slot에 두었다가 다시 내린다
+        at = w->tick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    at = (at >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    t->next = w->slots[level][at];
+    w->slots[level][at] = t;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * runs one tick: cascades the upper levels whose turn has come,
+ * then fires level 0's slot of this tick
+ */
+static void wheel_step(struct wheel *w)
+{
+    struct wheel_timer *t, *next;
+    size_t idx;
+    int level;
+
+    // 아래 level이 한 바퀴 돌 때마다 위 level의 slot 하나를 내린다
+    for (level = 1; level < WHEEL_LEVELS; level++)
+    {
+        if ((w->tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+        {
+            break;
+        }
+        idx = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        t = w->slots[level][idx];
+        w->slots[level][idx] = NULL;
+        for (; t; t = next)
+        {
+            next = t->next;
+            wheel_place(w, t);
+        }
+    }
+
+    idx = w->tick & WHEEL_MASK;
+    t = w->slots[0][idx];
+    w->slots[0][idx] = NULL;
+    for (; t; t = next)
+    {
+        next = t->next;
+        w->count--;
+        w->fn(w->arg, t);
+    }
+    w->tick++;
+}
+/*--------------------------------------------------------------------*/
+/* moves the timers added since the last tick into the slots */
+static void wheel_drain(struct wheel *w)
+{
+    struct wheel_timer *t, *next;
+
+    t = __atomic_exchange_n(&w->pending, NULL, __ATOMIC_ACQUIRE);
+    for (; t; t = next)
+    {
+        next = t->next;
+        wheel_place(w, t);
+        w->count++;
+    }
+}
+/*--------------------------------------------------------------------*/
+/* runs every tick that has come, then sleeps for one, until stopped */
+static void *wheel_thread(void *arg)
+{
+    TRACE_PRINT();
+    struct wheel *w = (struct wheel *)arg;
+    struct timespec deadline;
+    uint64_t now;
+
+    // tick을 도는 동안 lock을 잡아 wheel_sync()가 끝나기를 기다리게 한다
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop)
+    {
+        now = wheel_now() / WHEEL_TICK_MS;
+        while (w->tick <= now)
+        {
+            wheel_drain(w);
+            if (w->count == 0)
+            {
+                // timer가 없으면 지나간 tick을 한 번에 건너뛴다
+                w->tick = now + 1;
+                break;
+            }
+            wheel_step(w);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += WHEEL_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (!w->stop)
+        {
+            pthread_cond_timedwait(&w->cond, &w->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+/*--------------------------------------------------------------------*/
+struct wheel *wheel_create(wheel_fn fn, void *arg)
+{
+    TRACE_PRINT();
+    struct wheel *w;
+    pthread_condattr_t attr;
+
+    if (posix_memalign((void **)&w, WHEEL_CACHE_LINE,
+                       sizeof(struct wheel)) != 0)
+    {
+        DEBUG_PRINT("Failed to allocate memory for timing wheel");
+        return NULL;
+    }
+    memset(w, 0, sizeof(struct wheel));
+    w->fn = fn;
+    w->arg = arg;
+    w->tick = wheel_now() / WHEEL_TICK_MS;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&w->thread, NULL, wheel_thread, w) != 0)
+    {
+        DEBUG_PRINT("Failed to create timing wheel thread");
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+/*--------------------------------------------------------------------*/
+void wheel_add(struct wheel *w, struct wheel_timer *t)
+{
+    struct wheel_timer *head = __atomic_load_n(&w->pending, __ATOMIC_RELAXED);
+
+    // 통째로만 꺼내가므로 ABA 없이 CAS로 push
+    do
+    {
+        t->next = head;
+    } while (!__atomic_compare_exchange_n(&w->pending, &head, t, 1,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+/*--------------------------------------------------------------------*/
+void wheel_sync(struct wheel *w)
+{
+    TRACE_PRINT();
+    if (w == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+/*--------------------------------------------------------------------*/
+void wheel_destroy(struct wheel *w, void (*free_fn)(struct wheel_timer *))
+{
+    TRACE_PRINT();
+    struct wheel_timer *t, *next;
+    int level, i;
+
+    if (w == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    wheel_drain(w);
+    for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (i = 0; i < WHEEL_SLOTS; i++)
+        {
+            for (t = w->slots[level][i]; t; t = next)
+            {
+                next = t->next;
+                free_fn(t);
+            }
+        }
+    }
+
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w);
+}
+/*--------------------------------------------------------------------*/
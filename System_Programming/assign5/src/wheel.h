@@ -0,0 +1,84 @@
+/*--------------------------------------------------------------------*/
+/* wheel.h                                                            */
+/* Author: Jaeun Park                                                 */
+/*--------------------------------------------------------------------*/
+#ifndef _WHEEL_H
+#define _WHEEL_H
+/*--------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "common.h"
+/*--------------------------------------------------------------------*/
+/**
+ * Hierarchical timing wheel driven by its own thread.
+ * Level 0 has WHEEL_SLOTS slots of one tick each, and every slot of a
+ * level above spans the whole level below. A timer goes to the lowest
+ * level whose span reaches its deadline and moves one level down
+ * (cascades) when the level below wraps around to its slot, so adding,
+ * cascading and firing cost O(1) per timer and a tick only touches the
+ * slots it reaches, however many timers are pending.
+ * Any thread may add timers; they are pushed onto a lock-free list
+ * that the wheel thread moves into the slots at its next tick.
+ */
+#define WHEEL_TICK_MS 10
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // 256^4 ticks of 10ms, about 497 days
+/*--------------------------------------------------------------------*/
+/* embedded in the caller's timer record */
+struct wheel_timer
+{
+    struct wheel_timer *next;
+    uint64_t expire; // deadline in ms of wheel_now()
+};
+/**
+ * Called by the wheel thread for every timer whose deadline has come;
+ * the timer is handed over, so fn frees it or adds it again.
+ */
+typedef void (*wheel_fn)(void *arg, struct wheel_timer *t);
+/*--------------------------------------------------------------------*/
+struct wheel;
+/*--------------------------------------------------------------------*/
+/**
+ * Current wall clock time in ms, the clock of every deadline.
+ * Coarse (a few ms), but cheap enough to read on every lookup.
+ */
+static inline uint64_t wheel_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*--------------------------------------------------------------------*/
+/**
+ * Creates an empty wheel and starts its thread, which calls fn with
+ * arg for every timer that expires.
+ * Returns NULL when any internal errors occur.
+ */
+struct wheel *wheel_create(wheel_fn fn, void *arg);
+/*--------------------------------------------------------------------*/
+/**
+ * Adds t, whose expire is set, to the wheel; t must not be in it yet.
+ * A deadline already past fires at the next tick.
+ * May be called from any thread, including from fn.
+ */
+void wheel_add(struct wheel *w, struct wheel_timer *t);
+/*--------------------------------------------------------------------*/
+/**
+ * Waits until the tick being run, if any, is over, so everything fn
+ * has done happens before the return. Does nothing when w is NULL.
+ * Must not be called from fn.
+ */
+void wheel_sync(struct wheel *w);
+/*--------------------------------------------------------------------*/
+/**
+ * Stops the wheel thread, calls free_fn for every timer not fired
+ * yet and frees the wheel.
+ * Call only when no other thread adds timers any more.
+ */
+void wheel_destroy(struct wheel *w, void (*free_fn)(struct wheel_timer *));
+/*--------------------------------------------------------------------*/
+#endif // _WHEEL_H